@@ -46,6 +46,31 @@ if zoom !=512 :
    test_cases.add_failure_info('zoom level mismatch. Got '+str(zoom)+', expected 512')
 tests.append(test_cases)
 
+test_cases = TestCase("route matrix of 2 sources and 1 destination", '', time.time() - start_time, '', '')
+sources=[dbus.Struct((1, 0x138a4a, 0x5d773f), signature='iii'), dbus.Struct((1, 0x138b00, 0x5d7800), signature='iii')]
+destinations=[dbus.Struct((1, 0x139000, 0x5d7a00), signature='iii')]
+times, lengths = iface.get_route_matrix(dbus.Array(sources, signature='(iii)'), dbus.Array(destinations, signature='(iii)'))
+if len(times) != 2 or len(lengths) != 2 :
+   test_cases.add_failure_info('matrix size mismatch. Got '+str(len(times))+' times and '+str(len(lengths))+' lengths, expected 2')
+tests.append(test_cases)
+
+test_cases = TestCase("route matrix without destinations is rejected", '', time.time() - start_time, '', '')
+try:
+   iface.get_route_matrix(dbus.Array(sources, signature='(iii)'), dbus.Array([], signature='(iii)'))
+   test_cases.add_failure_info('empty destination list accepted')
+except dbus.exceptions.DBusException:
+   pass
+tests.append(test_cases)
+
+test_cases = TestCase("file cache stats start with the default partition", '', time.time() - start_time, '', '')
+stats=iface.get_file_cache_stats()
+if len(stats) < 1 or stats[0][0] != "default" :
+   test_cases.add_failure_info('no default partition. Got '+str(stats))
+for name, hits, misses, evictions, size, max_size in stats :
+   if size > max_size :
+      test_cases.add_failure_info('partition '+name+' holds '+str(size)+' bytes, more than its maximum of '+str(max_size))
+tests.append(test_cases)
+
 ts = [TestSuite("Navit dbus tests", tests)]
 
 with open(junit_directory+'dbus.xml', 'w+') as f:
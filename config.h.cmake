@@ -25,6 +25,8 @@
 
 #cmakedefine HAVE_ZLIB 1
 
+#cmakedefine HAVE_ZSTD 1
+
 #cmakedefine USE_ROUTING 1
 
 #cmakedefine HAVE_GTK2 1
@@ -82,6 +84,8 @@
 
 #cmakedefine HAVE_FSYNC 1
 
+#cmakedefine HAVE_PREAD 1
+
 #cmakedefine HAVE_ENDIAN_H 1
 
 #cmakedefine HAVE_FREEIMAGE 1
@@ -93,3 +97,5 @@
 #cmakedefine HAVE_SHMEM 1
 
 #cmakedefine HAVE_IMLIB2 1
+
+#cmakedefine HAVE_PTHREAD 1
@@ -194,6 +194,9 @@ ATTR(turn_around_penalty)
 ATTR(turn_around_penalty2)
 ATTR(autozoom_max)
 ATTR(nav_status)
+ATTR(route_algorithm)
+ATTR(tile_index)
+ATTR(async_read)
 ATTR2(0x00027500,type_rel_abs_begin)
 /* These attributes are int that can either hold relative or absolute values. See the
  * documentation of ATTR_REL_RELSHIFT for details.
@@ -394,6 +397,7 @@ ATTR(street_destination)
 ATTR(exit_to)
 ATTR(street_destination_forward)
 ATTR(street_destination_backward)
+ATTR(tile_cache)
 ATTR2(0x0003ffff,type_string_end)
 ATTR2(0x00040000,type_special_begin)
 ATTR(order)
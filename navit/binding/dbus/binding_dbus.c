@@ -52,6 +52,8 @@
 #include "util.h"
 #include "transform.h"
 #include "event.h"
+#include "file.h"
+#include "cache.h"
 
 static DBusConnection *connection;
 static dbus_uint32_t dbus_serial;
@@ -1673,6 +1675,109 @@ request_navit_set_destination(DBusConnection *connection, DBusMessage *message)
 	return empty_reply(connection, message);
 }
 
+static int
+pcoords_get_from_message(DBusMessage *message, DBusMessageIter *iter, struct pcoord **pc)
+{
+	DBusMessageIter iter2;
+	int count=0;
+
+	if (dbus_message_iter_get_arg_type(iter) != DBUS_TYPE_ARRAY)
+		return -1;
+	dbus_message_iter_recurse(iter, &iter2);
+	while (dbus_message_iter_get_arg_type(&iter2) != DBUS_TYPE_INVALID) {
+		*pc=g_renew(struct pcoord, *pc, count+1);
+		if (!pcoord_get_from_message(message, &iter2, *pc+count))
+			return -1;
+		count++;
+		dbus_message_iter_next(&iter2);
+	}
+	return count;
+}
+
+static DBusHandlerResult
+request_navit_get_route_matrix(DBusConnection *connection, DBusMessage *message)
+{
+	struct navit *navit;
+	struct route *route;
+	struct pcoord *src=NULL,*dst=NULL;
+	int src_count,dst_count,*times,*lengths;
+	DBusMessageIter iter,iter1,iter2;
+	DBusMessage *reply;
+
+	navit = object_get_from_message(message, "navit");
+	if (! navit)
+		return dbus_error_invalid_object_path(connection, message);
+	route=navit_get_route(navit);
+	if (! route)
+		return dbus_error_no_data_available(connection, message);
+
+	dbus_message_iter_init(message, &iter);
+	src_count=pcoords_get_from_message(message, &iter, &src);
+	dbus_message_iter_next(&iter);
+	dst_count=pcoords_get_from_message(message, &iter, &dst);
+	if (src_count <= 0 || dst_count <= 0 || src_count > INT_MAX/sizeof(int)/dst_count) {
+		g_free(src);
+		g_free(dst);
+		return dbus_error_invalid_parameter(connection, message);
+	}
+	times=g_new(int, src_count*dst_count);
+	lengths=g_new(int, src_count*dst_count);
+	route_get_matrix(route, src, src_count, dst, dst_count, times, lengths);
+
+	reply = dbus_message_new_method_return(message);
+	dbus_message_iter_init_append(reply, &iter1);
+	dbus_message_iter_open_container(&iter1, DBUS_TYPE_ARRAY, DBUS_TYPE_INT32_AS_STRING, &iter2);
+	dbus_message_iter_append_fixed_array(&iter2, DBUS_TYPE_INT32, &times, src_count*dst_count);
+	dbus_message_iter_close_container(&iter1, &iter2);
+	dbus_message_iter_open_container(&iter1, DBUS_TYPE_ARRAY, DBUS_TYPE_INT32_AS_STRING, &iter2);
+	dbus_message_iter_append_fixed_array(&iter2, DBUS_TYPE_INT32, &lengths, src_count*dst_count);
+	dbus_message_iter_close_container(&iter1, &iter2);
+	dbus_connection_send (connection, reply, NULL);
+	dbus_message_unref (reply);
+	g_free(times);
+	g_free(lengths);
+	g_free(src);
+	g_free(dst);
+	return DBUS_HANDLER_RESULT_HANDLED;
+}
+
+static DBusHandlerResult
+request_navit_get_file_cache_stats(DBusConnection *connection, DBusMessage *message)
+{
+	struct cache_stats stats;
+	char *name;
+	dbus_uint32_t hits,misses,evictions;
+	dbus_int32_t size,max_size;
+	int i;
+	DBusMessageIter iter1,iter2,iter3;
+	DBusMessage *reply;
+
+	reply = dbus_message_new_method_return(message);
+	dbus_message_iter_init_append(reply, &iter1);
+	dbus_message_iter_open_container(&iter1, DBUS_TYPE_ARRAY, "(suuuii)", &iter2);
+	for (i = 0 ; file_get_cache_stats(i, &name, &stats) ; i++) {
+		if (!name)
+			name="default";
+		hits=stats.hits;
+		misses=stats.misses;
+		evictions=stats.evictions;
+		size=stats.size;
+		max_size=stats.max_size;
+		dbus_message_iter_open_container(&iter2, DBUS_TYPE_STRUCT, NULL, &iter3);
+		dbus_message_iter_append_basic(&iter3, DBUS_TYPE_STRING, &name);
+		dbus_message_iter_append_basic(&iter3, DBUS_TYPE_UINT32, &hits);
+		dbus_message_iter_append_basic(&iter3, DBUS_TYPE_UINT32, &misses);
+		dbus_message_iter_append_basic(&iter3, DBUS_TYPE_UINT32, &evictions);
+		dbus_message_iter_append_basic(&iter3, DBUS_TYPE_INT32, &size);
+		dbus_message_iter_append_basic(&iter3, DBUS_TYPE_INT32, &max_size);
+		dbus_message_iter_close_container(&iter2, &iter3);
+	}
+	dbus_message_iter_close_container(&iter1, &iter2);
+	dbus_connection_send (connection, reply, NULL);
+	dbus_message_unref (reply);
+	return DBUS_HANDLER_RESULT_HANDLED;
+}
+
 static DBusHandlerResult
 request_navit_clear_destination(DBusConnection *connection, DBusMessage *message)
 {
@@ -1985,6 +2090,8 @@ struct dbus_method {
 	{".navit",  "set_destination",     "(is)s",   "(projection,coordinates)comment",         "",   "",      request_navit_set_destination},
 	{".navit",  "set_destination",     "(iii)s",  "(projection,longitude,latitude)comment",  "",   "",      request_navit_set_destination},
 	{".navit",  "clear_destination",   "",        "",                                        "",   "",      request_navit_clear_destination},
+	{".navit",  "get_route_matrix",    "a(iii)a(iii)","sources,destinations",                "aiai","times,lengths", request_navit_get_route_matrix},
+	{".navit",  "get_file_cache_stats","",        "",                                        "a(suuuii)","stats", request_navit_get_file_cache_stats},
 	{".navit",  "evaluate", 	   "s",	      "command",				 "s",  "",      request_navit_evaluate},
 	{".layout", "get_attr",		   "s",	      "attribute",                               "sv",  "attrname,value", request_layout_get_attr},
 	{".map",    "get_attr",            "s",       "attribute",                               "sv",  "attrname,value", request_map_get_attr},
@@ -26,6 +26,9 @@ struct cache {
 	int t1_target;
 	unsigned int misses;
 	unsigned int hits;
+	unsigned int miss_count;
+	unsigned int hit_count;
+	unsigned int evictions;
 	GHashTable *hash;
 };
 
@@ -188,6 +191,8 @@ cache_remove_lru(struct cache *cache, struct cache_entry_list *list)
 	dbg(lvl_debug,"removing %d\n", last->id[0]);
 	cache_remove_lru_helper(list);
 	if (cache) {
+		if (list == &cache->t1 || list == &cache->t2)
+			cache->evictions++;
 		cache_remove(cache, last);
 		return NULL;
 	}
@@ -207,6 +212,20 @@ cache_entry_new(struct cache *cache, void *id, int size)
 	return &ret->id[cache->id_size];
 }
 
+/**
+ * @brief Returns the id of a cache entry
+ *
+ * @param cache The cache
+ * @param data The data of the entry, as returned by cache_lookup() or cache_entry_new()
+ * @return The id the entry was created with
+ */
+void *
+cache_entry_get_id(struct cache *cache, void *data)
+{
+	struct cache_entry *entry=(struct cache_entry *)((char *)data-cache->entry_size);
+	return entry->id;
+}
+
 void
 cache_entry_destroy(struct cache *cache, void *data)
 {
@@ -249,6 +268,7 @@ cache_move(struct cache *cache, struct cache_entry_list *old, struct cache_entry
 		return NULL;
 	entry=cache_trim(cache, entry);
 	cache_insert_mru(NULL, new, entry);
+	cache->evictions++;
 	return entry;
 }
 
@@ -301,6 +321,7 @@ cache_lookup(struct cache *cache, void *id) {
 	dbg(lvl_debug,"get %d\n", ((int *)id)[0]);
 	entry=g_hash_table_lookup(cache->hash, id);
 	if (entry == NULL) {
+		cache->miss_count++;
 		cache->insert=&cache->t1;
 #ifdef DEBUG_CACHE
 		fprintf(stderr,"-");
@@ -311,6 +332,7 @@ cache_lookup(struct cache *cache, void *id) {
 	dbg(lvl_debug,"found 0x%x 0x%x 0x%x 0x%x 0x%x\n", entry->id[0], entry->id[1], entry->id[2], entry->id[3], entry->id[4]);
 	if (entry->where == &cache->t1 || entry->where == &cache->t2) {
 		cache->hits+=entry->size;
+		cache->hit_count++;
 #ifdef DEBUG_CACHE
 		if (entry->where == &cache->t1)
 			fprintf(stderr,"h");
@@ -342,6 +364,7 @@ cache_lookup(struct cache *cache, void *id) {
 		}
 		cache_replace(cache);
 		cache_remove(cache, entry);
+		cache->miss_count++;
 		cache->insert=&cache->t2;
 		return NULL;
 	}
@@ -379,6 +402,24 @@ cache_insert_new(struct cache *cache, void *id, int size)
 	return data;	
 }
 
+/**
+ * @brief Adds the counters of a cache to a statistics record
+ *
+ * Unlike the byte counters dumped by cache_dump(), these counters are never reset.
+ *
+ * @param cache The cache
+ * @param stats The record the counters are added to
+ */
+void
+cache_get_stats(struct cache *cache, struct cache_stats *stats)
+{
+	stats->hits+=cache->hit_count;
+	stats->misses+=cache->miss_count;
+	stats->evictions+=cache->evictions;
+	stats->size+=cache->t1.size+cache->t2.size;
+	stats->max_size+=cache->size;
+}
+
 static void
 cache_stats(struct cache *cache)
 {
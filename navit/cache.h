@@ -1,9 +1,22 @@
 struct cache_entry;
 struct cache;
+
+/**
+ * @brief Counters of a cache, see cache_get_stats()
+ */
+struct cache_stats {
+	unsigned int hits;		/**< Lookups which found the data */
+	unsigned int misses;		/**< Lookups which did not find the data */
+	unsigned int evictions;		/**< Entries whose data was dropped to make room for other data */
+	int size;			/**< Bytes of data held, including the entry headers */
+	int max_size;			/**< Budget in bytes */
+};
+
 /* prototypes */
 struct cache *cache_new(int id_size, int size);
 void cache_resize(struct cache *cache, int size);
 void *cache_entry_new(struct cache *cache, void *id, int size);
+void *cache_entry_get_id(struct cache *cache, void *data);
 void cache_entry_destroy(struct cache *cache, void *data);
 void *cache_lookup(struct cache *cache, void *id);
 void cache_insert(struct cache *cache, void *data);
@@ -11,4 +24,5 @@ void *cache_insert_new(struct cache *cache, void *id, int size);
 void cache_flush(struct cache *cache, void *id);
 void cache_dump(struct cache *cache);
 void cache_flush_data(struct cache *cache, void *data);
+void cache_get_stats(struct cache *cache, struct cache_stats *stats);
 /* end of prototypes */
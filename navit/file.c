@@ -53,12 +53,56 @@ extern char *version;
 #include <openssl/evp.h>
 #include <openssl/rand.h>
 #endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
 
 #ifdef CACHE_SIZE
 static GHashTable *file_name_hash;
 #endif
 
-static struct cache *file_cache;
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+#define FILE_CACHE_SHARDS 4
+
+/**
+ * @brief A part of the file cache, with its own lock
+ */
+struct file_cache_shard {
+	struct cache *cache;
+#ifdef HAVE_PTHREAD
+	/* Maps may be read from several threads at once, e.g. when building a route graph */
+	pthread_mutex_t mutex;
+#endif
+};
+
+/**
+ * @brief A part of the file cache with a budget of its own
+ *
+ * Files get their own partition with file_set_cache_budget(), all other files share the
+ * default partition. Each partition is split into shards by the offset of the data, so threads
+ * reading different blocks rarely wait for each other. Partitions are created by the main thread
+ * and live until navit exits.
+ */
+struct file_cache_partition {
+	char *name;				/**< Name of the file, NULL for the default partition */
+	int file_name_id;			/**< Id of the file name, 0 for the default partition */
+	int size;				/**< Budget in bytes */
+	struct file_cache_shard shards[FILE_CACHE_SHARDS];
+	struct file_cache_partition *next;
+};
+
+static struct file_cache_partition *file_cache_partitions;
+
+#ifdef HAVE_PTHREAD
+#define file_cache_lock(shard) pthread_mutex_lock(&(shard)->mutex)
+#define file_cache_unlock(shard) pthread_mutex_unlock(&(shard)->mutex)
+#else
+#define file_cache_lock(shard)
+#define file_cache_unlock(shard)
+#endif
 
 #ifdef HAVE_PRAGMA_PACK
 #pragma pack(push)
@@ -76,6 +120,107 @@ struct file_cache_id {
 #pragma pack(pop)
 #endif
 
+static struct file_cache_partition *
+file_cache_partition_new(char *name, int file_name_id, int size)
+{
+	struct file_cache_partition *partition=g_new0(struct file_cache_partition, 1);
+	int i;
+	partition->name=g_strdup(name);
+	partition->file_name_id=file_name_id;
+	partition->size=size;
+	for (i = 0 ; i < FILE_CACHE_SHARDS ; i++) {
+		partition->shards[i].cache=cache_new(sizeof(struct file_cache_id), size/FILE_CACHE_SHARDS);
+#ifdef HAVE_PTHREAD
+		pthread_mutex_init(&partition->shards[i].mutex, NULL);
+#endif
+	}
+	return partition;
+}
+
+/**
+ * @brief Returns the cache partition data of a file goes to
+ *
+ * @return The partition, or NULL if file_init() has not been called, e.g. in maptool
+ */
+static struct file_cache_partition *
+file_cache_partition(int file_name_id)
+{
+	struct file_cache_partition *partition=file_cache_partitions;
+	if (!partition)
+		return NULL;
+	while (partition->next) {
+		if (partition->next->file_name_id == file_name_id)
+			return partition->next;
+		partition=partition->next;
+	}
+	return file_cache_partitions;
+}
+
+static struct file_cache_shard *
+file_cache_shard(struct file *file, struct file_cache_id *id)
+{
+	unsigned long long hash=(unsigned long long)id->offset*2654435761ULL;
+	return &file->cache_partition->shards[(hash >> 16) % FILE_CACHE_SHARDS];
+}
+
+static struct file_cache_shard *
+file_cache_shard_data(struct file *file, void *data)
+{
+	struct cache *cache=file->cache_partition->shards[0].cache;
+	return file_cache_shard(file, cache_entry_get_id(cache, data));
+}
+
+static void
+file_cache_resize(struct file_cache_partition *partition, int size)
+{
+	int i;
+	partition->size=size;
+	for (i = 0 ; i < FILE_CACHE_SHARDS ; i++) {
+		file_cache_lock(&partition->shards[i]);
+		cache_resize(partition->shards[i].cache, size/FILE_CACHE_SHARDS);
+		file_cache_unlock(&partition->shards[i]);
+	}
+}
+
+static void *
+file_cache_lookup(struct file *file, struct file_cache_id *id)
+{
+	struct file_cache_shard *shard=file_cache_shard(file, id);
+	void *ret;
+	file_cache_lock(shard);
+	ret=cache_lookup(shard->cache,id);
+	file_cache_unlock(shard);
+	return ret;
+}
+
+/**
+ * @brief Puts data which has been read into the cache
+ *
+ * The data is only inserted once it is complete, so other threads never see a partially read entry.
+ * If another thread has inserted the same data in the meantime, that entry is used instead.
+ *
+ * @param file The file the data has been read from
+ * @param id The id of the data
+ * @param data The data, allocated with g_malloc(). It is freed by this function.
+ * @param size The size of the data
+ * @return The cache entry holding the data
+ */
+static void *
+file_cache_insert(struct file *file, struct file_cache_id *id, void *data, int size)
+{
+	struct file_cache_shard *shard=file_cache_shard(file, id);
+	void *ret;
+	file_cache_lock(shard);
+	ret=cache_lookup(shard->cache,id);
+	if (!ret) {
+		ret=cache_insert_new(shard->cache,id,size);
+		memcpy(ret, data, size);
+	}
+	file_cache_unlock(shard);
+	g_free(data);
+	return ret;
+}
+
 #ifdef HAVE_SOCKET
 static int
 file_socket_connect(char *host, char *service)
@@ -231,8 +376,10 @@ file_create(char *name, struct attr **options)
 		file->name_id = (long)atom(name);
 	}
 #ifdef CACHE_SIZE
-	if (!options || !(attr=attr_search(options, NULL, attr_cache)) || attr->u.num)
+	if (!options || !(attr=attr_search(options, NULL, attr_cache)) || attr->u.num) {
 		file->cache=1;
+		file->cache_partition=file_cache_partition(file->name_id);
+	}
 #endif
 	dbg_assert(file != NULL);
 	return file;
@@ -333,27 +480,49 @@ file_mmap(struct file *file)
 	return 1;
 }
 
+/**
+ * @brief Reads data from a file at an offset
+ *
+ * If pread() is available, the file position is not used, so several threads may read from the same file at once.
+ *
+ * @param file The file
+ * @param offset The offset to read from
+ * @param buffer Receives the data
+ * @param size The number of bytes to read
+ * @return True if all data was read
+ */
+static int
+file_read_at(struct file *file, long long offset, void *buffer, int size)
+{
+#ifdef HAVE_PREAD
+	return pread(file->fd, buffer, size, offset) == size;
+#else
+	lseek(file->fd, offset, SEEK_SET);
+	return read(file->fd, buffer, size) == size;
+#endif
+}
+
 unsigned char *
 file_data_read(struct file *file, long long offset, int size)
 {
 	void *ret;
+	struct file_cache_id id={offset,size,file->name_id,0};
 	if (file->special)
 		return NULL;
 	if (file->begin)
 		return file->begin+offset;
 	if (file->cache) {
-		struct file_cache_id id={offset,size,file->name_id,0};
-		ret=cache_lookup(file_cache,&id); 
+		ret=file_cache_lookup(file, &id);
 		if (ret)
 			return ret;
-		ret=cache_insert_new(file_cache,&id,size);
-	} else
-		ret=g_malloc(size);
-	lseek(file->fd, offset, SEEK_SET);
-	if (read(file->fd, ret, size) != size) {
-		file_data_free(file, ret);
-		ret=NULL;
 	}
+	ret=g_malloc(size);
+	if (!file_read_at(file, offset, ret, size)) {
+		g_free(ret);
+		return NULL;
+	}
+	if (file->cache)
+		ret=file_cache_insert(file, &id, ret, size);
 	return ret;
 
 }
@@ -460,7 +629,10 @@ file_data_flush(struct file *file, long long offset, int size)
 {
 	if (file->cache) {
 		struct file_cache_id id={offset,size,file->name_id,0};
-		cache_flush(file_cache,&id);
+		struct file_cache_shard *shard=file_cache_shard(file, &id);
+		file_cache_lock(shard);
+		cache_flush(shard->cache,&id);
+		file_cache_unlock(shard);
 		dbg(lvl_debug,"Flushing "LONGLONG_FMT" %d bytes\n",offset,size);
 	}
 }
@@ -528,19 +700,17 @@ file_data_read_compressed(struct file *file, long long offset, int size, int siz
 	void *ret;
 	char *buffer = 0;
 	uLongf destLen=size_uncomp;
+	struct file_cache_id id={offset,size,file->name_id,1};
 
 	if (file->cache) {
-		struct file_cache_id id={offset,size,file->name_id,1};
-		ret=cache_lookup(file_cache,&id); 
+		ret=file_cache_lookup(file, &id);
 		if (ret)
 			return ret;
-		ret=cache_insert_new(file_cache,&id,size_uncomp);
-	} else 
-		ret=g_malloc(size_uncomp);
-	lseek(file->fd, offset, SEEK_SET);
+	}
+	ret=g_malloc(size_uncomp);
 
 	buffer = (char *)g_malloc(size);
-	if (read(file->fd, buffer, size) != size) {
+	if (!file_read_at(file, offset, buffer, size)) {
 		g_free(ret);
 		ret=NULL;
 	} else {
@@ -551,8 +721,58 @@ file_data_read_compressed(struct file *file, long long offset, int size, int siz
 		}
 	}
 	g_free(buffer);
+	if (ret && file->cache)
+		ret=file_cache_insert(file, &id, ret, size_uncomp);
+
+	return ret;
+}
+
+/**
+ * @brief Reads a block of data compressed with Zstandard
+ *
+ * @param file The file to read from
+ * @param offset The offset of the compressed data
+ * @param size The size of the compressed data
+ * @param size_uncomp The size of the data after decompression
+ * @return The decompressed data, or NULL if it could not be read or zstd support is not compiled in
+ */
+unsigned char *
+file_data_read_zstd(struct file *file, long long offset, int size, int size_uncomp)
+{
+#ifdef HAVE_ZSTD
+	void *ret;
+	char *buffer;
+	size_t len;
+	struct file_cache_id id={offset,size,file->name_id,2};
+
+	if (file->cache) {
+		ret=file_cache_lookup(file, &id);
+		if (ret)
+			return ret;
+	}
+	ret=g_malloc(size_uncomp);
+
+	buffer = (char *)g_malloc(size);
+	if (!file_read_at(file, offset, buffer, size)) {
+		g_free(ret);
+		ret=NULL;
+	} else {
+		len=ZSTD_decompress(ret, size_uncomp, buffer, size);
+		if (ZSTD_isError(len) || len != size_uncomp) {
+			dbg(lvl_error,"zstd decompression failed: %s\n", ZSTD_isError(len) ? ZSTD_getErrorName(len) : "size mismatch");
+			g_free(ret);
+			ret=NULL;
+		}
+	}
+	g_free(buffer);
+	if (ret && file->cache)
+		ret=file_cache_insert(file, &id, ret, size_uncomp);
 
 	return ret;
+#else
+	dbg(lvl_error,"%s: zstd compressed data, but zstd support is not compiled in\n", file->name);
+	return NULL;
+#endif
 }
 
 unsigned char *
@@ -562,19 +782,17 @@ file_data_read_encrypted(struct file *file, long long offset, int size, int size
 	void *ret;
 	unsigned char *buffer = 0;
 	uLongf destLen=size_uncomp;
+	struct file_cache_id id={offset,size,file->name_id,1};
 
 	if (file->cache) {
-		struct file_cache_id id={offset,size,file->name_id,1};
-		ret=cache_lookup(file_cache,&id); 
+		ret=file_cache_lookup(file, &id);
 		if (ret)
 			return ret;
-		ret=cache_insert_new(file_cache,&id,size_uncomp);
-	} else 
-		ret=g_malloc(size_uncomp);
-	lseek(file->fd, offset, SEEK_SET);
+	}
+	ret=g_malloc(size_uncomp);
 
 	buffer = (unsigned char *)g_malloc(size);
-	if (read(file->fd, buffer, size) != size) {
+	if (!file_read_at(file, offset, buffer, size)) {
 		g_free(ret);
 		ret=NULL;
 	} else {
@@ -623,6 +841,8 @@ file_data_read_encrypted(struct file *file, long long offset, int size, int size
 		}
 	}
 	g_free(buffer);
+	if (ret && file->cache)
+		ret=file_cache_insert(file, &id, ret, size_uncomp);
 
 	return ret;
 #else
@@ -630,6 +850,264 @@ file_data_read_encrypted(struct file *file, long long offset, int size, int size
 #endif
 }
 
+static void
+file_data_read_request(struct file_data_request *request)
+{
+	switch (request->method) {
+	case 8:
+		request->data=file_data_read_compressed(request->file, request->offset, request->size, request->size_uncomp);
+		break;
+	case 93:
+		request->data=file_data_read_zstd(request->file, request->offset, request->size, request->size_uncomp);
+		break;
+	default:
+		request->data=file_data_read(request->file, request->offset, request->size);
+	}
+}
+
+#ifdef HAVE_PTHREAD
+#define FILE_POOL_MAX_THREADS 8
+
+/**
+ * @brief Requests passed to file_data_read_batch() or file_data_read_async() which are worked on by the thread pool
+ */
+struct file_batch {
+	struct file_data_request *requests;
+	int count;
+	int next;			/**< The next request to be taken by a thread */
+	int done;			/**< The number of requests which have been read */
+	pthread_cond_t done_cond;	/**< Signalled when all requests have been read */
+	struct file_batch *next_batch;
+};
+
+static pthread_mutex_t file_pool_mutex=PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t file_pool_cond=PTHREAD_COND_INITIALIZER;
+static struct file_batch *file_pool_batches;	/* Batches with requests not yet taken, oldest first */
+static int file_pool_threads=-1;		/* Number of threads in the pool, -1 until it has been started */
+
+/**
+ * @brief Takes the next request from a batch
+ *
+ * Has to be called with file_pool_mutex held.
+ *
+ * @param batch The batch
+ * @return The request, or NULL if all requests have been taken
+ */
+static struct file_data_request *
+file_pool_take(struct file_batch *batch)
+{
+	struct file_batch **curr;
+
+	if (batch->next >= batch->count)
+		return NULL;
+	if (batch->next+1 == batch->count) {
+		for (curr = &file_pool_batches ; *curr ; curr=&(*curr)->next_batch) {
+			if (*curr == batch) {
+				*curr=batch->next_batch;
+				break;
+			}
+		}
+	}
+	return &batch->requests[batch->next++];
+}
+
+/**
+ * @brief Reads one request of a batch and marks it as done
+ */
+static void
+file_pool_work(struct file_batch *batch, struct file_data_request *request)
+{
+	file_data_read_request(request);
+	pthread_mutex_lock(&file_pool_mutex);
+	if (++batch->done == batch->count)
+		pthread_cond_signal(&batch->done_cond);
+	pthread_mutex_unlock(&file_pool_mutex);
+}
+
+static void *
+file_pool_run(void *data)
+{
+	struct file_batch *batch;
+	struct file_data_request *request;
+
+	pthread_mutex_lock(&file_pool_mutex);
+	for (;;) {
+		while (!file_pool_batches)
+			pthread_cond_wait(&file_pool_cond, &file_pool_mutex);
+		batch=file_pool_batches;
+		request=file_pool_take(batch);
+		pthread_mutex_unlock(&file_pool_mutex);
+		file_pool_work(batch, request);
+		pthread_mutex_lock(&file_pool_mutex);
+	}
+	return NULL;
+}
+
+/**
+ * @brief Starts the threads of the pool, if this has not been done yet
+ *
+ * The thread calling file_data_read_batch() works on its batch as well, so one thread less than there
+ * are processors is started, but at least one for file_data_read_async(). Has to be called with
+ * file_pool_mutex held.
+ */
+static void
+file_pool_start(void)
+{
+	long count;
+	pthread_t thread;
+	pthread_attr_t attr;
+
+	if (file_pool_threads != -1)
+		return;
+	count=sysconf(_SC_NPROCESSORS_ONLN)-1;
+	if (count > FILE_POOL_MAX_THREADS)
+		count=FILE_POOL_MAX_THREADS;
+	if (count < 1)
+		count=1;
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	for (file_pool_threads = 0 ; file_pool_threads < count ; file_pool_threads++) {
+		if (pthread_create(&thread, &attr, file_pool_run, NULL)) {
+			dbg(lvl_error,"failed to start file reading thread\n");
+			break;
+		}
+	}
+	pthread_attr_destroy(&attr);
+	dbg(lvl_debug,"started %d file reading threads\n", file_pool_threads);
+}
+#endif
+
+/**
+ * @brief Reads several blocks of data, decompressing them if needed
+ *
+ * Each request is read like file_data_read(), file_data_read_compressed() or file_data_read_zstd() would do. If pthreads
+ * are available, the requests are worked on by a pool of threads at the same time, so several tiles of
+ * a map can be inflated at once. The function returns when all requests have been read.
+ *
+ * @param requests The requests. On return, their data is set to the data read, which has to be
+ * freed with file_data_free(), or NULL if reading failed.
+ * @param count The number of requests
+ */
+void
+file_data_read_batch(struct file_data_request *requests, int count)
+{
+#ifdef HAVE_PTHREAD
+	struct file_batch batch;
+	struct file_batch **curr;
+	struct file_data_request *request;
+
+	pthread_mutex_lock(&file_pool_mutex);
+	file_pool_start();
+	if (count > 1 && file_pool_threads > 0) {
+		batch.requests=requests;
+		batch.count=count;
+		batch.next=0;
+		batch.done=0;
+		batch.next_batch=NULL;
+		pthread_cond_init(&batch.done_cond, NULL);
+		for (curr = &file_pool_batches ; *curr ; curr=&(*curr)->next_batch);
+		*curr=&batch;
+		pthread_cond_broadcast(&file_pool_cond);
+		while ((request=file_pool_take(&batch))) {
+			pthread_mutex_unlock(&file_pool_mutex);
+			file_pool_work(&batch, request);
+			pthread_mutex_lock(&file_pool_mutex);
+		}
+		while (batch.done < batch.count)
+			pthread_cond_wait(&batch.done_cond, &file_pool_mutex);
+		pthread_mutex_unlock(&file_pool_mutex);
+		pthread_cond_destroy(&batch.done_cond);
+		return;
+	}
+	pthread_mutex_unlock(&file_pool_mutex);
+#endif
+	while (count-- > 0)
+		file_data_read_request(requests++);
+}
+
+/**
+ * @brief Starts reading several blocks of data in the background
+ *
+ * The requests are read like file_data_read_batch() does, but by the thread pool only, so the
+ * function returns right away. file_data_read_async_done() tells whether all requests have been
+ * read, file_data_read_async_wait() waits for them and has to be called exactly once for each
+ * batch. The requests must not be touched until then. Without pthreads, or if no thread could be
+ * started, the requests are read before the function returns.
+ *
+ * @param requests The requests, see file_data_read_batch()
+ * @param count The number of requests
+ * @return The batch, or NULL if the requests have already been read
+ */
+struct file_batch *
+file_data_read_async(struct file_data_request *requests, int count)
+{
+#ifdef HAVE_PTHREAD
+	struct file_batch *batch;
+	struct file_batch **curr;
+
+	pthread_mutex_lock(&file_pool_mutex);
+	file_pool_start();
+	if (count > 0 && file_pool_threads > 0) {
+		batch=g_new0(struct file_batch, 1);
+		batch->requests=requests;
+		batch->count=count;
+		pthread_cond_init(&batch->done_cond, NULL);
+		for (curr = &file_pool_batches ; *curr ; curr=&(*curr)->next_batch);
+		*curr=batch;
+		pthread_cond_broadcast(&file_pool_cond);
+		pthread_mutex_unlock(&file_pool_mutex);
+		return batch;
+	}
+	pthread_mutex_unlock(&file_pool_mutex);
+#endif
+	while (count-- > 0)
+		file_data_read_request(requests++);
+	return NULL;
+}
+
+/**
+ * @brief Checks whether all requests of a batch started with file_data_read_async() have been read
+ *
+ * @param batch The batch
+ * @return 1 if the requests have been read, 0 if some are still being read
+ */
+int
+file_data_read_async_done(struct file_batch *batch)
+{
+#ifdef HAVE_PTHREAD
+	int ret;
+
+	if (!batch)
+		return 1;
+	pthread_mutex_lock(&file_pool_mutex);
+	ret=(batch->done == batch->count);
+	pthread_mutex_unlock(&file_pool_mutex);
+	return ret;
+#else
+	return 1;
+#endif
+}
+
+/**
+ * @brief Waits until all requests of a batch started with file_data_read_async() have been read and frees the batch
+ *
+ * @param batch The batch
+ */
+void
+file_data_read_async_wait(struct file_batch *batch)
+{
+#ifdef HAVE_PTHREAD
+	if (!batch)
+		return;
+	pthread_mutex_lock(&file_pool_mutex);
+	while (batch->done < batch->count)
+		pthread_cond_wait(&batch->done_cond, &file_pool_mutex);
+	pthread_mutex_unlock(&file_pool_mutex);
+	pthread_cond_destroy(&batch->done_cond);
+	g_free(batch);
+#endif
+}
+
 void
 file_data_free(struct file *file, unsigned char *data)
 {
@@ -640,7 +1118,10 @@ file_data_free(struct file *file, unsigned char *data)
 			return;
 	}
 	if (file->cache && data) {
-		cache_entry_destroy(file_cache, data);
+		struct file_cache_shard *shard=file_cache_shard_data(file, data);
+		file_cache_lock(shard);
+		cache_entry_destroy(shard->cache, data);
+		file_cache_unlock(shard);
 	} else
 		g_free(data);
 }
@@ -655,7 +1136,10 @@ file_data_remove(struct file *file, unsigned char *data)
 			return;
 	}
 	if (file->cache && data) {
-		cache_flush_data(file_cache, data);
+		struct file_cache_shard *shard=file_cache_shard_data(file, data);
+		file_cache_lock(shard);
+		cache_flush_data(shard->cache, data);
+		file_cache_unlock(shard);
 	} else
 		g_free(data);
 }
@@ -688,7 +1172,8 @@ file_unmap(struct file *f)
 #if defined(_WIN32) || defined(__CEGCC__)
     mmap_unmap_win32( f->begin, f->map_handle , f->map_file );
 #else
-	munmap(f->begin, f->size);
+	/* The file may have grown by file_data_write() since it was mapped */
+	munmap(f->begin, f->mmap_end-f->begin);
 #endif
 }
 
@@ -905,19 +1390,73 @@ int
 file_set_cache_size(int cache_size)
 {
 #ifdef CACHE_SIZE
-	cache_resize(file_cache, cache_size);
+	file_cache_resize(file_cache_partitions, cache_size);
 	return 1;
 #else
 	return 0;
 #endif
 }
 
+/**
+ * @brief Gives the cached data of a file a budget of its own
+ *
+ * The data is kept in a cache partition of its own, so it does not compete with the data of other
+ * files. Files opened later with the same name use the same partition.
+ *
+ * @param file The file
+ * @param cache_size The budget in bytes
+ * @return 1 on success, 0 if the file is not cached
+ */
+int
+file_set_cache_budget(struct file *file, int cache_size)
+{
+	struct file_cache_partition *partition;
+	if (!file->cache || !file->name_id)
+		return 0;
+	partition=file_cache_partition(file->name_id);
+	if (partition == file_cache_partitions) {
+		partition=file_cache_partition_new(file->name, file->name_id, cache_size);
+		partition->next=file_cache_partitions->next;
+		file_cache_partitions->next=partition;
+	} else
+		file_cache_resize(partition, cache_size);
+	file->cache_partition=partition;
+	return 1;
+}
+
+/**
+ * @brief Returns the counters of a partition of the file cache
+ *
+ * @param idx Index of the partition, 0 is the default partition
+ * @param name Set to the name of the file the partition belongs to, NULL for the default partition
+ * @param stats Set to the counters of the partition
+ * @return 1 on success, 0 if there is no such partition
+ */
+int
+file_get_cache_stats(int idx, char **name, struct cache_stats *stats)
+{
+	struct file_cache_partition *partition=file_cache_partitions;
+	int i;
+	while (partition && idx--)
+		partition=partition->next;
+	if (!partition)
+		return 0;
+	memset(stats, 0, sizeof(*stats));
+	for (i = 0 ; i < FILE_CACHE_SHARDS ; i++) {
+		file_cache_lock(&partition->shards[i]);
+		cache_get_stats(partition->shards[i].cache, stats);
+		file_cache_unlock(&partition->shards[i]);
+	}
+	*name=partition->name;
+	return 1;
+}
+
 void
 file_init(void)
 {
 #ifdef CACHE_SIZE
 	file_name_hash=g_hash_table_new(g_str_hash, g_str_equal);
-	file_cache=cache_new(sizeof(struct file_cache_id), CACHE_SIZE);
+	file_cache_partitions=file_cache_partition_new(NULL, 0, CACHE_SIZE);
 #endif
 	if(sizeof(off_t)<8)
 		dbg(lvl_error,"Maps larger than 2GB are not supported by this binary, sizeof(off_t)=%zu\n",sizeof(off_t));
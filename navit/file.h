@@ -53,13 +53,28 @@ struct file {
 	char *name;
 	int special;
 	int cache;
+	struct file_cache_partition *cache_partition;
 	int requests;
 	unsigned char *buffer;
 	int buffer_len;
 	GHashTable *headers;
 };
 
+/**
+ * @brief A block of data to be read by file_data_read_batch() or file_data_read_async()
+ */
+struct file_data_request {
+	struct file *file;
+	long long offset;
+	int size;			/**< The size of the data in the file */
+	int size_uncomp;		/**< The size of the uncompressed data, if compressed */
+	int method;			/**< The zip compression method: 0 (stored), 8 (deflate) or 93 (zstd) */
+	unsigned char *data;		/**< Set to the data read */
+};
+
 struct attr;
+struct cache_stats;
+struct file_batch;
 
 /* prototypes */
 int file_request(struct file *f, struct attr **options);
@@ -76,7 +91,12 @@ void file_data_flush(struct file *file, long long offset, int size);
 int file_data_write(struct file *file, long long offset, int size, const void *data);
 int file_get_contents(char *name, unsigned char **buffer, int *size);
 unsigned char *file_data_read_compressed(struct file *file, long long offset, int size, int size_uncomp);
+unsigned char *file_data_read_zstd(struct file *file, long long offset, int size, int size_uncomp);
 unsigned char *file_data_read_encrypted(struct file *file, long long offset, int size, int size_uncomp, int compressed, char *passwd);
+void file_data_read_batch(struct file_data_request *requests, int count);
+struct file_batch *file_data_read_async(struct file_data_request *requests, int count);
+int file_data_read_async_done(struct file_batch *batch);
+void file_data_read_async_wait(struct file_batch *batch);
 void file_data_free(struct file *file, unsigned char *data);
 int file_exists(char const *name);
 void file_remap_readonly(struct file *f);
@@ -95,6 +115,8 @@ int file_get_param(struct file *file, struct param_list *param, int count);
 int file_version(struct file *file, int byname);
 void *file_get_os_handle(struct file *file);
 int file_set_cache_size(int cache_size);
+int file_set_cache_budget(struct file *file, int cache_size);
+int file_get_cache_stats(int idx, char **name, struct cache_stats *stats);
 void file_init(void);
 int file_is_reg(char *name);
 void file_data_remove(struct file *file, unsigned char *data);
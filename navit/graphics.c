@@ -2488,7 +2488,10 @@ do_draw(struct displaylist *displaylist, int cancel, int flags)
 				displaylist->sel=route_selection;
 			else
 				displaylist->sel=displaylist_get_selection(displaylist);
-			displaylist->mr=map_rect_new(displaylist->m, displaylist->sel);
+			if (displaylist->workload)
+				displaylist->mr=map_rect_new_async(displaylist->m, displaylist->sel);
+			else
+				displaylist->mr=map_rect_new(displaylist->m, displaylist->sel);
 		}
 		if (displaylist->mr) {
 			while ((item=map_rect_get_item(displaylist->mr))) {
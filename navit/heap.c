@@ -0,0 +1,211 @@
+/**
+ * Navit, a modular navigation system.
+ * Copyright (C) 2005-2008 Navit Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public License
+ * version 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ */
+
+/** @file
+ * @brief An array based 4-ary min heap with decrease key
+ *
+ * Every element on the heap has an int owned by the caller, which the heap keeps set to the
+ * position of the element plus one while it is on the heap, and to 0 otherwise. This replaces
+ * the element handles of a Fibonacci heap and allows keys to be changed without a separate
+ * allocation per element.
+ */
+
+#include <glib.h>
+#include <limits.h>
+#include "debug.h"
+#include "heap.h"
+
+#define HEAP_ARITY 4
+
+struct heap_entry {
+	int key;
+	int *pos;
+	void *data;
+};
+
+struct heap {
+	struct heap_entry *entries;
+	int size;
+	int allocated;
+};
+
+struct heap *
+heap_new(void)
+{
+	struct heap *heap=g_new0(struct heap, 1);
+	heap->allocated=256;
+	heap->entries=g_new(struct heap_entry, heap->allocated);
+	return heap;
+}
+
+static void
+heap_set(struct heap *heap, int i, struct heap_entry *entry)
+{
+	heap->entries[i]=*entry;
+	*entry->pos=i+1;
+}
+
+static void
+heap_sift_up(struct heap *heap, int i)
+{
+	struct heap_entry entry=heap->entries[i];
+	while (i > 0) {
+		int parent=(i-1)/HEAP_ARITY;
+		if (heap->entries[parent].key <= entry.key)
+			break;
+		heap_set(heap, i, &heap->entries[parent]);
+		i=parent;
+	}
+	heap_set(heap, i, &entry);
+}
+
+static void
+heap_sift_down(struct heap *heap, int i)
+{
+	struct heap_entry entry=heap->entries[i];
+	for (;;) {
+		int child=i*HEAP_ARITY+1;
+		int end=child+HEAP_ARITY;
+		int min=-1,j;
+		if (end > heap->size)
+			end=heap->size;
+		for (j = child ; j < end ; j++) {
+			if (heap->entries[j].key < (min < 0 ? entry.key : heap->entries[min].key))
+				min=j;
+		}
+		if (min < 0)
+			break;
+		heap_set(heap, i, &heap->entries[min]);
+		i=min;
+	}
+	heap_set(heap, i, &entry);
+}
+
+/**
+ * @brief Inserts an element
+ *
+ * @param heap The heap
+ * @param key The key of the element
+ * @param data The element
+ * @param pos Position of the element, kept up to date by the heap. Must not be moved while the element is on the heap.
+ */
+void
+heap_insert(struct heap *heap, int key, void *data, int *pos)
+{
+	struct heap_entry *entry;
+	if (heap->size == heap->allocated) {
+		heap->allocated*=2;
+		heap->entries=g_renew(struct heap_entry, heap->entries, heap->allocated);
+	}
+	entry=&heap->entries[heap->size];
+	entry->key=key;
+	entry->data=data;
+	entry->pos=pos;
+	heap_sift_up(heap, heap->size++);
+}
+
+/**
+ * @brief Changes the key of an element which is on the heap
+ *
+ * @param heap The heap
+ * @param pos The position passed to heap_insert()
+ * @param key The new key
+ */
+void
+heap_replace_key(struct heap *heap, int *pos, int key)
+{
+	int i=*pos-1;
+	dbg_assert(i >= 0 && i < heap->size);
+	if (key < heap->entries[i].key) {
+		heap->entries[i].key=key;
+		heap_sift_up(heap, i);
+	} else {
+		heap->entries[i].key=key;
+		heap_sift_down(heap, i);
+	}
+}
+
+/**
+ * @brief Returns the element with the lowest key without removing it
+ *
+ * @return The element, or NULL if the heap is empty
+ */
+void *
+heap_min(struct heap *heap)
+{
+	if (!heap->size)
+		return NULL;
+	return heap->entries[0].data;
+}
+
+/**
+ * @brief Returns the lowest key, or INT_MAX if the heap is empty
+ */
+int
+heap_min_key(struct heap *heap)
+{
+	if (!heap->size)
+		return INT_MAX;
+	return heap->entries[0].key;
+}
+
+/**
+ * @brief Removes the element with the lowest key
+ *
+ * @return The element, or NULL if the heap is empty
+ */
+void *
+heap_extract_min(struct heap *heap)
+{
+	struct heap_entry *first;
+	void *ret;
+	if (!heap->size)
+		return NULL;
+	first=&heap->entries[0];
+	ret=first->data;
+	*first->pos=0;
+	if (--heap->size) {
+		*first=heap->entries[heap->size];
+		heap_sift_down(heap, 0);
+	}
+	return ret;
+}
+
+int
+heap_size(struct heap *heap)
+{
+	return heap->size;
+}
+
+/**
+ * @brief Destroys the heap
+ *
+ * The positions of elements still on the heap are reset to 0.
+ */
+void
+heap_destroy(struct heap *heap)
+{
+	int i;
+	if (!heap)
+		return;
+	for (i = 0 ; i < heap->size ; i++)
+		*heap->entries[i].pos=0;
+	g_free(heap->entries);
+	g_free(heap);
+}
@@ -0,0 +1,43 @@
+/**
+ * Navit, a modular navigation system.
+ * Copyright (C) 2005-2008 Navit Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public License
+ * version 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ */
+
+#ifndef NAVIT_HEAP_H
+#define NAVIT_HEAP_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct heap;
+/* prototypes */
+struct heap *heap_new(void);
+void heap_insert(struct heap *heap, int key, void *data, int *pos);
+void heap_replace_key(struct heap *heap, int *pos, int key);
+void *heap_min(struct heap *heap);
+int heap_min_key(struct heap *heap);
+void *heap_extract_min(struct heap *heap);
+int heap_size(struct heap *heap);
+void heap_destroy(struct heap *heap);
+/* end of prototypes */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,196 @@
+/**
+ * Navit, a modular navigation system.
+ * Copyright (C) 2005-2008 Navit Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public License
+ * version 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ */
+
+/** @file
+ * @brief Checks the 4-ary heap against the Fibonacci heap and compares their speed
+ *
+ * Both heaps are fed the same random sequence of inserts, key decreases and extractions, like
+ * route_graph_flood() does. Keys are unique, so both heaps have to extract the same elements, in
+ * ascending order of their keys.
+ * Afterwards a larger run of the same kind is timed on both heaps.
+ *
+ * Usage: heaptest [elements [rounds]]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include <glib.h>
+#include "debug.h"
+#include "heap.h"
+#include "fib.h"
+
+/**
+ * @brief An element on both heaps, the equivalent of a route graph point
+ */
+struct heaptest_el {
+	int key;
+	int pos;			/**< Position on the 4-ary heap */
+	struct fibheap_el *fel;		/**< Handle on the Fibonacci heap */
+};
+
+void
+debug_assert_fail(const char *module, const int mlen, const char *function, const int flen, const char *file, int line, const char *expr)
+{
+	fprintf(stderr,"%s:%d: %s: assertion %s failed\n", file, line, function, expr);
+	abort();
+}
+
+static double
+heaptest_time(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec+tv.tv_usec/1000000.0;
+}
+
+/**
+ * @brief Runs the same operations on both heaps and compares the extracted keys
+ *
+ * @param count Number of elements
+ * @param seed Seed of the random sequence
+ * @return The number of mismatches
+ */
+static int
+heaptest_compare(int count, unsigned int seed)
+{
+	struct heaptest_el *els=g_new0(struct heaptest_el, count);
+	struct heap *heap=heap_new();
+	struct fibheap *fheap=fh_makekeyheap();
+	struct heaptest_el *el,*fel;
+	int i,base,inserted=0,last=-1,errors=0;
+
+	srand(seed);
+	while (inserted < count || heap_size(heap)) {
+		switch (rand() % 4) {
+		case 0:
+		case 1:
+			if (inserted < count) {
+				/* The key is base*count+index, which makes it unique */
+				el=&els[inserted];
+				el->key=(last/count+1+rand() % 1000)*count+inserted;
+				heap_insert(heap, el->key, el, &el->pos);
+				el->fel=fh_insertkey(fheap, el->key, el);
+				inserted++;
+				break;
+			}
+			/* fall through */
+		case 2:
+			if (!inserted)
+				break;
+			i=rand() % inserted;
+			el=&els[i];
+			base=el->key/count-last/count;
+			if (el->pos && base > 1) {
+				el->key=(last/count+1+rand() % (base-1))*count+i;
+				heap_replace_key(heap, &el->pos, el->key);
+				fh_replacekey(fheap, el->fel, el->key);
+			}
+			break;
+		case 3:
+			if (!heap_size(heap))
+				break;
+			el=heap_extract_min(heap);
+			fel=fh_extractmin(fheap);
+			if (el != fel || el->key <= last) {
+				printf("mismatch: got %d, fibheap %d, previous %d\n", el->key, fel ? fel->key : -1, last);
+				errors++;
+			}
+			if (el->pos) {
+				printf("extracted element still has position %d\n", el->pos);
+				errors++;
+			}
+			last=el->key;
+			break;
+		}
+	}
+	if (fh_extractmin(fheap)) {
+		printf("fibheap has more elements\n");
+		errors++;
+	}
+	heap_destroy(heap);
+	fh_deleteheap(fheap);
+	g_free(els);
+	return errors;
+}
+
+/**
+ * @brief Times a flood-like sequence of operations
+ *
+ * @param count Number of elements
+ * @param fib True to use the Fibonacci heap, false for the 4-ary heap
+ * @return The time in seconds
+ */
+static double
+heaptest_bench(int count, int fib)
+{
+	struct heaptest_el *els=g_new0(struct heaptest_el, count);
+	struct heap *heap=heap_new();
+	struct fibheap *fheap=fh_makekeyheap();
+	struct heaptest_el *el;
+	int i,j,last=0;
+	double start=heaptest_time();
+
+	srand(1);
+	for (i = 0 ; i < count ; i++) {
+		el=&els[i];
+		el->key=last+rand() % 1000;
+		if (fib)
+			el->fel=fh_insertkey(fheap, el->key, el);
+		else
+			heap_insert(heap, el->key, el, &el->pos);
+		/* Every settled point lowers the value of a few neighbors */
+		for (j = 0 ; j < 3 ; j++) {
+			el=&els[rand() % (i+1)];
+			if (el->key <= last)
+				continue;
+			el->key=last+(el->key-last)/2;
+			if (fib) {
+				if (el->fel)
+					fh_replacekey(fheap, el->fel, el->key);
+			} else if (el->pos)
+				heap_replace_key(heap, &el->pos, el->key);
+		}
+		if (i % 2) {
+			el=fib ? fh_extractmin(fheap) : heap_extract_min(heap);
+			el->fel=NULL;
+			last=el->key;
+		}
+	}
+	while ((el=fib ? fh_extractmin(fheap) : heap_extract_min(heap)))
+		el->fel=NULL;
+	heap_destroy(heap);
+	fh_deleteheap(fheap);
+	g_free(els);
+	return heaptest_time()-start;
+}
+
+int
+main(int argc, char **argv)
+{
+	int count=argc > 1 ? atoi(argv[1]) : 1000;
+	int rounds=argc > 2 ? atoi(argv[2]) : 100;
+	int i,errors=0;
+
+	for (i = 0 ; i < rounds ; i++)
+		errors+=heaptest_compare(count, i);
+	printf("%d rounds of %d elements, %d mismatches\n", rounds, count, errors);
+	printf("4-ary heap: %.3f s, Fibonacci heap: %.3f s for %d elements\n", heaptest_bench(count*1000, 0), heaptest_bench(count*1000, 1), count*1000);
+	return errors ? 1 : 0;
+}
@@ -621,4 +621,6 @@ ITEM(poly_place5)
 ITEM(poly_place6)
 ITEM(poly_water_tiled)
 ITEM(poly_meadow)
+ITEM(poly_isochrone)
+ITEM(tile_index)
 ITEM2(0xffffffff,last)
@@ -118,6 +118,21 @@ map_new(struct attr *parent, struct attr **attrs)
 	return m;
 }
 
+/**
+ * @brief Opens a map a second time
+ *
+ * The new map is created from the same attributes as the original one, but has its own
+ * private data. This allows to read the map from another thread while the original map is in use.
+ *
+ * @param this_ The map to open again
+ * @return The new map or NULL on failure
+ */
+struct map *
+map_clone(struct map *this_)
+{
+	return map_new(NULL, this_->attrs);
+}
+
 /**
  * @brief Gets an attribute from a map
  *
@@ -340,6 +355,53 @@ map_rect_new(struct map *m, struct map_selection *sel)
 	return mr;
 }
 
+/**
+ * @brief Creates a new map rect which may return busy_item
+ *
+ * This works like map_rect_new(), but lets the map read its data in the background.
+ * While it does, map_rect_get_item() returns busy_item, and the caller should try
+ * again later. Maps which don't support this return a normal map rect.
+ *
+ * @param m The map to build the rect on
+ * @param sel Map selection to choose the rectangle - may be NULL, see map_rect_new()
+ * @return A new map rect
+ */
+struct map_rect *
+map_rect_new_async(struct map *m, struct map_selection *sel)
+{
+	struct map_rect *mr;
+
+	if (!m->meth.map_rect_new_async)
+		return map_rect_new(m, sel);
+	mr=g_new0(struct map_rect, 1);
+	mr->m=m;
+	mr->priv=m->meth.map_rect_new_async(m->priv, sel);
+	if (! mr->priv) {
+		g_free(mr);
+		mr=NULL;
+	}
+
+	return mr;
+}
+
+/**
+ * @brief Tells a map where a vehicle is heading
+ *
+ * Maps which support it read the data of the area the vehicle is heading to in the background,
+ * other maps ignore this.
+ *
+ * @param m The map
+ * @param pos The position of the vehicle
+ * @param dir The heading of the vehicle in degrees
+ * @param speed The speed of the vehicle in km/h
+ */
+void
+map_prefetch(struct map *m, struct coord_geo *pos, double dir, double speed)
+{
+	if (m->meth.map_prefetch)
+		m->meth.map_prefetch(m->priv, pos, dir, speed);
+}
+
 /**
  * @brief Gets the next item from a map rect
  *
@@ -86,6 +86,8 @@ struct map_methods {
 	struct item *		(*map_rect_create_item)(struct map_rect_priv *mr, enum item_type type); /**< Function to create a new item in the map */
 	int			(*map_get_attr)(struct map_priv *priv, enum attr_type type, struct attr *attr);
         int			(*map_set_attr)(struct map_priv *priv, struct attr *attr);
+	struct map_rect_priv *  (*map_rect_new_async)(struct map_priv *map, struct map_selection *sel); /**< Function to create a new map rect which may return busy_item, optional */
+	void			(*map_prefetch)(struct map_priv *priv, struct coord_geo *pos, double dir, double speed); /**< Function to read the data ahead of a vehicle in the background, optional */
 
 };
 
@@ -240,6 +242,7 @@ struct map_search;
 struct map_selection;
 struct pcoord;
 struct map *map_new(struct attr *parent, struct attr **attrs);
+struct map *map_clone(struct map *this_);
 struct map *map_ref(struct map* m);
 void map_unref(struct map* m);
 int map_get_attr(struct map *this_, enum attr_type type, struct attr *attr, struct attr_iter *iter);
@@ -255,6 +258,8 @@ enum projection map_projection(struct map *this_);
 void map_set_projection(struct map *this_, enum projection pro);
 void map_destroy(struct map *m);
 struct map_rect *map_rect_new(struct map *m, struct map_selection *sel);
+struct map_rect *map_rect_new_async(struct map *m, struct map_selection *sel);
+void map_prefetch(struct map *m, struct coord_geo *pos, double dir, double speed);
 struct item *map_rect_get_item(struct map_rect *mr);
 struct item *map_rect_get_item_byid(struct map_rect *mr, int id_hi, int id_lo);
 struct item *map_rect_create_item(struct map_rect *mr, enum item_type type_);
@@ -39,9 +39,19 @@
 #include "callback.h"
 #include "types.h"
 #include "geom.h"
+#include "profile.h"
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
 
 static int map_id;
 
+/** Highest map version this driver can read */
+#define BINFILE_MAP_VERSION_MAX 16
+
+/** Flag in the coordinate size of an item whose coordinates are stored as zig-zag delta varints */
+#define BINFILE_COORD_VARINT 0x80000000
+
 
 /**
  * @brief A map tile, a rectangular region of the world.
@@ -76,12 +86,19 @@ struct tile {
                                  * header[2] holds the size of the coordinates in the tile
                                  */
 	int *pos_coord;         //!< Current position in the coordinates region of the current item.
+	int coord_varint;       //!< The coordinates of the current item are zig-zag delta varints, see binfile_coord_get().
+	unsigned char *pos_varint;      //!< Current position in the varints of the current item.
+	int varint_left;        //!< Number of coordinates of the current item not read yet.
+	struct coord varint_last;       //!< Last coordinate read, the next varints are relative to it.
 	int *pos_attr_start;    //!< Pointer to the first attr data structure of the current item.
 	int *pos_attr;          //!< Current position in the attr region of the current item.
 	int *pos_next;          //!< Pointer to the next item (the item which follows the "current item" as indicated by *pos).
 	struct file *fi;        //!< The file from which this tile was loaded.
 	int zipfile_num;
 	int mode;
+	int *index;             //!< Bounding box index of the items, see binfile_tile_index_find(), or NULL.
+	int *index_end;         //!< First memory address not belonging to the index.
+	int *index_next;        //!< Index entry of the next group of items to check.
 };
 
 
@@ -133,6 +150,43 @@ struct map_priv {
 	long download_enabled;
 	int last_searched_town_id_hi;	
 	int last_searched_town_id_lo;
+	int cache_size;			/**< Budget of the file cache for this map in bytes, 0 to share the default one */
+	int tile_index;			/**< Number of items per group if the tiles have a bounding box index, 0 otherwise */
+	char *tile_cache_name;		/**< File to keep decompressed tiles in, see binfile_tile_cache_open() */
+	struct tile_cache *tile_cache;
+	struct cd_index *cd_index;	/**< Index of the zip member names, see binfile_cd_index_open() */
+	int cd_index_failed;
+	int async_read;			/**< Read tiles in the background and return busy_item meanwhile, see binfile_read_submit() */
+#ifdef HAVE_PTHREAD
+	struct map_prefetch *prefetch;	/**< Thread decompressing the tiles around the vehicle, see map_binfile_prefetch() */
+	int prefetch_failed;
+#endif
+};
+
+#define BINFILE_ATTR_INDEX_SIZE 32
+
+/**
+ * @brief A tile which was read ahead of being entered
+ */
+struct tile_data {
+	int zipfile_num;
+	struct file *fi;
+	unsigned char *data;
+	int size;
+	struct tile_data *next;
+};
+
+#define BINFILE_BATCH_MAX 64
+
+/**
+ * @brief Tiles being read by file_data_read_async() or file_data_read_batch()
+ */
+struct binfile_read {
+	struct file_batch *batch;	/**< The batch being read, NULL if already read */
+	struct file_data_request req[BINFILE_BATCH_MAX];
+	int zipfiles[BINFILE_BATCH_MAX];
+	int count;
+	int enter;			/**< Zip member to be entered once read, -1 if none */
 };
 
 struct map_rect_priv {
@@ -152,6 +206,16 @@ struct map_rect_priv {
 	struct attr attrs[8];
 	int status;
 	struct map_search_priv *msp;
+	int sel_tiles_only;		/**< The selection only restricts the tiles, items outside of it are still returned */
+	struct tile_data *tile_data;
+	struct binfile_read *read;	/**< Tiles being read, see binfile_read_finish() */
+	int async_read;			/**< Tiles may be read in the background, see map_rect_new_binfile_async() */
+	int *attr_index[BINFILE_ATTR_INDEX_SIZE];	/**< Start of each attribute of the current item, see binfile_attr_index() */
+	enum attr_type attr_index_type[BINFILE_ATTR_INDEX_SIZE];	/**< Type of each attribute in attr_index */
+	signed char attr_index_slot[BINFILE_ATTR_INDEX_SIZE];	/**< First entry of attr_index for each hash slot of the type, -1 if none */
+	signed char attr_index_chain[BINFILE_ATTR_INDEX_SIZE];	/**< Next entry of attr_index in the same hash slot, -1 if none */
+	int attr_index_count;		/**< Number of entries in attr_index, -1 if not built yet, -2 if the item has too many attributes */
+	int attr_index_next;		/**< Entry of attr_index binfile_attr_get() continues at, -1 to look it up, -2 if there are no more */
 #ifdef DEBUG_SIZE
 	int size;
 #endif
@@ -180,9 +244,13 @@ struct map_search_priv {
 
 static void push_tile(struct map_rect_priv *mr, struct tile *t, int offset, int length);
 static void setup_pos(struct map_rect_priv *mr);
+static int map_submap_zipfile(struct map_rect_priv *mr, int *zipfile);
 static void map_binfile_close(struct map_priv *m);
 static int map_binfile_open(struct map_priv *m);
 static void map_binfile_destroy(struct map_priv *m);
+#ifdef HAVE_PTHREAD
+static void map_binfile_prefetch_destroy(struct map_prefetch *p);
+#endif
 
 static void lfh_to_cpu(struct zip_lfh *lfh) {
 	dbg_assert(lfh != NULL);
@@ -376,6 +444,10 @@ binfile_read_content(struct map_priv *m, struct file *fi, long long offset, stru
 		offset+=lfh->zipxtraln;
 		ret=file_data_read_compressed(fi,offset, lfh->zipsize, lfh->zipuncmp);
 		break;
+	case 93:
+		offset+=lfh->zipxtraln;
+		ret=file_data_read_zstd(fi,offset, lfh->zipsize, lfh->zipuncmp);
+		break;
 	case 99:
 		if (!m->passwd)
 			break;
@@ -399,6 +471,216 @@ binfile_read_content(struct map_priv *m, struct file *fi, long long offset, stru
 	return ret;
 }
 
+/**
+ * @brief Header of a central directory index file
+ *
+ * The index is a hash table mapping the names of the zip members to the offsets of their central
+ * directory entries, so a member can be found without scanning the central directory. It is kept
+ * next to the map as <map>.cdx and rebuilt if the map changed.
+ */
+struct cd_index_header {
+	char magic[8];			/**< "navitcdx" */
+	int slots;			/**< Number of entries of the hash table, a power of 2 */
+	int members;			/**< Number of entries of the central directory */
+	long long cd_size;		/**< Size of the central directory */
+	long long map_size;		/**< Size of the map file */
+	long long map_mtime;		/**< Modification time of the map file, as returned by file_version() */
+};
+
+/**
+ * @brief An entry of the hash table of a central directory index file
+ */
+struct cd_index_entry {
+	unsigned int hash;		/**< Hash of the member name, see binfile_cd_hash() */
+	int offset;			/**< Offset of the central directory entry, -1 if the slot is empty */
+};
+
+struct cd_index {
+	struct file *fi;		/**< The index file, NULL if the table is only kept in memory */
+	struct cd_index_entry *entries;
+	int slots;
+};
+
+static unsigned int
+binfile_cd_hash(char *name, int len)
+{
+	unsigned int hash=2166136261U;
+	while (len-- > 0) {
+		hash^=(unsigned char)*name++;
+		hash*=16777619U;
+	}
+	return hash;
+}
+
+/**
+ * @brief Builds the hash table of the central directory index by scanning the central directory
+ *
+ * The table has at least twice as many slots as the end of central directory record announces members.
+ * A central directory with more entries than that is rejected, so the table never fills up.
+ *
+ * @param m The map
+ * @param h The header of the index, with slots, members and cd_size set
+ * @return The table, or NULL if the central directory could not be read
+ */
+static struct cd_index_entry *
+binfile_cd_index_build(struct map_priv *m, struct cd_index_header *h)
+{
+	long long cdoffset=m->eoc64?m->eoc64->zip64eofst:m->eoc->zipeofst;
+	struct cd_index_entry *entries;
+	unsigned char *data;
+	struct zip_cd cd;
+	int offset=0,slot,count=0;
+
+	data=file_data_read(m->fi, cdoffset, h->cd_size);
+	if (!data)
+		return NULL;
+	entries=g_new(struct cd_index_entry, h->slots);
+	memset(entries, 0xff, h->slots*sizeof(*entries));
+	while (offset+sizeof(cd) <= h->cd_size) {
+		memcpy(&cd, data+offset, sizeof(cd));
+		cd_to_cpu(&cd);
+		if (cd.zipcensig != zip_cd_sig || offset+sizeof(cd)+cd.zipcfnl > h->cd_size)
+			break;
+		if (++count > h->members) {
+			dbg(lvl_error,"map file %s: central directory has more than %d members\n", m->filename, h->members);
+			g_free(entries);
+			file_data_free(m->fi, data);
+			return NULL;
+		}
+		slot=binfile_cd_hash((char *)data+offset+sizeof(cd), cd.zipcfnl) & (h->slots-1);
+		while (entries[slot].offset != -1)
+			slot=(slot+1) & (h->slots-1);
+		entries[slot].hash=binfile_cd_hash((char *)data+offset+sizeof(cd), cd.zipcfnl);
+		entries[slot].offset=offset;
+		offset+=sizeof(cd)+cd.zipcfnl+cd.zipcxtl+cd.zipccml;
+	}
+	file_data_free(m->fi, data);
+	return entries;
+}
+
+/**
+ * @brief Opens the central directory index of a map, building it if it is missing or outdated
+ *
+ * A newly built index is written next to the map. If that fails, it is only kept in memory.
+ *
+ * @param m The map
+ * @return 1 if the index is available, 0 otherwise
+ */
+static int
+binfile_cd_index_open(struct map_priv *m)
+{
+	struct attr readwrite={attr_readwrite,{(void *)1}};
+	struct attr create={attr_create,{(void *)1}};
+	struct attr cache={attr_cache,{(void *)0}};
+	struct attr *attrs[]={&cache, NULL, NULL, NULL};
+	struct cd_index_header header,*h;
+	struct cd_index *ci;
+	struct file *fi;
+	long long members=m->eoc64?m->eoc64->zip64ecenn:m->eoc->zipecenn;
+	char *name;
+	int valid=0;
+
+	if (m->cd_index)
+		return 1;
+	if (m->cd_index_failed || m->url || !m->eoc || members <= 0 || members > 0x10000000)
+		return 0;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, "navitcdx", sizeof(header.magic));
+	for (header.slots = 16 ; header.slots < members*2 ; header.slots*=2);
+	header.members=members;
+	header.cd_size=m->eoc64?m->eoc64->zip64ecsz:m->eoc->zipecsz;
+	if (header.cd_size > 0x7fffffff)
+		return 0;
+	header.map_size=m->fi->size;
+#ifndef __CEGCC__
+	file_version(m->fi, 0);
+	header.map_mtime=m->fi->mtime;
+#endif
+	profile(2, NULL);
+	ci=g_new0(struct cd_index, 1);
+	ci->slots=header.slots;
+	name=g_strdup_printf("%s.cdx",m->filename);
+	fi=file_create(name, attrs);
+	if (fi && fi->size == sizeof(header)+header.slots*sizeof(struct cd_index_entry)) {
+		h=(struct cd_index_header *)file_data_read(fi, 0, sizeof(header));
+		valid=h && !memcmp(h, &header, sizeof(header));
+		file_data_free(fi, (unsigned char *)h);
+	}
+	if (valid && file_mmap(fi)) {
+		ci->fi=fi;
+		ci->entries=(struct cd_index_entry *)(fi->begin+sizeof(header));
+		profile(2, "loaded %s\n", name);
+	} else {
+		if (fi)
+			file_destroy(fi);
+		ci->entries=binfile_cd_index_build(m, &header);
+		if (!ci->entries) {
+			dbg(lvl_error,"map file %s: unable to read central directory\n", m->filename);
+			g_free(ci);
+			g_free(name);
+			m->cd_index_failed=1;
+			return 0;
+		}
+		profile(2, "built index of %d members\n", header.members);
+		attrs[1]=&readwrite;
+		attrs[2]=&create;
+		fi=file_create(name, attrs);
+		if (!fi || !file_data_write(fi, 0, sizeof(header), &header) ||
+		    !file_data_write(fi, sizeof(header), header.slots*sizeof(struct cd_index_entry), ci->entries))
+			dbg(lvl_debug,"unable to write %s, keeping the index in memory\n", name);
+		if (fi)
+			file_destroy(fi);
+	}
+	g_free(name);
+	m->cd_index=ci;
+	return 1;
+}
+
+static void
+binfile_cd_index_close(struct map_priv *m)
+{
+	struct cd_index *ci=m->cd_index;
+	if (!ci)
+		return;
+	if (ci->fi)
+		file_destroy(ci->fi);
+	else
+		g_free(ci->entries);
+	g_free(ci);
+	m->cd_index=NULL;
+	m->cd_index_failed=0;
+}
+
+/**
+ * @brief Looks up a zip member by name in the central directory index
+ *
+ * @param m The map, with the index opened
+ * @param name The name of the member
+ * @return The offset of the central directory entry of the member, or -1 if there is none
+ */
+static int
+binfile_cd_index_find(struct map_priv *m, char *name)
+{
+	struct cd_index *ci=m->cd_index;
+	struct cd_index_entry *e;
+	struct zip_cd *cd;
+	int len=strlen(name);
+	unsigned int hash=binfile_cd_hash(name, len);
+	int slot=hash & (ci->slots-1),match;
+
+	while ((e=&ci->entries[slot])->offset != -1) {
+		if (e->hash == hash) {
+			cd=binfile_read_cd(m, e->offset, -1);
+			match=cd && cd->zipcfnl == len && !strncmp(cd->zipcfn, name, len);
+			file_data_free(m->fi, (unsigned char *)cd);
+			if (match)
+				return e->offset;
+		}
+		slot=(slot+1) & (ci->slots-1);
+	}
+	return -1;
+}
+
 static int
 binfile_search_cd(struct map_priv *m, int offset, char *name, int partial, int skip)
 {
@@ -410,6 +692,13 @@ binfile_search_cd(struct map_priv *m, int offset, char *name, int partial, int s
 #if 0
 	dbg(lvl_debug,"end=%d\n",end);
 #endif
+	/* Member names are unique, so exact names can be looked up in the index */
+	if (!partial && binfile_cd_index_open(m)) {
+		int found=binfile_cd_index_find(m, name);
+		if (found > offset || (found == offset && !skip))
+			return found;
+		return -1;
+	}
 	while (offset < end) {
 		cd=(struct zip_cd *)(m->search_data+offset-m->search_offset);
 		if (! m->search_data ||
@@ -448,17 +737,47 @@ static void
 map_destroy_binfile(struct map_priv *m)
 {
 	dbg(lvl_debug,"map_destroy_binfile\n");
+#ifdef HAVE_PTHREAD
+	map_binfile_prefetch_destroy(m->prefetch);
+#endif
 	if (m->fi)
 		map_binfile_close(m);
 	map_binfile_destroy(m);
 }
 
+static inline int
+binfile_zigzag_decode(unsigned int value)
+{
+	return (int)(value >> 1) ^ -(int)(value & 1);
+}
+
+static inline unsigned int
+binfile_varint_get(unsigned char **p, unsigned char *end)
+{
+	unsigned char *s=*p;
+	unsigned int ret=0;
+	int shift=0;
+	while (s < end) {
+		ret|=(unsigned int)(*s & 0x7f) << shift;
+		if (!(*s++ & 0x80) || (shift+=7) > 28)
+			break;
+	}
+	*p=s;
+	return ret;
+}
+
 static void
 binfile_coord_rewind(void *priv_data)
 {
 	struct map_rect_priv *mr=priv_data;
 	struct tile *t=mr->t;
 	t->pos_coord=t->pos_coord_start;
+	if (t->coord_varint) {
+		t->pos_varint=(unsigned char *)t->pos_coord_start;
+		t->varint_left=binfile_varint_get(&t->pos_varint, (unsigned char *)t->pos_attr_start);
+		t->varint_last.x=0;
+		t->varint_last.y=0;
+	}
 }
 
 static inline int
@@ -466,9 +785,55 @@ binfile_coord_left(void *priv_data)
 {
 	struct map_rect_priv *mr=priv_data;
   	struct tile *t=mr->t;
+	if (t->coord_varint)
+		return t->varint_left;
 	return (t->pos_attr_start-t->pos_coord)/2;
 }
 
+/**
+ * @brief Decodes coordinates stored as zig-zag delta varints
+ *
+ * The coordinates follow a varint holding their number. Each one is stored as the differences of
+ * x and y to the previous one (to 0,0 for the first one).
+ * Where the next 4 coordinates all differ by less than 64 units, they fit into 8 single byte varints,
+ * which are checked with one 64 bit test and decoded without branches.
+ */
+static int
+binfile_coord_get_varint(struct tile *t, struct coord *c, int count)
+{
+	unsigned char *p=t->pos_varint,*end=(unsigned char *)t->pos_attr_start;
+	int x=t->varint_last.x,y=t->varint_last.y;
+	unsigned long long word;
+	int i=0,j;
+
+	while (i < count) {
+		if (count-i >= 4 && p+8 <= end) {
+			memcpy(&word, p, 8);
+			if (!(word & 0x8080808080808080ULL)) {
+				for (j = 0 ; j < 4 ; j++) {
+					x+=binfile_zigzag_decode(p[j*2]);
+					y+=binfile_zigzag_decode(p[j*2+1]);
+					c[i+j].x=x;
+					c[i+j].y=y;
+				}
+				p+=8;
+				i+=4;
+				continue;
+			}
+		}
+		x+=binfile_zigzag_decode(binfile_varint_get(&p, end));
+		y+=binfile_zigzag_decode(binfile_varint_get(&p, end));
+		c[i].x=x;
+		c[i].y=y;
+		i++;
+	}
+	t->pos_varint=p;
+	t->varint_left-=count;
+	t->varint_last.x=x;
+	t->varint_last.y=y;
+	return count;
+}
+
 static int
 binfile_coord_get(void *priv_data, struct coord *c, int count)
 {
@@ -478,6 +843,8 @@ binfile_coord_get(void *priv_data, struct coord *c, int count)
 	max=binfile_coord_left(priv_data);
 	if (count > max)
 		count=max;
+	if (t->coord_varint)
+		return binfile_coord_get_varint(t, c, count);
 #if __BYTE_ORDER == __LITTLE_ENDIAN
 	memcpy(c, t->pos_coord, count*sizeof(struct coord));
 #else
@@ -509,7 +876,99 @@ binfile_attr_rewind(void *priv_data)
 	t->pos_attr=t->pos_attr_start;
 	mr->label=0;
 	memset(mr->label_attr, 0, sizeof(mr->label_attr));
+	mr->attr_index_count=-1;
+}
+
+/**
+ * @brief Notes the attributes an item may be labelled with
+ *
+ * @param mr The map rect
+ * @param type The type of the attribute
+ * @param pos The position of the attribute, after its size
+ */
+static void
+binfile_attr_label(struct map_rect_priv *mr, enum attr_type type, int *pos)
+{
+	if (type == attr_label)
+		mr->label=1;
+	if (type == attr_house_number)
+		mr->label_attr[0]=pos;
+	if (type == attr_street_name)
+		mr->label_attr[1]=pos;
+	if (type == attr_street_name_systematic)
+		mr->label_attr[2]=pos;
+	if (type == attr_district_name && mr->item.type < type_line)
+		mr->label_attr[3]=pos;
+	if (type == attr_town_name && mr->item.type < type_line)
+		mr->label_attr[4]=pos;
+}
 
+/* Hash slot of an attribute type in the attribute table, the types within an attribute range are consecutive */
+#define BINFILE_ATTR_INDEX_SLOT(type) (((type) ^ ((type) >> 16)) & (BINFILE_ATTR_INDEX_SIZE-1))
+
+/**
+ * @brief Builds the table of the attributes of the current item
+ *
+ * The table lets binfile_attr_get() find an attribute without walking the attribute data
+ * again each time another attribute type is asked for. Besides the attributes in item order,
+ * which attr_any returns, it hashes them by type, so an attribute type is found in its slot
+ * no matter how many attributes come before it. Items with more than
+ * BINFILE_ATTR_INDEX_SIZE attributes are not indexed and walked as before.
+ *
+ * @param mr The map rect
+ */
+static void
+binfile_attr_index(struct map_rect_priv *mr)
+{
+	struct tile *t=mr->t;
+	int *pos=t->pos_attr_start;
+	int count=0,i,slot;
+
+	mr->attr_index_next=-1;
+	while (pos < t->pos_next) {
+		if (count >= BINFILE_ATTR_INDEX_SIZE) {
+			mr->attr_index_count=-2;
+			return;
+		}
+		mr->attr_index_type[count]=le32_to_cpu(pos[1]);
+		binfile_attr_label(mr, mr->attr_index_type[count], pos+1);
+		mr->attr_index[count++]=pos;
+		pos+=le32_to_cpu(pos[0])+1;
+	}
+	memset(mr->attr_index_slot, -1, sizeof(mr->attr_index_slot));
+	/* Chained from the last attribute, so attributes of the same type stay in item order */
+	for (i = count-1 ; i >= 0 ; i--) {
+		slot=BINFILE_ATTR_INDEX_SLOT(mr->attr_index_type[i]);
+		mr->attr_index_chain[i]=mr->attr_index_slot[slot];
+		mr->attr_index_slot[slot]=i;
+	}
+	mr->attr_index_count=count;
+}
+
+/**
+ * @brief Looks up the next attribute of a type in the attribute table
+ *
+ * @param mr The map rect, its attribute table must be built
+ * @param attr_type The type of the attribute, or attr_any for any attribute
+ * @param e The entry of attr_index to start at, or -1 to start at t->pos_attr
+ * @return The entry of attr_index, or -1 if there is no such attribute
+ */
+static int
+binfile_attr_index_find(struct map_rect_priv *mr, enum attr_type attr_type, int e)
+{
+	if (attr_type == attr_any) {
+		if (e == -1)
+			for (e = 0 ; e < mr->attr_index_count && mr->attr_index[e] < mr->t->pos_attr ; e++);
+		return e < mr->attr_index_count ? e : -1;
+	}
+	if (e == -1) {
+		e=mr->attr_index_slot[BINFILE_ATTR_INDEX_SLOT(attr_type)];
+		while (e != -1 && mr->attr_index[e] < mr->t->pos_attr)
+			e=mr->attr_index_chain[e];
+	}
+	while (e != -1 && mr->attr_index_type[e] != attr_type)
+		e=mr->attr_index_chain[e];
+	return e;
 }
 
 static char *
@@ -559,6 +1018,48 @@ binfile_extract(struct map_priv *m, char *dir, char *filename, int partial)
 	return g_strdup_printf("%s/%s",dir,filename);
 }
 
+/**
+ * @brief Fills in an attribute from the item data at t->pos_attr
+ *
+ * @param mr The map rect
+ * @param type The type of the attribute
+ * @param size The size of the attribute in ints, including its type
+ * @param attr The attribute to fill in
+ */
+static void
+binfile_attr_decode(struct map_rect_priv *mr, enum attr_type type, int size, struct attr *attr)
+{
+	struct tile *t=mr->t;
+
+	attr->type=type;
+	if (ATTR_IS_GROUP(type)) {
+		int i=0;
+		int *subpos=t->pos_attr+1;
+		int size_rem=size-1;
+		while (size_rem > 0 && i < 7) {
+			int subsize=le32_to_cpu(*subpos++);
+			int subtype=le32_to_cpu(subpos[0]);
+			mr->attrs[i].type=subtype;
+			attr_data_set_le(&mr->attrs[i], subpos+1);
+			subpos+=subsize;
+			size_rem-=subsize+1;
+			i++;
+		}
+		mr->attrs[i].type=type_none;
+		mr->attrs[i].u.data=NULL;
+		attr->u.attrs=mr->attrs;
+	} else {
+		attr_data_set_le(attr, t->pos_attr+1);
+		if (type == attr_url_local) {
+			g_free(mr->url);
+			mr->url=binfile_extract(mr->m, mr->m->cachedir, attr->u.str, 1);
+			attr->u.str=mr->url;
+		}
+		if (type == attr_flags && mr->m->map_version < 1)
+			attr->u.num |= AF_CAR;
+	}
+}
+
 static int
 binfile_attr_get(void *priv_data, enum attr_type attr_type, struct attr *attr)
 {
@@ -570,54 +1071,39 @@ binfile_attr_get(void *priv_data, enum attr_type attr_type, struct attr *attr)
 	if (attr_type != mr->attr_last) {
 		t->pos_attr=t->pos_attr_start;
 		mr->attr_last=attr_type;
+		mr->attr_index_next=-1;
+	}
+	if (mr->attr_index_count == -1)
+		binfile_attr_index(mr);
+	if (mr->attr_index_count >= 0) {
+		int e=-1;
+		if (mr->attr_index_next != -2)
+			e=binfile_attr_index_find(mr, attr_type, mr->attr_index_next);
+		if (e != -1) {
+			int *pos=mr->attr_index[e];
+			type=mr->attr_index_type[e];
+			mr->attr_index_next=attr_type == attr_any ? e+1 : mr->attr_index_chain[e];
+			if (mr->attr_index_next == -1 || mr->attr_index_next == mr->attr_index_count)
+				mr->attr_index_next=-2;
+			size=le32_to_cpu(pos[0]);
+			t->pos_attr=pos+1;
+			if (attr_type == attr_any)
+				dbg(lvl_debug,"pos %p attr %s size %d\n", pos, attr_to_name(type), size);
+			binfile_attr_decode(mr, type, size, attr);
+			t->pos_attr+=size;
+			return 1;
+		}
+		mr->attr_index_next=-2;
+		t->pos_attr=t->pos_next;
 	}
 	while (t->pos_attr < t->pos_next) {
 		size=le32_to_cpu(*(t->pos_attr++));
 		type=le32_to_cpu(t->pos_attr[0]);
-		if (type == attr_label)
-			mr->label=1;
-		if (type == attr_house_number)
-			mr->label_attr[0]=t->pos_attr;
-		if (type == attr_street_name)
-			mr->label_attr[1]=t->pos_attr;
-		if (type == attr_street_name_systematic)
-			mr->label_attr[2]=t->pos_attr;
-		if (type == attr_district_name && mr->item.type < type_line)
-			mr->label_attr[3]=t->pos_attr;
-		if (type == attr_town_name && mr->item.type < type_line)
-			mr->label_attr[4]=t->pos_attr;
+		binfile_attr_label(mr, type, t->pos_attr);
 		if (type == attr_type || attr_type == attr_any) {
-			if (attr_type == attr_any) {
+			if (attr_type == attr_any)
 				dbg(lvl_debug,"pos %p attr %s size %d\n", t->pos_attr-1, attr_to_name(type), size);
-			}
-			attr->type=type;
-			if (ATTR_IS_GROUP(type)) {
-				int i=0;
-				int *subpos=t->pos_attr+1;
-				int size_rem=size-1;
-				i=0;
-				while (size_rem > 0 && i < 7) {
-					int subsize=le32_to_cpu(*subpos++);
-					int subtype=le32_to_cpu(subpos[0]);
-					mr->attrs[i].type=subtype;
-					attr_data_set_le(&mr->attrs[i], subpos+1);
-					subpos+=subsize;
-					size_rem-=subsize+1;
-					i++;
-				}
-				mr->attrs[i].type=type_none;
-				mr->attrs[i].u.data=NULL;
-				attr->u.attrs=mr->attrs;
-			} else {
-				attr_data_set_le(attr, t->pos_attr+1);
-				if (type == attr_url_local) {
-					g_free(mr->url);
-					mr->url=binfile_extract(mr->m, mr->m->cachedir, attr->u.str, 1);
-					attr->u.str=mr->url;
-				}
-				if (type == attr_flags && mr->m->map_version < 1)
-					attr->u.num |= AF_CAR;
-			}
+			binfile_attr_decode(mr, type, size, attr);
 			t->pos_attr+=size;
 			return 1;
 		} else {
@@ -658,24 +1144,69 @@ binfile_hash_entry_equal(gconstpointer a, gconstpointer b)
 }
 
 static int *
-binfile_item_dup(struct map_priv *m, struct item *item, struct tile *t, int extend)
+binfile_item_new(struct map_priv *m, struct item *item, int size)
 {
-	int size=le32_to_cpu(t->pos[0]);
-	struct binfile_hash_entry *entry=g_malloc(sizeof(struct binfile_hash_entry)+(size+1+extend)*sizeof(int));
-	void *ret=entry->data;
+	struct binfile_hash_entry *entry=g_malloc(sizeof(struct binfile_hash_entry)+size*sizeof(int));
 	entry->id.id_hi=item->id_hi;
 	entry->id.id_lo=item->id_lo;
 	entry->flags=1;
 	dbg(lvl_debug,"id 0x%x,0x%x\n",entry->id.id_hi,entry->id.id_lo);
-
-	memcpy(ret, t->pos, (size+1)*sizeof(int));
 	if (!m->changes)
 		m->changes=g_hash_table_new_full(binfile_hash_entry_hash, binfile_hash_entry_equal, g_free, NULL);
 	g_hash_table_replace(m->changes, entry, entry);
+	return entry->data;
+}
+
+static int *
+binfile_item_dup(struct map_priv *m, struct item *item, struct tile *t, int extend)
+{
+	int size=le32_to_cpu(t->pos[0]);
+	int *ret;
+
+	ret=binfile_item_new(m, item, size+1+extend);
+	memcpy(ret, t->pos, (size+1)*sizeof(int));
 	dbg(lvl_debug,"ret %p\n",ret);
 	return ret;
 }
 
+/**
+ * @brief Replaces the current item by a copy with plain coordinates
+ *
+ * binfile_coord_set() can only change plain coordinates, so an item with varint coordinates is
+ * decoded into a modified item first. The current coordinate and attribute are kept.
+ *
+ * @param mr The map rect, its current item has varint coordinates
+ */
+static void
+binfile_coord_expand(struct map_rect_priv *mr)
+{
+	struct tile *t=mr->t,new;
+	int left=t->varint_left;
+	int aoffset=t->pos_attr-t->pos_attr_start;
+	int asize=t->pos_next-t->pos_attr_start;
+	int count,done,i,*data;
+
+	binfile_coord_rewind(mr);
+	count=t->varint_left;
+	done=count-left;
+	data=binfile_item_new(mr->m, &mr->item, 3+count*2+asize);
+	data[0]=cpu_to_le32(2+count*2+asize);
+	data[1]=t->pos[1];
+	data[2]=cpu_to_le32(count*2);
+	binfile_coord_get(mr, (struct coord *)(data+3), count);
+	for (i = 3 ; i < 3+count*2 ; i++)
+		data[i]=cpu_to_le32(data[i]);
+	memcpy(data+3+count*2, t->pos_attr_start, asize*sizeof(int));
+	new.pos=new.start=data;
+	new.end=data+3+count*2+asize;
+	new.zipfile_num=t->zipfile_num;
+	new.mode=2;
+	push_tile(mr, &new, 0, 0);
+	setup_pos(mr);
+	mr->t->pos_coord=mr->t->pos_coord_start+done*2;
+	mr->t->pos_attr=mr->t->pos_attr_start+aoffset;
+}
+
 static int
 binfile_coord_set(void *priv_data, struct coord *c, int count, enum change_mode mode)
 {
@@ -685,6 +1216,11 @@ binfile_coord_set(void *priv_data, struct coord *c, int count, enum change_mode
 	int write_offset,move_offset,aoffset,coffset,clen;
 	int *data;
 
+	mr->attr_index_count=-1;
+	if (t->coord_varint) {
+		binfile_coord_expand(mr);
+		t=mr->t;
+	}
 	{
 		int *i=t->pos,j=0;
 		dbg(lvl_debug,"Before: pos_coord=%td\n",t->pos_coord-i);
@@ -781,6 +1317,7 @@ binfile_attr_set(void *priv_data, struct attr *attr, enum change_mode mode)
 	int nattr_size,nattr_len,pad;
 	int *data;
 
+	mr->attr_index_count=-1;
 	{
 		int *i=t->pos,j=0;
 		dbg(lvl_debug,"Before: pos_attr=%td\n",t->pos_attr-i);
@@ -847,6 +1384,8 @@ binfile_attr_set(void *priv_data, struct attr *attr, enum change_mode mode)
 	setup_pos(mr);
 	tn=mr->t;
 	tn->pos_coord=tn->pos_coord_start+coffset;
+	if (tn->coord_varint)
+		tn->pos_varint=(unsigned char *)tn->pos_coord_start+(t->pos_varint-(unsigned char *)t->pos_coord_start);
 	tn->pos_attr=tn->pos_attr_start+offset;
 	dbg(lvl_debug,"attr start %td offset %d\n",tn->pos_attr_start-data,offset);
 	dbg(lvl_debug,"moving %d ints from offset %td to %td\n",move_len,tn->pos_attr_start+move_offset-data,tn->pos_attr_start+move_offset+delta-data);
@@ -888,6 +1427,77 @@ static struct item_methods methods_binfile = {
         binfile_coord_set,
 };
 
+/**
+ * @brief Looks for the bounding box index at the end of a tile
+ *
+ * maptool -I appends an item of type_tile_index to each tile holding, for each group of items,
+ * the offset of its first item and the bounding box of the group. The last int of the item is
+ * its size, so it is found without walking the items of the tile. If present, the item is hidden
+ * from the tile and its data is used by binfile_tile_index_skip().
+ *
+ * @param t The tile
+ */
+static void
+binfile_tile_index_find(struct tile *t)
+{
+	int *last,*attr;
+	int size;
+
+	if (t->end-t->start < 6)
+		return;
+	size=le32_to_cpu(t->end[-1]);
+	if (size < 6 || size > t->end-t->start)
+		return;
+	last=t->end-size;
+	if (le32_to_cpu(last[0])+1 != size || le32_to_cpu(last[1]) != type_tile_index || le32_to_cpu(last[2]) != 0)
+		return;
+	attr=last+3;
+	if (le32_to_cpu(attr[1]) != attr_tile_index || attr+le32_to_cpu(attr[0])+1 != t->end)
+		return;
+	t->index=t->index_next=attr+2;
+	t->index_end=t->index+(le32_to_cpu(attr[0])-1)/5*5;
+	t->end=last;
+}
+
+/**
+ * @brief Skips a group of items not overlapping the selection of a map rect
+ *
+ * Only decides at the first item of a group, so items reached in other ways (e.g. by id) are
+ * never skipped.
+ *
+ * @param mr The map rect, its current tile must have an index
+ * @return 1 if t->pos_next was advanced past the group, 0 if the item at t->pos is to be returned
+ */
+static int
+binfile_tile_index_skip(struct map_rect_priv *mr)
+{
+	struct tile *t=mr->t;
+	struct map_selection *sel;
+	struct coord_rect r;
+	int offset=t->pos-t->start;
+	int *entry;
+
+	while (t->index_next < t->index_end && le32_to_cpu(t->index_next[0]) < offset)
+		t->index_next+=5;
+	entry=t->index_next;
+	if (entry >= t->index_end || le32_to_cpu(entry[0]) != offset)
+		return 0;
+	t->index_next+=5;
+	r.lu.x=le32_to_cpu(entry[1]);
+	r.rl.y=le32_to_cpu(entry[2]);
+	r.rl.x=le32_to_cpu(entry[3]);
+	r.lu.y=le32_to_cpu(entry[4]);
+	for (sel = mr->sel ; sel ; sel = sel->next) {
+		if (coord_rect_overlap(&sel->u.c_rect, &r))
+			return 0;
+	}
+	if (t->index_next < t->index_end)
+		t->pos_next=t->start+le32_to_cpu(t->index_next[0]);
+	else
+		t->pos_next=t->end;
+	return 1;
+}
+
 static void
 push_tile(struct map_rect_priv *mr, struct tile *t, int offset, int length)
 {
@@ -899,6 +1509,9 @@ push_tile(struct map_rect_priv *mr, struct tile *t, int offset, int length)
 		length=le32_to_cpu(mr->t->pos[0])+1;
 	if (length > 0)
 		mr->t->end=mr->t->pos+length;
+	mr->t->index=NULL;
+	if (!offset && !length && mr->t->mode < 2 && mr->m->tile_index)
+		binfile_tile_index_find(mr->t);
 }
 
 static int
@@ -907,7 +1520,7 @@ pop_tile(struct map_rect_priv *mr)
 	if (mr->tile_depth <= 1)
 		return 0;
 	if (mr->t->mode < 2)
-		file_data_free(mr->m->fi, (unsigned char *)(mr->t->start));
+		file_data_free(mr->t->fi, (unsigned char *)(mr->t->start));
 #ifdef DEBUG_SIZE
 #if DEBUG_SIZE > 0
 	dbg(lvl_debug,"leave %d\n",mr->t->zipfile_num);
@@ -918,6 +1531,274 @@ pop_tile(struct map_rect_priv *mr)
 }
 
 
+/**
+ * @brief Header of a tile cache file
+ *
+ * The header is followed by one struct tile_cache_entry per zip member and the tile data.
+ * It holds the size and modification time of the map, so a cache of another map or of an
+ * older version of the map is recreated.
+ */
+struct tile_cache_header {
+	char magic[8];
+	int zip_members;
+	int reserved;
+	long long map_size;
+	long long map_mtime;
+};
+
+struct tile_cache_entry {
+	long long offset;	/**< Offset of the tile data in the tile cache file */
+	int size;		/**< Size of the tile data, 0 if the tile is not cached */
+	int reserved;
+};
+
+/**
+ * @brief Tiles of a compressed map kept decompressed in a file
+ *
+ * The file is mapped into memory when the map is opened, so the tiles written in former sessions
+ * are used without reading or decompressing them. Tiles decompressed in this session are appended
+ * to the file, but only used from the next session on.
+ *
+ * All instances of a map (see map_clone() and the prefetch thread) share one tile cache, so only one
+ * of them appends to the file at a time.
+ */
+struct tile_cache {
+	char *name;				/**< Name of the file */
+	int refcount;				/**< Number of maps using the tile cache */
+	struct tile_cache_header header;	/**< Header of the file, identifies the map the tiles belong to */
+	struct file *fi;
+	struct tile_cache_entry *entries;	/**< Copy of the table of the file */
+	long long end;				/**< Offset to append the next tile at */
+	int failed;				/**< Writing to the file failed, don't try again */
+#ifdef HAVE_PTHREAD
+	pthread_mutex_t mutex;			/**< The tiles may be read by several threads */
+#endif
+};
+
+/* The open tile caches, see binfile_tile_cache_open() */
+static GList *tile_caches;
+#ifdef HAVE_PTHREAD
+static pthread_mutex_t tile_caches_mutex=PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+static void
+binfile_tile_cache_lock(struct tile_cache *tc)
+{
+#ifdef HAVE_PTHREAD
+	pthread_mutex_lock(&tc->mutex);
+#endif
+}
+
+static void
+binfile_tile_cache_unlock(struct tile_cache *tc)
+{
+#ifdef HAVE_PTHREAD
+	pthread_mutex_unlock(&tc->mutex);
+#endif
+}
+
+static void
+binfile_tile_caches_lock(void)
+{
+#ifdef HAVE_PTHREAD
+	pthread_mutex_lock(&tile_caches_mutex);
+#endif
+}
+
+static void
+binfile_tile_caches_unlock(void)
+{
+#ifdef HAVE_PTHREAD
+	pthread_mutex_unlock(&tile_caches_mutex);
+#endif
+}
+
+/**
+ * @brief Opens the tile cache file of a map, creating it if it is missing or outdated
+ *
+ * If another instance of the map has the file open already, its tile cache is shared. If that instance
+ * belongs to another version of the map, the map is used without a tile cache.
+ *
+ * @param m The map, with m->tile_cache_name set
+ */
+static void
+binfile_tile_cache_open(struct map_priv *m)
+{
+	struct attr readwrite={attr_readwrite,{(void *)1}};
+	struct attr create={attr_create,{(void *)1}};
+	struct attr cache={attr_cache,{(void *)0}};
+	struct attr *attrs[]={&readwrite, &cache, NULL, NULL};
+	struct tile_cache_header header,*h;
+	struct tile_cache *tc;
+	struct file *fi;
+	unsigned char *table;
+	int table_size=m->zip_members*sizeof(struct tile_cache_entry);
+	int valid=0;
+	GList *l;
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, "navtiles", sizeof(header.magic));
+	header.zip_members=m->zip_members;
+	header.map_size=m->fi->size;
+#ifndef __CEGCC__
+	file_version(m->fi, 0);
+	header.map_mtime=m->fi->mtime;
+#endif
+	binfile_tile_caches_lock();
+	for (l = tile_caches ; l ; l = g_list_next(l)) {
+		tc=l->data;
+		if (strcmp(tc->name, m->tile_cache_name))
+			continue;
+		if (memcmp(&tc->header, &header, sizeof(header))) {
+			dbg(lvl_warning,"Tile cache '%s' is in use for another version of the map, not using it\n", m->tile_cache_name);
+		} else {
+			tc->refcount++;
+			m->tile_cache=tc;
+		}
+		binfile_tile_caches_unlock();
+		return;
+	}
+	fi=file_create(m->tile_cache_name, attrs);
+	if (fi && fi->size >= sizeof(header)+table_size) {
+		h=(struct tile_cache_header *)file_data_read(fi, 0, sizeof(header));
+		valid=h && !memcmp(h, &header, sizeof(header));
+		file_data_free(fi, (unsigned char *)h);
+	}
+	if (!valid) {
+		if (fi)
+			file_destroy(fi);
+		attrs[2]=&create;
+		fi=file_create(m->tile_cache_name, attrs);
+		if (!fi) {
+			dbg(lvl_error,"Failed to create tile cache '%s'\n", m->tile_cache_name);
+			binfile_tile_caches_unlock();
+			return;
+		}
+		table=g_malloc0(table_size);
+		if (!file_data_write(fi, 0, sizeof(header), &header) || !file_data_write(fi, sizeof(header), table_size, table)) {
+			dbg(lvl_error,"Failed to write tile cache '%s'\n", m->tile_cache_name);
+			g_free(table);
+			file_destroy(fi);
+			binfile_tile_caches_unlock();
+			return;
+		}
+		g_free(table);
+		dbg(lvl_debug,"created tile cache %s for %d tiles\n", m->tile_cache_name, m->zip_members);
+	}
+	table=file_data_read(fi, sizeof(header), table_size);
+	if (!table || !file_mmap(fi)) {
+		file_data_free(fi, table);
+		file_destroy(fi);
+		binfile_tile_caches_unlock();
+		return;
+	}
+	tc=g_new0(struct tile_cache, 1);
+	tc->name=g_strdup(m->tile_cache_name);
+	tc->refcount=1;
+	tc->header=header;
+	tc->fi=fi;
+	tc->entries=g_malloc(table_size);
+	memcpy(tc->entries, table, table_size);
+	file_data_free(fi, table);
+	tc->end=(fi->size+7)&~7;
+#ifdef HAVE_PTHREAD
+	pthread_mutex_init(&tc->mutex, NULL);
+#endif
+	tile_caches=g_list_prepend(tile_caches, tc);
+	binfile_tile_caches_unlock();
+	m->tile_cache=tc;
+}
+
+/**
+ * @brief Releases the tile cache of a map, closing the file once no instance of the map uses it
+ *
+ * @param m The map
+ */
+static void
+binfile_tile_cache_close(struct map_priv *m)
+{
+	struct tile_cache *tc=m->tile_cache;
+	if (!tc)
+		return;
+	m->tile_cache=NULL;
+	binfile_tile_caches_lock();
+	if (--tc->refcount) {
+		binfile_tile_caches_unlock();
+		return;
+	}
+	tile_caches=g_list_remove(tile_caches, tc);
+	binfile_tile_caches_unlock();
+	file_destroy(tc->fi);
+	g_free(tc->entries);
+#ifdef HAVE_PTHREAD
+	pthread_mutex_destroy(&tc->mutex);
+#endif
+	g_free(tc->name);
+	g_free(tc);
+}
+
+/**
+ * @brief Gets a tile from the tile cache
+ *
+ * @param m The map
+ * @param t The tile to fill in, with t->zipfile_num set
+ * @return 1 if the tile is in the mapped part of the tile cache, 0 otherwise
+ */
+static int
+binfile_tile_cache_get(struct map_priv *m, struct tile *t)
+{
+	struct tile_cache *tc=m->tile_cache;
+	struct tile_cache_entry *e;
+	int ret=0;
+
+	if (!tc || t->zipfile_num < 0 || t->zipfile_num >= m->zip_members)
+		return 0;
+	binfile_tile_cache_lock(tc);
+	e=&tc->entries[t->zipfile_num];
+	if (e->size && e->offset+e->size <= tc->fi->end-tc->fi->begin) {
+		t->start=(int *)(tc->fi->begin+e->offset);
+		t->end=t->start+e->size/4;
+		t->fi=tc->fi;
+		t->mode=1;
+		ret=1;
+	}
+	binfile_tile_cache_unlock(tc);
+	return ret;
+}
+
+/**
+ * @brief Appends a decompressed tile to the tile cache
+ *
+ * @param m The map
+ * @param zipfile The zip member of the tile
+ * @param data The tile data
+ * @param size The size of the tile data
+ */
+static void
+binfile_tile_cache_add(struct map_priv *m, int zipfile, unsigned char *data, int size)
+{
+	struct tile_cache *tc=m->tile_cache;
+	struct tile_cache_entry *e;
+
+	if (!tc || !data || !size || zipfile < 0 || zipfile >= m->zip_members)
+		return;
+	binfile_tile_cache_lock(tc);
+	e=&tc->entries[zipfile];
+	if (!e->size && !tc->failed) {
+		if (file_data_write(tc->fi, tc->end, size, data)) {
+			e->offset=tc->end;
+			e->size=size;
+			tc->end=(tc->end+size+7)&~7;
+			if (!file_data_write(tc->fi, sizeof(struct tile_cache_header)+zipfile*sizeof(*e), sizeof(*e), e))
+				tc->failed=1;
+		} else
+			tc->failed=1;
+		if (tc->failed)
+			dbg(lvl_error,"Failed to write tile cache '%s', not adding more tiles\n", tc->fi->name);
+	}
+	binfile_tile_cache_unlock(tc);
+}
+
 static int
 zipfile_to_tile(struct map_priv *m, struct zip_cd *cd, struct tile *t)
 {
@@ -940,6 +1821,8 @@ zipfile_to_tile(struct map_priv *m, struct zip_cd *cd, struct tile *t)
 	t->start=(int *)binfile_read_content(m, fi, binfile_cd_offset(cd), lfh);
 	t->end=t->start+lfh->zipuncmp/4;
 	t->fi=fi;
+	if (lfh->zipmthd == 8 || lfh->zipmthd == 93)
+		binfile_tile_cache_add(m, t->zipfile_num, (unsigned char *)t->start, lfh->zipuncmp);
 	file_data_free(fi, (unsigned char *)zipfn);
 	file_data_free(fi, (unsigned char *)lfh);
 	return t->start != NULL;
@@ -1289,8 +2172,211 @@ download_initial_finish(struct map_download *download)
 	return 1;
 }
 
+/**
+ * @brief Sets up a request to read a tile
+ *
+ * @param m The map
+ * @param zipfile The zip member of the tile
+ * @param req The request to fill in
+ * @return 1 if the tile can be read by file_data_read_batch(), 0 otherwise
+ */
+static int
+binfile_tile_request(struct map_priv *m, int zipfile, struct file_data_request *req)
+{
+	long long cdoffset=m->eoc64?m->eoc64->zip64eofst:m->eoc->zipeofst;
+	struct zip_cd *cd;
+	struct zip_lfh *lfh;
+	struct file *fi;
+	int ret=0;
+
+	cd=(struct zip_cd *)(file_data_read(m->fi, cdoffset + zipfile*m->cde_size, m->cde_size));
+	if (!cd)
+		return 0;
+	cd_to_cpu(cd);
+	if (cd->zipcunc) {
+		fi=m->fis ? m->fis[cd->zipdsk] : m->fi;
+		lfh=binfile_read_lfh(fi, binfile_cd_offset(cd));
+		if (lfh && (lfh->zipmthd == 0 || lfh->zipmthd == 8 || lfh->zipmthd == 93)) {
+			req->file=fi;
+			req->offset=binfile_cd_offset(cd)+sizeof(struct zip_lfh)+lfh->zipfnln+lfh->zipxtraln;
+			req->size=lfh->zipmthd ? lfh->zipsize : lfh->zipuncmp;
+			req->size_uncomp=lfh->zipuncmp;
+			req->method=lfh->zipmthd;
+			req->data=NULL;
+			ret=1;
+		}
+		if (lfh)
+			file_data_free(fi, (unsigned char *)lfh);
+	}
+	file_data_free(m->fi, (unsigned char *)cd);
+	return ret;
+}
+
+/**
+ * @brief Waits for the tiles being read by a map rect
+ *
+ * The tiles read are added to the tile cache and kept in mr->tile_data until
+ * push_zipfile_tile_do() enters them.
+ *
+ * @param mr The map rect
+ * @return The zip member to be entered next, or -1
+ */
+static int
+binfile_read_finish(struct map_rect_priv *mr)
+{
+	struct binfile_read *r=mr->read;
+	int i,enter;
+
+	if (!r)
+		return -1;
+	file_data_read_async_wait(r->batch);
+	for (i = r->count-1 ; i >= 0 ; i--) {
+		struct tile_data *td;
+		if (!r->req[i].data)
+			continue;
+		if (r->req[i].method)
+			binfile_tile_cache_add(mr->m, r->zipfiles[i], r->req[i].data, r->req[i].size_uncomp);
+		td=g_new(struct tile_data, 1);
+		td->zipfile_num=r->zipfiles[i];
+		td->fi=r->req[i].file;
+		td->data=r->req[i].data;
+		td->size=r->req[i].size_uncomp;
+		td->next=mr->tile_data;
+		mr->tile_data=td;
+	}
+	/* A tile which failed to be read is skipped like push_zipfile_tile_do() would do */
+	enter=r->req[0].data ? r->enter : -1;
+	g_free(r);
+	mr->read=NULL;
+	return enter;
+}
+
+/**
+ * @brief Reads the submaps of the current tile which lie within the selection
+ *
+ * The submaps are read and inflated together by file_data_read_batch(), so that
+ * the tiles a map rect is going to enter next are decompressed concurrently. They are
+ * kept in mr->tile_data until push_zipfile_tile_do() enters them. If async is set, they are
+ * read in the background and map_rect_get_item_binfile() returns busy_item until they are done.
+ *
+ * @param mr The map rect, with the tile just pushed on top
+ * @param async 1 if the tiles may be read in the background
+ */
+static void
+binfile_read_batch(struct map_rect_priv *mr, int async)
+{
+	struct map_priv *m=mr->m;
+	struct tile *t=mr->t;
+	struct binfile_read *r=g_new0(struct binfile_read, 1);
+	struct tile cached;
+	int zipfile;
+
+	for (t->pos_next=t->start ; t->pos_next < t->end && r->count < BINFILE_BATCH_MAX ; ) {
+		t->pos=t->pos_next;
+		setup_pos(mr);
+		binfile_coord_rewind(mr);
+		binfile_attr_rewind(mr);
+		if (mr->item.type != type_submap || !map_submap_zipfile(mr, &zipfile))
+			continue;
+		/* Tiles in the tile cache don't need to be read */
+		cached.zipfile_num=zipfile;
+		if (binfile_tile_cache_get(m, &cached))
+			continue;
+		if (binfile_tile_request(m, zipfile, &r->req[r->count]))
+			r->zipfiles[r->count++]=zipfile;
+	}
+	t->pos=t->pos_next=t->start;
+	if (r->count < 2) {
+		g_free(r);
+		return;
+	}
+	dbg(lvl_debug,"reading %d tiles below %d\n", r->count, t->zipfile_num);
+	r->enter=-1;
+	mr->read=r;
+	if (async)
+		r->batch=file_data_read_async(r->req, r->count);
+	else
+		file_data_read_batch(r->req, r->count);
+	if (!r->batch)
+		binfile_read_finish(mr);
+}
+
+/**
+ * @brief Starts reading a tile in the background before entering it
+ *
+ * @param mr The map rect
+ * @param zipfile The zip member of the tile
+ * @return 1 if the tile is being read, 0 if it can be entered right away
+ */
+static int
+binfile_read_submit(struct map_rect_priv *mr, int zipfile)
+{
+	struct tile_data *td;
+	struct tile cached;
+	struct binfile_read *r;
+
+	for (td = mr->tile_data ; td ; td=td->next)
+		if (td->zipfile_num == zipfile)
+			return 0;
+	cached.zipfile_num=zipfile;
+	if (binfile_tile_cache_get(mr->m, &cached))
+		return 0;
+	r=g_new0(struct binfile_read, 1);
+	if (!binfile_tile_request(mr->m, zipfile, &r->req[0])) {
+		g_free(r);
+		return 0;
+	}
+	r->zipfiles[0]=zipfile;
+	r->count=1;
+	r->enter=zipfile;
+	mr->read=r;
+	r->batch=file_data_read_async(r->req, r->count);
+	if (!r->batch) {
+		binfile_read_finish(mr);
+		return 0;
+	}
+	return 1;
+}
+
+/**
+ * @brief Takes a tile from the ones read by binfile_read_batch()
+ *
+ * @param mr The map rect
+ * @param t The tile to fill in, with t->zipfile_num set
+ * @return 1 if the tile was read ahead, 0 otherwise
+ */
+static int
+binfile_tile_data_take(struct map_rect_priv *mr, struct tile *t)
+{
+	struct tile_data **tdp=&mr->tile_data, *td;
+	while ((td=*tdp)) {
+		if (td->zipfile_num == t->zipfile_num) {
+			*tdp=td->next;
+			t->start=(int *)td->data;
+			t->end=t->start+td->size/4;
+			t->fi=td->fi;
+			t->mode=1;
+			g_free(td);
+			return 1;
+		}
+		tdp=&td->next;
+	}
+	return 0;
+}
+
+static void
+binfile_tile_data_free(struct map_rect_priv *mr)
+{
+	struct tile_data *td;
+	while ((td=mr->tile_data)) {
+		mr->tile_data=td->next;
+		file_data_free(td->fi, td->data);
+		g_free(td);
+	}
+}
+
 static void
-push_zipfile_tile_do(struct map_rect_priv *mr, struct zip_cd *cd, int zipfile, int offset, int length)
+push_zipfile_tile_do(struct map_rect_priv *mr, struct zip_cd *cd, int zipfile, int offset, int length, int async)
 
 {
 	struct tile t;
@@ -1310,8 +2396,11 @@ push_zipfile_tile_do(struct map_rect_priv *mr, struct zip_cd *cd, int zipfile, i
 	mr->size+=cd->zipcunc;
 #endif
 	t.zipfile_num=zipfile;
-	if (zipfile_to_tile(m, cd, &t))
+	if (binfile_tile_data_take(mr, &t) || binfile_tile_cache_get(m, &t) || zipfile_to_tile(m, cd, &t)) {
 		push_tile(mr, &t, offset, length);
+		if (!offset && !length && mr->sel && !mr->country_id && m->eoc)
+			binfile_read_batch(mr, async == 1 && mr->async_read);
+	}
 	file_data_free(f, (unsigned char *)cd);
 }
 
@@ -1387,7 +2476,7 @@ download(struct map_priv *m, struct map_rect_priv *mr, struct zip_cd *cd, int zi
 				m->progress=g_strdup_printf("Download Tile %d 100%%",download->zipfile);
 				callback_list_call_attr_0(m->cbl, attr_progress);
 				if (async) {
-					push_zipfile_tile_do(download->mr, download->cd, download->zipfile, download->toffset, download->tlength);
+					push_zipfile_tile_do(download->mr, download->cd, download->zipfile, download->toffset, download->tlength, async);
 					ret=NULL;
 				} else
 					ret=download->cd;
@@ -1461,7 +2550,10 @@ push_zipfile_tile(struct map_rect_priv *mr, int zipfile, int offset, int length,
         struct map_priv *m=mr->m;
 	struct file *f=m->fi;
 	long long cdoffset=m->eoc64?m->eoc64->zip64eofst:m->eoc->zipeofst;
-	struct zip_cd *cd=(struct zip_cd *)(file_data_read(f, cdoffset + zipfile*m->cde_size, m->cde_size));
+	struct zip_cd *cd;
+	/* Tiles still being read are waited for, a tile waiting to be entered is not entered any more */
+	binfile_read_finish(mr);
+	cd=(struct zip_cd *)(file_data_read(f, cdoffset + zipfile*m->cde_size, m->cde_size));
 	dbg(lvl_debug,"read from "LONGLONG_FMT" %d bytes\n",cdoffset + zipfile*m->cde_size, m->cde_size);
 	cd_to_cpu(cd);
 	if (!cd->zipcunc && m->url) {
@@ -1469,7 +2561,11 @@ push_zipfile_tile(struct map_rect_priv *mr, int zipfile, int offset, int length,
 		if (!cd)
 			return 1;
 	}
-	push_zipfile_tile_do(mr, cd, zipfile, offset, length);
+	if (async == 1 && mr->async_read && !offset && !length && binfile_read_submit(mr, zipfile)) {
+		file_data_free(f, (unsigned char *)cd);
+		return 1;
+	}
+	push_zipfile_tile_do(mr, cd, zipfile, offset, length, async);
 	return 0;
 }
 
@@ -1490,6 +2586,7 @@ map_rect_new_binfile_int(struct map_priv *map, struct map_selection *sel)
 	mr->item.id_lo=0;
 	mr->item.meth=&methods_binfile;
 	mr->item.priv_data=mr;
+	mr->attr_index_count=-1;
 	return mr;
 }
 
@@ -1651,6 +2748,8 @@ map_rect_destroy_binfile(struct map_rect_priv *mr)
 {
 	write_changes(mr->m);
 	while (pop_tile(mr));
+	binfile_read_finish(mr);
+	binfile_tile_data_free(mr);
 #ifdef DEBUG_SIZE
 	dbg(lvl_debug,"size=%d kb\n",mr->size/1024);
 #endif
@@ -1677,6 +2776,8 @@ setup_pos(struct map_rect_priv *mr)
 	t->pos_next=t->pos+size+1;
 	mr->item.type=le32_to_cpu(t->pos[1]);
 	coord_size=le32_to_cpu(t->pos[2]);
+	t->coord_varint=(coord_size & BINFILE_COORD_VARINT) != 0;
+	coord_size&=~BINFILE_COORD_VARINT;
 	t->pos_coord_start=t->pos+3;
 	t->pos_attr_start=t->pos_coord_start+coord_size;
 }
@@ -1738,8 +2839,15 @@ map_parse_country_binfile(struct map_rect_priv *mr)
 	push_zipfile_tile(mr, at.u.num, 0, 0, 0);
 }
 
+/**
+ * @brief Checks whether the current submap item lies within the selection of a map rect
+ *
+ * @param mr The map rect, positioned on a submap item
+ * @param zipfile Set to the zipfile number of the submap
+ * @return 1 if the submap has to be entered, 0 otherwise
+ */
 static int
-map_parse_submap(struct map_rect_priv *mr, int async)
+map_submap_zipfile(struct map_rect_priv *mr, int *zipfile)
 {
 	struct coord_rect r;
 	struct coord c[2];
@@ -1763,8 +2871,18 @@ map_parse_submap(struct map_rect_priv *mr, int async)
 		return 0;
 	if (!binfile_attr_get(mr->item.priv_data, attr_zipfile_ref, &at))
 		return 0;
-	dbg(lvl_debug,"pushing zipfile %ld from %d\n", at.u.num, mr->t->zipfile_num);
-	return push_zipfile_tile(mr, at.u.num, 0, 0, async);
+	*zipfile=at.u.num;
+	return 1;
+}
+
+static int
+map_parse_submap(struct map_rect_priv *mr, int async)
+{
+	int zipfile;
+	if (!map_submap_zipfile(mr, &zipfile))
+		return 0;
+	dbg(lvl_debug,"pushing zipfile %d from %d\n", zipfile, mr->t->zipfile_num);
+	return push_zipfile_tile(mr, zipfile, 0, 0, async);
 }
 
 static int
@@ -1792,10 +2910,18 @@ map_rect_get_item_binfile(struct map_rect_priv *mr)
 {
 	struct tile *t;
 	struct map_priv *m=mr->m;
+	int zipfile;
 	if (m->download) {
 		download(m, NULL, NULL, 0, 0, 0, 2);
 		return &busy_item;
 	}
+	if (mr->read) {
+		if (!file_data_read_async_done(mr->read->batch))
+			return &busy_item;
+		zipfile=binfile_read_finish(mr);
+		if (zipfile != -1 && push_zipfile_tile(mr, zipfile, 0, 0, 1))
+			return &busy_item;
+	}
 	if (mr->status == 1) {
 		mr->status=0;
 		if (push_zipfile_tile(mr, m->zip_members-1, 0, 0, 1))
@@ -1811,6 +2937,8 @@ map_rect_get_item_binfile(struct map_rect_priv *mr)
 				continue;
 			return NULL;
 		}
+		if (t->index && mr->sel && !mr->sel_tiles_only && !mr->m->changes && binfile_tile_index_skip(mr))
+			continue;
 		setup_pos(mr);
 		binfile_coord_rewind(mr);
 		binfile_attr_rewind(mr);
@@ -1851,6 +2979,7 @@ map_rect_get_item_byid_binfile(struct map_rect_priv *mr, int id_hi, int id_lo)
 	}
 	t=mr->t;
 	t->pos=t->start+id_lo;
+	t->index=NULL;
 	mr->item.id_hi=id_hi;
 	mr->item.id_lo=id_lo;
 	if (mr->m->changes)
@@ -1892,6 +3021,36 @@ binmap_search_by_index(struct map_priv *map, struct item *item, struct map_rect_
 	return 0;
 }
 
+/**
+ * @brief Creates a map rect for callers which handle busy_item
+ *
+ * Unlike the ones created by map_rect_new_binfile(), these return busy_item while tiles are
+ * read in the background if the map has async_read set.
+ */
+static struct map_rect_priv *
+map_rect_new_binfile_async(struct map_priv *map, struct map_selection *sel)
+{
+	struct map_rect_priv *mr=map_rect_new_binfile(map, sel);
+	if (mr)
+		mr->async_read=map->async_read;
+	return mr;
+}
+
+/**
+ * @brief Creates a map rect for searching inside an area
+ *
+ * The search area is only an estimate, so the items of all tiles overlapping it are returned
+ * even if the tiles have a bounding box index.
+ */
+static struct map_rect_priv *
+binmap_search_rect_new(struct map_priv *map, struct map_selection *sel)
+{
+	struct map_rect_priv *mr=map_rect_new_binfile(map, sel);
+	if (mr)
+		mr->sel_tiles_only=1;
+	return mr;
+}
+
 static struct map_rect_priv *
 binmap_search_street_by_place(struct map_priv *map, struct item *town, struct coord *c, struct map_selection *sel, GList **boundaries)
 {
@@ -1930,7 +3089,7 @@ binmap_search_street_by_place(struct map_priv *map, struct item *town, struct co
 	}
 	map_rect_destroy_binfile(map_rec2);
 	if (found)
-		return map_rect_new_binfile(map, sel);
+		return binmap_search_rect_new(map, sel);
 	return NULL;
 }
 
@@ -1994,7 +3153,7 @@ binmap_search_street_by_estimate(struct map_priv *map, struct item *town, struct
 	sel->u.c_rect.lu.y = c->y+size;
 	sel->u.c_rect.rl.x = c->x+size;
 	sel->u.c_rect.rl.y = c->y-size;
-	return map_rect_new_binfile(map, sel);
+	return binmap_search_rect_new(map, sel);
 }
 
 static struct map_rect_priv *
@@ -2009,7 +3168,7 @@ binmap_search_housenumber_by_estimate(struct map_priv *map, struct coord *c, str
 	sel->range = item_range_all;
 	sel->order = 18;
 
-	return map_rect_new_binfile(map, sel);
+	return binmap_search_rect_new(map, sel);
 }
 
 
@@ -2431,7 +3590,7 @@ binmap_search_get_item(struct map_search_priv *map_search)
 				map_search->ms.u.c_rect.rl.x!=map_search->rect_new.rl.x || map_search->ms.u.c_rect.rl.y!=map_search->rect_new.rl.y) {
 					map_search->ms.u.c_rect=map_search->rect_new;
 					map_rect_destroy_binfile(map_search->mr);
-					map_search->mr=map_rect_new_binfile(map_search->map, &map_search->ms);
+					map_search->mr=binmap_search_rect_new(map_search->map, &map_search->ms);
 					dbg(lvl_debug,"Extended house number search region to %d x %d, restarting...\n",map_search->ms.u.c_rect.rl.x - map_search->ms.u.c_rect.lu.x, map_search->ms.u.c_rect.lu.y-map_search->ms.u.c_rect.rl.y);
 					continue;
 				}
@@ -2465,6 +3624,199 @@ binmap_search_destroy(struct map_search_priv *ms)
 	g_free(ms);
 }
 
+#ifdef HAVE_PTHREAD
+/**
+ * @brief Decompresses the tiles of the area a vehicle is heading to on a background thread
+ *
+ * The tiles end up in the file cache, where map rects on the map find them later on.
+ */
+struct map_prefetch {
+	struct map_priv *m;		/**< A second instance of the map with its own file handles, only used by the thread */
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	struct coord_rect rect;		/**< The area to prefetch next */
+	struct coord_rect done;		/**< The area prefetched last */
+	int pending;			/**< {@code rect} has been requested and not yet been started */
+	int have_done;			/**< {@code done} is valid */
+	int quit;
+	double dir;			/**< Last heading of the vehicle in degrees */
+	double speed;			/**< Last speed of the vehicle in km/h */
+};
+
+/* How far ahead of the vehicle tiles are prefetched, in seconds of driving */
+#define BINFILE_PREFETCH_AHEAD 30
+/* Distance in meters added around the predicted path */
+#define BINFILE_PREFETCH_MARGIN 500
+
+static int
+map_binfile_prefetch_pending(struct map_prefetch *p)
+{
+	int ret;
+	pthread_mutex_lock(&p->mutex);
+	ret=p->pending || p->quit;
+	pthread_mutex_unlock(&p->mutex);
+	return ret;
+}
+
+static void *
+map_binfile_prefetch_run(void *data)
+{
+	struct map_prefetch *p=data;
+	struct map_selection sel;
+	struct map_rect_priv *mr;
+	struct item *item=NULL;
+	int count;
+
+	pthread_mutex_lock(&p->mutex);
+	for (;;) {
+		while (!p->pending && !p->quit)
+			pthread_cond_wait(&p->cond, &p->mutex);
+		if (p->quit)
+			break;
+		sel.next=NULL;
+		sel.u.c_rect=p->rect;
+		sel.order=18;
+		sel.range.min=type_none;
+		sel.range.max=type_last;
+		p->pending=0;
+		pthread_mutex_unlock(&p->mutex);
+		dbg(lvl_debug,"prefetching 0x%x,0x%x-0x%x,0x%x\n", sel.u.c_rect.lu.x, sel.u.c_rect.lu.y, sel.u.c_rect.rl.x, sel.u.c_rect.rl.y);
+		count=0;
+		mr=map_rect_new_binfile(p->m, &sel);
+		while (mr && (item=map_rect_get_item_binfile(mr))) {
+			/* Give up on the area as soon as the vehicle has moved on */
+			if (!(++count & 1023) && map_binfile_prefetch_pending(p))
+				break;
+		}
+		if (mr)
+			map_rect_destroy_binfile(mr);
+		pthread_mutex_lock(&p->mutex);
+		if (!item) {
+			p->done=sel.u.c_rect;
+			p->have_done=1;
+			dbg(lvl_debug,"prefetched %d items\n", count);
+		}
+	}
+	pthread_mutex_unlock(&p->mutex);
+	return NULL;
+}
+
+/**
+ * @brief Starts the prefetch thread of a map
+ *
+ * @param m The map
+ * @return The prefetcher, or NULL if the map can not be prefetched
+ */
+static struct map_prefetch *
+map_binfile_prefetch_new(struct map_priv *m)
+{
+	struct map_prefetch *p;
+	struct map_priv *m2;
+
+	if (m->url || !m->fi || !m->eoc)
+		return NULL;
+	m2=g_new0(struct map_priv, 1);
+	m2->id=m->id;
+	m2->filename=g_strdup(m->filename);
+	m2->passwd=g_strdup(m->passwd);
+	m2->flags=m->flags;
+	m2->cache_size=m->cache_size;
+	m2->tile_cache_name=g_strdup(m->tile_cache_name);
+	if (!map_binfile_open(m2)) {
+		map_binfile_destroy(m2);
+		return NULL;
+	}
+	p=g_new0(struct map_prefetch, 1);
+	p->m=m2;
+	pthread_mutex_init(&p->mutex, NULL);
+	pthread_cond_init(&p->cond, NULL);
+	if (pthread_create(&p->thread, NULL, map_binfile_prefetch_run, p)) {
+		dbg(lvl_error,"failed to start prefetch thread\n");
+		pthread_mutex_destroy(&p->mutex);
+		pthread_cond_destroy(&p->cond);
+		map_destroy_binfile(m2);
+		g_free(p);
+		return NULL;
+	}
+	return p;
+}
+
+static void
+map_binfile_prefetch_destroy(struct map_prefetch *p)
+{
+	if (!p)
+		return;
+	pthread_mutex_lock(&p->mutex);
+	p->quit=1;
+	pthread_cond_signal(&p->cond);
+	pthread_mutex_unlock(&p->mutex);
+	pthread_join(p->thread, NULL);
+	pthread_mutex_destroy(&p->mutex);
+	pthread_cond_destroy(&p->cond);
+	map_destroy_binfile(p->m);
+	g_free(p);
+}
+
+/**
+ * @brief Requests the tiles the vehicle is going to need next
+ *
+ * The area covers the path the vehicle takes within the next BINFILE_PREFETCH_AHEAD seconds if it keeps
+ * its heading and speed, widened by a margin which grows with the speed. Nothing is requested while
+ * the area lies within the one prefetched last.
+ *
+ * @param m The map
+ * @param g The position of the vehicle
+ */
+static void
+map_binfile_prefetch(struct map_priv *m, struct coord_geo *g)
+{
+	struct map_prefetch *p=m->prefetch;
+	struct coord c,ahead;
+	struct coord_rect r;
+	double scale,dist,margin;
+
+	transform_from_geo(projection_mg, g, &c);
+	scale=transform_scale(c.y);
+	dist=p->speed/3.6*BINFILE_PREFETCH_AHEAD;
+	margin=(BINFILE_PREFETCH_MARGIN+dist/4)*scale;
+	ahead.x=c.x+sin(p->dir*M_PI/180)*dist*scale;
+	ahead.y=c.y+cos(p->dir*M_PI/180)*dist*scale;
+	r.lu.x=MIN(c.x,ahead.x)-margin;
+	r.lu.y=MAX(c.y,ahead.y)+margin;
+	r.rl.x=MAX(c.x,ahead.x)+margin;
+	r.rl.y=MIN(c.y,ahead.y)-margin;
+	pthread_mutex_lock(&p->mutex);
+	if (!p->have_done || !coord_rect_contains(&p->done, &r.lu) || !coord_rect_contains(&p->done, &r.rl)) {
+		p->rect=r;
+		p->pending=1;
+		pthread_cond_signal(&p->cond);
+	}
+	pthread_mutex_unlock(&p->mutex);
+}
+#endif
+
+/**
+ * @brief Reads the tiles ahead of a vehicle on a thread, see map_prefetch()
+ *
+ * The thread is started on the first call.
+ */
+static void
+binmap_prefetch(struct map_priv *map, struct coord_geo *pos, double dir, double speed)
+{
+#ifdef HAVE_PTHREAD
+	if (!map->prefetch && !map->prefetch_failed) {
+		map->prefetch=map_binfile_prefetch_new(map);
+		map->prefetch_failed=!map->prefetch;
+	}
+	if (!map->prefetch)
+		return;
+	map->prefetch->dir=dir;
+	map->prefetch->speed=speed;
+	map_binfile_prefetch(map, pos);
+#endif
+}
+
 static int
 binmap_get_attr(struct map_priv *m, enum attr_type type, struct attr *attr)
 {
@@ -2514,6 +3866,8 @@ static struct map_methods map_methods_binfile = {
 	NULL,
 	binmap_get_attr,
 	binmap_set_attr,
+	map_rect_new_binfile_async,
+	binmap_prefetch,
 };
 
 static int
@@ -2693,6 +4047,7 @@ map_binfile_open(struct map_priv *m)
 	struct attr *attrs[]={&readwrite, NULL};
 
 	dbg(lvl_debug,"file_create %s\n", m->filename);
+	profile(1, NULL);
 	m->fi=file_create(m->filename, m->url?attrs:NULL);
 	if (! m->fi && m->url)
 		return 0;
@@ -2702,6 +4057,8 @@ map_binfile_open(struct map_priv *m)
 	}
 	if (m->check_version)
 		m->version=file_version(m->fi, m->check_version);
+	if (m->cache_size)
+		file_set_cache_budget(m->fi, m->cache_size);
 	magic=(int *)file_data_read(m->fi, 0, 4);
 	if (!magic) {
 		file_destroy(m->fi);
@@ -2724,8 +4081,14 @@ map_binfile_open(struct map_priv *m)
 	} else
 		file_mmap(m->fi);
 	file_data_free(m->fi, (unsigned char *)magic);
+	profile(1, "%s: zip setup\n", m->filename);
+	if (m->tile_cache_name && m->eoc && !m->url) {
+		binfile_tile_cache_open(m);
+		profile(1, "%s: tile cache\n", m->filename);
+	}
 	m->cachedir=g_strdup("/tmp/navit");
 	m->map_version=0;
+	m->tile_index=0;
 	mr=map_rect_new_binfile(m, NULL);
 	if (mr) {
 		while ((item=map_rect_get_item_binfile(mr)) == &busy_item);
@@ -2734,6 +4097,8 @@ map_binfile_open(struct map_priv *m)
 				m->map_version=attr.u.num;
 			if (binfile_attr_get(item->priv_data, attr_map_release, &attr))
 				m->map_release=g_strdup(attr.u.str);
+			if (binfile_attr_get(item->priv_data, attr_tile_index, &attr))
+				m->tile_index=attr.u.num;
 			if (m->url && binfile_attr_get(item->priv_data, attr_url, &attr)) {
 				dbg(lvl_debug,"url config %s map %s\n",m->url,attr.u.str);
 				if (strcmp(m->url, attr.u.str))
@@ -2743,7 +4108,8 @@ map_binfile_open(struct map_priv *m)
 			}
 		}
 		map_rect_destroy_binfile(mr);
-		if (m->map_version >= 16) {
+		profile(1, "%s: map information\n", m->filename);
+		if (m->map_version > BINFILE_MAP_VERSION_MAX) {
 			dbg(lvl_error,"%s: This map is incompatible with your navit version. Please update navit. (map version %d)\n",
 				m->filename, m->map_version);
 			return 0;
@@ -2756,6 +4122,8 @@ static void
 map_binfile_close(struct map_priv *m)
 {
 	int i;
+	binfile_tile_cache_close(m);
+	binfile_cd_index_close(m);
 	file_data_free(m->fi, (unsigned char *)m->index_cd);
 	file_data_free(m->fi, (unsigned char *)m->eoc);
 	file_data_free(m->fi, (unsigned char *)m->eoc64);
@@ -2775,6 +4143,7 @@ map_binfile_destroy(struct map_priv *m)
 	g_free(m->filename);
 	g_free(m->url);
 	g_free(m->progress);
+	g_free(m->tile_cache_name);
 	g_free(m);
 }
 
@@ -2788,6 +4157,12 @@ binfile_check_version(struct map_priv *m)
 	if (m->fi)
 		version=file_version(m->fi, m->check_version);
 	if (version != m->version) {
+#ifdef HAVE_PTHREAD
+		/* The prefetch thread reads the old version of the map */
+		map_binfile_prefetch_destroy(m->prefetch);
+		m->prefetch=NULL;
+		m->prefetch_failed=0;
+#endif
 		if (m->fi)
 			map_binfile_close(m);
 		map_binfile_open(m);
@@ -2800,7 +4175,7 @@ map_new_binfile(struct map_methods *meth, struct attr **attrs, struct callback_l
 {
 	struct map_priv *m;
 	struct attr *data=attr_search(attrs, NULL, attr_data);
-	struct attr *check_version,*map_pass,*flags,*url,*download_enabled;
+	struct attr *check_version,*map_pass,*flags,*url,*download_enabled,*cache_size,*tile_cache,*async_read;
 	struct file_wordexp *wexp;
 	char **wexp_data;
 	if (! data)
@@ -2831,6 +4206,15 @@ map_new_binfile(struct map_methods *meth, struct attr **attrs, struct callback_l
 	download_enabled = attr_search(attrs, NULL, attr_update);
 	if (download_enabled)
 		m->download_enabled=download_enabled->u.num;
+	cache_size=attr_search(attrs, NULL, attr_cache_size);
+	if (cache_size)
+		m->cache_size=cache_size->u.num;
+	tile_cache=attr_search(attrs, NULL, attr_tile_cache);
+	if (tile_cache)
+		m->tile_cache_name=g_strdup(tile_cache->u.str);
+	async_read=attr_search(attrs, NULL, attr_async_read);
+	if (async_read)
+		m->async_read=async_read->u.num;
 
 	if (!map_binfile_open(m) && !m->check_version && !m->url) {
 		map_binfile_destroy(m);
@@ -20,10 +20,14 @@
 #include <string.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <unistd.h>
 #include "maptool.h"
 #include "linguistics.h"
 #include "file.h"
 #include "debug.h"
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
 
 
 
@@ -503,109 +507,411 @@ item_bin_write_match(struct item_bin *ib, enum attr_type type, enum attr_type ma
 	} while (word);
 }
 
+/** Maximum number of runs item_bin_sort_file() merges at once, more are merged in several passes */
+#define ITEM_BIN_SORT_MERGE_MAX 64
+
+/**
+ * @brief The sort key of an item in item_bin_sort_file()
+ *
+ * The key is computed once per item, so the names don't have to be casefolded again on every comparison.
+ */
+struct item_bin_sort_key {
+	struct item_bin *ib;
+	char *tile;		/**< Tile name of the item, or NULL */
+	char *name;		/**< Casefolded value of the last attribute */
+	int house_number;	/**< Numeric value of the name, if the last attribute is a house number */
+	int is_house_number;
+	int match;		/**< Set if the last attribute is a town or district name match */
+	int pos;		/**< Position of the item in the input, keeps items with the same key in order */
+};
+
+/**
+ * @brief Items read from the input by item_bin_sort_file() which are sorted in memory
+ */
+struct item_bin_sort_chunk {
+	unsigned char *buffer;
+	size_t size, used;
+	struct item_bin_sort_key *keys;
+	int count;
+};
+
+/**
+ * @brief A sorted run written to a temporary file, read back item by item while merging
+ */
+struct item_bin_sort_run {
+	FILE *f;
+	unsigned char *buffer;
+	size_t size;
+	struct item_bin_sort_key key;
+};
+
+static void
+item_bin_sort_key_init(struct item_bin_sort_key *key)
+{
+	struct attr_bin *attr;
+	char *s;
+
+	attr=item_bin_get_attr_bin(key->ib, attr_tile_name, NULL);
+	key->tile=attr ? (char *)(attr+1) : NULL;
+	attr=item_bin_get_attr_bin_last(key->ib);
+	s=(char *)(attr+1);
+	key->is_house_number=(attr->type == attr_house_number);
+	key->house_number=key->is_house_number ? atoi(s) : 0;
+	key->name=linguistics_casefold(s);
+	key->match=(attr->type == attr_town_name_match || attr->type == attr_district_name_match);
+}
+
 static int
 item_bin_sort_compare(const void *p1, const void *p2)
 {
-	struct item_bin *ib1=*((struct item_bin **)p1),*ib2=*((struct item_bin **)p2);
-	struct attr_bin *attr1,*attr2;
-	char *s1,*s2;
+	const struct item_bin_sort_key *k1=p1,*k2=p2;
 	int ret;
 
-	attr1=item_bin_get_attr_bin(ib1, attr_tile_name, NULL);
-	attr2=item_bin_get_attr_bin(ib2, attr_tile_name, NULL);
-	if(attr1&&attr2) {
-		s1=(char *)(attr1+1);
-		s2=(char *)(attr2+1);
-		ret=strcmp(s1,s2);
-		if(ret)
+	if (k1->tile && k2->tile) {
+		ret=strcmp(k1->tile,k2->tile);
+		if (ret)
 			return ret;
 	}
-#if 0
-	dbg_assert(ib1->clen==2);
-	dbg_assert(ib2->clen==2);
-	attr1=(struct attr_bin *)((int *)(ib1+1)+ib1->clen);
-	attr2=(struct attr_bin *)((int *)(ib2+1)+ib1->clen);
-#else
-	attr1=item_bin_get_attr_bin_last(ib1);
-	attr2=item_bin_get_attr_bin_last(ib2);
-#endif
-#if 0
-	dbg_assert(attr1->type == attr_town_name || attr1->type == attr_town_name_match);
-	dbg_assert(attr2->type == attr_town_name || attr2->type == attr_town_name_match);
-#endif
-	s1=(char *)(attr1+1);
-	s2=(char *)(attr2+1);
-	if (attr1->type == attr_house_number && attr2->type == attr_house_number) {
-		ret=atoi(s1)-atoi(s2);
+	if (k1->is_house_number && k2->is_house_number) {
+		ret=k1->house_number-k2->house_number;
 		if (ret)
 			return ret;
 	}
+	ret=strcmp(k1->name, k2->name);
+	if (ret)
+		return ret;
+	ret=k1->match-k2->match;
+	if (ret)
+		return ret;
+	return (k1->pos > k2->pos)-(k1->pos < k2->pos);
+}
+
+/**
+ * @brief Computes the keys of a part of a chunk and sorts them
+ *
+ * @param data The part, a struct item_bin_sort_chunk whose keys only have ib and pos set
+ */
+static void *
+item_bin_sort_part(void *data)
+{
+	struct item_bin_sort_chunk *part=data;
+	int i;
 
-	s1=linguistics_casefold(s1);
-	s2=linguistics_casefold(s2);
+	for (i = 0 ; i < part->count ; i++)
+		item_bin_sort_key_init(&part->keys[i]);
+	qsort(part->keys, part->count, sizeof(struct item_bin_sort_key), item_bin_sort_compare);
+	return NULL;
+}
 
-	ret=strcmp(s1, s2);
-	g_free(s1);
-	g_free(s2);
+static void
+item_bin_sort_merge(struct item_bin_sort_key *a, int na, struct item_bin_sort_key *b, int nb,
+		struct item_bin_sort_key *out)
+{
+	while (na && nb) {
+		if (item_bin_sort_compare(b, a) < 0) {
+			*out++=*b++;
+			nb--;
+		} else {
+			*out++=*a++;
+			na--;
+		}
+	}
+	memcpy(out, a, na*sizeof(*a));
+	memcpy(out+na, b, nb*sizeof(*b));
+}
+
+/**
+ * @brief Sorts the keys of a chunk
+ *
+ * The keys are split into one part per thread. Each part is sorted on its own, then the sorted parts are merged.
+ */
+static void
+item_bin_sort_keys(struct item_bin_sort_chunk *chunk)
+{
+	struct item_bin_sort_chunk *parts;
+	struct item_bin_sort_key *src,*dst,*swap;
+	int i,count=threads,width,*start;
+#ifdef HAVE_PTHREAD
+	pthread_t *workers;
+	int *started;
+#endif
 
-	if (!ret) {
-		int match1=0,match2=0;
-		match1=(attr1->type == attr_town_name_match || attr1->type == attr_district_name_match);
-		match2=(attr2->type == attr_town_name_match || attr2->type == attr_district_name_match);
-		ret=match1-match2;
+	if (count > chunk->count/1024)
+		count=chunk->count/1024;
+	if (count < 1)
+		count=1;
+	parts=g_new(struct item_bin_sort_chunk, count);
+	start=g_new(int, count+1);
+	for (i = 0 ; i <= count ; i++)
+		start[i]=(long long)chunk->count*i/count;
+	for (i = 0 ; i < count ; i++) {
+		parts[i].keys=chunk->keys+start[i];
+		parts[i].count=start[i+1]-start[i];
 	}
-#if 0
-	fprintf(stderr,"sort_countries_compare p1=%p p2=%p %s %s\n",p1,p2,s1,s2);
+#ifdef HAVE_PTHREAD
+	workers=g_new(pthread_t, count);
+	started=g_new0(int, count);
+	for (i = 1 ; i < count ; i++)
+		started[i]=!pthread_create(&workers[i], NULL, item_bin_sort_part, &parts[i]);
+	item_bin_sort_part(&parts[0]);
+	for (i = 1 ; i < count ; i++) {
+		if (started[i])
+			pthread_join(workers[i], NULL);
+		else
+			item_bin_sort_part(&parts[i]);
+	}
+	g_free(started);
+	g_free(workers);
+#else
+	for (i = 0 ; i < count ; i++)
+		item_bin_sort_part(&parts[i]);
 #endif
-	return ret;
+	if (count > 1) {
+		src=chunk->keys;
+		dst=g_new(struct item_bin_sort_key, chunk->count);
+		for (width = 1 ; width < count ; width*=2) {
+			for (i = 0 ; i < count ; i+=2*width) {
+				int lo=start[i],mid=start[MIN(i+width,count)],hi=start[MIN(i+2*width,count)];
+				item_bin_sort_merge(src+lo, mid-lo, src+mid, hi-mid, dst+lo);
+			}
+			swap=src;
+			src=dst;
+			dst=swap;
+		}
+		chunk->keys=src;
+		g_free(dst);
+	}
+	g_free(start);
+	g_free(parts);
 }
 
+/**
+ * @brief Reads items into a chunk until the memory budget is used up
+ *
+ * Besides the item itself, each item is accounted for with the upper bound of its casefolded name and two keys,
+ * for sorting and for merging the sorted parts.
+ *
+ * @param in The file to read from
+ * @param chunk The chunk to fill, its buffer is reused and grown as needed
+ * @param budget The memory to use, in bytes. At least one item is read regardless of it
+ * @return 1 if the end of the file was reached, 0 if there are more items to read
+ */
+static int
+item_bin_sort_read_chunk(FILE *in, struct item_bin_sort_chunk *chunk, long long budget)
+{
+	long long used=0,cost;
+	size_t bytes,pos;
+	int len,i;
+
+	chunk->used=0;
+	chunk->count=0;
+	while (fread(&len, 4, 1, in) == 1) {
+		bytes=((size_t)len+1)*4;
+		cost=bytes*2+sizeof(struct item_bin_sort_key)*2;
+		if (chunk->count && used+cost > budget) {
+			fseek(in, -4, SEEK_CUR);
+			break;
+		}
+		if (chunk->used+bytes > chunk->size) {
+			chunk->size=MAX(chunk->size*2, chunk->used+bytes);
+			if (chunk->size > budget/2)
+				chunk->size=MAX(budget/2, chunk->used+bytes);
+			chunk->buffer=g_realloc(chunk->buffer, chunk->size);
+		}
+		memcpy(chunk->buffer+chunk->used, &len, 4);
+		dbg_assert(fread(chunk->buffer+chunk->used+4, bytes-4, 1, in) == 1 || bytes == 4);
+		chunk->used+=bytes;
+		chunk->count++;
+		used+=cost;
+	}
+	chunk->keys=g_renew(struct item_bin_sort_key, chunk->keys, chunk->count);
+	pos=0;
+	for (i = 0 ; i < chunk->count ; i++) {
+		chunk->keys[i].ib=(struct item_bin *)(chunk->buffer+pos);
+		chunk->keys[i].pos=i;
+		pos+=(chunk->keys[i].ib->len+1)*4;
+	}
+	return feof(in);
+}
+
+static void
+item_bin_sort_write(struct item_bin *ib, FILE *f, struct rect *r, int *rc)
+{
+	struct coord *c=(struct coord *)(ib+1);
+	int k;
+
+	dbg_assert(fwrite(ib, (ib->len+1)*4, 1, f)==1);
+	if (r) {
+		for (k = 0 ; k < ib->clen/2 ; k++) {
+			if (*rc)
+				bbox_extend(&c[k], r);
+			else {
+				r->l=c[k];
+				r->h=c[k];
+			}
+			(*rc)++;
+		}
+	}
+}
+
+static int
+item_bin_sort_run_next(struct item_bin_sort_run *run)
+{
+	int len;
+	size_t bytes;
+
+	g_free(run->key.name);
+	run->key.name=NULL;
+	if (fread(&len, 4, 1, run->f) != 1)
+		return 0;
+	bytes=((size_t)len+1)*4;
+	if (bytes > run->size) {
+		run->size=bytes;
+		run->buffer=g_realloc(run->buffer, run->size);
+	}
+	memcpy(run->buffer, &len, 4);
+	dbg_assert(fread(run->buffer+4, bytes-4, 1, run->f) == 1 || bytes == 4);
+	run->key.ib=(struct item_bin *)run->buffer;
+	item_bin_sort_key_init(&run->key);
+	return 1;
+}
+
+static void
+item_bin_sort_heap_down(struct item_bin_sort_run **heap, int count, int i)
+{
+	struct item_bin_sort_run *run=heap[i];
+	int child;
+
+	while ((child=2*i+1) < count) {
+		if (child+1 < count && item_bin_sort_compare(&heap[child+1]->key, &heap[child]->key) < 0)
+			child++;
+		if (item_bin_sort_compare(&heap[child]->key, &run->key) >= 0)
+			break;
+		heap[i]=heap[child];
+		i=child;
+	}
+	heap[i]=run;
+}
+
+/**
+ * @brief Merges the sorted runs written by item_bin_sort_file() into the output file
+ *
+ * The runs are kept in a heap ordered by their current item. Items with the same key are taken from the
+ * earlier run first, so the result is the same as if the whole file had been sorted at once.
+ * The run files are removed and their names freed afterwards.
+ */
+static void
+item_bin_sort_merge_runs(char **names, int count, FILE *out, struct rect *r, int *rc)
+{
+	struct item_bin_sort_run *runs=g_new0(struct item_bin_sort_run, count);
+	struct item_bin_sort_run **heap=g_new(struct item_bin_sort_run *, count);
+	int i,used=0;
+
+	for (i = 0 ; i < count ; i++) {
+		runs[i].f=fopen(names[i], "rb");
+		dbg_assert(runs[i].f != NULL);
+		runs[i].key.pos=i;
+		if (item_bin_sort_run_next(&runs[i]))
+			heap[used++]=&runs[i];
+	}
+	for (i = used/2-1 ; i >= 0 ; i--)
+		item_bin_sort_heap_down(heap, used, i);
+	while (used) {
+		item_bin_sort_write(heap[0]->key.ib, out, r, rc);
+		if (!item_bin_sort_run_next(heap[0]))
+			heap[0]=heap[--used];
+		if (used)
+			item_bin_sort_heap_down(heap, used, 0);
+	}
+	for (i = 0 ; i < count ; i++) {
+		fclose(runs[i].f);
+		g_free(runs[i].buffer);
+		unlink(names[i]);
+		g_free(names[i]);
+	}
+	g_free(heap);
+	g_free(runs);
+}
+
+/**
+ * @brief Sorts the items of a file by tile and name
+ *
+ * The items are read in chunks which fit into slice_size bytes. Each chunk is sorted in memory, using up to
+ * threads threads. If the file doesn't fit into a single chunk, the sorted chunks are written to temporary
+ * run files next to out_file, which are merged afterwards, at most ITEM_BIN_SORT_MERGE_MAX at a time.
+ *
+ * @param in_file The file to sort
+ * @param out_file The file to write the sorted items to
+ * @param r If not NULL, set to the bounding box of all coordinates of the items
+ * @param size Set to the size of the input file
+ * @return 1 on success, 0 if in_file could not be opened
+ */
 int
 item_bin_sort_file(char *in_file, char *out_file, struct rect *r, int *size)
 {
-	int j,k,count,rc=0;
-	struct coord *c;
-	struct item_bin *ib;
-	FILE *f;
-	unsigned char *p,**idx,*buffer;
-	if (file_get_contents(in_file, &buffer, size)) {
-		ib=(struct item_bin *)buffer;
-		p=buffer;
-		count=0;
-		while (p < buffer+*size) {
-			count++;
-			p+=(*((int *)p)+1)*4;
+	struct item_bin_sort_chunk chunk;
+	char **runs=NULL,*name;
+	FILE *in,*out,*f;
+	int i,eof,count=0,next,merged,rc=0;
+
+	in=fopen(in_file,"rb");
+	if (!in)
+		return 0;
+	memset(&chunk, 0, sizeof(chunk));
+	fseek(in, 0, SEEK_END);
+	chunk.size=MIN(ftell(in), slice_size/2);
+	chunk.buffer=g_malloc(chunk.size);
+	rewind(in);
+	*size=0;
+	do {
+		eof=item_bin_sort_read_chunk(in, &chunk, slice_size);
+		*size+=chunk.used;
+		item_bin_sort_keys(&chunk);
+		if (eof && !count)
+			name=g_strdup(out_file);
+		else {
+			name=g_strdup_printf("%s.run%d", out_file, count);
+			runs=g_renew(char *, runs, count+1);
+			runs[count++]=name;
 		}
-		idx=g_malloc(count*sizeof(void *));
-		p=buffer;
-		for (j = 0 ; j < count ; j++) {
-			idx[j]=p;
-			p+=(*((int *)p)+1)*4;
+		f=fopen(name,"wb");
+		dbg_assert(f != NULL);
+		for (i = 0 ; i < chunk.count ; i++) {
+			if (count)
+				dbg_assert(fwrite(chunk.keys[i].ib, (chunk.keys[i].ib->len+1)*4, 1, f)==1);
+			else
+				item_bin_sort_write(chunk.keys[i].ib, f, r, &rc);
+			g_free(chunk.keys[i].name);
 		}
-		qsort(idx, count, sizeof(void *), item_bin_sort_compare);
-		f=fopen(out_file,"wb");
-		for (j = 0 ; j < count ; j++) {
-			ib=(struct item_bin *)(idx[j]);
-			c=(struct coord *)(ib+1);
-			dbg_assert(fwrite(ib, (ib->len+1)*4, 1, f)==1);
-			if (r) {
-				for (k = 0 ; k < ib->clen/2 ; k++) {
-					if (rc) 
-						bbox_extend(&c[k], r);
-					else {
-						r->l=c[k];
-						r->h=c[k];
-					}
-					rc++;
-				}
+		fclose(f);
+		if (!count)
+			g_free(name);
+	} while (!eof);
+	fclose(in);
+	g_free(chunk.keys);
+	g_free(chunk.buffer);
+	if (count) {
+		fprintf(stderr,"PROGRESS: Merging %d sorted runs of %s\n", count, in_file);
+		next=count;
+		while (count > ITEM_BIN_SORT_MERGE_MAX) {
+			merged=0;
+			for (i = 0 ; i < count ; i+=ITEM_BIN_SORT_MERGE_MAX) {
+				name=g_strdup_printf("%s.run%d", out_file, next++);
+				f=fopen(name,"wb");
+				dbg_assert(f != NULL);
+				item_bin_sort_merge_runs(runs+i, MIN(count-i, ITEM_BIN_SORT_MERGE_MAX), f, NULL, NULL);
+				fclose(f);
+				runs[merged++]=name;
 			}
+			count=merged;
 		}
-		fclose(f);
-		g_free(idx);
-		g_free(buffer);
-		return 1;
+		out=fopen(out_file,"wb");
+		dbg_assert(out != NULL);
+		item_bin_sort_merge_runs(runs, count, out, r, &rc);
+		fclose(out);
+		g_free(runs);
 	}
-	return 0;
+	return 1;
 }
 
 struct geom_poly_segment *
@@ -60,6 +60,12 @@ char ch_suffix[] ="r"; /* Used to make compiler happy due to Bug 35903 in gcc */
 char* experimental_feature_description = "Move coastline data to order 6 tiles. Makes map look more smooth, but may affect drawing/searching performance."; /* add description here */
 /** Indicates if experimental features (if available) were enabled. */
 int experimental;
+/** Indicates if tiles get a bounding box index of their items. */
+int tile_index;
+/** Indicates if coordinates are stored as zig-zag delta varints. */
+int compact_coords;
+/** Number of threads to use for the parts of the conversion which can run in parallel. */
+int threads=1;
 
 struct buffer node_buffer = {
 	64*1024*1024,
@@ -281,7 +287,9 @@ usage(FILE *f)
 	fprintf(f,"-5 (--md5) <file>                 : set file where to write md5 sum\n");
 	fprintf(f,"-6 (--64bit)                      : set zip 64 bit compression\n");
 	fprintf(f,"-a (--attr-debug-level)  <level>  : control which data is included in the debug attribute\n");
+	fprintf(f,"-A (--update) <map>               : apply the OSM change file (osc) given as input to map, writing the updated map. Needs the node table (coords.tmp) of the previous run, kept by -k\n");
 	fprintf(f,"-c (--dump-coordinates)           : dump coordinates after phase 1\n");
+	fprintf(f,"-C (--compact-coordinates)        : store coordinates as deltas, makes the map smaller but needs a recent navit\n");
 #ifdef HAVE_POSTGRESQL
 	fprintf(f,"-d (--db) <conn. string>          : get osm data out of a postgresql database with osm simple scheme and given connect string\n");
 #endif
@@ -289,6 +297,8 @@ usage(FILE *f)
 	fprintf(f,"-E (--experimental)               : Enable experimental features (%s)\n",
 		experimental_feature_description ? experimental_feature_description : "-not available in this version-");
 	fprintf(f,"-i (--input-file) <file>          : specify the input file name (OSM), overrules default stdin\n");
+	fprintf(f,"-I (--tile-index)                 : add a bounding box index to each tile, lets navit skip items outside the visible area\n");
+	fprintf(f,"-j (--jobs) <count>               : number of threads to use, e.g. for decoding protobuf input, sorting the search index or compressing tiles. Default is 1\n");
 	fprintf(f,"-k (--keep-tmpfiles)              : do not delete tmp files after processing. useful to reuse them\n");
 	fprintf(f,"-M (--o5m)                        : input file os o5m\n");
 	fprintf(f,"-N (--nodes-only)                 : process only nodes\n");
@@ -303,6 +313,7 @@ usage(FILE *f)
 	fprintf(f,"-U (--unknown-country)            : add objects with unknown country to index\n");
 	fprintf(f,"-x (--index-size)                 : set maximum country index size in bytes\n");
 	fprintf(f,"-z (--compression-level) <level>  : set the compression level\n");
+	fprintf(f,"-Z (--zstd)                       : compress tiles with Zstandard instead of deflate, needs a navit built with zstd\n");
 	fprintf(f,"Internal options (undocumented):\n");                                                                      
 	fprintf(f,"-b (--binfile)\n");                                                                                        
 	fprintf(f,"-B \n");                                                                                                   
@@ -316,6 +327,7 @@ usage(FILE *f)
 struct maptool_params {
 	int zip64;
 	int keep_tmpfiles;
+	char *update;
 	int process_nodes;
 	int process_ways;
 	int process_relations;
@@ -327,6 +339,7 @@ struct maptool_params {
 	int output;
 	int o5m;
 	int compression_level;
+	int compression_method;
 	int protobuf;
 	int dump_coordinates;
 	int input;
@@ -356,9 +369,12 @@ parse_option(struct maptool_params *p, char **argv, int argc, int *option_index)
 	static struct option long_options[] = {
 		{"md5", 1, 0, '5'},
 		{"64bit", 0, 0, '6'},
+		{"update", 1, 0, 'A'},
 		{"attr-debug-level", 1, 0, 'a'},
 		{"binfile", 0, 0, 'b'},
 		{"compression-level", 1, 0, 'z'},
+		{"compact-coordinates", 0, 0, 'C'},
+		{"zstd", 0, 0, 'Z'},
 #ifdef HAVE_POSTGRESQL
 		{"db", 1, 0, 'd'},
 #endif
@@ -377,6 +393,8 @@ parse_option(struct maptool_params *p, char **argv, int argc, int *option_index)
 		{"start", 1, 0, 's'},
 		{"timestamp", 1, 0, 't'},
 		{"input-file", 1, 0, 'i'},
+		{"tile-index", 0, 0, 'I'},
+		{"jobs", 1, 0, 'j'},
 		{"rule-file", 1, 0, 'r'},
 		{"ignore-unknown", 0, 0, 'n'},
 		{"url", 1, 0, 'u'},
@@ -386,11 +404,11 @@ parse_option(struct maptool_params *p, char **argv, int argc, int *option_index)
 		{"index-size", 0, 0, 'x'},
 		{0, 0, 0, 0}
 	};
-	c = getopt_long (argc, argv, "5:6B:DEMNO:PS:Wa:bc"
+	c = getopt_long (argc, argv, "5:6A:B:CDEIMNO:PS:Wa:bc"
 #ifdef HAVE_POSTGRESQL
 				      "d:"
 #endif
-				      "e:hi:knm:p:r:s:t:wu:z:Ux:", long_options, option_index);
+				      "e:hi:j:knm:p:r:s:t:wu:z:ZUx:", long_options, option_index);
 	if (c == -1)
 		return 1;
 	switch (c) {
@@ -400,15 +418,24 @@ parse_option(struct maptool_params *p, char **argv, int argc, int *option_index)
 	case '6':
 		p->zip64=1;
 		break;
+	case 'A':
+		p->update=optarg;
+		break;
 	case 'B':
 		p->protobufdb=optarg;
 		break;
+	case 'C':
+		compact_coords=1;
+		break;
 	case 'D':
 		p->output=1;
 		break;
 	case 'E':
 		experimental=1;
 		break;
+	case 'I':
+		tile_index=1;
+		break;
 	case 'M':
 		p->o5m=1;
 		break;	
@@ -506,6 +533,11 @@ parse_option(struct maptool_params *p, char **argv, int argc, int *option_index)
 		    exit( -1 );
 		}
 		break;
+	case 'j':
+		threads=atoi(optarg);
+		if (threads < 1)
+			threads=1;
+		break;
 	case 'r':
 		p->rule_file = fopen( optarg, "r" );
 		if (p->rule_file ==  NULL )
@@ -524,6 +556,9 @@ parse_option(struct maptool_params *p, char **argv, int argc, int *option_index)
 	case 'z':
 		p->compression_level=atoi(optarg);
 		break;
+	case 'Z':
+		p->compression_method=93;
+		break;
 #endif
         case '?':
 	default:
@@ -532,25 +567,97 @@ parse_option(struct maptool_params *p, char **argv, int argc, int *option_index)
 	return 3;
 }
 
+/** Number of phases the time is measured for */
+#define PHASE_TIMES 32
+
+/** Name and total time of each phase, for phase_summary() */
+static struct phase_time {
+	char *name;
+	double seconds;
+} phase_times[PHASE_TIMES];
+static int timed_phase;
+static double timed_phase_start;
+
+static double
+phase_clock(void)
+{
+#ifdef _WIN32
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec+tv.tv_usec/1000000.0;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec+ts.tv_nsec/1000000000.0;
+#endif
+}
+
+/**
+ * @brief Stops measuring the time of the current phase and starts measuring the given one
+ *
+ * Phases which run several times, like the ones run for each map suffix, are added up.
+ *
+ * @param current The phase which starts now, or 0 if the phase is skipped
+ * @param name The name of the phase
+ */
+static void
+phase_timing(int current, char *name)
+{
+	double now=phase_clock();
+
+	if (timed_phase)
+		phase_times[timed_phase].seconds+=now-timed_phase_start;
+	timed_phase=0;
+	if (current > 0 && current < PHASE_TIMES) {
+		phase_times[current].name=name;
+		timed_phase=current;
+		timed_phase_start=now;
+	}
+}
+
+/**
+ * @brief Prints how long each phase took
+ */
+static void
+phase_summary(void)
+{
+	int i;
+
+	phase_timing(0, NULL);
+	fprintf(stderr,"PROGRESS: Time per phase:\n");
+	for (i = 1 ; i < PHASE_TIMES ; i++) {
+		if (phase_times[i].name && i != phase)
+			fprintf(stderr,"PROGRESS: Phase %d: %s %.1f s\n", i, phase_times[i].name, phase_times[i].seconds);
+	}
+}
+
 static int
 start_phase(struct maptool_params *p, char *str)
 {
 	phase++;
 	if (p->start <= phase && p->end >= phase) {
+		phase_timing(phase, str);
 		fprintf(stderr,"PROGRESS: Phase %d: %s",phase,str);
 		fflush(stderr);
 		progress_time();
 		progress_memory();
 		fprintf(stderr,"\n");
 		return 1;
-	} else
+	} else {
+		phase_timing(0, NULL);
 		return 0;
+	}
 }
 
 static void
 osm_read_input_data(struct maptool_params *p, char *suffix)
 {
-	unlink("coords.tmp");
+	if (p->update) {
+		/* The node table of the previous run, to resolve the nodes the change file doesn't contain */
+		rename("coords.tmp","coords_base.tmp");
+		p->osm.changes=tempfile(suffix,"changes",1);
+	} else
+		unlink("coords.tmp");
 	if (p->process_ways)
 		p->osm.ways=tempfile(suffix,"ways",1);
 	if (p->process_nodes) {
@@ -586,7 +693,10 @@ osm_read_input_data(struct maptool_params *p, char *suffix)
 		fprintf(stderr,"Option -P not yet supported on MSVC\n");
 		exit(1);
 #else
-		map_collect_data_osm_protobuf(p->input_file,&p->osm);
+		if (!map_collect_data_osm_protobuf(p->input_file,&p->osm)) {
+			fprintf(stderr,"Unable to read the protobuf input file\n");
+			exit(1);
+		}
 #endif
 	}
 	else if (p->o5m)
@@ -594,11 +704,17 @@ osm_read_input_data(struct maptool_params *p, char *suffix)
 	else
 		map_collect_data_osm(p->input_file,&p->osm);
 
-	if (node_buffer.size==0 && !p->map_handles){
+	if (node_buffer.size==0 && !p->map_handles && !p->update){
 		fprintf(stderr,"No nodes found - looks like an invalid input file.\n");
 		exit(1);
 	}
-	flush_nodes(1);
+	if (p->update) {
+		FILE *moved=tempfile(suffix,"moved_nodes",1);
+		merge_node_table("coords_base.tmp", p->osm.ways, moved);
+		fclose(moved);
+		unlink("coords_base.tmp");
+	} else
+		flush_nodes(1);
 	if (p->osm.ways)
 		fclose(p->osm.ways);
 	if (p->osm.nodes)
@@ -617,6 +733,8 @@ osm_read_input_data(struct maptool_params *p, char *suffix)
 		fclose(p->osm.line2poi);
 	if (p->osm.towns)
 		fclose(p->osm.towns);
+	if (p->osm.changes)
+		fclose(p->osm.changes);
 }
 int debug_ref=0;
 
@@ -630,6 +748,7 @@ osm_count_references(struct maptool_params *p, char *suffix, int clear)
 		if (!first) {
 			FILE *ways=tempfile(suffix,"ways",0);
 			load_buffer("coords.tmp",&node_buffer, i*slice_size, slice_size);
+			node_index_build();
 			if (clear) 
 				clear_node_item_buffer();
 			ref_ways(ways);
@@ -656,6 +775,29 @@ osm_count_references(struct maptool_params *p, char *suffix, int clear)
 	}
 }
 
+/**
+ * @brief Counts the references of the nodes by the ways of the map to update
+ *
+ * Ways the change file doesn't touch are only in the old map, so they aren't counted by
+ * osm_count_references(). Without their references, the ways of the change file wouldn't be
+ * split where they meet them.
+ */
+static void
+osm_count_references_update(struct maptool_params *p, char *suffix)
+{
+	FILE *changes=tempfile(suffix,"changes",0);
+	FILE *moved=tempfile(suffix,"moved_nodes",0);
+	int ret=update_count_references(p->update, changes, moved);
+
+	if (changes)
+		fclose(changes);
+	if (moved)
+		fclose(moved);
+	if (ret < 0) {
+		fprintf(stderr,"Fatal: Could not update %s.\n", p->update);
+		exit(1);
+	}
+}
 
 static void
 osm_resolve_coords_and_split_at_intersections(struct maptool_params *p, char *suffix)
@@ -670,8 +812,10 @@ osm_resolve_coords_and_split_at_intersections(struct maptool_params *p, char *su
 		ways_split_index=final ? tempfile(suffix,"ways_split_index",1) : NULL;
 		graph=tempfile(suffix,"graph",1);
 		coastline=tempfile(suffix,"coastline",1);
-		if (i)
+		if (i) {
 			load_buffer("coords.tmp",&node_buffer, i*slice_size, slice_size);
+			node_index_build();
+		}
 		map_resolve_coords_and_split_at_intersections(ways,ways_split,ways_split_index,graph,coastline,final);
 		fclose(ways_split);
 		if (ways_split_index)
@@ -788,13 +932,27 @@ maptool_generate_tiles(struct maptool_params *p, char *suffix, char **filenames,
 	zip_set_zipnum(zip_info,zipnum);
 }
 
+static void
+maptool_write_md5(struct maptool_params *p, struct zip_info *zip_info)
+{
+	unsigned char md5_data[16];
+	if (p->md5file && zip_get_md5(zip_info, md5_data)) {
+		FILE *md5=fopen(p->md5file,"w");
+		int i;
+		for (i = 0 ; i < 16 ; i++)
+			fprintf(md5,"%02x",md5_data[i]);
+		fprintf(md5,"\n");
+		fclose(md5);
+	}
+}
+
 static void
 maptool_assemble_map(struct maptool_params *p, char *suffix, char **filenames, char **referencenames, int filename_count, int first, int last, char *suffix0)
 {
 	FILE *files[10];
 	FILE *references[10];
 	struct zip_info *zip_info;
-	int zipnum,f;
+	int zipnum,f,i;
 
 	if (first) {
 		char *zipdir=tempfile_name("zipdir","");
@@ -804,6 +962,10 @@ maptool_assemble_map(struct maptool_params *p, char *suffix, char **filenames, c
 		zip_set_timestamp(zip_info, p->timestamp);
 		zip_set_maxnamelen(zip_info, 14+strlen(suffix0));
 		zip_set_compression_level(zip_info, p->compression_level);
+		if (p->compression_method && !zip_set_compression_method(zip_info, p->compression_method)) {
+			fprintf(stderr,"Fatal: This maptool was built without zstd support.\n");
+			exit(1);
+		}
 		if (p->md5file) 
 			zip_set_md5(zip_info, 1);
 		if(!zip_open(zip_info, p->result, zipdir, zipindex)) {
@@ -814,7 +976,12 @@ maptool_assemble_map(struct maptool_params *p, char *suffix, char **filenames, c
 			map_information_attrs[1].type=attr_url;
 			map_information_attrs[1].u.str=p->url;
 		}
-		index_init(zip_info, 1);
+		if (tile_index) {
+			for (i = 1 ; map_information_attrs[i].type ; i++);
+			map_information_attrs[i].type=attr_tile_index;
+			map_information_attrs[i].u.num=TILE_INDEX_GROUP;
+		}
+		index_init(zip_info, compact_coords ? MAP_VERSION_COMPACT_COORDS : 1);
 	}
 	if (!strcmp(suffix,ch_suffix)) {  /* Makes compiler happy due to bug 35903 in gcc */
 		ch_assemble_map(suffix0,suffix,zip_info);
@@ -852,7 +1019,6 @@ maptool_assemble_map(struct maptool_params *p, char *suffix, char **filenames, c
 		unlink("coords.tmp");
 	}
 	if (last) {
-		unsigned char md5_data[16];
 		zipnum=zip_get_zipnum(zip_info);
 		add_aux_tiles("auxtiles.txt", zip_info);
 		write_countrydir(zip_info,p->max_index_size);
@@ -861,14 +1027,7 @@ maptool_assemble_map(struct maptool_params *p, char *suffix, char **filenames, c
 		zip_write_index(zip_info);
 		zip_write_directory(zip_info);
 		zip_close(zip_info);
-		if (p->md5file && zip_get_md5(zip_info, md5_data)) {
-			FILE *md5=fopen(p->md5file,"w");
-			int i;
-			for (i = 0 ; i < 16 ; i++)
-				fprintf(md5,"%02x",md5_data[i]);
-			fprintf(md5,"\n");
-			fclose(md5);
-		}
+		maptool_write_md5(p, zip_info);
 		if (!p->keep_tmpfiles) {
 			remove_countryfiles();
 			tempfile_unlink("index","");
@@ -877,6 +1036,75 @@ maptool_assemble_map(struct maptool_params *p, char *suffix, char **filenames, c
 	}
 }
 
+/**
+ * @brief Writes the map given by -A updated with the items of the change file read in phase 1
+ *
+ * Replaces generating the tiles and assembling the map. The node table is kept even without -k,
+ * as the next update needs it.
+ */
+static void
+maptool_update_map(struct maptool_params *p, char *suffix, char **filenames, int filename_count)
+{
+	FILE *files[10];
+	FILE *changes,*moved;
+	struct zip_info *zip_info;
+	char *zipdir=tempfile_name("zipdir","");
+	char *zipindex=tempfile_name("index","");
+	int f,changed;
+
+	zip_info=zip_new();
+	zip_set_zip64(zip_info, p->zip64);
+	zip_set_timestamp(zip_info, p->timestamp);
+	zip_set_compression_level(zip_info, p->compression_level);
+	if (p->compression_method && !zip_set_compression_method(zip_info, p->compression_method)) {
+		fprintf(stderr,"Fatal: This maptool was built without zstd support.\n");
+		exit(1);
+	}
+	if (p->md5file)
+		zip_set_md5(zip_info, 1);
+	if(!zip_open(zip_info, p->result, zipdir, zipindex)) {
+		fprintf(stderr,"Fatal: Could not write output file.\n");
+		exit(1);
+	}
+	for (f = 0 ; f < filename_count ; f++)
+		files[f]=tempfile(suffix, filenames[f], 0);
+	changes=tempfile(suffix, "changes", 0);
+	moved=tempfile(suffix, "moved_nodes", 0);
+	changed=update_map(p->update, changes, moved, files, filename_count, zip_info);
+	for (f = 0 ; f < filename_count ; f++) {
+		if (files[f])
+			fclose(files[f]);
+	}
+	if (changes)
+		fclose(changes);
+	if (moved)
+		fclose(moved);
+	if (changed < 0) {
+		zip_close(zip_info);
+		unlink(p->result);
+		fprintf(stderr,"Fatal: Could not update %s.\n", p->update);
+		exit(1);
+	}
+	zip_write_directory(zip_info);
+	zip_close(zip_info);
+	maptool_write_md5(p, zip_info);
+	if(!p->keep_tmpfiles) {
+		tempfile_unlink(suffix,"changes");
+		tempfile_unlink(suffix,"moved_nodes");
+		tempfile_unlink(suffix,"nodes");
+		tempfile_unlink(suffix,"ways_split");
+		tempfile_unlink(suffix,"poly2poi_resolved");
+		tempfile_unlink(suffix,"line2poi_resolved");
+		tempfile_unlink(suffix,"coastline");
+		tempfile_unlink(suffix,"turn_restrictions");
+		tempfile_unlink(suffix,"graph");
+		tempfile_unlink(suffix,"way2poi_result");
+		tempfile_unlink(suffix,"towns");
+		tempfile_unlink("index","");
+		tempfile_unlink("zipdir","");
+	}
+}
+
 static void
 maptool_load_node_table(struct maptool_params *p, int last)
 {
@@ -884,6 +1112,7 @@ maptool_load_node_table(struct maptool_params *p, int last)
 		slices=(sizeof_buffer("coords.tmp")+(long long)slice_size-(long long)1)/(long long)slice_size;
 		assert(slices>0);
 		load_buffer("coords.tmp",&node_buffer,last?(slices-1)*slice_size:0, slice_size);
+		node_index_build();
 		p->node_table_loaded=1;
 	}
 }
@@ -968,6 +1197,18 @@ int main(int argc, char **argv)
 	if (optind != argc-(p.output == 1 ? 0:1))
 		usage(stderr);
 	p.result=argv[optind];
+	if (p.update) {
+		if (p.input || p.protobuf || p.o5m || p.map_handles) {
+			fprintf(stderr,"The change file for -A has to be OSM XML.\n");
+			exit(1);
+		}
+		if (p.output || !strcmp(p.update, p.result)) {
+			fprintf(stderr,"-A needs an output map different from the map to update.\n");
+			exit(1);
+		}
+		/* Relations need members which are not part of the change file */
+		p.process_relations=0;
+	}
 
 
 	// initialize plugins and OSM mappings
@@ -992,6 +1233,8 @@ int main(int argc, char **argv)
 		if (start_phase(&p, "counting references and resolving ways")) {
 			maptool_load_node_table(&p,1);
 			osm_count_references(&p, suffix, p.start == phase);
+			if (p.update && p.process_ways)
+				osm_count_references_update(&p, suffix);
 		}
 		if (start_phase(&p,"converting ways to pois")) {
 			osm_process_way2poi(&p, suffix);
@@ -1006,6 +1249,7 @@ int main(int argc, char **argv)
 		node_buffer.base=NULL;
 		node_buffer.malloced=0;
 		node_buffer.size=0;
+		node_index_build();
 		p.node_table_loaded=0;
 	} else {
 		if (start_phase(&p,"reading data")) {
@@ -1014,10 +1258,10 @@ int main(int argc, char **argv)
 			fclose(ways_split);
 		}
 	}
-	if (start_phase(&p,"generating coastlines")) {
+	if (!p.update && start_phase(&p,"generating coastlines")) {
 		osm_process_coastlines(&p, suffix);
 	}
-	if (start_phase(&p,"assigning towns to countries")) {
+	if (!p.update && start_phase(&p,"assigning towns to countries")) {
 		FILE *towns=tempfile(suffix,"towns",0),*boundaries=NULL,*ways=NULL;
 		if (towns) {
 			boundaries=tempfile(suffix,"boundaries",0);
@@ -1030,7 +1274,7 @@ int main(int argc, char **argv)
 				tempfile_unlink(suffix,"towns");
 		}
 	}
-	if (start_phase(&p,"sorting countries")) {
+	if (!p.update && start_phase(&p,"sorting countries")) {
 		sort_countries(p.keep_tmpfiles);
 		p.countries_loaded=1;
 	}
@@ -1092,21 +1336,27 @@ int main(int argc, char **argv)
 		filenames[filename_count]="way2poi_result";
 		referencenames[filename_count++]=NULL;
 	}
-	for (i = suffix_start ; i < suffix_count ; i++) {
-		suffix=suffixes[i];
-		if (start_phase(&p,"generating tiles")) {
-			maptool_load_countries(&p);
-			maptool_generate_tiles(&p, suffix, filenames, filename_count, i == suffix_start, suffixes[0]);
-			p.tilesdir_loaded=1;
-		}
-		if (start_phase(&p,"assembling map")) {
-			maptool_load_countries(&p);
-			maptool_load_tilesdir(&p, suffix);
-			maptool_assemble_map(&p, suffix, filenames, referencenames, filename_count, i == suffix_start, i == suffix_count-1, suffixes[0]);
+	if (p.update) {
+		if (start_phase(&p,"updating map"))
+			maptool_update_map(&p, suffix, filenames, filename_count);
+	} else {
+		for (i = suffix_start ; i < suffix_count ; i++) {
+			suffix=suffixes[i];
+			if (start_phase(&p,"generating tiles")) {
+				maptool_load_countries(&p);
+				maptool_generate_tiles(&p, suffix, filenames, filename_count, i == suffix_start, suffixes[0]);
+				p.tilesdir_loaded=1;
+			}
+			if (start_phase(&p,"assembling map")) {
+				maptool_load_countries(&p);
+				maptool_load_tilesdir(&p, suffix);
+				maptool_assemble_map(&p, suffix, filenames, referencenames, filename_count, i == suffix_start, i == suffix_count-1, suffixes[0]);
+			}
+			phase-=2;
 		}
-		phase-=2;
+		phase+=2;
 	}
-	phase+=2;
 	start_phase(&p,"done");
+	phase_summary();
 	return 0;
 }
@@ -248,6 +248,9 @@ extern int bytes_read;
 extern int overlap;
 extern int unknown_country;
 extern int experimental;
+extern int tile_index;
+extern int compact_coords;
+extern int threads;
 void sig_alrm(int sig);
 void sig_alrm_end(void);
 
@@ -269,6 +272,7 @@ void process_binfile(FILE *in, FILE *out);
 void add_aux_tiles(char *name, struct zip_info *info);
 void cat(FILE *in, FILE *out);
 int item_order_by_type(enum item_type type);
+int item_bin_max_order(struct item_bin *ib);
 
 
 /* osm.c */
@@ -282,6 +286,7 @@ struct maptool_osm {
 	FILE *line2poi;
 	FILE *poly2poi;
 	FILE *towns;
+	FILE *changes;
 };
 
 /** Type of a relation member. */
@@ -292,6 +297,19 @@ enum relation_member_type {
 	rel_member_relation,
 };
 
+/** An object created, modified or deleted by an osmChange file */
+struct osm_change {
+	enum relation_member_type type;
+	osmid id;
+};
+
+/** A node of the previous run which an osmChange file moved */
+struct osm_moved_node {
+	osmid id;
+	struct coord from;	/**< The coordinates in the old map */
+	struct coord to;
+};
+
 void osm_warning(char *type, osmid id, int cont, char *fmt, ...);
 void osm_info(char *type, osmid id, int cont, char *fmt, ...);
 void osm_add_tag(char *k, char *v);
@@ -304,7 +322,9 @@ void osm_end_way(struct maptool_osm *osm);
 void osm_end_node(struct maptool_osm *osm);
 void osm_add_nd(osmid ref);
 osmid item_bin_get_id(struct item_bin *ib);
+void node_index_build(void);
 void flush_nodes(int final);
+void merge_node_table(char *base, FILE *ways, FILE *moved);
 void sort_countries(int keep_tmpfiles);
 void process_associated_streets(FILE *in, struct files_relation_processing *files_relproc);
 void process_house_number_interpolations(FILE *in, struct files_relation_processing *files_relproc);
@@ -376,6 +396,15 @@ void tempfile_rename(char *suffix, char *from, char *to);
 /* tile.c */
 extern GHashTable *tile_hash,*tile_hash2;
 
+/** Number of consecutive items sharing one bounding box in the tile index. */
+#define TILE_INDEX_GROUP 8
+
+/** Flag in the clen of an item in a map tile whose coordinates are stored as zig-zag delta varints. */
+#define ITEM_BIN_COORDS_COMPACT 0x80000000
+
+/** Map version of maps containing items with ITEM_BIN_COORDS_COMPACT, older navit versions refuse them. */
+#define MAP_VERSION_COMPACT_COORDS 16
+
 struct aux_tile {
 	char *name;
 	char *filename;
@@ -398,8 +427,19 @@ void merge_tiles(struct tile_info *info);
 struct attr map_information_attrs[32];
 void index_init(struct zip_info *info, int version);
 void index_submap_add(struct tile_info *info, struct tile_head *th);
+int tile_index_add(char *data, int size, char **ret);
+int tile_compact_coords(char *data, int size, char **ret);
+
+/* update.c */
+int update_count_references(char *oldmap, FILE *changes, FILE *moved);
+int update_map(char *oldmap, FILE *changes, FILE *moved, FILE **in, int in_count, struct zip_info *zip_info);
 
 /* zip.c */
+struct zip_member;
+struct zip_member *zip_member_new(struct zip_info *zip_info, char *data, int data_size);
+struct zip_member *zip_member_new_compressed(char *data, int data_size, int comp_size, int method, int crc);
+char *zip_member_uncompress(char *data, int comp_size, int data_size, int method);
+void zip_member_write(struct zip_info *zip_info, struct zip_member *member, char *name, int filelen);
 void write_zipmember(struct zip_info *zip_info, char *name, int filelen, char *data, int data_size);
 void zip_write_index(struct zip_info *info);
 int zip_write_directory(struct zip_info *info);
@@ -408,6 +448,7 @@ void zip_set_md5(struct zip_info *info, int on);
 int zip_get_md5(struct zip_info *info, unsigned char *out);
 void zip_set_zip64(struct zip_info *info, int on);
 void zip_set_compression_level(struct zip_info *info, int level);
+int zip_set_compression_method(struct zip_info *info, int method);
 void zip_set_maxnamelen(struct zip_info *info, int max);
 int zip_get_maxnamelen(struct zip_info *info);
 int zip_add_member(struct zip_info *info);
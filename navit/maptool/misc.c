@@ -44,6 +44,9 @@
 #include "linguistics.h"
 #include "plugin.h"
 #include "maptool.h"
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
 
 #define phase1_coord_max 16384
 
@@ -229,26 +232,38 @@ item_order_by_type(enum item_type type)
 	return max;
 }
 
+/**
+ * @brief Returns the deepest tile level an item is put into
+ *
+ * @param ib The item
+ * @return The level by item_order_by_type(), limited by the item's attr_order
+ */
+int
+item_bin_max_order(struct item_bin *ib)
+{
+	struct attr_bin *a;
+	int max=item_order_by_type(ib->type);
+
+	a=item_bin_get_attr_bin(ib, attr_order, NULL);
+	if(a) {
+		int max2=((struct range *)(a+1))->max;
+		if(max>max2)
+			max=max2;
+	}
+	return max;
+}
+
 static void
 phase34_process_file(struct tile_info *info, FILE *in, FILE *reference)
 {
 	struct item_bin *ib;
-	struct attr_bin *a;
-	int max;
 
 	while ((ib=read_item(in))) {
 		if (ib->type < 0x80000000)
 			processed_nodes++;
 		else
 			processed_ways++;
-		max=item_order_by_type(ib->type);
-		a=item_bin_get_attr_bin(ib, attr_order, NULL);
-		if(a) {
-			int max2=((struct range *)(a+1))->max;
-			if(max>max2)
-				max=max2;
-		}
-		tile_write_item_minmax(info, ib, reference, 0, max);
+		tile_write_item_minmax(info, ib, reference, 0, item_bin_max_order(ib));
 	}
 }
 
@@ -317,6 +332,184 @@ phase4(FILE **in, int in_count, int with_range, char *suffix, FILE *tilesdir_out
 	return phase34(&info, zip_info, in, NULL, in_count, with_range);
 }
 
+/**
+ * @brief A tile of a slice which is prepared for the zip file by tile_job_prepare()
+ */
+struct tile_job {
+	struct tile_head *th;
+	char *data_index,*data_compact;
+	struct zip_member *member;
+	int done;
+};
+
+/**
+ * @brief Writes the tiles of a slice to the zip file
+ *
+ * With more than one thread, the tiles are prepared by worker threads. The jobs are kept in a ring of slots:
+ * tile_pipeline_add() fills slot queued, the workers take slot prepare, and the tiles are written from slot write
+ * once they are done, so the zip file is the same as without threads.
+ */
+struct tile_pipeline {
+	struct zip_info *zip_info;
+	struct tile_job *jobs;
+	int slots;
+	int queued, prepare, write;
+	int eof;
+	int started;		/**< The number of worker threads, 0 to prepare the tiles on the calling thread */
+#ifdef HAVE_PTHREAD
+	pthread_t *workers;
+	pthread_mutex_t mutex;
+	pthread_cond_t work_cond;	/**< Signalled when a tile has been queued or all tiles are queued */
+	pthread_cond_t done_cond;	/**< Signalled when a tile has been prepared */
+#endif
+};
+
+/**
+ * @brief Adds the index, compacts the coordinates and compresses a tile
+ *
+ * This doesn't touch any global state, so the workers of a tile_pipeline can run it in parallel.
+ */
+static void
+tile_job_prepare(struct tile_job *job, struct zip_info *zip_info)
+{
+	char *data=job->th->zip_data;
+	int tile_size=job->th->total_size,len;
+
+	if (tile_index && (len=tile_index_add(data, tile_size, &job->data_index))) {
+		data=job->data_index;
+		tile_size=len;
+	}
+	if (compact_coords && (len=tile_compact_coords(data, tile_size, &job->data_compact))) {
+		data=job->data_compact;
+		tile_size=len;
+	}
+	job->member=zip_member_new(zip_info, data, tile_size);
+}
+
+static void
+tile_job_write(struct tile_job *job, struct zip_info *zip_info)
+{
+	zip_member_write(zip_info, job->member, job->th->name, zip_get_maxnamelen(zip_info));
+	g_free(job->data_index);
+	g_free(job->data_compact);
+	memset(job, 0, sizeof(*job));
+}
+
+#ifdef HAVE_PTHREAD
+static void *
+tile_pipeline_worker(void *data)
+{
+	struct tile_pipeline *pl=data;
+	struct tile_job *job;
+
+	pthread_mutex_lock(&pl->mutex);
+	for (;;) {
+		while (pl->prepare == pl->queued && !pl->eof)
+			pthread_cond_wait(&pl->work_cond, &pl->mutex);
+		if (pl->prepare == pl->queued)
+			break;
+		job=&pl->jobs[pl->prepare++ % pl->slots];
+		pthread_mutex_unlock(&pl->mutex);
+		tile_job_prepare(job, pl->zip_info);
+		pthread_mutex_lock(&pl->mutex);
+		job->done=1;
+		pthread_cond_broadcast(&pl->done_cond);
+	}
+	pthread_mutex_unlock(&pl->mutex);
+	return NULL;
+}
+
+/**
+ * @brief Writes the oldest tile of the pipeline, waiting for it to be prepared
+ */
+static void
+tile_pipeline_write(struct tile_pipeline *pl)
+{
+	struct tile_job *job=&pl->jobs[pl->write % pl->slots];
+
+	pthread_mutex_lock(&pl->mutex);
+	while (!job->done)
+		pthread_cond_wait(&pl->done_cond, &pl->mutex);
+	pthread_mutex_unlock(&pl->mutex);
+	tile_job_write(job, pl->zip_info);
+	pl->write++;
+}
+#endif
+
+static void
+tile_pipeline_start(struct tile_pipeline *pl, struct zip_info *zip_info, int count)
+{
+	memset(pl, 0, sizeof(*pl));
+	pl->zip_info=zip_info;
+	pl->slots=1;
+#ifdef HAVE_PTHREAD
+	if (count > 1) {
+		pl->slots=count*4;
+		pl->workers=g_new(pthread_t, count);
+		pthread_mutex_init(&pl->mutex, NULL);
+		pthread_cond_init(&pl->work_cond, NULL);
+		pthread_cond_init(&pl->done_cond, NULL);
+		for (pl->started = 0 ; pl->started < count ; pl->started++)
+			if (pthread_create(&pl->workers[pl->started], NULL, tile_pipeline_worker, pl))
+				break;
+		if (!pl->started)
+			fprintf(stderr,"Failed to start tile threads, compressing tiles on the main thread\n");
+	}
+#endif
+	pl->jobs=g_new0(struct tile_job, pl->slots);
+}
+
+static void
+tile_pipeline_add(struct tile_pipeline *pl, struct tile_head *th)
+{
+	struct tile_job *job;
+
+	if (!pl->started) {
+		job=pl->jobs;
+		job->th=th;
+		tile_job_prepare(job, pl->zip_info);
+		tile_job_write(job, pl->zip_info);
+		return;
+	}
+#ifdef HAVE_PTHREAD
+	if (pl->queued-pl->write == pl->slots)
+		tile_pipeline_write(pl);
+	job=&pl->jobs[pl->queued % pl->slots];
+	job->th=th;
+	pthread_mutex_lock(&pl->mutex);
+	pl->queued++;
+	pthread_cond_signal(&pl->work_cond);
+	pthread_mutex_unlock(&pl->mutex);
+	/* Write what is already done, so the workers don't wait for slots */
+	while (pl->write < pl->queued && pl->jobs[pl->write % pl->slots].done)
+		tile_pipeline_write(pl);
+#endif
+}
+
+static void
+tile_pipeline_finish(struct tile_pipeline *pl)
+{
+#ifdef HAVE_PTHREAD
+	int i;
+
+	if (pl->workers) {
+		pthread_mutex_lock(&pl->mutex);
+		pl->eof=1;
+		pthread_cond_broadcast(&pl->work_cond);
+		pthread_mutex_unlock(&pl->mutex);
+		while (pl->write < pl->queued)
+			tile_pipeline_write(pl);
+		for (i = 0 ; i < pl->started ; i++)
+			pthread_join(pl->workers[i], NULL);
+		pthread_cond_destroy(&pl->done_cond);
+		pthread_cond_destroy(&pl->work_cond);
+		pthread_mutex_destroy(&pl->mutex);
+		g_free(pl->workers);
+	}
+#endif
+	g_free(pl->jobs);
+}
+
 static int
 process_slice(FILE **in, FILE **reference, int in_count, int with_range, long long size, char *suffix, struct zip_info *zip_info)
 {
@@ -324,6 +517,7 @@ process_slice(FILE **in, FILE **reference, int in_count, int with_range, long lo
 	char *slice_data,*zip_data;
 	int zipfiles=0;
 	struct tile_info info;
+	struct tile_pipeline pl;
 	int i;
 
 	slice_data=malloc(size);
@@ -351,6 +545,7 @@ process_slice(FILE **in, FILE **reference, int in_count, int with_range, long lo
 	info.tilesdir_out=NULL;
 	phase34(&info, zip_info, in, reference, in_count, with_range);
 
+	tile_pipeline_start(&pl, zip_info, threads);
 	for (th=tile_head_root;th;th=th->next) {
 		if (!th->process)
 			continue;
@@ -359,12 +554,13 @@ process_slice(FILE **in, FILE **reference, int in_count, int with_range, long lo
 				fprintf(stderr,"Size error '%s': %d vs %d\n", th->name, th->total_size, th->total_size_used);
 				exit(1);
 			}
-			write_zipmember(zip_info, th->name, zip_get_maxnamelen(zip_info), th->zip_data, th->total_size);
+			tile_pipeline_add(&pl, th);
 			zipfiles++;
 		} else {
 			dbg_assert(fwrite(th->zip_data, th->total_size, 1, zip_get_index(zip_info))==1);
 		}
 	}
+	tile_pipeline_finish(&pl);
 	free(slice_data);
 
 	return zipfiles;
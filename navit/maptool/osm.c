@@ -1335,17 +1335,179 @@ node_buffer_to_hash(void)
 		g_hash_table_insert(node_hash, (gpointer)(long long)(ni[i].nd_id), (gpointer)(long long)i);
 }
 
+/**
+ * @brief Index of the nodes in node_buffer by their id
+ *
+ * The nodes in node_buffer are sorted by id. The id range of the buffer is split into buckets of
+ * 2^shift ids, and for each bucket the index of its first node is kept, so a node is found by
+ * looking at the nodes of one bucket only. For dense id ranges, shift is 0 or 1 and the table is
+ * a flat array indexed by id. Sparse ranges get larger buckets, so the table never has more
+ * entries than half the number of nodes.
+ */
+static struct node_index {
+	unsigned char *base;	/**< node_buffer.base the index was built for */
+	long long size;		/**< node_buffer.size the index was built for */
+	osmid min_id;
+	int shift;
+	long long buckets;
+	long long *first;	/**< Index of the first node of each bucket, buckets+1 entries */
+} node_index;
+
+static int
+node_item_cmp(const void *a, const void *b)
+{
+	const struct node_item *na=a,*nb=b;
+	if (na->nd_id < nb->nd_id)
+		return -1;
+	if (na->nd_id > nb->nd_id)
+		return 1;
+	return 0;
+}
+
+/**
+ * @brief Builds the index of the nodes in node_buffer
+ *
+ * Has to be called whenever another slice of the nodes is loaded into node_buffer.
+ */
+void
+node_index_build(void)
+{
+	struct node_item *ni=(struct node_item *)node_buffer.base;
+	long long i,b,count=node_buffer.size/sizeof(struct node_item);
+	osmid span;
+
+	g_free(node_index.first);
+	memset(&node_index, 0, sizeof(node_index));
+	node_index.base=node_buffer.base;
+	node_index.size=node_buffer.size;
+	if (!count)
+		return;
+	node_index.min_id=ni[0].nd_id;
+	span=ni[count-1].nd_id-node_index.min_id;
+	while ((span >> node_index.shift) >= count/2+1)
+		node_index.shift++;
+	node_index.buckets=(span >> node_index.shift)+1;
+	node_index.first=g_new(long long, node_index.buckets+1);
+	for (i = 0, b = 0 ; i < count ; i++) {
+		long long nb=(ni[i].nd_id-node_index.min_id) >> node_index.shift;
+		while (b <= nb)
+			node_index.first[b++]=i;
+	}
+	while (b <= node_index.buckets)
+		node_index.first[b++]=count;
+}
+
 void
 flush_nodes(int final)
 {
 	fprintf(stderr,"flush_nodes %d\n",final);
+	/* Nodes which arrived out of sequence are sorted, so they can be indexed like the others */
+	if (node_hash)
+		qsort(node_buffer.base, node_buffer.size/sizeof(struct node_item), sizeof(struct node_item), node_item_cmp);
 	save_buffer("coords.tmp",&node_buffer,slices*slice_size);
 	if (!final) {
 		node_buffer.size=0;
-	}
+	} else
+		node_index_build();
 	slices++;
 }
 
+/**
+ * @brief Merges the nodes of an osmChange file into the node table of a previous run
+ *
+ * Instead of flush_nodes(), this writes coords.tmp from the slices of base, with the nodes in
+ * node_buffer (those of the change file) taking precedence. Nodes which are not in base yet are
+ * added to its last slice, so every slice of coords.tmp stays sorted. As after flush_nodes(), the
+ * last slice is left in node_buffer with its references by ways counted.
+ *
+ * @param base The node table of the previous run
+ * @param ways The ways of the change file, to count the references of the last slice
+ * @param moved Gets a struct osm_moved_node for every node of base the change file moved
+ */
+void
+merge_node_table(char *base, FILE *ways, FILE *moved)
+{
+	struct node_item *changes=(struct node_item *)node_buffer.base,*ni;
+	long long count=node_buffer.size/sizeof(struct node_item),base_size,size,i,j,added=0;
+	FILE *f;
+	int s,base_slices;
+
+	if (slices) {
+		fprintf(stderr,"FATAL: The nodes of the change file don't fit into one slice, increase -S\n");
+		exit(1);
+	}
+	f=fopen(base,"rb");
+	base_size=0;
+	if (f) {
+		fclose(f);
+		base_size=sizeof_buffer(base);
+	}
+	if (!base_size) {
+		fprintf(stderr,"WARNING: No node table %s of a previous run found, ways can only use the nodes of the change file\n", base);
+		if (!node_buffer.size) {
+			fprintf(stderr,"No nodes found - looks like an invalid input file.\n");
+			exit(1);
+		}
+		flush_nodes(1);
+		return;
+	}
+	qsort(changes, count, sizeof(struct node_item), node_item_cmp);
+	for (i = 0 ; i < count ; i++)
+		changes[i].ref_way=0;
+	node_buffer.base=NULL;
+	node_buffer.size=node_buffer.malloced=0;
+	base_slices=(base_size+slice_size-1)/slice_size;
+	unlink("coords.tmp");
+	for (s = 0 ; s < base_slices ; s++) {
+		load_buffer(base, &node_buffer, s*slice_size, slice_size);
+		ni=(struct node_item *)node_buffer.base;
+		size=node_buffer.size/sizeof(struct node_item);
+		for (i = 0 ; i < size ; i++) {
+			struct node_item *c=bsearch(&ni[i], changes, count, sizeof(struct node_item), node_item_cmp);
+			if (c) {
+				if (moved && (ni[i].c.x != c->c.x || ni[i].c.y != c->c.y)) {
+					struct osm_moved_node mn;
+					memset(&mn, 0, sizeof(mn));
+					mn.id=ni[i].nd_id;
+					mn.from=ni[i].c;
+					mn.to=c->c;
+					dbg_assert(fwrite(&mn, sizeof(mn), 1, moved)==1);
+				}
+				ni[i].c=c->c;
+				c->ref_way=1;
+			}
+			ni[i].ref_way=0;
+		}
+		if (s < base_slices-1)
+			save_buffer("coords.tmp",&node_buffer,s*slice_size);
+	}
+	for (i = 0 ; i < count ; i++)
+		if (!changes[i].ref_way)
+			added++;
+	node_buffer.base=realloc(node_buffer.base, node_buffer.size+added*sizeof(struct node_item));
+	dbg_assert(node_buffer.base != NULL);
+	ni=(struct node_item *)(node_buffer.base+node_buffer.size);
+	for (i = 0, j = 0 ; i < count ; i++) {
+		if (!changes[i].ref_way)
+			ni[j++]=changes[i];
+	}
+	node_buffer.size+=added*sizeof(struct node_item);
+	node_buffer.malloced=node_buffer.size;
+	qsort(node_buffer.base, node_buffer.size/sizeof(struct node_item), sizeof(struct node_item), node_item_cmp);
+	save_buffer("coords.tmp",&node_buffer,(long long)(base_slices-1)*slice_size);
+	free(changes);
+	fprintf(stderr,"Merged %lld nodes of the change file into %s, %lld of them new\n", count, base, added);
+	/* Nodes added to the last slice can overflow into a new one */
+	slices=(sizeof_buffer("coords.tmp")+slice_size-1)/slice_size;
+	if (slices > base_slices)
+		load_buffer("coords.tmp",&node_buffer,(long long)(slices-1)*slice_size, slice_size);
+	node_index_build();
+	if (ways) {
+		ref_ways(ways);
+		save_buffer("coords.tmp",&node_buffer,(long long)(slices-1)*slice_size);
+	}
+}
+
 static struct node_item*
 allocate_node_item_in_buffer(void) {
       struct node_item* new_node;
@@ -1415,67 +1577,30 @@ clear_node_item_buffer(void)
       }
 }
 
-static long long
-node_item_find_index_in_ordered_list(osmid id)
-{
-      struct node_item *node_buffer_base=(struct node_item *)(node_buffer.base);
-      long long node_count=node_buffer.size/sizeof(struct node_item);
-      long long search_step=node_count>4 ? node_count/4 : 1;
-      long long search_index=node_count/2;
-      if (node_buffer_base[0].nd_id > id)
-	      return -1;
-      if (node_buffer_base[node_count-1].nd_id < id)
-	      return -1;
-      while (node_buffer_base[search_index].nd_id != id) {
-#if 0
-	      fprintf(stderr,"search_index=%d node_count=%d search_step=%d id=%d node_buffer_base[search_index].id=%d\n",
-		  search_index, node_count, search_step, id, node_buffer_base[search_index].id);
-#endif
-	      if (node_buffer_base[search_index].nd_id < id) {
-		      search_index+=search_step;
-		      if (search_step == 1) {
-			      if (search_index >= node_count)
-				      return -1;
-			      if (node_buffer_base[search_index].nd_id > id)
-				      return -1;
-		      } else {
-			      if (search_index >= node_count)
-				      search_index=node_count-1;
-		      }
-	      } else {
-		      search_index-=search_step;
-		      if (search_step == 1) {
-			      if (search_index < 0)
-				      return -1;
-			      if (node_buffer_base[search_index].nd_id < id)
-				      return -1;
-		      } else {
-			      if (search_index < 0)
-				      search_index=0;
-		      }
-	      }
-	      if (search_step > 1)
-		      search_step/=2;
-      }
-      return search_index;
-}
-
 static struct node_item *
 node_item_get(osmid id)
 {
       struct node_item *node_buffer_base=(struct node_item *)(node_buffer.base);
-      long long result_index;
-      if (node_hash) {
-            // Use g_hash_table_lookup_extended instead of g_hash_table_lookup
-            // to distinguish a key with a value 0 from a missing key.
-            if (!g_hash_table_lookup_extended (node_hash, (gpointer)(id), NULL,
-                                           (gpointer)&result_index)) {
-                  result_index=-1;
-            }
-      } else {
-	      result_index=node_item_find_index_in_ordered_list(id);
+      long long b,lo,hi,mid;
+      if (node_index.base != node_buffer.base || node_index.size != node_buffer.size)
+	      node_index_build();
+      if (!node_index.first || id < node_index.min_id)
+	      return NULL;
+      b=(id-node_index.min_id) >> node_index.shift;
+      if (b >= node_index.buckets)
+	      return NULL;
+      lo=node_index.first[b];
+      hi=node_index.first[b+1];
+      while (lo < hi) {
+	      mid=(lo+hi)/2;
+	      if (node_buffer_base[mid].nd_id < id)
+		      lo=mid+1;
+	      else if (node_buffer_base[mid].nd_id > id)
+		      hi=mid;
+	      else
+		      return node_buffer_base+mid;
       }
-      return result_index!=-1 ? node_buffer_base+result_index : NULL;
+      return NULL;
 }
 
 #if 0
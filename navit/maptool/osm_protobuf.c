@@ -22,12 +22,16 @@
 #include <unistd.h>
 #include <time.h>
 #include <zlib.h>
+#include <sys/time.h>
 #include "maptool.h"
 #include "debug.h"
 #include "linguistics.h"
 #include "file.h"
 #include "generated-code/fileformat.pb-c.h"
 #include "generated-code/osmformat.pb-c.h"
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
 
 
 static double latlon_scale=10000000.0;
@@ -329,11 +333,9 @@ process_relation(OSMPBF__PrimitiveBlock *primitive_block, OSMPBF__Relation *rela
 }
 
 static void
-process_osmdata(OSMPBF__Blob *blob, unsigned char *data, struct maptool_osm *osm)
+process_primitive_block(OSMPBF__PrimitiveBlock *primitive_block, struct maptool_osm *osm)
 {
 	int i,j;
-	OSMPBF__PrimitiveBlock *primitive_block;
-	primitive_block=osmpbf__primitive_block__unpack(&protobuf_c_system_allocator, blob->raw_size, data);
 	for (i = 0 ; i < primitive_block->n_primitivegroup ; i++) {
 		OSMPBF__PrimitiveGroup *primitive_group=primitive_block->primitivegroup[i];
 		process_dense(primitive_block, primitive_group->dense, osm);
@@ -345,9 +347,254 @@ process_osmdata(OSMPBF__Blob *blob, unsigned char *data, struct maptool_osm *osm
 		printf("Group %p %d %d %d %d\n",primitive_group->dense,primitive_group->n_nodes,primitive_group->n_ways,primitive_group->n_relations,primitive_group->n_changesets);
 #endif
 	}
+}
+
+static void
+process_osmdata(OSMPBF__Blob *blob, unsigned char *data, struct maptool_osm *osm)
+{
+	OSMPBF__PrimitiveBlock *primitive_block;
+	primitive_block=osmpbf__primitive_block__unpack(&protobuf_c_system_allocator, blob->raw_size, data);
+	process_primitive_block(primitive_block, osm);
 	osmpbf__primitive_block__free_unpacked(primitive_block, &protobuf_c_system_allocator);
 }
 
+static double
+protobuf_time(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec+tv.tv_usec/1000000.0;
+}
+
+static void
+protobuf_report(int blocks, long long bytes, double start)
+{
+	double secs=protobuf_time()-start;
+	double mb=bytes/(1024.0*1024.0);
+	fprintf(stderr,"PROGRESS: Read %d protobuf blocks (%.1f MB) in %.1f s, %.1f MB/s\n", blocks, mb, secs, secs > 0 ? mb/secs : 0);
+}
+
+#ifdef HAVE_PTHREAD
+/**
+ * @brief A file block decoded by the threads of map_collect_data_osm_protobuf_parallel()
+ */
+struct protobuf_job {
+	OSMPBF__BlobHeader *header;
+	unsigned char *buffer;				/**< The blob as read from the file */
+	OSMPBF__PrimitiveBlock *primitive_block;	/**< Set by the decoder for OSMData blocks */
+	int failed;					/**< Set by the decoder if the block could not be decoded */
+	int done;
+};
+
+/**
+ * @brief The state shared by the reader, the decoders and the emitter
+ *
+ * Jobs are kept in a ring of slots. The reader fills slot read, the decoders take slot decode, and the emitter
+ * processes slot emit once it is done, so the blocks are processed in file order.
+ */
+struct protobuf_pipeline {
+	struct protobuf_job *jobs;
+	int slots;
+	int read, decode, emit;
+	int eof;
+	pthread_mutex_t mutex;
+	pthread_cond_t work_cond;	/**< Signalled when a job has been read or the end of the file is reached */
+	pthread_cond_t done_cond;	/**< Signalled when a job has been decoded */
+};
+
+static void
+protobuf_decode(struct protobuf_job *job)
+{
+	OSMPBF__Blob *blob;
+	unsigned char *data;
+
+	blob=osmpbf__blob__unpack(&protobuf_c_system_allocator, job->header->datasize, job->buffer);
+	free(job->buffer);
+	job->buffer=NULL;
+	if (!blob) {
+		job->failed=1;
+		return;
+	}
+	data=uncompress_blob(blob);
+	if (data) {
+		if (!strcmp(job->header->type,"OSMHeader"))
+			process_osmheader(blob, data);
+		else {
+			job->primitive_block=osmpbf__primitive_block__unpack(&protobuf_c_system_allocator, blob->raw_size, data);
+			if (!job->primitive_block)
+				job->failed=1;
+		}
+		free(data);
+	} else
+		job->failed=1;
+	osmpbf__blob__free_unpacked(blob, &protobuf_c_system_allocator);
+}
+
+static void *
+protobuf_decoder(void *data)
+{
+	struct protobuf_pipeline *pl=data;
+	struct protobuf_job *job;
+
+	pthread_mutex_lock(&pl->mutex);
+	for (;;) {
+		while (pl->decode == pl->read && !pl->eof)
+			pthread_cond_wait(&pl->work_cond, &pl->mutex);
+		if (pl->decode == pl->read)
+			break;
+		job=&pl->jobs[pl->decode++ % pl->slots];
+		pthread_mutex_unlock(&pl->mutex);
+		protobuf_decode(job);
+		pthread_mutex_lock(&pl->mutex);
+		job->done=1;
+		pthread_cond_broadcast(&pl->done_cond);
+	}
+	pthread_mutex_unlock(&pl->mutex);
+	return NULL;
+}
+
+/**
+ * @brief Emits the oldest job of the pipeline, waiting for it to be decoded
+ *
+ * @return 1 on success, 0 if the block could not be decoded
+ */
+static int
+protobuf_emit(struct protobuf_pipeline *pl, struct maptool_osm *osm)
+{
+	struct protobuf_job *job=&pl->jobs[pl->emit % pl->slots];
+	int ret=1;
+
+	pthread_mutex_lock(&pl->mutex);
+	while (!job->done)
+		pthread_cond_wait(&pl->done_cond, &pl->mutex);
+	pthread_mutex_unlock(&pl->mutex);
+	if (job->failed) {
+		fprintf(stderr,"Not a valid protobuf file. Unable to decode block %d\n", pl->emit);
+		ret=0;
+	} else if (job->primitive_block)
+		process_primitive_block(job->primitive_block, osm);
+	if (job->primitive_block)
+		osmpbf__primitive_block__free_unpacked(job->primitive_block, &protobuf_c_system_allocator);
+	osmpbf__blob_header__free_unpacked(job->header, &protobuf_c_system_allocator);
+	memset(job, 0, sizeof(*job));
+	pl->emit++;
+	return ret;
+}
+
+/**
+ * @brief Reads a protobuf file with several threads decoding the file blocks
+ *
+ * The calling thread reads the blocks and hands them to the decoder threads, which inflate and
+ * unpack them. The calling thread then processes the decoded blocks in file order, so
+ * osm_add_node() and friends are called exactly like map_collect_data_osm_protobuf() does without threads.
+ * A block which can not be read or decoded stops the pipeline, the blocks after it are not processed.
+ *
+ * @param in The file to read
+ * @param osm The files to write to
+ * @param count The number of decoder threads
+ * @return 1 on success, 0 on errors
+ */
+static int
+map_collect_data_osm_protobuf_parallel(FILE *in, struct maptool_osm *osm, int count)
+{
+	struct protobuf_pipeline pl;
+	struct protobuf_job *job;
+	OSMPBF__BlobHeader *header;
+	pthread_t *decoders=g_new(pthread_t, count);
+	int i,started,ret=1;
+	long long bytes=0;
+	double start=protobuf_time();
+
+	memset(&pl, 0, sizeof(pl));
+	pl.slots=count*4;
+	pl.jobs=g_new0(struct protobuf_job, pl.slots);
+	pthread_mutex_init(&pl.mutex, NULL);
+	pthread_cond_init(&pl.work_cond, NULL);
+	pthread_cond_init(&pl.done_cond, NULL);
+	for (started = 0 ; started < count ; started++)
+		if (pthread_create(&decoders[started], NULL, protobuf_decoder, &pl))
+			break;
+	if (!started) {
+		fprintf(stderr,"Failed to start protobuf decoder threads\n");
+		ret=-1;
+	}
+	while (ret == 1 && (header=read_header(in))) {
+		if (strcmp(header->type,"OSMHeader") && strcmp(header->type,"OSMData")) {
+			printf("skipping fileblock of unknown type '%s'\n", header->type);
+			osmpbf__blob_header__free_unpacked(header, &protobuf_c_system_allocator);
+			ret=0;
+			break;
+		}
+		if (header->datasize > MAX_BLOB_LENGTH) {
+			fprintf(stderr,"Not a valid protobuf file. Invalid block size in input: %d, max is %d. \n",
+				header->datasize, MAX_BLOB_LENGTH);
+			osmpbf__blob_header__free_unpacked(header, &protobuf_c_system_allocator);
+			ret=0;
+			break;
+		}
+		if (pl.read-pl.emit == pl.slots && !protobuf_emit(&pl, osm)) {
+			osmpbf__blob_header__free_unpacked(header, &protobuf_c_system_allocator);
+			ret=0;
+			break;
+		}
+		job=&pl.jobs[pl.read % pl.slots];
+		job->header=header;
+		job->buffer=malloc(header->datasize);
+		if (!job->buffer || fread(job->buffer, header->datasize, 1, in) != 1) {
+			fprintf(stderr,"Not a valid protobuf file. Unable to read block %d\n", pl.read);
+			free(job->buffer);
+			job->buffer=NULL;
+			osmpbf__blob_header__free_unpacked(header, &protobuf_c_system_allocator);
+			job->header=NULL;
+			ret=0;
+			break;
+		}
+		bytes+=header->datasize;
+		pthread_mutex_lock(&pl.mutex);
+		pl.read++;
+		pthread_cond_signal(&pl.work_cond);
+		pthread_mutex_unlock(&pl.mutex);
+		/* Process what is already decoded, so the decoders don't wait for slots */
+		while (ret == 1 && pl.emit < pl.read && pl.jobs[pl.emit % pl.slots].done) {
+			if (!protobuf_emit(&pl, osm))
+				ret=0;
+		}
+	}
+	if (ret == 1 && !feof(in)) {
+		fprintf(stderr,"Not a valid protobuf file. Unable to read block header %d\n", pl.read);
+		ret=0;
+	}
+	pthread_mutex_lock(&pl.mutex);
+	pl.eof=1;
+	pthread_cond_broadcast(&pl.work_cond);
+	pthread_mutex_unlock(&pl.mutex);
+	while (pl.emit < pl.read) {
+		if (ret != 1) {
+			/* Only wait for the jobs to be decoded and free them */
+			pthread_mutex_lock(&pl.mutex);
+			while (!pl.jobs[pl.emit % pl.slots].done)
+				pthread_cond_wait(&pl.done_cond, &pl.mutex);
+			pthread_mutex_unlock(&pl.mutex);
+			job=&pl.jobs[pl.emit++ % pl.slots];
+			if (job->primitive_block)
+				osmpbf__primitive_block__free_unpacked(job->primitive_block, &protobuf_c_system_allocator);
+			osmpbf__blob_header__free_unpacked(job->header, &protobuf_c_system_allocator);
+		} else if (!protobuf_emit(&pl, osm))
+			ret=0;
+	}
+	for (i = 0 ; i < started ; i++)
+		pthread_join(decoders[i], NULL);
+	pthread_cond_destroy(&pl.done_cond);
+	pthread_cond_destroy(&pl.work_cond);
+	pthread_mutex_destroy(&pl.mutex);
+	g_free(pl.jobs);
+	g_free(decoders);
+	if (ret != -1)
+		protobuf_report(pl.read, bytes, start);
+	return ret;
+}
+#endif
+
 
 int
 map_collect_data_osm_protobuf(FILE *in, struct maptool_osm *osm)
@@ -355,15 +602,34 @@ map_collect_data_osm_protobuf(FILE *in, struct maptool_osm *osm)
 	OSMPBF__BlobHeader *header;
 	OSMPBF__Blob *blob;
 	unsigned char *data;
-	unsigned char *buffer=malloc(MAX_BLOB_LENGTH);
+	unsigned char *buffer;
+	int blocks=0;
+	long long bytes=0;
+	double start=protobuf_time();
 
+#ifdef HAVE_PTHREAD
+	if (threads > 1) {
+		int ret=map_collect_data_osm_protobuf_parallel(in, osm, threads);
+		if (ret != -1)
+			return ret;
+	}
+#endif
+	buffer=malloc(MAX_BLOB_LENGTH);
 #if 0
 	printf("<?xml version='1.0' encoding='UTF-8'?>\n");
 	printf("<osm version=\"0.6\" generator=\"pbf2osm\">\n");
 #endif
 	while ((header=read_header(in))) {
 		blob=read_blob(header, in, buffer);
-		data=uncompress_blob(blob);
+		data=blob ? uncompress_blob(blob) : NULL;
+		if (!data) {
+			fprintf(stderr,"Not a valid protobuf file. Unable to read block %d\n", blocks);
+			if (blob)
+				osmpbf__blob__free_unpacked(blob, &protobuf_c_system_allocator);
+			osmpbf__blob_header__free_unpacked(header, &protobuf_c_system_allocator);
+			free(buffer);
+			return 0;
+		}
 		if (!strcmp(header->type,"OSMHeader")) {
 			process_osmheader(blob, data);
 		} else if (!strcmp(header->type,"OSMData")) {
@@ -374,10 +640,17 @@ map_collect_data_osm_protobuf(FILE *in, struct maptool_osm *osm)
 			return 0;
 		}
 		free(data);
+		blocks++;
+		bytes+=header->datasize;
 		osmpbf__blob__free_unpacked(blob, &protobuf_c_system_allocator);
 		osmpbf__blob_header__free_unpacked(header, &protobuf_c_system_allocator);
 	}
 	free(buffer);
+	if (!feof(in)) {
+		fprintf(stderr,"Not a valid protobuf file. Unable to read block header %d\n", blocks);
+		return 0;
+	}
+	protobuf_report(blocks, bytes, start);
 #if 0
 	printf("</osm>\n");
 #endif
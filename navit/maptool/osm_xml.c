@@ -25,6 +25,7 @@
 #include <unistd.h>
 #endif
 #include "maptool.h"
+#include "debug.h"
 
 int
 osm_xml_get_attribute(char *xml, char *attribute, char *buffer, int buffer_size)
@@ -180,6 +181,30 @@ parse_nd(char *p)
 	return 1;
 }
 
+/**
+ * @brief Records an object of an osmChange file in osm->changes
+ *
+ * @param p The line starting the object
+ * @param type The type of the object
+ * @param osm The output files, nothing is recorded if osm->changes is NULL
+ * @return 1 on success, 0 if the object has no id
+ */
+static int
+parse_change(char *p, enum relation_member_type type, struct maptool_osm *osm)
+{
+	char id_buffer[BUFFER_SIZE];
+	struct osm_change change;
+	if (!osm_xml_get_attribute(p, "id", id_buffer, BUFFER_SIZE))
+		return 0;
+	if (osm->changes) {
+		memset(&change, 0, sizeof(change));
+		change.type=type;
+		change.id=atoll(id_buffer);
+		dbg_assert(fwrite(&change, sizeof(change), 1, osm->changes)==1);
+	}
+	return 1;
+}
+
 static int
 xml_declaration_in_line(char* buffer){
 	return !strncmp(buffer, "<?xml ", 6);
@@ -191,6 +216,7 @@ map_collect_data_osm(FILE *in, struct maptool_osm *osm)
 	int size=BUFFER_SIZE;
 	char buffer[BUFFER_SIZE];
 	char *p;
+	int change=0,deleting=0;
 	sig_alrm(0);
 	if (!fgets(buffer, size, in) || !xml_declaration_in_line(buffer)){
 		fprintf(stderr,"FATAL: First line does not start with XML declaration;\n"
@@ -206,8 +232,27 @@ map_collect_data_osm(FILE *in, struct maptool_osm *osm)
 			exit(EXIT_FAILURE);
 		}
 		if (!strncmp(p, "<osm ",5)) {
+		} else if (!strncmp(p, "<osmChange ",11) || !strncmp(p, "</osmChange>",12)) {
+		} else if (!strncmp(p, "<create>",8) || !strncmp(p, "<modify>",8)) {
+			change=1;
+		} else if (!strncmp(p, "<delete",7)) {
+			change=1;
+			deleting=1;
+		} else if (!strncmp(p, "</create>",9) || !strncmp(p, "</modify>",9) || !strncmp(p, "</delete>",9)) {
+			change=0;
+			deleting=0;
+		} else if (deleting) {
+			/* Deleted objects are only recorded, their contents are not needed */
+			if (!strncmp(p, "<node ",6) && !parse_change(p, rel_member_node, osm))
+				fprintf(stderr,"WARNING: failed to parse %s\n", buffer);
+			else if (!strncmp(p, "<way ",5) && !parse_change(p, rel_member_way, osm))
+				fprintf(stderr,"WARNING: failed to parse %s\n", buffer);
+			else if (!strncmp(p, "<relation ",10) && !parse_change(p, rel_member_relation, osm))
+				fprintf(stderr,"WARNING: failed to parse %s\n", buffer);
 		} else if (!strncmp(p, "<bound ",7)) {
 		} else if (!strncmp(p, "<node ",6)) {
+			if (change)
+				parse_change(p, rel_member_node, osm);
 			if (!parse_node(p))
 				fprintf(stderr,"WARNING: failed to parse %s\n", buffer);
 			processed_nodes++;
@@ -215,6 +260,8 @@ map_collect_data_osm(FILE *in, struct maptool_osm *osm)
 			if (!parse_tag(p))
 				fprintf(stderr,"WARNING: failed to parse %s\n", buffer);
 		} else if (!strncmp(p, "<way ",5)) {
+			if (change)
+				parse_change(p, rel_member_way, osm);
 			if (!parse_way(p))
 				fprintf(stderr,"WARNING: failed to parse %s\n", buffer);
 			processed_ways++;
@@ -222,6 +269,8 @@ map_collect_data_osm(FILE *in, struct maptool_osm *osm)
 			if (!parse_nd(p))
 				fprintf(stderr,"WARNING: failed to parse %s\n", buffer);
 		} else if (!strncmp(p, "<relation ",10)) {
+			if (change)
+				parse_change(p, rel_member_relation, osm);
 			if (!parse_relation(p))
 				fprintf(stderr,"WARNING: failed to parse %s\n", buffer);
 			processed_relations++;
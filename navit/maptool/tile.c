@@ -28,6 +28,7 @@
 #include <signal.h>
 #include <stdio.h>
 #include <math.h>
+#include <limits.h>
 #ifndef _MSC_VER
 #include <getopt.h>
 #include <unistd.h>
@@ -700,3 +701,190 @@ index_submap_add(struct tile_info *info, struct tile_head *th)
 	item_bin_add_attr_int(item_bin, attr_zipfile_ref, th->zipnum);
 	tile_write_item_to_tile(info, item_bin, NULL, index_tile);
 }
+
+/**
+ * @brief Appends a bounding box index to the items of a tile
+ *
+ * The items are split into groups of TILE_INDEX_GROUP consecutive items. For every group the
+ * offset of its first item (in ints from the start of the tile) and the bounding box of its
+ * coordinates are stored as attr_tile_index of a type_tile_index item appended at the end of
+ * the tile, so the offsets of the other items don't change. Groups containing an item without
+ * coordinates get an unlimited bounding box. The last int of the attribute is the size of the
+ * whole item in ints, so binfile finds the item from the end of the tile.
+ *
+ * @param data The items of the tile
+ * @param size The size of the items in bytes
+ * @param ret Set to the newly allocated tile data including the index
+ * @return The size of the returned data, or 0 if the tile is too small to need an index
+ */
+int
+tile_index_add(char *data, int size, char **ret)
+{
+	struct item_bin *ib,*index;
+	struct coord *c;
+	struct rect r;
+	int *entries,*entry=NULL;
+	int count=0,groups,i,pos=0;
+
+	while (pos < size) {
+		ib=(struct item_bin *)(data+pos);
+		pos+=(ib->len+1)*4;
+		count++;
+	}
+	groups=(count+TILE_INDEX_GROUP-1)/TILE_INDEX_GROUP;
+	if (groups < 2)
+		return 0;
+	entries=g_new(int, groups*5+1);
+	for (pos = 0, i = 0 ; pos < size ; i++) {
+		ib=(struct item_bin *)(data+pos);
+		if (!(i % TILE_INDEX_GROUP)) {
+			entry=entries+i/TILE_INDEX_GROUP*5;
+			entry[0]=pos/4;
+			entry[1]=entry[2]=INT_MAX;
+			entry[3]=entry[4]=INT_MIN;
+		}
+		if (ib->clen >= 2) {
+			c=(struct coord *)(ib+1);
+			bbox(c, ib->clen/2, &r);
+		} else {
+			r.l.x=r.l.y=INT_MIN;
+			r.h.x=r.h.y=INT_MAX;
+		}
+		if (r.l.x < entry[1])
+			entry[1]=r.l.x;
+		if (r.l.y < entry[2])
+			entry[2]=r.l.y;
+		if (r.h.x > entry[3])
+			entry[3]=r.h.x;
+		if (r.h.y > entry[4])
+			entry[4]=r.h.y;
+		pos+=(ib->len+1)*4;
+	}
+	entries[groups*5]=6+groups*5;
+	index=g_malloc((6+groups*5)*4);
+	item_bin_init(index, type_tile_index);
+	item_bin_add_attr_data(index, attr_tile_index, entries, (groups*5+1)*4);
+	g_free(entries);
+	*ret=g_malloc(size+(index->len+1)*4);
+	memcpy(*ret, data, size);
+	memcpy(*ret+size, index, (index->len+1)*4);
+	size+=(index->len+1)*4;
+	g_free(index);
+	return size;
+}
+
+static unsigned char *
+tile_varint_put(unsigned char *p, unsigned int v)
+{
+	while (v >= 0x80) {
+		*p++=(v & 0x7f) | 0x80;
+		v>>=7;
+	}
+	*p++=v;
+	return p;
+}
+
+static inline unsigned int
+tile_zigzag(int value)
+{
+	return ((unsigned int)value << 1) ^ (unsigned int)(value >> 31);
+}
+
+/**
+ * @brief Stores the coordinates of an item as zig-zag delta varints
+ *
+ * The coordinate region becomes a varint holding the number of coordinates followed by the
+ * zig-zag varints of the differences of x and y to the previous coordinate (to 0,0 for the
+ * first one), padded to a multiple of 4 bytes.
+ *
+ * @param ib The item
+ * @param out Buffer for the compacted item, not larger than ib
+ * @return 1 if the compacted item was written to out, 0 if it wouldn't be smaller
+ */
+static int
+tile_item_compact_coords(struct item_bin *ib, struct item_bin *out)
+{
+	struct coord *c=(struct coord *)(ib+1);
+	int last[2]={0,0};
+	int count=ib->clen/2,clen,i;
+	unsigned char *start,*p;
+
+	if (count < 2 || (ib->clen & ITEM_BIN_COORDS_COMPACT))
+		return 0;
+	start=(unsigned char *)(out+1);
+	p=tile_varint_put(start, count);
+	for (i = 0 ; i < count*2 ; i++) {
+		/* Give up before the varints could grow beyond the plain coordinates, a varint takes up to 5 bytes */
+		if (p-start+5 > ib->clen*4)
+			return 0;
+		p=tile_varint_put(p, tile_zigzag(((int *)c)[i]-last[i%2]));
+		last[i%2]=((int *)c)[i];
+	}
+	while ((p-start) % 4)
+		*p++=0;
+	clen=(p-start)/4;
+	if (clen >= ib->clen)
+		return 0;
+	memcpy((int *)(out+1)+clen, (int *)(ib+1)+ib->clen, (ib->len-2-ib->clen)*4);
+	out->len=ib->len-ib->clen+clen;
+	out->type=ib->type;
+	out->clen=clen | ITEM_BIN_COORDS_COMPACT;
+	return 1;
+}
+
+/**
+ * @brief Stores the coordinates of the items of a tile as zig-zag delta varints
+ *
+ * Only items which get smaller are changed, the offsets in a bounding box index added by
+ * tile_index_add() are adjusted to the new item positions.
+ *
+ * @param data The items of the tile
+ * @param size The size of the items in bytes
+ * @param ret Set to the newly allocated tile data
+ * @return The size of the returned data, or 0 if no item got smaller
+ */
+int
+tile_compact_coords(char *data, int size, char **ret)
+{
+	struct item_bin *ib,*ob,*index=NULL;
+	int *offsets,*entry,*end;
+	int count=0,changed=0,pos,opos=0,i=0;
+	char *out;
+
+	for (pos = 0 ; pos < size ; pos+=(ib->len+1)*4) {
+		ib=(struct item_bin *)(data+pos);
+		count++;
+	}
+	offsets=g_new(int, count*2);
+	out=g_malloc(size);
+	for (pos = 0 ; pos < size ; pos+=(ib->len+1)*4, opos+=(ob->len+1)*4, i++) {
+		ib=(struct item_bin *)(data+pos);
+		ob=(struct item_bin *)(out+opos);
+		offsets[i*2]=pos/4;
+		offsets[i*2+1]=opos/4;
+		if (tile_item_compact_coords(ib, ob))
+			changed=1;
+		else
+			memcpy(ob, ib, (ib->len+1)*4);
+		if (ob->type == type_tile_index)
+			index=ob;
+	}
+	if (!changed) {
+		g_free(offsets);
+		g_free(out);
+		return 0;
+	}
+	if (index) {
+		/* The index is a single attribute with 5 ints per group, starting with the offset of its first item, and the size of the item */
+		entry=(int *)(index+1)+index->clen+2;
+		end=entry+(((int *)(index+1))[index->clen]-1)/5*5;
+		for (i = 0 ; entry < end ; entry+=5) {
+			while (i < count-1 && offsets[i*2] < entry[0])
+				i++;
+			entry[0]=offsets[i*2+1];
+		}
+	}
+	g_free(offsets);
+	*ret=out;
+	return opos;
+}
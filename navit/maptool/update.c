@@ -0,0 +1,775 @@
+/**
+ * Navit, a modular navigation system.
+ * Copyright (C) 2005-2011 Navit Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ */
+
+/** @file
+ * @brief Updates a map written by maptool with the items of an osmChange file
+ *
+ * Items of objects created, modified or deleted by the change file are removed from the tiles
+ * of the old map, and the items generated from the change file are appended to the tiles they
+ * belong to. Removed items are only blanked, so the offsets of the other items, which are
+ * referenced by the search index, don't change. Only the tiles which changed are compressed
+ * again, all other members are copied from the old map unchanged.
+ * Nodes the change file moved are moved in the items of the old map as well, and streets of the
+ * old map are split where the ways of the change file meet them. The items store coordinates, not
+ * node ids, so the nodes are found by their coordinates.
+ */
+
+#include "navit_lfs.h"
+#include <stdlib.h>
+#include <string.h>
+#include "maptool.h"
+#include "debug.h"
+#include "zipfile.h"
+
+/**
+ * @brief A member of the map being updated
+ */
+struct update_member {
+	char *name;		/**< The name in the zip file, including the padding */
+	int tile;		/**< Set if the items of the member are to be updated */
+	long long offset;	/**< The offset of the stored data in the old map */
+	int comp_size;
+	int data_size;
+	int method;
+	int crc;
+	struct rect r;		/**< The area of the tile, including the overlap */
+	char *added;		/**< Items to append to the member */
+	int added_size;
+};
+
+struct update_info {
+	FILE *in;
+	struct update_member *members;
+	int count;
+	int index;		/**< The number of the index member */
+	GHashTable *tiles;	/**< Maps tile names to member number+1 */
+	struct osm_change *changes;
+	int changes_count;
+	struct osm_moved_node *moved;	/**< Sorted by id */
+	int moved_count;
+	GHashTable *moved_from;	/**< Maps the old coordinates of the moved nodes to them */
+	struct coord *used;	/**< The nodes used by the ways of the change file */
+	int used_count;
+	GHashTable *used_hash;	/**< Maps the coordinates in used to their index+1 */
+	int tile_index;		/**< Set if the tiles of the map have a bounding box index */
+	int removed;
+	int added;
+	int split;
+};
+
+static int
+update_read(FILE *in, long long offset, void *buffer, int size)
+{
+	return !fseeko(in, offset, SEEK_SET) && fread(buffer, size, 1, in) == 1;
+}
+
+/**
+ * @brief Reads the central directory of the old map
+ *
+ * @param info The update, info->in has to be the old map
+ * @param zip_info The new map, switched to zip64 if the old map uses it, or NULL
+ * @return 1 on success, 0 if this isn't a map which can be updated
+ */
+static int
+update_read_directory(struct update_info *info, struct zip_info *zip_info)
+{
+	struct zip_eoc eoc;
+	struct zip64_eocl eocl;
+	struct zip64_eoc eoc64;
+	struct zip_cd cd;
+	struct zip_lfh lfh;
+	struct update_member *m;
+	long long end,offset;
+	char *extra;
+	int i,j;
+
+	fseeko(info->in, 0, SEEK_END);
+	end=ftello(info->in);
+	if (end < sizeof(eoc) || !update_read(info->in, end-sizeof(eoc), &eoc, sizeof(eoc)) || eoc.zipesig != zip_eoc_sig) {
+		fprintf(stderr,"Not a map written by maptool\n");
+		return 0;
+	}
+	info->count=eoc.zipenum;
+	offset=eoc.zipeofst;
+	if (end >= sizeof(eoc)+sizeof(eocl) && update_read(info->in, end-sizeof(eoc)-sizeof(eocl), &eocl, sizeof(eocl)) &&
+			eocl.zip64lsig == zip64_eocl_sig) {
+		if (!update_read(info->in, eocl.zip64lofst, &eoc64, sizeof(eoc64)) || eoc64.zip64esig != zip64_eoc_sig) {
+			fprintf(stderr,"Corrupt zip64 directory\n");
+			return 0;
+		}
+		info->count=eoc64.zip64enum;
+		offset=eoc64.zip64eofst;
+		if (zip_info)
+			zip_set_zip64(zip_info, 1);
+	}
+	info->members=g_new0(struct update_member, info->count);
+	info->index=-1;
+	info->tiles=g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+	for (i = 0 ; i < info->count ; i++) {
+		m=&info->members[i];
+		if (!update_read(info->in, offset, &cd, sizeof(cd)) || cd.zipcensig != zip_cd_sig) {
+			fprintf(stderr,"Corrupt zip directory\n");
+			return 0;
+		}
+		if (cd.zipcmthd == 99) {
+			fprintf(stderr,"Encrypted maps can't be updated\n");
+			return 0;
+		}
+		m->name=g_malloc(cd.zipcfnl+1);
+		extra=g_malloc(cd.zipcxtl+1);
+		dbg_assert(fread(m->name, cd.zipcfnl, 1, info->in)==1 || !cd.zipcfnl);
+		dbg_assert(fread(extra, cd.zipcxtl, 1, info->in)==1 || !cd.zipcxtl);
+		m->name[cd.zipcfnl]='\0';
+		m->offset=cd.zipofst;
+		if (cd.zipofst == zip_size_64bit_placeholder) {
+			for (j = 0 ; j+sizeof(struct zip_cd_ext) <= cd.zipcxtl ; j+=((struct zip_cd_ext *)(extra+j))->size+4) {
+				struct zip_cd_ext *ext=(struct zip_cd_ext *)(extra+j);
+				if (ext->tag == zip_extra_header_id_zip64) {
+					m->offset=ext->zipofst;
+					break;
+				}
+			}
+		}
+		g_free(extra);
+		m->comp_size=cd.zipcsiz;
+		m->data_size=cd.zipcunc;
+		m->method=cd.zipcmthd;
+		m->crc=cd.zipccrc;
+		if (!update_read(info->in, m->offset, &lfh, sizeof(lfh)) || lfh.ziplocsig != zip_lfh_sig) {
+			fprintf(stderr,"Corrupt zip member %s\n", m->name);
+			return 0;
+		}
+		m->offset+=sizeof(lfh)+lfh.zipfnln+lfh.zipxtraln;
+		offset+=sizeof(cd)+cd.zipcfnl+cd.zipcxtl+cd.zipccml;
+		if (!strcmp(m->name, "index")) {
+			info->index=i;
+			m->tile=1;
+			m->r=world_bbox;
+		} else {
+			/* Tiles are named by their quadrants, padded with '_' */
+			char *tile=g_strdup(m->name);
+			for (j = strlen(tile) ; j > 0 && tile[j-1] == '_' ; j--)
+				tile[j-1]='\0';
+			if (tile[0] && tile_len(tile) == strlen(tile)) {
+				m->tile=1;
+				tile_bbox(tile, &m->r, overlap);
+				g_hash_table_insert(info->tiles, tile, GINT_TO_POINTER(i+1));
+			} else
+				g_free(tile);
+		}
+	}
+	if (info->index == -1) {
+		fprintf(stderr,"Map has no index\n");
+		return 0;
+	}
+	return 1;
+}
+
+/**
+ * @brief Reads and uncompresses a member of the old map
+ *
+ * @param info The update
+ * @param m The member
+ * @return The newly allocated data of the member
+ */
+static char *
+update_member_get(struct update_info *info, struct update_member *m)
+{
+	char *data=g_malloc(m->comp_size ? m->comp_size : 1),*ret;
+
+	dbg_assert(update_read(info->in, m->offset, data, m->comp_size) || !m->comp_size);
+	ret=zip_member_uncompress(data, m->comp_size, m->data_size, m->method);
+	g_free(data);
+	if (!ret) {
+		fprintf(stderr,"Can't uncompress %s (method %d)\n", m->name, m->method);
+		exit(1);
+	}
+	return ret;
+}
+
+static int
+update_change_cmp(const void *a, const void *b)
+{
+	const struct osm_change *ca=a,*cb=b;
+	if (ca->type != cb->type)
+		return ca->type < cb->type ? -1:1;
+	if (ca->id != cb->id)
+		return ca->id < cb->id ? -1:1;
+	return 0;
+}
+
+static void
+update_load_changes(struct update_info *info, FILE *changes)
+{
+	long long size;
+
+	fseeko(changes, 0, SEEK_END);
+	size=ftello(changes);
+	info->changes_count=size/sizeof(struct osm_change);
+	info->changes=g_new(struct osm_change, info->changes_count+1);
+	fseeko(changes, 0, SEEK_SET);
+	if (info->changes_count)
+		dbg_assert(fread(info->changes, sizeof(struct osm_change), info->changes_count, changes)==info->changes_count);
+	qsort(info->changes, info->changes_count, sizeof(struct osm_change), update_change_cmp);
+}
+
+static int
+update_is_changed(struct update_info *info, struct item_bin *ib, enum attr_type attr_type, enum relation_member_type type)
+{
+	struct osm_change key;
+	osmid *id=item_bin_get_attr(ib, attr_type, NULL);
+
+	if (!id)
+		return 0;
+	memset(&key, 0, sizeof(key));
+	key.type=type;
+	key.id=*id;
+	return bsearch(&key, info->changes, info->changes_count, sizeof(struct osm_change), update_change_cmp) != NULL;
+}
+
+static guint
+update_coord_hash(gconstpointer key)
+{
+	const struct coord *c=key;
+	return (guint)c->x ^ ((guint)c->y << 16) ^ ((guint)c->y >> 16);
+}
+
+static gboolean
+update_coord_equal(gconstpointer a, gconstpointer b)
+{
+	const struct coord *ca=a,*cb=b;
+	return ca->x == cb->x && ca->y == cb->y;
+}
+
+static int
+update_moved_cmp(const void *a, const void *b)
+{
+	const struct osm_moved_node *ma=a,*mb=b;
+	if (ma->id != mb->id)
+		return ma->id < mb->id ? -1:1;
+	return 0;
+}
+
+static void
+update_load_moved(struct update_info *info, FILE *moved)
+{
+	long long size;
+	int i;
+
+	fseeko(moved, 0, SEEK_END);
+	size=ftello(moved);
+	info->moved_count=size/sizeof(struct osm_moved_node);
+	info->moved=g_new(struct osm_moved_node, info->moved_count+1);
+	fseeko(moved, 0, SEEK_SET);
+	if (info->moved_count)
+		dbg_assert(fread(info->moved, sizeof(struct osm_moved_node), info->moved_count, moved)==info->moved_count);
+	qsort(info->moved, info->moved_count, sizeof(struct osm_moved_node), update_moved_cmp);
+	info->moved_from=g_hash_table_new(update_coord_hash, update_coord_equal);
+	for (i = 0 ; i < info->moved_count ; i++)
+		g_hash_table_insert(info->moved_from, &info->moved[i].from, &info->moved[i]);
+}
+
+/**
+ * @brief Returns the coordinates a node has in the old map
+ */
+static struct coord *
+update_node_coord(struct update_info *info, struct node_item *ni)
+{
+	struct osm_moved_node key,*mn;
+
+	key.id=ni->nd_id;
+	mn=bsearch(&key, info->moved, info->moved_count, sizeof(struct osm_moved_node), update_moved_cmp);
+	return mn ? &mn->from : &ni->c;
+}
+
+/**
+ * @brief Collects the nodes of the node table used by the ways of the change file
+ *
+ * Only the ways of the change file are counted in the node table, so these are the nodes with
+ * references.
+ *
+ * @param info The update
+ * @param from 1 for the coordinates the nodes have in the old map, 0 for the new ones
+ */
+static void
+update_load_used(struct update_info *info, int from)
+{
+	struct node_item *ni;
+	long long i,count;
+	int s,count_slices=(sizeof_buffer("coords.tmp")+slice_size-1)/slice_size,size=0;
+
+	for (s = 0 ; s < count_slices ; s++) {
+		load_buffer("coords.tmp",&node_buffer,(long long)s*slice_size,slice_size);
+		ni=(struct node_item *)node_buffer.base;
+		count=node_buffer.size/sizeof(struct node_item);
+		for (i = 0 ; i < count ; i++) {
+			if (!ni[i].ref_way)
+				continue;
+			if (info->used_count == size) {
+				size=size ? size*2 : 1024;
+				info->used=g_renew(struct coord, info->used, size);
+			}
+			info->used[info->used_count++]=from ? *update_node_coord(info, &ni[i]) : ni[i].c;
+		}
+	}
+	info->used_hash=g_hash_table_new(update_coord_hash, update_coord_equal);
+	for (i = 0 ; i < info->used_count ; i++)
+		g_hash_table_insert(info->used_hash, &info->used[i], GINT_TO_POINTER(i+1));
+}
+
+/**
+ * @brief Checks whether an item of the old map stays, as its object isn't in the change file
+ */
+static int
+update_is_kept(struct update_info *info, struct item_bin *ib)
+{
+	return ib->type != type_none && !update_is_changed(info, ib, attr_osm_nodeid, rel_member_node) &&
+		!update_is_changed(info, ib, attr_osm_wayid, rel_member_way) &&
+		!update_is_changed(info, ib, attr_osm_relationid, rel_member_relation);
+}
+
+/**
+ * @brief Removes an item without moving the items behind it
+ *
+ * The item keeps its size and coordinates, but gets type_none and all its attributes attr_none.
+ */
+static void
+update_item_remove(struct item_bin *ib)
+{
+	int *end=(int *)ib+ib->len+1;
+	struct attr_bin *ab=(struct attr_bin *)((int *)(ib+1)+ib->clen);
+
+	ib->type=type_none;
+	while ((int *)ab < end) {
+		ab->type=attr_none;
+		ab=(struct attr_bin *)((int *)ab+ab->len+1);
+	}
+}
+
+/**
+ * @brief Appends a part of an item to the items to add to a member
+ *
+ * @param m The member
+ * @param ib The item
+ * @param first The first coordinate of the part
+ * @param last The last coordinate of the part
+ */
+static void
+update_member_add(struct update_member *m, struct item_bin *ib, int first, int last)
+{
+	struct item_bin *new;
+	int *attr=(int *)(ib+1)+ib->clen;
+	int attr_len=ib->len-ib->clen-2;
+	int clen=(last-first+1)*2;
+	int size=(clen+attr_len+3)*4;
+
+	m->added=g_realloc(m->added, m->added_size+size);
+	new=(struct item_bin *)(m->added+m->added_size);
+	new->len=clen+attr_len+2;
+	new->type=ib->type;
+	new->clen=clen;
+	memcpy(new+1, (struct coord *)(ib+1)+first, new->clen*4);
+	memcpy((int *)(new+1)+new->clen, attr, attr_len*4);
+	m->added_size+=size;
+}
+
+/**
+ * @brief Splits a street of the old map at the nodes the ways of the change file use
+ *
+ * Like phase 2 does, so the streets meet at their ends. The first part of the street stays in
+ * place, with the coordinates it lost replaced by an unused attribute, so the search index still
+ * finds it. The other parts are added to the member.
+ *
+ * @param info The update
+ * @param m The member holding the street
+ * @param ib The street, which the change file doesn't contain
+ * @return 1 if the street was split, 0 otherwise
+ */
+static int
+update_item_split(struct update_info *info, struct update_member *m, struct item_bin *ib)
+{
+	struct coord *c=(struct coord *)(ib+1);
+	struct attr_bin *pad;
+	int count=ib->clen/2,first=0,i,attr_len,gap;
+
+	if (!info->used_count || !item_get_default_flags(ib->type))
+		return 0;
+	for (i = count-2 ; i > 0 ; i--) {
+		if (g_hash_table_lookup(info->used_hash, &c[i])) {
+			update_member_add(m, ib, i, first ? first : count-1);
+			first=i;
+		}
+	}
+	if (!first)
+		return 0;
+	attr_len=ib->len-ib->clen-2;
+	gap=(count-first-1)*2;
+	memmove(&c[first+1], &c[count], attr_len*4);
+	ib->clen=(first+1)*2;
+	pad=(struct attr_bin *)((int *)(ib+1)+ib->clen+attr_len);
+	pad->len=gap-1;
+	pad->type=attr_none;
+	info->split++;
+	return 1;
+}
+
+/**
+ * @brief Assigns the items of a file to the tiles of the old map they have to be added to
+ *
+ * Every item goes to the tile it would be written to by phase 4, or, as the tiles of the old
+ * map were merged, to the longest tile of the old map this tile is within. Items outside of
+ * all tiles are added to the index.
+ */
+static void
+update_add_items(struct update_info *info, FILE *in)
+{
+	struct item_bin *ib;
+	struct update_member *m;
+	struct rect r;
+	char name[1024];
+	int len,num;
+
+	fseek(in, 0, SEEK_SET);
+	while ((ib=read_item(in))) {
+		r=world_bbox;
+		bbox((struct coord *)(ib+1), ib->clen/2, &r);
+		name[0]='\0';
+		tile(&r, "", name, item_bin_max_order(ib), overlap, NULL);
+		len=strlen(name);
+		num=0;
+		while (len > 0 && !(num=GPOINTER_TO_INT(g_hash_table_lookup(info->tiles, name))))
+			name[--len]='\0';
+		m=&info->members[num ? num-1 : info->index];
+		update_member_add(m, ib, 0, ib->clen/2-1);
+		info->added++;
+	}
+}
+
+/**
+ * @brief Moves the nodes of an item of the old map which the change file moved
+ *
+ * The item keeps its place, so it has to stay within its tile.
+ *
+ * @param info The update
+ * @param m The member holding the item
+ * @param ib The item, which the change file doesn't contain
+ * @return The number of moved coordinates, or -1 if the item doesn't fit into its tile anymore
+ */
+static int
+update_item_move_nodes(struct update_info *info, struct update_member *m, struct item_bin *ib)
+{
+	struct coord *c=(struct coord *)(ib+1);
+	struct osm_moved_node *mn,*last=NULL;
+	struct rect r;
+	osmid *id;
+	int i,moved=0;
+
+	for (i = 0 ; i < ib->clen/2 ; i++) {
+		mn=g_hash_table_lookup(info->moved_from, &c[i]);
+		if (mn) {
+			c[i]=mn->to;
+			last=mn;
+			moved++;
+		}
+	}
+	if (!moved)
+		return 0;
+	bbox(c, ib->clen/2, &r);
+	if (!bbox_contains_bbox(&m->r, &r)) {
+		id=item_bin_get_attr(ib, attr_osm_wayid, NULL);
+		fprintf(stderr,"Node "OSMID_FMT" moved out of tile %s, which has an item of way "OSMID_FMT" not contained in the change file using it\n",
+			last->id, m->name, id ? *id : 0);
+		return -1;
+	}
+	return moved;
+}
+
+/**
+ * @brief Applies the changes to the items of a member
+ *
+ * @param info The update
+ * @param m The member
+ * @param data The uncompressed data of the member, replaced if items are added
+ * @param size The size of the data, updated if items are added
+ * @return 1 if the member changed, 0 otherwise, -1 if a moved node can't be moved in it
+ */
+static int
+update_member_items(struct update_info *info, struct update_member *m, char **data, int *size)
+{
+	struct item_bin *ib,*last=NULL;
+	char *ret;
+	int pos=0,changed=0,reindex=0,moved,len;
+
+	while (pos < *size) {
+		ib=(struct item_bin *)(*data+pos);
+		if (ib->len < 2 || pos+(ib->len+1)*4 > *size) {
+			fprintf(stderr,"Corrupt item in %s at %d\n", m->name, pos);
+			exit(1);
+		}
+		if (ib->type != type_none && !update_is_kept(info, ib)) {
+			update_item_remove(ib);
+			info->removed++;
+			changed=1;
+		} else if (ib->type != type_none) {
+			moved=info->moved_count ? update_item_move_nodes(info, m, ib) : 0;
+			if (moved < 0)
+				return -1;
+			if (moved)
+				changed=reindex=1;
+			if (update_item_split(info, m, ib))
+				changed=1;
+		}
+		last=ib;
+		pos+=(ib->len+1)*4;
+	}
+	if (!m->added_size && !reindex)
+		return changed;
+	/* The bounding box index has to stay the last item of the tile */
+	len=*size;
+	if (info->tile_index && last && last->type == type_tile_index)
+		len=(char *)last-*data;
+	ret=g_malloc(len+m->added_size);
+	memcpy(ret, *data, len);
+	memcpy(ret+len, m->added, m->added_size);
+	len+=m->added_size;
+	g_free(*data);
+	*data=ret;
+	*size=len;
+	if (info->tile_index && m != &info->members[info->index] && (len=tile_index_add(*data, *size, &ret))) {
+		g_free(*data);
+		*data=ret;
+		*size=len;
+	}
+	return 1;
+}
+
+/**
+ * @brief Checks whether the map can be updated and how its tiles are organized
+ *
+ * @param info The update
+ * @return 1 if the map can be updated, 0 otherwise
+ */
+static int
+update_check_map(struct update_info *info)
+{
+	struct update_member *m=&info->members[info->index];
+	char *data=update_member_get(info, m);
+	struct item_bin *ib=(struct item_bin *)data;
+	int *version=NULL,ret=1;
+
+	if (m->data_size >= sizeof(*ib) && ib->type == type_map_information) {
+		version=item_bin_get_attr(ib, attr_version, NULL);
+		info->tile_index=item_bin_get_attr(ib, attr_tile_index, NULL) != NULL;
+	}
+	if (!version) {
+		fprintf(stderr,"Map has no map information\n");
+		ret=0;
+	} else if (*version == MAP_VERSION_COMPACT_COORDS) {
+		fprintf(stderr,"Maps with compact coordinates (-C) can't be updated\n");
+		ret=0;
+	}
+	g_free(data);
+	return ret;
+}
+
+static void
+update_close(struct update_info *info)
+{
+	int i;
+
+	if (info->in)
+		fclose(info->in);
+	if (info->tiles)
+		g_hash_table_destroy(info->tiles);
+	if (info->moved_from)
+		g_hash_table_destroy(info->moved_from);
+	if (info->used_hash)
+		g_hash_table_destroy(info->used_hash);
+	for (i = 0 ; info->members && i < info->count ; i++) {
+		g_free(info->members[i].name);
+		g_free(info->members[i].added);
+	}
+	g_free(info->members);
+	g_free(info->changes);
+	g_free(info->moved);
+	g_free(info->used);
+}
+
+/**
+ * @brief Opens the map to update and loads the objects of the change file
+ *
+ * @param info The update to initialize
+ * @param oldmap The file name of the map to update
+ * @param changes The objects of the change file, as written by map_collect_data_osm()
+ * @param moved The nodes moved by the change file, as written by merge_node_table()
+ * @param zip_info The new map, or NULL
+ * @return 1 on success, 0 if the map could not be opened or can't be updated
+ */
+static int
+update_open(struct update_info *info, char *oldmap, FILE *changes, FILE *moved, struct zip_info *zip_info)
+{
+	memset(info, 0, sizeof(*info));
+	info->in=fopen(oldmap,"rb");
+	if (!info->in) {
+		fprintf(stderr,"Could not open map %s\n", oldmap);
+		return 0;
+	}
+	if (!update_read_directory(info, zip_info) || !update_check_map(info)) {
+		update_close(info);
+		return 0;
+	}
+	if (changes)
+		update_load_changes(info, changes);
+	if (moved)
+		update_load_moved(info, moved);
+	return 1;
+}
+
+/**
+ * @brief Adds the references by the ways of the old map which stay to the node table
+ *
+ * Phase 2 splits ways at the nodes referenced more than once, but the node table only counts
+ * the references by the ways of the change file. Every node a way of the change file shares
+ * with a way of the old map the change file doesn't contain gets one more reference, so the
+ * way is split there. Nodes are found by the coordinates they have in the old map.
+ * Leaves the first slice of coords.tmp in node_buffer.
+ *
+ * @param oldmap The file name of the map to update
+ * @param changes The objects of the change file, as written by map_collect_data_osm()
+ * @param moved The nodes moved by the change file, as written by merge_node_table()
+ * @return The number of nodes which got a reference, or -1 if the map could not be read
+ */
+int
+update_count_references(char *oldmap, FILE *changes, FILE *moved)
+{
+	struct update_info info;
+	struct update_member *m;
+	struct item_bin *ib;
+	struct node_item *ni;
+	struct coord *c;
+	char *data,*refs;
+	long long i,count;
+	int s,j,pos,ret=0;
+
+	if (!update_open(&info, oldmap, changes, moved, NULL))
+		return -1;
+	update_load_used(&info, 1);
+	refs=g_malloc0(info.used_count+1);
+	for (j = 0 ; j < info.count ; j++) {
+		m=&info.members[j];
+		if (!m->tile)
+			continue;
+		data=update_member_get(&info, m);
+		for (pos = 0 ; pos+(int)sizeof(*ib) <= m->data_size ; pos+=(ib->len+1)*4) {
+			ib=(struct item_bin *)(data+pos);
+			if (ib->len < 2 || pos+(ib->len+1)*4 > m->data_size)
+				break;
+			if (ib->clen < 4 || !item_bin_get_attr(ib, attr_osm_wayid, NULL) || !update_is_kept(&info, ib))
+				continue;
+			c=(struct coord *)(ib+1);
+			for (i = 0 ; i < ib->clen/2 ; i++)
+				refs[GPOINTER_TO_INT(g_hash_table_lookup(info.used_hash, &c[i]))]=1;
+		}
+		g_free(data);
+	}
+	/* The last slice is loaded last, as the first one is used by the next phase */
+	for (s = slices-1 ; s >= 0 ; s--) {
+		load_buffer("coords.tmp",&node_buffer,(long long)s*slice_size,slice_size);
+		ni=(struct node_item *)node_buffer.base;
+		count=node_buffer.size/sizeof(struct node_item);
+		for (i = 0 ; i < count ; i++) {
+			if (ni[i].ref_way && refs[GPOINTER_TO_INT(g_hash_table_lookup(info.used_hash, update_node_coord(&info, &ni[i])))]) {
+				ni[i].ref_way++;
+				ret++;
+			}
+		}
+		save_buffer("coords.tmp",&node_buffer,(long long)s*slice_size);
+	}
+	node_index_build();
+	fprintf(stderr,"PROGRESS: %d nodes of the change file are used by ways of %s as well\n", ret, oldmap);
+	g_free(refs);
+	update_close(&info);
+	return ret;
+}
+
+/**
+ * @brief Writes an updated copy of a map
+ *
+ * The members of the new map are the same as those of the old map, in the same order, so all
+ * references to members stay valid. Items of the old map using nodes the change file moved are
+ * moved with them, and streets of the old map are split where the ways of the change file meet
+ * them.
+ *
+ * @param oldmap The file name of the map to update
+ * @param changes The objects of the change file, as written by map_collect_data_osm()
+ * @param moved The nodes moved by the change file, as written by merge_node_table()
+ * @param in The files with the items generated from the change file
+ * @param in_count The number of files in in, entries may be NULL
+ * @param zip_info The new map, opened by zip_open()
+ * @return The number of changed tiles, or -1 if the map could not be updated
+ */
+int
+update_map(char *oldmap, FILE *changes, FILE *moved, FILE **in, int in_count, struct zip_info *zip_info)
+{
+	struct update_info info;
+	struct update_member *m;
+	char *data;
+	int i,size,ret,changed=0;
+
+	if (!update_open(&info, oldmap, changes, moved, zip_info))
+		return -1;
+	update_load_used(&info, 0);
+	free(node_buffer.base);
+	node_buffer.base=NULL;
+	node_buffer.malloced=0;
+	node_buffer.size=0;
+	for (i = 0 ; i < in_count ; i++) {
+		if (in[i])
+			update_add_items(&info, in[i]);
+	}
+	for (i = 0 ; i < info.count ; i++) {
+		m=&info.members[i];
+		if (m->tile) {
+			data=update_member_get(&info, m);
+			size=m->data_size;
+			ret=update_member_items(&info, m, &data, &size);
+			if (ret < 0) {
+				g_free(data);
+				update_close(&info);
+				return -1;
+			}
+			if (ret) {
+				zip_member_write(zip_info, zip_member_new(zip_info, data, size), m->name, strlen(m->name));
+				g_free(data);
+				zip_add_member(zip_info);
+				changed++;
+				continue;
+			}
+			g_free(data);
+		}
+		data=g_malloc(m->comp_size ? m->comp_size : 1);
+		dbg_assert(update_read(info.in, m->offset, data, m->comp_size) || !m->comp_size);
+		zip_member_write(zip_info, zip_member_new_compressed(data, m->data_size, m->comp_size, m->method, m->crc), m->name, strlen(m->name));
+		zip_add_member(zip_info);
+	}
+	/* The index is a tile as well, the one holding the items of the whole world */
+	fprintf(stderr,"PROGRESS: Updated %d of %d tiles: %d items removed, %d items added, %d streets split\n", changed, g_hash_table_size(info.tiles)+1, info.removed, info.added, info.split);
+	update_close(&info);
+	return changed;
+}
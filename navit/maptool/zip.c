@@ -33,12 +33,16 @@
 #include <openssl/rand.h>
 #include <openssl/md5.h>
 #endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
 
 struct zip_info {
 	int zipnum;
 	int dir_size;
 	long long offset;
 	int compression_level;
+	int compression_method;
 	int maxnamelen;
 	int zip64;
 	short date;
@@ -97,8 +101,91 @@ compress2_int(Byte *dest, uLongf *destLen, const Bytef *source, uLong sourceLen,
 }
 #endif
 
+/**
+ * @brief The data of a zip member, prepared by zip_member_new() to be written by zip_member_write()
+ */
+struct zip_member {
+	char *data;		/**< The data to store, points either to the original data or to compbuffer */
+	char *compbuffer;
+	int data_size;		/**< The size of the original data */
+	int comp_size;		/**< The size of the stored data */
+	int method;		/**< The compression method of the stored data */
+	int crc;
+};
+
+/**
+ * @brief Compresses the data of a zip member
+ *
+ * This only reads zip_info, so it can be called by several threads at once for different members.
+ *
+ * @param zip_info The zip file the member is for
+ * @param data The data of the member. It is not modified, but must stay valid until the member is written.
+ * @param data_size The size of the data
+ * @return The member, to be passed to zip_member_write()
+ */
+struct zip_member *
+zip_member_new(struct zip_info *zip_info, char *data, int data_size)
+{
+	struct zip_member *member=g_new0(struct zip_member, 1);
+	uLongf destlen=data_size+data_size/500+12;
+
+	member->data=data;
+	member->data_size=data_size;
+	member->comp_size=data_size;
+	member->compbuffer = malloc(destlen);
+	if (!member->compbuffer) {
+	  fprintf(stderr, "No more memory.\n");
+	  exit (1);
+	}
+#ifdef HAVE_LIBCRYPTO
+	/* encrypted members store no crc */
+	if (!zip_info->passwd)
+#endif
+	{
+		member->crc=crc32(0, NULL, 0);
+		member->crc=crc32(member->crc, (unsigned char *)data, data_size);
+	}
+	member->method=zip_info->compression_level ? zip_info->compression_method:0;
+	/* binfile only decrypts deflated or stored members */
+	if (zip_info->passwd && member->method == 93)
+		member->method=8;
+#ifdef HAVE_ZSTD
+	if (member->method == 93) {
+		size_t zlen=ZSTD_compress(member->compbuffer, destlen, data, data_size, zip_info->compression_level);
+		if (!ZSTD_isError(zlen) && zlen < data_size) {
+			member->data=member->compbuffer;
+			member->comp_size=zlen;
+		} else
+			member->method=0;
+	}
+#endif
+#ifdef HAVE_ZLIB
+	if (member->method == 8) {
+		int error=compress2_int((Byte *)member->compbuffer, &destlen, (Bytef *)data, data_size, zip_info->compression_level);
+		if (error == Z_OK) {
+			if (destlen < data_size) {
+				member->data=member->compbuffer;
+				member->comp_size=destlen;
+			} else
+				member->method=0;
+		} else {
+			fprintf(stderr,"compress2 returned %d\n", error);
+		}
+	}
+#endif
+	return member;
+}
+
+/**
+ * @brief Appends a zip member prepared by zip_member_new() to the zip file and frees it
+ *
+ * @param zip_info The zip file
+ * @param member The member
+ * @param name The name of the member
+ * @param filelen The length of the name in the zip file, the name is padded with '_'
+ */
 void
-write_zipmember(struct zip_info *zip_info, char *name, int filelen, char *data, int data_size)
+zip_member_write(struct zip_info *zip_info, struct zip_member *member, char *name, int filelen)
 {
 	struct zip_lfh lfh = {
 		0x04034b50,
@@ -151,43 +238,18 @@ write_zipmember(struct zip_info *zip_info, char *name, int filelen, char *data,
 	unsigned char salt[8], key[34], verify[2], mac[10];
 #endif
 	char *filename;
-	int crc=0,len,comp_size=data_size;
-	uLongf destlen=data_size+data_size/500+12;
-	char *compbuffer;
+	char *data=member->data;
+	int crc=member->crc,len,comp_size=member->comp_size,data_size=member->data_size;
 
-	compbuffer = malloc(destlen);
-	if (!compbuffer) {
-	  fprintf(stderr, "No more memory.\n");
-	  exit (1);
-	}
 #ifdef HAVE_LIBCRYPTO
 	if (zip_info->passwd) {	
 		RAND_bytes(salt, sizeof(salt));
 		PKCS5_PBKDF2_HMAC_SHA1(zip_info->passwd, strlen(zip_info->passwd), salt, sizeof(salt), 1000, sizeof(key), key);
 		verify[0]=key[32];
 		verify[1]=key[33];
-	} else {
-#endif
-		crc=crc32(0, NULL, 0);
-		crc=crc32(crc, (unsigned char *)data, data_size);
-#ifdef HAVE_LIBCRYPTO
-	}
-#endif
-	lfh.zipmthd=zip_info->compression_level ? 8:0;
-#ifdef HAVE_ZLIB
-	if (zip_info->compression_level) {
-		int error=compress2_int((Byte *)compbuffer, &destlen, (Bytef *)data, data_size, zip_info->compression_level);
-		if (error == Z_OK) {
-			if (destlen < data_size) {
-				data=compbuffer;
-				comp_size=destlen;
-			} else
-				lfh.zipmthd=0;
-		} else {
-			fprintf(stderr,"compress2 returned %d\n", error);
-		}
 	}
 #endif
+	lfh.zipmthd=member->method;
 	lfh.zipcrc=crc;
 	lfh.zipsize=comp_size;
 	lfh.zipuncmp=data_size;
@@ -276,7 +338,85 @@ write_zipmember(struct zip_info *zip_info, char *name, int filelen, char *data,
 	}
 #endif
 	
-	free(compbuffer);
+	free(member->compbuffer);
+	g_free(member);
+}
+
+void
+write_zipmember(struct zip_info *zip_info, char *name, int filelen, char *data, int data_size)
+{
+	zip_member_write(zip_info, zip_member_new(zip_info, data, data_size), name, filelen);
+}
+
+/**
+ * @brief Creates a zip member from data which is already compressed, e.g. copied from another zip file
+ *
+ * @param data The stored data, it is freed when the member is written
+ * @param data_size The size of the uncompressed data
+ * @param comp_size The size of the stored data
+ * @param method The compression method of the stored data
+ * @param crc The crc of the uncompressed data
+ * @return The member, to be passed to zip_member_write()
+ */
+struct zip_member *
+zip_member_new_compressed(char *data, int data_size, int comp_size, int method, int crc)
+{
+	struct zip_member *member=g_new0(struct zip_member, 1);
+
+	member->data=data;
+	member->compbuffer=data;
+	member->data_size=data_size;
+	member->comp_size=comp_size;
+	member->method=method;
+	member->crc=crc;
+	return member;
+}
+
+/**
+ * @brief Uncompresses the data of a zip member
+ *
+ * @param data The stored data
+ * @param comp_size The size of the stored data
+ * @param data_size The size of the uncompressed data
+ * @param method The compression method, 0, 8 or 93
+ * @return The newly allocated uncompressed data, or NULL if the method isn't supported or the data is corrupt
+ */
+char *
+zip_member_uncompress(char *data, int comp_size, int data_size, int method)
+{
+	char *ret=g_malloc(data_size ? data_size : 1);
+
+	if (method == 0 && comp_size == data_size) {
+		memcpy(ret, data, data_size);
+		return ret;
+	}
+#ifdef HAVE_ZLIB
+	if (method == 8) {
+		z_stream stream;
+		int err;
+
+		memset(&stream, 0, sizeof(stream));
+		stream.next_in=(Bytef *)data;
+		stream.avail_in=comp_size;
+		stream.next_out=(Bytef *)ret;
+		stream.avail_out=data_size;
+		if (inflateInit2(&stream, -MAX_WBITS) == Z_OK) {
+			err=inflate(&stream, Z_FINISH);
+			inflateEnd(&stream);
+			if (err == Z_STREAM_END && stream.total_out == data_size)
+				return ret;
+		}
+	}
+#endif
+#ifdef HAVE_ZSTD
+	if (method == 93) {
+		size_t len=ZSTD_decompress(ret, data_size, data, comp_size);
+		if (!ZSTD_isError(len) && len == data_size)
+			return ret;
+	}
+#endif
+	g_free(ret);
+	return NULL;
 }
 
 void
@@ -360,7 +500,9 @@ zip_write_directory(struct zip_info *info)
 struct zip_info *
 zip_new(void)
 {
-	return g_new0(struct zip_info, 1);
+	struct zip_info *info=g_new0(struct zip_info, 1);
+	info->compression_method=8;
+	return info;
 }
 
 void
@@ -397,6 +539,24 @@ zip_set_compression_level(struct zip_info *info, int level)
 	info->compression_level=level;
 }
 
+/**
+ * @brief Sets the compression method of the members written afterwards
+ *
+ * @param info The zip file
+ * @param method The zip compression method, 8 for deflate or 93 for Zstandard
+ * @return 1 if the method is supported, 0 otherwise
+ */
+int
+zip_set_compression_method(struct zip_info *info, int method)
+{
+#ifndef HAVE_ZSTD
+	if (method == 93)
+		return 0;
+#endif
+	info->compression_method=method;
+	return 1;
+}
+
 void
 zip_set_maxnamelen(struct zip_info *info, int max)
 {
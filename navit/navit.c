@@ -59,6 +59,7 @@
 #include "attr.h"
 #include "event.h"
 #include "file.h"
+#include "cache.h"
 #include "profile.h"
 #include "command.h"
 #include "navit_nls.h"
@@ -1267,6 +1268,139 @@ navit_cmd_set_position(struct navit *this, char *function, struct attr **in, str
 	navit_set_position(this, &pc);
 }
 
+/**
+ * Calculate travel times and lengths between a set of sources and destinations
+ *
+ * @param navit The navit instance
+ * @param function unused (needed to match command function signature)
+ * @param in input attributes in[0] - number of sources, in[1..] - coordinates of the sources followed by those of the destinations
+ * @param out output attribute, a string with one line per source holding one "time/length" pair per destination,
+ * separated by spaces. Times are in tenths of seconds, lengths in meters, pairs without a route are "-".
+ * @param valid unused 
+ * @returns nothing
+ */
+static void
+navit_cmd_route_matrix(struct navit *this, char *function, struct attr **in, struct attr ***out, int *valid)
+{
+	struct attr attr;
+	struct pcoord *pc=NULL;
+	int i,j,count=0,src_count,dst_count,*times,*lengths;
+	char *str,*p;
+
+	if (!this->route || !in || !in[0] || !ATTR_IS_INT(in[0]->type))
+		return;
+	src_count=in[0]->u.num;
+	in++;
+	while (in && in[0]) {
+		pc=g_renew(struct pcoord, pc, count+1);
+		in=navit_get_coord(this, in, &pc[count]);
+		if (in)
+			count++;
+	}
+	dst_count=count-src_count;
+	if (src_count <= 0 || dst_count <= 0) {
+		dbg(lvl_error,"need at least one source and one destination, got %d coordinates for %d sources\n", count, src_count);
+		g_free(pc);
+		return;
+	}
+	/* Each pair takes up to 24 characters of the result */
+	if (src_count > INT_MAX/24/dst_count) {
+		dbg(lvl_error,"matrix of %d sources and %d destinations is too large\n", src_count, dst_count);
+		g_free(pc);
+		return;
+	}
+	times=g_new(int, src_count*dst_count);
+	lengths=g_new(int, src_count*dst_count);
+	route_get_matrix(this->route, pc, src_count, pc+src_count, dst_count, times, lengths);
+	p=str=g_malloc(src_count*dst_count*24+1);
+	for (i = 0 ; i < src_count ; i++) {
+		for (j = 0 ; j < dst_count ; j++) {
+			if (times[i*dst_count+j] == INT_MAX)
+				p+=sprintf(p, "-");
+			else
+				p+=sprintf(p, "%d/%d", times[i*dst_count+j], lengths[i*dst_count+j]);
+			*p++=j == dst_count-1 ? '\n':' ';
+		}
+	}
+	*p='\0';
+	attr.type=attr_type_string_begin;
+	attr.u.str=str;
+	if (out)
+		*out=attr_generic_add_attr(*out, &attr);
+	g_free(str);
+	g_free(times);
+	g_free(lengths);
+	g_free(pc);
+}
+
+/**
+ * Calculate the area which can be reached from a coordinate within a given time
+ *
+ * The reached points and segments and their outline are shown on the route isochrone map.
+ *
+ * @param navit The navit instance
+ * @param function unused (needed to match command function signature)
+ * @param in input attributes in[0] - coordinate of the start (a string, or projection, x and y), followed by the time limit in seconds (0 removes the
+ * isochrone) and optionally the concavity of the outline (0 for the convex hull, larger values for a smoother outline).
+ * Without a concavity no outline is calculated.
+ * @param out output attribute, the number of reached points
+ * @param valid unused 
+ * @returns nothing
+ */
+static void
+navit_cmd_route_isochrone(struct navit *this, char *function, struct attr **in, struct attr ***out, int *valid)
+{
+	struct attr attr;
+	struct pcoord pc;
+	int limit,concavity=-1;
+
+	if (!this->route)
+		return;
+	in=navit_get_coord(this, in, &pc);
+	if (!in || !in[0] || !ATTR_IS_INT(in[0]->type))
+		return;
+	limit=in[0]->u.num*10;
+	if (in[1] && ATTR_IS_INT(in[1]->type))
+		concavity=in[1]->u.num;
+	attr.type=attr_type_int_begin;
+	attr.u.num=route_set_isochrone(this->route, &pc, limit, concavity);
+	if (out)
+		*out=attr_generic_add_attr(*out, &attr);
+	navit_draw(this);
+}
+
+/**
+ * Report the counters of the file cache
+ *
+ * @param navit The navit instance
+ * @param function unused (needed to match command function signature)
+ * @param in unused
+ * @param out output attribute, a string with one line per cache partition: the name of the map file (or "default"),
+ * the number of hits, misses and evictions, the bytes held and the budget in bytes, separated by spaces
+ * @param valid unused 
+ * @returns nothing
+ */
+static void
+navit_cmd_file_cache_stats(struct navit *this, char *function, struct attr **in, struct attr ***out, int *valid)
+{
+	struct attr attr;
+	struct cache_stats stats;
+	char *name,*str=NULL;
+	int i;
+
+	for (i = 0 ; file_get_cache_stats(i, &name, &stats) ; i++) {
+		str=g_strconcat_printf(str, "%s %u %u %u %d %d\n", name ? name : "default", stats.hits, stats.misses, stats.evictions,
+			stats.size, stats.max_size);
+	}
+	if (!str)
+		return;
+	attr.type=attr_type_string_begin;
+	attr.u.str=str;
+	if (out)
+		*out=attr_generic_add_attr(*out, &attr);
+	g_free(str);
+}
+
 
 static void
 navit_cmd_fmt_coordinates(struct navit *this, char *function, struct attr **in, struct attr ***out, int *valid)
@@ -1386,6 +1520,9 @@ static struct command_table commands[] = {
 	{"set_center_cursor",command_cast(navit_cmd_set_center_cursor)},
 	{"set_destination",command_cast(navit_cmd_set_destination)},
 	{"set_position",command_cast(navit_cmd_set_position)},
+	{"route_matrix",command_cast(navit_cmd_route_matrix)},
+	{"route_isochrone",command_cast(navit_cmd_route_isochrone)},
+	{"file_cache_stats",command_cast(navit_cmd_file_cache_stats)},
 	{"route_remove_next_waypoint",command_cast(navit_cmd_route_remove_next_waypoint)},
 	{"route_remove_last_waypoint",command_cast(navit_cmd_route_remove_last_waypoint)},
 	{"set_position",command_cast(navit_cmd_set_position)},
@@ -2115,6 +2252,12 @@ navit_init(struct navit *this_)
 				mapset_add_attr(ms, &map_a);
 				map_set_attr(map, &active);
 			}
+			if ((map=route_get_isochrone_map(this_->route))) {
+				struct attr map_a;
+				map_a.type=attr_map;
+				map_a.u.map=map;
+				mapset_add_attr(ms, &map_a);
+			}
 			route_set_mapset(this_->route, ms);
 			route_set_projection(this_->route, transform_get_projection(this_->trans));
 		}
@@ -3088,6 +3231,31 @@ navit_vehicle_draw(struct navit *this_, struct navit_vehicle *nv, struct point *
 	vehicle_draw(nv->vehicle, this_->gra, &cursor_pnt, nv->dir-transform_get_yaw(this_->trans_cursor), nv->speed);
 }
 
+/**
+ * @brief Passes the position, heading and speed of the vehicle to the maps
+ *
+ * Maps can use this to read the data for the area the vehicle is heading to
+ * before it is drawn or routed through, see map_prefetch().
+ *
+ * @param this_ The navit instance
+ * @param dir The heading of the vehicle
+ * @param speed The speed of the vehicle
+ * @param pos The position of the vehicle
+ */
+static void
+navit_vehicle_prefetch(struct navit *this_, struct attr *dir, struct attr *speed, struct attr *pos)
+{
+	struct mapset_handle *msh;
+	struct map *map;
+
+	if (!this_->mapsets)
+		return;
+	msh=mapset_open(this_->mapsets->data);
+	while (msh && (map=mapset_next(msh, 1)))
+		map_prefetch(map, pos->u.coord_geo, *dir->u.numd, *speed->u.numd);
+	mapset_close(msh);
+}
+
 /**
  * @brief Called when the position of a vehicle changes.
  *
@@ -3154,6 +3322,7 @@ navit_vehicle_update_position(struct navit *this_, struct navit_vehicle *nv) {
 		profile(0,"return 3\n");
 		return;
 	}
+	navit_vehicle_prefetch(this_, &attr_dir, &attr_speed, &attr_pos);
 	cursor_pc.x = nv->coord.x;
 	cursor_pc.y = nv->coord.y;
 	cursor_pc.pro = pro;
@@ -65,7 +65,7 @@ popup_set_no_passing(struct popup_item *item, void *param)
 #endif
 
 static void
-popup_traffic_distortion(struct item *item, char *attr)
+popup_traffic_distortion(struct navit *nav, struct item *item, char *attr)
 {
 	/* add the configuration directory to the name of the file to use */
 	char *dist_filename = g_strjoin(NULL, navit_get_user_data_directory(TRUE),
@@ -84,6 +84,9 @@ popup_traffic_distortion(struct item *item, char *attr)
 				fprintf(map,"0x%x 0x%x\n",c.x,c.y);
 			}
 			fclose(map);
+			/* the route graph picks up the new distortion without being rebuilt */
+			if (navit_get_route(nav))
+				route_update_traffic_distortions(navit_get_route(nav));
 		}
 		else
 		{
@@ -97,26 +100,26 @@ popup_traffic_distortion(struct item *item, char *attr)
 
  
 static void
-popup_traffic_distortion_blocked(struct item *item)
+popup_traffic_distortion_blocked(struct navit *nav, struct item *item)
 {
 	dbg(lvl_debug,"item=%p\n",item);
-	popup_traffic_distortion(item, "maxspeed=0");
+	popup_traffic_distortion(nav, item, "maxspeed=0");
 }
 
 static void
-popup_traffic_distortion_speed(struct item *item, int maxspeed)
+popup_traffic_distortion_speed(struct navit *nav, struct item *item, int maxspeed)
 {
 	char buffer[256];
 	sprintf(buffer,"maxspeed=%d",maxspeed);
-	popup_traffic_distortion(item,buffer);
+	popup_traffic_distortion(nav, item,buffer);
 }
 
 static void
-popup_traffic_distortion_delay(struct item *item, int delay)
+popup_traffic_distortion_delay(struct navit *nav, struct item *item, int delay)
 {
 	char buffer[256];
 	sprintf(buffer,"delay=%d",delay*600);
-	popup_traffic_distortion(item,buffer);
+	popup_traffic_distortion(nav, item,buffer);
 }
 
 static void
@@ -376,14 +379,14 @@ popup_show_item(struct navit *nav, void *popup, struct displayitem *di)
 		int delays[]={1,2,3,5,10,15,20,30,45,60,75,90,120,150,180,240,300};
 		int i;
 		menu_dist=popup_printf(menu, menu_type_submenu, "Traffic distortion");
-		popup_printf_cb(menu_dist, menu_type_menu, callback_new_1(callback_cast(popup_traffic_distortion_blocked), diitem), "Blocked");
+		popup_printf_cb(menu_dist, menu_type_menu, callback_new_2(callback_cast(popup_traffic_distortion_blocked), nav, diitem), "Blocked");
 		menu_item=popup_printf(menu_dist, menu_type_submenu,"Max speed");
 		for (i = 0 ; i < sizeof(speeds)/sizeof(int); i++) {
-			popup_printf_cb(menu_item, menu_type_menu, callback_new_2(callback_cast(popup_traffic_distortion_speed), diitem, speeds[i]), "%d km/h",speeds[i]);
+			popup_printf_cb(menu_item, menu_type_menu, callback_new_3(callback_cast(popup_traffic_distortion_speed), nav, diitem, speeds[i]), "%d km/h",speeds[i]);
 		}
 		menu_item=popup_printf(menu_dist, menu_type_submenu,"Delay");
 		for (i = 0 ; i < sizeof(delays)/sizeof(int); i++) {
-			popup_printf_cb(menu_item, menu_type_menu, callback_new_2(callback_cast(popup_traffic_distortion_delay), diitem, delays[i]*600), "%d min",delays[i]);
+			popup_printf_cb(menu_item, menu_type_menu, callback_new_3(callback_cast(popup_traffic_distortion_delay), nav, diitem, delays[i]*600), "%d min",delays[i]);
 		}
 	}
 }
@@ -65,17 +65,48 @@
 #include "transform.h"
 #include "plugin.h"
 #include "fib.h"
+#include "heap.h"
 #include "event.h"
 #include "callback.h"
 #include "vehicle.h"
 #include "vehicleprofile.h"
 #include "roadprofile.h"
 #include "debug.h"
+#include "file.h"
+#include "navit.h"
+#include "types.h"
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#include <unistd.h>
+#endif
 
 struct map_priv {
 	struct route *route;
 };
 
+/* The priority queue used by route_graph_flood() and the contraction hierarchy query.
+ * Define ROUTE_USE_FIBHEAP to use the Fibonacci heap from fib-1.1 instead of the
+ * array based heap from heap.c. */
+#ifdef ROUTE_USE_FIBHEAP
+#define route_heap fibheap
+typedef struct fibheap_el *route_heap_el;
+#define route_heap_new() fh_makekeyheap()
+#define route_heap_insert(heap,key,data,el) (*(el)=fh_insertkey((heap),(key),(data)))
+#define route_heap_replace_key(heap,el,key) fh_replacekey((heap),*(el),(key))
+#define route_heap_min(heap) fh_min(heap)
+#define route_heap_extract_min(heap) fh_extractmin(heap)
+#define route_heap_destroy(heap) fh_deleteheap(heap)
+#else
+#define route_heap heap
+typedef int route_heap_el;
+#define route_heap_new() heap_new()
+#define route_heap_insert(heap,key,data,el) heap_insert((heap),(key),(data),(el))
+#define route_heap_replace_key(heap,el,key) heap_replace_key((heap),(el),(key))
+#define route_heap_min(heap) heap_min(heap)
+#define route_heap_extract_min(heap) heap_extract_min(heap)
+#define route_heap_destroy(heap) heap_destroy(heap)
+#endif
+
 int debug_route=0;
 
 /**
@@ -92,16 +123,21 @@ struct route_graph_point {
 										  *  of this linked-list are in route_graph_segment->end_next. */
 	struct route_graph_segment *seg;	 /**< Pointer to the segment one should use to reach the destination at
 										  *  least costs */
-	struct fibheap_el *el;				 /**< When this point is put on a Fibonacci heap, this is a pointer
-										  *  to this point's heap-element */
+	route_heap_el el;					 /**< When this point is put on the heap, this identifies
+										  *  this point's heap-element, otherwise it is 0 */
 	int value;							 /**< The cost at which one can reach the destination from this point on */
 	struct coord c;						 /**< Coordinates of this point */
 	int flags;						/**< Flags for this point (eg traffic distortion) */
+	int edge_first;						/**< Index of the first segment of this point in route_graph->edges */
+	int edge_starts;					/**< Number of segments in route_graph->edges starting at this point */
+	int edge_ends;						/**< Number of segments in route_graph->edges ending at this point,
+								 *  they follow the starting ones */
 };
 
 #define RP_TRAFFIC_DISTORTION 1
 #define RP_TURN_RESTRICTION 2
 #define RP_TURN_RESTRICTION_RESOLVED 4
+#define RP_FLOOD_TARGET 8
 
 /**
  * @brief A segment in the route graph or path
@@ -249,6 +285,8 @@ struct route {
 	struct route_path *path2;	/**< Pointer to the route path */
 	struct map *map;
 	struct map *graph_map;
+	struct route_isochrone *isochrone;	/**< The area reachable from a start, see route_set_isochrone() */
+	struct map *isochrone_map;
 	struct callback * route_graph_done_cb ; /**< Callback when route graph is done */
 	struct callback * route_graph_flood_done_cb ; /**< Callback when route graph flooding is done */
 	struct callback_list *cbl2;	/**< Callback list to call when route changes */
@@ -258,6 +296,18 @@ struct route {
 	int link_path;			/**< Link paths over multiple waypoints together */
 	struct pcoord pc;
 	struct vehicle *v;
+	GList *map_clones;		/**< Copies of the binfile maps which are not read by graph workers at the moment, see route_graph_workers_new() */
+};
+
+/**
+ * @brief The area reachable from a start within a cost limit
+ */
+struct route_isochrone {
+	struct route_graph *graph;	/**< The graph flooded from the start, points beyond the limit have a value of INT_MAX */
+	struct route_info *start;	/**< The start */
+	int limit;			/**< The cost limit in tenths of seconds */
+	struct coord *hull;		/**< The outline of the reached points, NULL if it was not requested */
+	int hull_count;			/**< The number of coordinates in {@code hull} */
 };
 
 /**
@@ -267,7 +317,7 @@ struct route {
  */
 struct route_graph {
 	int busy;					/**< The graph is being built */
-	struct map_selection *sel;			/**< The rectangle selection for the graph */
+	struct map_selection *sel;			/**< The rectangle selection for the graph, kept until the graph is destroyed */
 	struct mapset_handle *h;			/**< Handle to the mapset */	
 	struct map *m;					/**< Pointer to the currently active map */	
 	struct map_rect *mr;				/**< Pointer to the currently active map rectangle */
@@ -278,10 +328,61 @@ struct route_graph {
    	struct route_graph_segment *route_segments; /**< Pointer to the first route_graph_segment in the linked list of all segments */
 	struct route_graph_segment *avoid_seg;
 #define HASH_SIZE 8192
-	struct route_graph_point *hash[HASH_SIZE];	/**< A hashtable containing all route_graph_points in this graph */
+	struct route_graph_point **hash;		/**< A hashtable containing all route_graph_points in this graph */
+	int hash_size;					/**< Number of buckets in hash, a power of two of at least HASH_SIZE */
+	int point_count;				/**< Number of points in this graph */
+	struct route_graph_chunk *points;		/**< Chunks holding the points of this graph */
+	struct route_graph_chunk *segments;		/**< Chunks holding the segments of this graph */
+	struct route_graph_segment **edges;		/**< Segments of all points, see route_graph_point->edge_first */
+	int edges_valid;				/**< edges is up to date with the segment lists of the points */
+	int flood_partial;				/**< The last flood stopped before settling all points (A*) */
+	struct route_graph_cache *cache;		/**< Where this graph is stored on disk, NULL if it is not cached */
+	struct route_graph_workers *workers;		/**< Threads reading maps into this graph while it is built */
+	struct route_graph_job *job;			/**< Thread flooding this graph, NULL if there is none */
+};
+
+#ifdef HAVE_PTHREAD
+/**
+ * @brief A flood of the route graph running on its own thread
+ *
+ * While a job exists, the graph belongs to its thread. The job is either cancelled
+ * by route_graph_job_cancel() or, once the thread is done, its callback is called
+ * from the main loop.
+ */
+struct route_graph_job {
+	struct route_graph *graph;		/**< The graph being flooded */
+	struct vehicleprofile *profile;		/**< The vehicle profile */
+	struct route_info *dst;			/**< Copy of the destination the graph is flooded for */
+	struct route_info *pos;			/**< Copy of the start of the path */
+	int astar;				/**< The flood is directed towards {@code pos} */
+	int at_position;			/**< {@code pos} is the position of the vehicle */
+	struct callback *cb;			/**< Called from the main loop when the job is done */
+	struct callback *watch_cb;		/**< Callback of {@code watch} */
+	struct event_watch *watch;		/**< Watch on {@code fd[0]}, the thread writes to {@code fd[1]} when it is done */
+	int fd[2];
+	pthread_t thread;
+	int started;
+	pthread_mutex_t mutex;
+	int cancel;
+};
+#endif
+
+#define HASHCOORD(c,size) ((((c)->x +(c)->y) * 2654435761UL) & ((size)-1))
+
+/**
+ * @brief A block of memory holding points or segments of a route graph
+ *
+ * Points and segments are never freed individually, so they are packed into large
+ * blocks which are released together when the graph is destroyed.
+ */
+struct route_graph_chunk {
+	struct route_graph_chunk *next;			/**< Next (older) chunk */
+	int size;					/**< Usable size of this chunk in bytes */
+	int used;					/**< Bytes in use */
+	/* data follows */
 };
 
-#define HASHCOORD(c) ((((c)->x +(c)->y) * 2654435761UL) & (HASH_SIZE-1))
+#define ROUTE_GRAPH_CHUNK_SIZE 65536
 
 /**
  * @brief Iterator to iterate through all route graph segments in a route graph point
@@ -302,16 +403,34 @@ struct attr_iter {
 };
 
 static struct route_info * route_find_nearest_street(struct vehicleprofile *vehicleprofile, struct mapset *ms, struct pcoord *c);
+static struct route_info * route_find_nearest_street_graph(struct vehicleprofile *vehicleprofile, struct mapset *ms, struct pcoord *c, struct route_graph *graph, int order);
+static struct route_graph_segment *route_graph_get_segment(struct route_graph *graph, struct street_data *sd, struct route_graph_segment *last);
+static int route_graph_snap_position(struct route *this);
+static void route_info_distances(struct route_info *ri, enum projection pro);
 static struct route_graph_point *route_graph_get_point(struct route_graph *this, struct coord *c);
 static void route_graph_update(struct route *this, struct callback *cb, int async);
 static void route_graph_build_done(struct route_graph *rg, int cancel);
 static struct route_path *route_path_new(struct route_graph *this, struct route_path *oldpath, struct route_info *pos, struct route_info *dst, struct vehicleprofile *profile);
 static void route_process_street_graph(struct route_graph *this, struct item *item, struct vehicleprofile *profile);
 static void route_graph_destroy(struct route_graph *this);
+static void route_graph_cache_destroy(struct route_graph_cache *this);
+static void route_graph_map_clones_destroy(GList **clones);
+#ifdef HAVE_PTHREAD
+static int route_graph_workers_has_map(struct route_graph_workers *this, struct map *m);
+static void route_graph_job_cancel(struct route_graph_job *job);
+static int route_path_start_async(struct route *this, struct route_info *pos);
+#endif
+static void route_graph_flood_start(struct route *this, struct callback *cb);
 static void route_path_update(struct route *this, int cancel, int async);
 static int route_time_seg(struct vehicleprofile *profile, struct route_segment_data *over, struct route_traffic_distortion *dist);
-static void route_graph_flood(struct route_graph *this, struct route_info *dst, struct vehicleprofile *profile, struct callback *cb);
+static void route_graph_flood(struct route_graph *this, struct route_info *dst, struct route_info *pos, struct vehicleprofile *profile, struct callback *cb);
 static void route_graph_reset(struct route_graph *this);
+static void route_graph_build_edges(struct route_graph *this);
+static void route_path_update_flags(struct route *this, enum route_path_flags flags);
+static int route_path_update_ch(struct route *this);
+static void route_path_calc_time_len(struct route_path *path, struct vehicleprofile *profile);
+static int route_graph_rescan_traffic_distortions(struct route_graph *this, struct mapset *ms, GList **changed);
+static void route_graph_flood_partial(struct route_graph *this, struct route_info *dst, GList **changed, struct vehicleprofile *profile);
 
 
 /**
@@ -594,6 +713,8 @@ route_check_roundabout(struct route_graph_segment *seg, int level, int direction
 void
 route_set_mapset(struct route *this, struct mapset *ms)
 {
+	if (this->ms != ms)
+		route_graph_map_clones_destroy(&this->map_clones);
 	this->ms=ms;
 }
 
@@ -771,6 +892,45 @@ route_previous_destination(struct route *this)
 	return l->data;
 }
 
+/**
+ * @brief Returns the origin to pass to route_graph_flood()
+ *
+ * @param this The route object
+ * @return The start of the current leg if the vehicle profile asks for A*, NULL to flood the whole graph
+ */
+static struct route_info *
+route_flood_origin(struct route *this)
+{
+	if (this->vehicleprofile && this->vehicleprofile->route_algorithm == route_algorithm_astar)
+		return route_previous_destination(this);
+	return NULL;
+}
+
+/**
+ * @brief Calculates the total time and length of a route path
+ *
+ * @param path The path, its {@code path_time} and {@code path_len} members will be set
+ * @param profile The vehicle profile used to calculate the time of each segment
+ */
+static void
+route_path_calc_time_len(struct route_path *path, struct vehicleprofile *profile)
+{
+	struct route_path_segment *seg=path->path;
+	int path_time=0,path_len=0;
+	while (seg) {
+		/* FIXME */
+		int seg_time=route_time_seg(profile, seg->data, NULL);
+		if (seg_time == INT_MAX) {
+			dbg(lvl_debug,"error\n");
+		} else
+			path_time+=seg_time;
+		path_len+=seg->data->len;
+		seg=seg->next;
+	}
+	path->path_time=path_time;
+	path->path_len=path_len;
+}
+
 /**
  * @brief Updates or recreates the route graph.
  *
@@ -795,9 +955,27 @@ route_path_update_done(struct route *this, int new_graph)
 		this->path2->update_required=1+new_graph;
 		return;
 	}
+	if (!this->graph) {
+		/* path was calculated without a graph (contraction hierarchy), start over */
+		route_path_update_flags(this, this->flags);
+		return;
+	}
+#ifdef HAVE_PTHREAD
+	if (this->graph->job) {
+		/* the path is updated when the flood is done */
+		dbg(lvl_debug,"flood in progress\n");
+		return;
+	}
+#endif
+	prev_dst=route_previous_destination(this);
+#ifdef HAVE_PTHREAD
+	if (route_path_start_async(this, prev_dst)) {
+		dbg(lvl_debug,"flood again to avoid turning around\n");
+		return;
+	}
+#endif
 	route_status.u.num=route_status_building_path;
 	route_set_attr(this, &route_status);
-	prev_dst=route_previous_destination(this);
 	if (this->link_path) {
 		this->path2=route_path_new(this->graph, NULL, prev_dst, this->current_dst, this->vehicleprofile);
 		if (this->path2)
@@ -806,31 +984,26 @@ route_path_update_done(struct route *this, int new_graph)
 		    route_path_destroy(oldpath,0);
 	} else {
 		this->path2=route_path_new(this->graph, oldpath, prev_dst, this->current_dst, this->vehicleprofile);
+		if (!this->path2 && !new_graph && route_flood_origin(this)) {
+			/* The graph was only flooded up to the previous position, do it again for the current one */
+			dbg(lvl_debug,"reflood for new position\n");
+			this->path2=oldpath;
+			route_graph_reset(this->graph);
+			route_graph_flood_start(this, this->route_graph_flood_done_cb);
+			return;
+		}
 		if (oldpath && this->path2) {
 			this->path2->next=oldpath->next;
 			route_path_destroy(oldpath,0);
 		}
 	}
 	if (this->path2) {
-		struct route_path_segment *seg=this->path2->path;
-		int path_time=0,path_len=0;
-		while (seg) {
-			/* FIXME */
-			int seg_time=route_time_seg(this->vehicleprofile, seg->data, NULL);
-			if (seg_time == INT_MAX) {
-				dbg(lvl_debug,"error\n");
-			} else
-				path_time+=seg_time;
-			path_len+=seg->data->len;
-			seg=seg->next;
-		}
-		this->path2->path_time=path_time;
-		this->path2->path_len=path_len;
+		route_path_calc_time_len(this->path2, this->vehicleprofile);
 		if (prev_dst != this->pos) {
 			this->link_path=1;
 			this->current_dst=prev_dst;
 			route_graph_reset(this->graph);
-			route_graph_flood(this->graph, this->current_dst, this->vehicleprofile, this->route_graph_flood_done_cb);
+			route_graph_flood_start(this, this->route_graph_flood_done_cb);
 			return;
 		}
 		if (!new_graph && this->path2->updated)
@@ -879,14 +1052,33 @@ route_path_update_flags(struct route *this, enum route_path_flags flags)
 		route_graph_destroy(this->graph);
 		this->graph=NULL;
 	}
+	if (!this->graph && route_path_update_ch(this)) {
+		dbg(lvl_debug,"path from contraction hierarchy\n");
+		return;
+	}
 	/* the graph is destroyed when setting the destination */
 	if (this->graph) {
 		if (this->graph->busy) {
 			dbg(lvl_debug,"busy building graph\n");
 			return;
 		}
+#ifdef HAVE_PTHREAD
+		if (this->graph->job) {
+			struct route_graph_job *job=this->graph->job;
+			if (job->at_position && (!job->pos->street || !this->pos->street || !item_is_equal(job->pos->street->item, this->pos->street->item))) {
+				/* the flood is directed towards a street the vehicle has left, start over */
+				dbg(lvl_debug,"restart flood\n");
+				route_graph_job_cancel(job);
+				route_graph_reset(this->graph);
+				route_graph_flood_start(this, this->route_graph_flood_done_cb);
+			} else
+				dbg(lvl_debug,"busy flooding graph\n");
+			return;
+		}
+#endif
 		// we can try to update
 		dbg(lvl_debug,"try update\n");
+		route_graph_snap_position(this);
 		route_path_update_done(this, 0);
 	} else {
 		route_path_destroy(this->path2,1);
@@ -917,6 +1109,53 @@ route_path_update(struct route *this, int cancel, int async)
 	route_path_update_flags(this, flags);
 }
 
+/**
+ * @brief Makes sure the position is on a street of the route graph
+ *
+ * If tracking matched the position to a street which is not part of the graph (e.g. a minor street
+ * in an area where the graph only holds major roads), but the position is still within the
+ * selection the graph was built from, the position is matched to the nearest street of the graph
+ * instead. Only streets of the order the graph was selected with at the position are searched.
+ * Since the graph is flooded from the destination, the path can then be calculated again without
+ * building or flooding a new graph.
+ *
+ * @param this The route
+ * @return True if the position is on a street of the graph
+ */
+static int
+route_graph_snap_position(struct route *this)
+{
+	struct route_info *ri;
+	struct map_selection *sel;
+	struct pcoord pc;
+	int order=-1;
+
+	if (!this->pos->street || !this->graph->sel)
+		return 0;
+	if (route_graph_get_segment(this->graph, this->pos->street, NULL))
+		return 1;
+	for (sel = this->graph->sel ; sel ; sel = sel->next) {
+		if (coord_rect_contains(&sel->u.c_rect, &this->pos->c) && sel->order > order)
+			order=sel->order;
+	}
+	if (order < 0) {
+		dbg(lvl_debug,"position outside of graph\n");
+		return 0;
+	}
+	pc.pro=map_projection(this->pos->street->item.map);
+	pc.x=this->pos->c.x;
+	pc.y=this->pos->c.y;
+	ri=route_find_nearest_street_graph(this->vehicleprofile, this->ms, &pc, this->graph, order);
+	if (!ri)
+		return 0;
+	dbg(lvl_debug,"snapped position to 0x%x,0x%x\n", ri->street->item.id_hi, ri->street->item.id_lo);
+	ri->street_direction=0;
+	route_info_distances(ri, pc.pro);
+	route_info_free(this->pos);
+	this->pos=ri;
+	return 1;
+}
+
 
 /** 
  * @brief This will calculate all the distances stored in a route_info
@@ -1372,10 +1611,57 @@ route_remove_waypoint(struct route *this)
 			return;
 		}
 		this->reached_destinations_count++;
+#ifdef HAVE_PTHREAD
+		if (this->graph->job)
+			route_graph_job_cancel(this->graph->job);
+#endif
 		route_graph_reset(this->graph);
 		this->current_dst = this->destinations->data;
-		route_graph_flood(this->graph, this->current_dst, this->vehicleprofile,	this->route_graph_flood_done_cb);
+		route_graph_flood_start(this, this->route_graph_flood_done_cb);
+	}
+}
+
+/**
+ * @brief Updates the route after traffic distortions within the route graph have changed
+ *
+ * The traffic distortions are read again from the maps. If the graph was completely flooded
+ * for a single destination, only the part of it affected by the changed distortions is flooded again,
+ * otherwise the whole graph is. The route graph itself is not rebuilt.
+ *
+ * @param this The route
+ */
+void
+route_update_traffic_distortions(struct route *this)
+{
+	GList *changed=NULL;
+	int count,restart=0;
+
+	if (!this->graph || this->graph->busy || !this->graph->sel || !this->current_dst)
+		return;
+#ifdef HAVE_PTHREAD
+	if (this->graph->job) {
+		/* the graph can't be changed while it is flooded, start the flood again afterwards */
+		route_graph_job_cancel(this->graph->job);
+		this->graph->flood_partial=1;
+		restart=1;
+	}
+#endif
+	count=route_graph_rescan_traffic_distortions(this->graph, this->ms, &changed);
+	dbg(lvl_debug,"%d traffic distortions changed\n", count);
+	if (count || restart) {
+		if (!this->destinations->next && !this->graph->flood_partial && !this->link_path) {
+			route_graph_flood_partial(this->graph, this->current_dst, &changed, this->vehicleprofile);
+			route_path_update_done(this, 1);
+		} else {
+			route_path_destroy(this->path2,1);
+			this->path2=NULL;
+			this->link_path=0;
+			this->current_dst=route_get_dst(this);
+			route_graph_reset(this->graph);
+			route_graph_flood_start(this, this->route_graph_flood_done_cb);
+		}
 	}
+	g_list_free(changed);
 }
 
 /**
@@ -1391,7 +1677,10 @@ static struct route_graph_point *
 route_graph_get_point_next(struct route_graph *this, struct coord *c, struct route_graph_point *last)
 {
 	struct route_graph_point *p;
-	int seen=0,hashval=HASHCOORD(c);
+	int seen=0,hashval;
+	if (!this->hash)
+		return NULL;
+	hashval=HASHCOORD(c,this->hash_size);
 	p=this->hash[hashval];
 	while (p) {
 		if (p->c.x == c->x && p->c.y == c->y) {
@@ -1429,7 +1718,10 @@ static struct route_graph_point *
 route_graph_get_point_last(struct route_graph *this, struct coord *c)
 {
 	struct route_graph_point *p,*ret=NULL;
-	int hashval=HASHCOORD(c);
+	int hashval;
+	if (!this->hash)
+		return NULL;
+	hashval=HASHCOORD(c,this->hash_size);
 	p=this->hash[hashval];
 	while (p) {
 		if (p->c.x == c->x && p->c.y == c->y)
@@ -1441,6 +1733,84 @@ route_graph_get_point_last(struct route_graph *this, struct coord *c)
 
 
 
+/**
+ * @brief Allocates zeroed memory for a point or segment of a route graph
+ *
+ * @param chunks The list of chunks to allocate from
+ * @param size The number of bytes needed
+ * @return The memory, which is valid until the chunks are freed
+ */
+static void *
+route_graph_alloc(struct route_graph_chunk **chunks, int size)
+{
+	struct route_graph_chunk *chunk=*chunks;
+	void *ret;
+
+	size=(size+sizeof(void *)-1) & ~(sizeof(void *)-1);
+	if (!chunk || chunk->used+size > chunk->size) {
+		int chunk_size=MAX(ROUTE_GRAPH_CHUNK_SIZE, size);
+		chunk=g_malloc0(sizeof(*chunk)+chunk_size);
+		chunk->size=chunk_size;
+		chunk->next=*chunks;
+		*chunks=chunk;
+	}
+	ret=(char *)(chunk+1)+chunk->used;
+	chunk->used+=size;
+	return ret;
+}
+
+/**
+ * @brief Frees a list of chunks
+ *
+ * @param chunks The list of chunks, will be set to NULL
+ */
+static void
+route_graph_free_chunks(struct route_graph_chunk **chunks)
+{
+	struct route_graph_chunk *chunk=*chunks,*next;
+	while (chunk) {
+		next=chunk->next;
+		g_free(chunk);
+		chunk=next;
+	}
+	*chunks=NULL;
+}
+
+/**
+ * @brief Grows the point hash of a route graph
+ *
+ * The number of buckets is doubled (or set to {@code HASH_SIZE} initially), so chains stay
+ * short however large the graph gets. Points with equal coordinates keep their order.
+ *
+ * @param this The route graph
+ */
+static void
+route_graph_resize_hash(struct route_graph *this)
+{
+	int i,size=this->hash ? this->hash_size*2 : HASH_SIZE;
+	struct route_graph_point **hash=g_new0(struct route_graph_point *, size);
+	struct route_graph_point **last=g_new0(struct route_graph_point *, size);
+	struct route_graph_point *p,*next;
+
+	for (i = 0 ; i < this->hash_size ; i++) {
+		for (p = this->hash[i] ; p ; p = next) {
+			int hashval=HASHCOORD(&p->c,size);
+			next=p->hash_next;
+			p->hash_next=NULL;
+			if (last[hashval])
+				last[hashval]->hash_next=p;
+			else
+				hash[hashval]=p;
+			last[hashval]=p;
+		}
+	}
+	g_free(last);
+	g_free(this->hash);
+	this->hash=hash;
+	this->hash_size=size;
+	dbg(lvl_debug,"%d points, %d buckets\n", this->point_count, size);
+}
+
 /**
  * @brief Create a new point for the route graph with the specified coordinates
  *
@@ -1455,14 +1825,18 @@ route_graph_point_new(struct route_graph *this, struct coord *f)
 	int hashval;
 	struct route_graph_point *p;
 
-	hashval=HASHCOORD(f);
+	if (!this->hash || this->point_count >= this->hash_size*2)
+		route_graph_resize_hash(this);
+	hashval=HASHCOORD(f,this->hash_size);
 	if (debug_route)
 		printf("p (0x%x,0x%x)\n", f->x, f->y);
-	p=g_slice_new0(struct route_graph_point);
+	p=route_graph_alloc(&this->points, sizeof(struct route_graph_point));
 	p->hash_next=this->hash[hashval];
 	this->hash[hashval]=p;
 	p->value=INT_MAX;
 	p->c=*f;
+	this->point_count++;
+	this->edges_valid=0;
 	return p;
 }
 
@@ -1498,17 +1872,14 @@ route_graph_add_point(struct route_graph *this, struct coord *f)
 static void
 route_graph_free_points(struct route_graph *this)
 {
-	struct route_graph_point *curr,*next;
-	int i;
-	for (i = 0 ; i < HASH_SIZE ; i++) {
-		curr=this->hash[i];
-		while (curr) {
-			next=curr->hash_next;
-			g_slice_free(struct route_graph_point, curr);
-			curr=next;
-		}
-		this->hash[i]=NULL;
-	}
+	route_graph_free_chunks(&this->points);
+	g_free(this->hash);
+	this->hash=NULL;
+	this->hash_size=0;
+	this->point_count=0;
+	g_free(this->edges);
+	this->edges=NULL;
+	this->edges_valid=0;
 }
 
 /**
@@ -1527,17 +1898,68 @@ route_graph_free_points(struct route_graph *this)
 static void
 route_graph_reset(struct route_graph *this)
 {
-	struct route_graph_point *curr;
-	int i;
-	for (i = 0 ; i < HASH_SIZE ; i++) {
-		curr=this->hash[i];
-		while (curr) {
+	struct route_graph_chunk *chunk;
+	struct route_graph_point *curr,*end;
+	for (chunk = this->points ; chunk ; chunk = chunk->next) {
+		curr=(struct route_graph_point *)(chunk+1);
+		end=(struct route_graph_point *)((char *)curr+chunk->used);
+		while (curr < end) {
 			curr->value=INT_MAX;
 			curr->seg=NULL;
-			curr->el=NULL;
-			curr=curr->hash_next;
+			curr->el=0;
+			curr++;
+		}
+	}
+}
+
+/**
+ * @brief Collects the segments of all points of a route graph into one array
+ *
+ * For each point, the segments starting at it followed by the segments ending at it are stored
+ * contiguously in {@code this->edges}, in the order of the point's segment lists. This is what
+ * the floods, route_graph_get_segment() and route_get_traffic_distortion() iterate over, instead of
+ * following the segment lists.
+ *
+ * The array has to be rebuilt when points or segments are added, which is tracked by
+ * {@code this->edges_valid}. Until then, lookups fall back to the segment lists.
+ *
+ * @param this The route graph
+ */
+static void
+route_graph_build_edges(struct route_graph *this)
+{
+	struct route_graph_chunk *chunk;
+	struct route_graph_point *p,*end;
+	struct route_graph_segment *s,**edge;
+	int count=0;
+
+	for (chunk = this->points ; chunk ; chunk = chunk->next) {
+		end=(struct route_graph_point *)((char *)(chunk+1)+chunk->used);
+		for (p = (struct route_graph_point *)(chunk+1) ; p < end ; p++) {
+			p->edge_first=count;
+			p->edge_starts=0;
+			p->edge_ends=0;
+			for (s = p->start ; s ; s = s->start_next)
+				p->edge_starts++;
+			for (s = p->end ; s ; s = s->end_next)
+				p->edge_ends++;
+			count+=p->edge_starts+p->edge_ends;
+		}
+	}
+	g_free(this->edges);
+	this->edges=g_new(struct route_graph_segment *, count);
+	for (chunk = this->points ; chunk ; chunk = chunk->next) {
+		end=(struct route_graph_point *)((char *)(chunk+1)+chunk->used);
+		for (p = (struct route_graph_point *)(chunk+1) ; p < end ; p++) {
+			edge=this->edges+p->edge_first;
+			for (s = p->start ; s ; s = s->start_next)
+				*edge++=s;
+			for (s = p->end ; s ; s = s->end_next)
+				*edge++=s;
 		}
 	}
+	this->edges_valid=1;
+	dbg(lvl_debug,"%d points, %d edges\n", this->point_count, count);
 }
 
 /**
@@ -1644,11 +2066,7 @@ route_graph_add_segment(struct route_graph *this, struct route_graph_point *star
 	int size;
 
 	size = sizeof(struct route_graph_segment)-sizeof(struct route_segment_data)+route_segment_data_size(data->flags);
-	s = g_slice_alloc0(size);
-	if (!s) {
-		printf("%s:Out of memory\n", __FUNCTION__);
-		return;
-	}
+	s = route_graph_alloc(&this->segments, size);
 	s->start=start;
 	s->start_next=start->start;
 	start->start=s;
@@ -1671,6 +2089,7 @@ route_graph_add_segment(struct route_graph *this, struct route_graph_point *star
 
 	s->next=this->route_segments;
 	this->route_segments=s;
+	this->edges_valid=0;
 	if (debug_route)
 		printf("l (0x%x,0x%x)-(0x%x,0x%x)\n", start->c.x, start->c.y, end->c.x, end->c.y);
 }
@@ -1946,16 +2365,9 @@ linkold:
 static void
 route_graph_free_segments(struct route_graph *this)
 {
-	struct route_graph_segment *curr,*next;
-	int size;
-	curr=this->route_segments;
-	while (curr) {
-		next=curr->next;
-		size = sizeof(struct route_graph_segment)-sizeof(struct route_segment_data)+route_segment_data_size(curr->data.flags);
-		g_slice_free1(size, curr);
-		curr=next;
-	}
+	route_graph_free_chunks(&this->segments);
 	this->route_segments=NULL;
+	this->avoid_seg=NULL;
 }
 
 /**
@@ -1967,9 +2379,14 @@ static void
 route_graph_destroy(struct route_graph *this)
 {
 	if (this) {
+#ifdef HAVE_PTHREAD
+		if (this->job)
+			route_graph_job_cancel(this->job);
+#endif
 		route_graph_build_done(this, 1);
 		route_graph_free_points(this);
 		route_graph_free_segments(this);
+		route_graph_cache_destroy(this->cache);
 		g_free(this);
 	}
 }
@@ -2063,28 +2480,41 @@ route_time_seg(struct vehicleprofile *profile, struct route_segment_data *over,
 /**
  * @brief Returns the traffic distortion for a segment.
  *
+ * @param graph The route graph the segment belongs to
  * @param seg The segment for which the traffic distortion is to be returned
  * @param ret Points to a {@code struct route_traffic_distortion}, whose members will be filled
  *
  * @return true if a traffic distortion was found, 0 if not
  */
 static int
-route_get_traffic_distortion(struct route_graph_segment *seg, struct route_traffic_distortion *ret)
+route_get_traffic_distortion(struct route_graph *graph, struct route_graph_segment *seg, struct route_traffic_distortion *ret)
 {
 	struct route_graph_point *start=seg->start;
 	struct route_graph_point *end=seg->end;
-	struct route_graph_segment *tmp,*found=NULL;
-	tmp=start->start;
-	while (tmp && !found) {
-		if (tmp->data.item.type == type_traffic_distortion && tmp->start == start && tmp->end == end)
-			found=tmp;
-		tmp=tmp->start_next;
-	}
-	tmp=start->end;
-	while (tmp && !found) {
-		if (tmp->data.item.type == type_traffic_distortion && tmp->end == start && tmp->start == end) 
-			found=tmp;
-		tmp=tmp->end_next;
+	struct route_graph_segment *tmp,*found=NULL,**edge;
+	int i;
+
+	if (graph->edges_valid) {
+		edge=graph->edges+start->edge_first;
+		for (i = 0 ; i < start->edge_starts+start->edge_ends && !found ; i++) {
+			tmp=edge[i];
+			if (tmp->data.item.type == type_traffic_distortion && ((tmp->start == start && tmp->end == end) ||
+				(tmp->end == start && tmp->start == end)))
+				found=tmp;
+		}
+	} else {
+		tmp=start->start;
+		while (tmp && !found) {
+			if (tmp->data.item.type == type_traffic_distortion && tmp->start == start && tmp->end == end)
+				found=tmp;
+			tmp=tmp->start_next;
+		}
+		tmp=start->end;
+		while (tmp && !found) {
+			if (tmp->data.item.type == type_traffic_distortion && tmp->end == start && tmp->start == end)
+				found=tmp;
+			tmp=tmp->end_next;
+		}
 	}
 	if (found) {
 		ret->delay=found->data.len;
@@ -2112,6 +2542,7 @@ route_through_traffic_allowed(struct vehicleprofile *profile, struct route_graph
  * due to traffic distortions or restrictions, {@code INT_MAX} is returned in order to prevent use
  * of this segment for routing.
  *
+ * @param graph The route graph
  * @param profile The routing preferences
  * @param from The point where we are starting
  * @param over The segment we are using
@@ -2123,7 +2554,7 @@ route_through_traffic_allowed(struct vehicleprofile *profile, struct route_graph
  */  
 
 static int
-route_value_seg(struct vehicleprofile *profile, struct route_graph_point *from, struct route_graph_segment *over, int dir)
+route_value_seg(struct route_graph *graph, struct vehicleprofile *profile, struct route_graph_point *from, struct route_graph_segment *over, int dir)
 {
 	int ret;
 	struct route_traffic_distortion dist,*distp=NULL;
@@ -2139,7 +2570,7 @@ route_value_seg(struct vehicleprofile *profile, struct route_graph_point *from,
 	if (from && from->seg == over)
 		return INT_MAX;
 	if ((over->start->flags & RP_TRAFFIC_DISTORTION) && (over->end->flags & RP_TRAFFIC_DISTORTION) && 
-		route_get_traffic_distortion(over, &dist) && dir != 2 && dir != -2) {
+		route_get_traffic_distortion(graph, over, &dist) && dir != 2 && dir != -2) {
 			distp=&dist;
 	}
 	ret=route_time_seg(profile, &over->data, distp);
@@ -2411,10 +2842,23 @@ static struct route_graph_segment *
 route_graph_get_segment(struct route_graph *graph, struct street_data *sd, struct route_graph_segment *last)
 {
 	struct route_graph_point *start=NULL;
-	struct route_graph_segment *s;
-	int seen=0;
+	struct route_graph_segment *s,**edge;
+	int i,seen=0;
 
 	while ((start=route_graph_get_point_next(graph, &sd->c[0], start))) {
+		if (graph->edges_valid) {
+			edge=graph->edges+start->edge_first;
+			for (i = 0 ; i < start->edge_starts ; i++) {
+				s=edge[i];
+				if (item_is_equal(sd->item, s->data.item)) {
+					if (!last || seen)
+						return s;
+					if (last == s)
+						seen=1;
+				}
+			}
+			continue;
+		}
 		s=start->start;
 		while (s) {
 			if (item_is_equal(sd->item, s->data.item)) {
@@ -2430,306 +2874,869 @@ route_graph_get_segment(struct route_graph *graph, struct street_data *sd, struc
 }
 
 /**
- * @brief Calculates the routing costs for each point
- *
- * This function is the heart of routing. It assigns each point in the route graph a
- * cost at which one can reach the destination from this point on. Additionally it assigns
- * each point a segment one should follow from this point on to reach the destination at the
- * stated costs.
- * 
- * This function uses Dijkstra's algorithm to do the routing. To understand it you should have a look
- * at this algorithm.
+ * @brief State of a flood directed towards a position (A*)
+ */
+struct route_graph_astar {
+	enum projection pro;		/**< Projection of the coordinates */
+	struct coord c;			/**< The position */
+	int radius;			/**< Maximum distance between the position and the points of its segments */
+	int maxspeed;			/**< Highest speed on any segment of the graph */
+};
+
+/**
+ * @brief Prepares a flood directed towards a position
  *
- * References to elements of the route graph which were obtained prior to calling this function
- * remain valid after it returns.
+ * The lower bound of the cost from a point to the position is the straight line distance
+ * driven at the highest speed found on any segment of the graph for this profile.
  *
- * @param this_ The route graph to flood
- * @param dst The destination of the route
- * @param profile The vehicle profile to use for routing. This determines which ways are passable
- * and how their costs are calculated.
- * @param cb The callback function to call when flooding is complete
+ * @param this The route graph
+ * @param astar Will be initialized
+ * @param pos The position
+ * @param profile The vehicle profile
+ * @return True if A* can be used
  */
-static void
-route_graph_flood(struct route_graph *this, struct route_info *dst, struct vehicleprofile *profile, struct callback *cb)
+static int
+route_graph_astar_init(struct route_graph *this, struct route_graph_astar *astar, struct route_info *pos, struct vehicleprofile *profile)
 {
-	struct route_graph_point *p_min;
 	struct route_graph_segment *s=NULL;
-	int min,new,val;
-	struct fibheap *heap; /* This heap will hold all points with "temporarily" calculated costs */
+	int speed,dist;
 
-	heap = fh_makekeyheap();   
-
-	while ((s=route_graph_get_segment(this, dst->street, s))) {
-		val=route_value_seg(profile, NULL, s, -1);
-		if (val != INT_MAX) {
-			val=val*(100-dst->percent)/100;
-			s->end->seg=s;
-			s->end->value=val;
-			s->end->el=fh_insertkey(heap, s->end->value, s->end);
-		}
-		val=route_value_seg(profile, NULL, s, 1);
-		if (val != INT_MAX) {
-			val=val*dst->percent/100;
-			s->start->seg=s;
-			s->start->value=val;
-			s->start->el=fh_insertkey(heap, s->start->value, s->start);
-		}
+	if (!pos->street)
+		return 0;
+	astar->pro=map_projection(pos->street->item.map);
+	astar->c=pos->lp;
+	astar->radius=0;
+	astar->maxspeed=0;
+	for (s = this->route_segments ; s ; s = s->next) {
+		speed=route_seg_speed(profile, &s->data, NULL);
+		if (speed > astar->maxspeed)
+			astar->maxspeed=speed;
 	}
-	for (;;) {
-		p_min=fh_extractmin(heap); /* Starting Dijkstra by selecting the point with the minimum costs on the heap */
-		if (! p_min) /* There are no more points with temporarily calculated costs, Dijkstra has finished */
-			break;
-		min=p_min->value;
-		if (debug_route)
-			printf("extract p=%p free el=%p min=%d, 0x%x, 0x%x\n", p_min, p_min->el, min, p_min->c.x, p_min->c.y);
-		p_min->el=NULL; /* This point is permanently calculated now, we've taken it out of the heap */
-		s=p_min->start;
-		while (s) { /* Iterating all the segments leading away from our point to update the points at their ends */
-			val=route_value_seg(profile, p_min, s, -1);
-			if (val != INT_MAX && item_is_equal(s->data.item,p_min->seg->data.item)) {
-				if (profile->turn_around_penalty2)
-					val+=profile->turn_around_penalty2;
-				else
-					val=INT_MAX;
-			}
-			if (val != INT_MAX) {
-				new=min+val;
-				if (debug_route)
-					printf("begin %d len %d vs %d (0x%x,0x%x)\n",new,val,s->end->value, s->end->c.x, s->end->c.y);
-				if (new < s->end->value) { /* We've found a less costly way to reach the end of s, update it */
-					s->end->value=new;
-					s->end->seg=s;
-					if (! s->end->el) {
-						if (debug_route)
-							printf("insert_end p=%p el=%p val=%d ", s->end, s->end->el, s->end->value);
-						s->end->el=fh_insertkey(heap, new, s->end);
-						if (debug_route)
-							printf("el new=%p\n", s->end->el);
-					}
-					else {
-						if (debug_route)
-							printf("replace_end p=%p el=%p val=%d\n", s->end, s->end->el, s->end->value);
-						fh_replacekey(heap, s->end->el, new);
-					}
-				}
-				if (debug_route)
-					printf("\n");
-			}
-			s=s->start_next;
-		}
-		s=p_min->end;
-		while (s) { /* Doing the same as above with the segments leading towards our point */
-			val=route_value_seg(profile, p_min, s, 1);
-			if (val != INT_MAX && item_is_equal(s->data.item,p_min->seg->data.item)) {
-				if (profile->turn_around_penalty2)
-					val+=profile->turn_around_penalty2;
-				else
-					val=INT_MAX;
-			}
-			if (val != INT_MAX) {
-				new=min+val;
-				if (debug_route)
-					printf("end %d len %d vs %d (0x%x,0x%x)\n",new,val,s->start->value,s->start->c.x, s->start->c.y);
-				if (new < s->start->value) {
-					s->start->value=new;
-					s->start->seg=s;
-					if (! s->start->el) {
-						if (debug_route)
-							printf("insert_start p=%p el=%p val=%d ", s->start, s->start->el, s->start->value);
-						s->start->el=fh_insertkey(heap, new, s->start);
-						if (debug_route)
-							printf("el new=%p\n", s->start->el);
-					}
-					else {
-						if (debug_route)
-							printf("replace_start p=%p el=%p val=%d\n", s->start, s->start->el, s->start->value);
-						fh_replacekey(heap, s->start->el, new);
-					}
-				}
-				if (debug_route)
-					printf("\n");
-			}
-			s=s->end_next;
-		}
+	if (!astar->maxspeed)
+		return 0;
+	while ((s=route_graph_get_segment(this, pos->street, s))) {
+		dist=transform_distance(astar->pro, &s->start->c, &astar->c);
+		if (dist > astar->radius)
+			astar->radius=dist;
+		dist=transform_distance(astar->pro, &s->end->c, &astar->c);
+		if (dist > astar->radius)
+			astar->radius=dist;
 	}
-	fh_deleteheap(heap);
-	callback_call_0(cb);
-	dbg(lvl_debug,"return\n");
+	return 1;
 }
 
 /**
- * @brief Starts an "offroad" path
- *
- * This starts a path that is not located on a street. It creates a new route path
- * adding only one segment, that leads from pos to dest, and which is not associated with an item.
+ * @brief Returns a lower bound of the cost to get from a point to the points at the position
  *
- * @param this Not used
- * @param pos The starting position for the new path
- * @param dst The destination of the new path
- * @param dir Not used
- * @return The new path
+ * @param astar The A* state
+ * @param targets The number of points at the position not yet settled, 0 if A* is not used
+ * @param p The point
+ * @return The estimated cost in tenths of seconds
  */
-static struct route_path *
-route_path_new_offroad(struct route_graph *this, struct route_info *pos, struct route_info *dst)
+static int
+route_graph_astar_estimate(struct route_graph_astar *astar, int targets, struct route_graph_point *p)
 {
-	struct route_path *ret;
+	int dist;
+	if (!targets || !astar->maxspeed)
+		return 0;
+	dist=transform_distance(astar->pro, &p->c, &astar->c)-astar->radius;
+	if (dist <= 0)
+		return 0;
+	return dist*36/astar->maxspeed;
+}
 
-	ret=g_new0(struct route_path, 1);
-	ret->in_use=1;
-	ret->path_hash=item_hash_new();
-	route_path_add_line(ret, &pos->c, &dst->c, pos->lenextra+dst->lenextra);
-	ret->updated=1;
+/**
+ * @brief Marks the points of the segments of a street as targets of a flood
+ *
+ * @param this The route graph
+ * @param ri The route info holding the street
+ * @return The number of points which were not marked before
+ */
+static int
+route_graph_flood_add_target(struct route_graph *this, struct route_info *ri)
+{
+	struct route_graph_segment *s=NULL;
+	int ret=0;
 
+	while ((s=route_graph_get_segment(this, ri->street, s))) {
+		if (!(s->start->flags & RP_FLOOD_TARGET)) {
+			s->start->flags |= RP_FLOOD_TARGET;
+			ret++;
+		}
+		if (!(s->end->flags & RP_FLOOD_TARGET)) {
+			s->end->flags |= RP_FLOOD_TARGET;
+			ret++;
+		}
+	}
 	return ret;
 }
 
 /**
- * @brief Returns a coordinate at a given distance
+ * @brief Removes the marks set by route_graph_flood_add_target()
  *
- * This function returns the coordinate, where the user will be if he
- * follows the current route for a certain distance.
+ * @param this The route graph
+ * @param ri The route info holding the street
+ */
+static void
+route_graph_flood_remove_target(struct route_graph *this, struct route_info *ri)
+{
+	struct route_graph_segment *s=NULL;
+
+	while ((s=route_graph_get_segment(this, ri->street, s))) {
+		s->start->flags &= ~RP_FLOOD_TARGET;
+		s->end->flags &= ~RP_FLOOD_TARGET;
+	}
+}
+
+/**
+ * @brief Cleans up after a flood has stopped early
  *
- * @param this_ The route we're driving upon
- * @param dist The distance in meters
- * @return The coordinate where the user will be in that distance
+ * Points which are not settled get their value reset, as it is not final.
+ *
+ * @param this The route graph
  */
-struct coord 
-route_get_coord_dist(struct route *this_, int dist)
+static void
+route_graph_flood_unsettle(struct route_graph *this)
 {
-	int d,l,i,len;
-	int dx,dy;
-	double frac;
-	struct route_path_segment *cur;
-	struct coord ret;
-	enum projection pro=route_projection(this_);
-	struct route_info *dst=route_get_dst(this_);
+	struct route_graph_chunk *chunk;
+	struct route_graph_point *p,*end;
+
+	for (chunk = this->points ; chunk ; chunk = chunk->next) {
+		end=(struct route_graph_point *)((char *)(chunk+1)+chunk->used);
+		for (p = (struct route_graph_point *)(chunk+1) ; p < end ; p++) {
+			if (p->el) {
+				p->value=INT_MAX;
+				p->seg=NULL;
+			}
+		}
+	}
+}
 
-	d = dist;
+/**
+ * @brief Cleans up after a flood directed towards a position has stopped early
+ *
+ * @param this The route graph
+ * @param pos The position
+ */
+static void
+route_graph_astar_done(struct route_graph *this, struct route_info *pos)
+{
+	route_graph_flood_remove_target(this, pos);
+	route_graph_flood_unsettle(this);
+}
 
-	if (!this_->path2 || pro == projection_none) {
-		return this_->pos->c;
+/**
+ * @brief Updates the neighbors of a settled point
+ *
+ * This checks all segments of {@code p_min} and lowers the value of the points at their other end
+ * if they can reach the destination at lower costs via {@code p_min}.
+ *
+ * @param this The route graph
+ * @param heap The heap holding all points with temporary values
+ * @param p_min The settled point
+ * @param profile The vehicle profile
+ * @param astar The A* state
+ * @param targets The number of points at the position not yet settled, 0 if A* is not used
+ */
+static void
+route_graph_flood_relax(struct route_graph *this, struct route_heap *heap, struct route_graph_point *p_min, struct vehicleprofile *profile,
+		struct route_graph_astar *astar, int targets)
+{
+	struct route_graph_segment *s,**edge;
+	int i,min=p_min->value,new,val;
+
+	edge=this->edges+p_min->edge_first;
+	for (i = 0 ; i < p_min->edge_starts ; i++) { /* Iterating all the segments leading away from our point to update the points at their ends */
+		s=edge[i];
+		val=route_value_seg(this, profile, p_min, s, -1);
+		if (val != INT_MAX && item_is_equal(s->data.item,p_min->seg->data.item)) {
+			if (profile->turn_around_penalty2)
+				val+=profile->turn_around_penalty2;
+			else
+				val=INT_MAX;
+		}
+		if (val != INT_MAX) {
+			new=min+val;
+			if (debug_route)
+				printf("begin %d len %d vs %d (0x%x,0x%x)\n",new,val,s->end->value, s->end->c.x, s->end->c.y);
+			if (new < s->end->value) { /* We've found a less costly way to reach the end of s, update it */
+				s->end->value=new;
+				s->end->seg=s;
+				if (! s->end->el) {
+					if (debug_route)
+						printf("insert_end p=%p val=%d\n", s->end, s->end->value);
+					route_heap_insert(heap, new+route_graph_astar_estimate(astar, targets, s->end), s->end, &s->end->el);
+				}
+				else {
+					if (debug_route)
+						printf("replace_end p=%p val=%d\n", s->end, s->end->value);
+					route_heap_replace_key(heap, &s->end->el, new+route_graph_astar_estimate(astar, targets, s->end));
+				}
+			}
+			if (debug_route)
+				printf("\n");
+		}
 	}
-	
-	ret = this_->pos->c;
-	cur = this_->path2->path;
-	while (cur) {
-		if (cur->data->len < d) {
-			d -= cur->data->len;
-		} else {
-			for (i=0; i < (cur->ncoords-1); i++) {
-				l = d;
-				len = (int)transform_polyline_length(pro, (cur->c + i), 2);
-				d -= len;
-				if (d <= 0) { 
-					// We interpolate a bit here...
-					frac = (double)l / len;
-					
-					dx = (cur->c + i + 1)->x - (cur->c + i)->x;
-					dy = (cur->c + i + 1)->y - (cur->c + i)->y;
-					
-					ret.x = (cur->c + i)->x + (frac * dx);
-					ret.y = (cur->c + i)->y + (frac * dy);
-					return ret;
+	for (i = p_min->edge_starts ; i < p_min->edge_starts+p_min->edge_ends ; i++) { /* Doing the same as above with the segments leading towards our point */
+		s=edge[i];
+		val=route_value_seg(this, profile, p_min, s, 1);
+		if (val != INT_MAX && item_is_equal(s->data.item,p_min->seg->data.item)) {
+			if (profile->turn_around_penalty2)
+				val+=profile->turn_around_penalty2;
+			else
+				val=INT_MAX;
+		}
+		if (val != INT_MAX) {
+			new=min+val;
+			if (debug_route)
+				printf("end %d len %d vs %d (0x%x,0x%x)\n",new,val,s->start->value,s->start->c.x, s->start->c.y);
+			if (new < s->start->value) {
+				s->start->value=new;
+				s->start->seg=s;
+				if (! s->start->el) {
+					if (debug_route)
+						printf("insert_start p=%p val=%d\n", s->start, s->start->value);
+					route_heap_insert(heap, new+route_graph_astar_estimate(astar, targets, s->start), s->start, &s->start->el);
+				}
+				else {
+					if (debug_route)
+						printf("replace_start p=%p val=%d\n", s->start, s->start->value);
+					route_heap_replace_key(heap, &s->start->el, new+route_graph_astar_estimate(astar, targets, s->start));
 				}
 			}
-			return cur->c[(cur->ncoords-1)];
+			if (debug_route)
+				printf("\n");
 		}
-		cur = cur->next;
 	}
+}
 
-	return dst->c;
+#ifdef HAVE_PTHREAD
+/**
+ * @brief Checks if a flood job has been cancelled
+ *
+ * @param job The job, may be NULL
+ * @return True if the job has been cancelled
+ */
+static int
+route_graph_job_cancelled(struct route_graph_job *job)
+{
+	int ret;
+	if (!job)
+		return 0;
+	pthread_mutex_lock(&job->mutex);
+	ret=job->cancel;
+	pthread_mutex_unlock(&job->mutex);
+	return ret;
 }
+#else
+#define route_graph_job_cancelled(job) 0
+#endif
 
 /**
- * @brief Creates a new route path
+ * @brief Runs Dijkstra's algorithm until the heap is empty
+ *
+ * If the graph is flooded by a job, the search also stops when the job is cancelled.
+ *
+ * @param this The route graph
+ * @param heap The heap holding all points with temporary values
+ * @param profile The vehicle profile
+ * @param astar The A* state
+ * @param targets The number of points at the position not yet settled, 0 if A* is not used.
+ * If it drops to 0, the search stops early.
+ * @return The number of settled points
+ */
+static int
+route_graph_flood_run(struct route_graph *this, struct route_heap *heap, struct vehicleprofile *profile, struct route_graph_astar *astar, int *targets)
+{
+	struct route_graph_point *p_min;
+	int settled=0;
+
+	for (;;) {
+		p_min=route_heap_extract_min(heap); /* Starting Dijkstra by selecting the point with the minimum costs on the heap */
+		if (! p_min) /* There are no more points with temporarily calculated costs, Dijkstra has finished */
+			break;
+		settled++;
+		if (!(settled & 1023) && route_graph_job_cancelled(this->job)) {
+			dbg(lvl_debug,"cancelled\n");
+			break;
+		}
+		if (debug_route)
+			printf("extract p=%p min=%d, 0x%x, 0x%x\n", p_min, p_min->value, p_min->c.x, p_min->c.y);
+		p_min->el=0; /* This point is permanently calculated now, we've taken it out of the heap */
+		if (p_min->flags & RP_FLOOD_TARGET) {
+			p_min->flags &= ~RP_FLOOD_TARGET;
+			if (!--(*targets)) /* All points at the position are settled, A* is done */
+				break;
+		}
+		route_graph_flood_relax(this, heap, p_min, profile, astar, *targets);
+	}
+	return settled;
+}
+
+/**
+ * @brief Puts the points of the destination street on the heap to start a flood
+ *
+ * @param this The route graph
+ * @param heap The heap
+ * @param dst The destination
+ * @param profile The vehicle profile
+ * @param astar The A* state
+ * @param targets The number of points the flood is directed towards, 0 if A* is not used
+ */
+static void
+route_graph_flood_seed(struct route_graph *this, struct route_heap *heap, struct route_info *dst, struct vehicleprofile *profile,
+		struct route_graph_astar *astar, int targets)
+{
+	struct route_graph_segment *s=NULL;
+	int val;
+
+	while ((s=route_graph_get_segment(this, dst->street, s))) {
+		val=route_value_seg(this, profile, NULL, s, -1);
+		if (val != INT_MAX) {
+			val=val*(100-dst->percent)/100;
+			s->end->seg=s;
+			s->end->value=val;
+			route_heap_insert(heap, val+route_graph_astar_estimate(astar, targets, s->end), s->end, &s->end->el);
+		}
+		val=route_value_seg(this, profile, NULL, s, 1);
+		if (val != INT_MAX) {
+			val=val*dst->percent/100;
+			s->start->seg=s;
+			s->start->value=val;
+			route_heap_insert(heap, val+route_graph_astar_estimate(astar, targets, s->start), s->start, &s->start->el);
+		}
+	}
+}
+
+/**
+ * @brief Calculates the routing costs for each point
+ *
+ * This function is the heart of routing. It assigns each point in the route graph a
+ * cost at which one can reach the destination from this point on. Additionally it assigns
+ * each point a segment one should follow from this point on to reach the destination at the
+ * stated costs.
  * 
- * This creates a new non-trivial route. It therefore needs the routing information created by route_graph_flood, so
- * make sure to run route_graph_flood() after changing the destination before using this function.
+ * This function uses Dijkstra's algorithm to do the routing. To understand it you should have a look
+ * at this algorithm.
  *
- * @param this The route graph to create the route from
- * @param oldpath (Optional) old path which may contain parts of the new part - this speeds things up a bit. May be NULL.
- * @param pos The starting position of the route
+ * References to elements of the route graph which were obtained prior to calling this function
+ * remain valid after it returns.
+ *
+ * If {@code pos} is given, the search is directed towards it (A*): points are taken from the heap
+ * in the order of their cost plus a lower bound of the cost to reach {@code pos}, and flooding
+ * stops as soon as the points of the segments at {@code pos} are settled. Afterwards only settled
+ * points have a value, all others are reset to {@code INT_MAX}, so a path can only be created from
+ * positions on the street of {@code pos}.
+ *
+ * @param this_ The route graph to flood
  * @param dst The destination of the route
- * @param preferences The routing preferences
- * @return The new route path
+ * @param pos The position the route will start at, or NULL to flood the whole graph
+ * @param profile The vehicle profile to use for routing. This determines which ways are passable
+ * and how their costs are calculated.
+ * @param cb The callback function to call when flooding is complete
  */
-static struct route_path *
-route_path_new(struct route_graph *this, struct route_path *oldpath, struct route_info *pos, struct route_info *dst, struct vehicleprofile *profile)
+static void
+route_graph_flood(struct route_graph *this, struct route_info *dst, struct route_info *pos, struct vehicleprofile *profile, struct callback *cb)
 {
-	struct route_graph_segment *s=NULL,*s1=NULL,*s2=NULL; /* candidate segments for cheapest path */
-	struct route_graph_point *start; /* point at which the next segment starts, i.e. up to which the path is complete */
-	struct route_info *posinfo, *dstinfo; /* same as pos and dst, but NULL if not part of current segment */
-	int segs=0,dir; /* number of segments added to graph, direction of first segment */
-	int val1=INT_MAX,val2=INT_MAX; /* total cost for s1 and s2, respectively */
-	int val,val1_new,val2_new;
-	struct route_path *ret;
+	int settled,targets=0;
+	struct route_graph_astar astar={0};
+	struct route_heap *heap; /* This heap will hold all points with "temporarily" calculated costs */
 
-	if (! pos->street || ! dst->street) {
-		dbg(lvl_error,"pos or dest not set\n");
-		return NULL;
+	profile(0,NULL);
+	if (!this->edges_valid)
+		route_graph_build_edges(this);
+	heap = route_heap_new();
+	if (pos && route_graph_astar_init(this, &astar, pos, profile)) {
+		targets=route_graph_flood_add_target(this, pos);
+		dbg(lvl_debug,"A* towards %d points, max speed %d\n", targets, astar.maxspeed);
 	}
+	route_graph_flood_seed(this, heap, dst, profile, &astar, targets);
+	settled=route_graph_flood_run(this, heap, profile, &astar, &targets);
+	this->flood_partial=route_heap_min(heap) != NULL;
+	if (pos && pos->street && astar.maxspeed)
+		route_graph_astar_done(this, pos);
+	route_heap_destroy(heap);
+	profile(0,"flood settled %d points\n", settled);
+	callback_call_0(cb);
+	dbg(lvl_debug,"return\n");
+}
 
-	if (profile->mode == 2 || (profile->mode == 0 && pos->lenextra + dst->lenextra > transform_distance(map_projection(pos->street->item.map), &pos->c, &dst->c)))
-		return route_path_new_offroad(this, pos, dst);
-	while ((s=route_graph_get_segment(this, pos->street, s))) {
-		val=route_value_seg(profile, NULL, s, 2);
-		if (val != INT_MAX && s->end->value != INT_MAX) {
-			val=val*(100-pos->percent)/100;
-			dbg(lvl_debug,"val1 %d\n",val);
-			if (route_graph_segment_match(s,this->avoid_seg) && pos->street_direction < 0)
-				val+=profile->turn_around_penalty;
-			dbg(lvl_debug,"val1 %d\n",val);
-			val1_new=s->end->value+val;
-			dbg(lvl_debug,"val1 +%d=%d\n",s->end->value,val1_new);
-			if (val1_new < val1) {
-				val1=val1_new;
-				s1=s;
+/**
+ * @brief Checks if a traffic distortion segment matches a traffic distortion item
+ *
+ * @param s The segment
+ * @param item The item, its coordinates and attributes will be read
+ * @return True if the segment was built from this item and the item has not changed since
+ */
+static int
+route_graph_traffic_distortion_match(struct route_graph_segment *s, struct item *item)
+{
+	struct coord c,l;
+	struct attr delay_attr, maxspeed_attr;
+	int delay=0;
+
+	if (!item_is_equal(s->data.item, *item))
+		return 0;
+	item_coord_rewind(item);
+	if (!item_coord_get(item, &l, 1) || l.x != s->start->c.x || l.y != s->start->c.y)
+		return 0;
+	while (item_coord_get(item, &c, 1))
+		l=c;
+	if (l.x != s->end->c.x || l.y != s->end->c.y)
+		return 0;
+	if (item_attr_get(item, attr_maxspeed, &maxspeed_attr)) {
+		if (!(s->data.flags & AF_SPEED_LIMIT) || RSD_MAXSPEED(&s->data) != maxspeed_attr.u.num)
+			return 0;
+	} else if (s->data.flags & AF_SPEED_LIMIT)
+		return 0;
+	if (item_attr_get(item, attr_delay, &delay_attr))
+		delay=delay_attr.u.num;
+	return s->data.len == delay;
+}
+
+/**
+ * @brief Reads the traffic distortions within the selection of a graph again
+ *
+ * Traffic distortion segments whose item has disappeared or changed are disabled, new ones are added.
+ * Distortions added by the route itself (to avoid a segment) are left alone.
+ *
+ * @param this The route graph, it must still have its selection
+ * @param ms The mapset to read the distortions from
+ * @param changed The start and end point of every distortion which was added or disabled are prepended to this list
+ * @return The number of changed distortions
+ */
+static int
+route_graph_rescan_traffic_distortions(struct route_graph *this, struct mapset *ms, GList **changed)
+{
+	struct map_selection *sel,*curr;
+	struct mapset_handle *h;
+	struct map *m;
+	struct map_rect *mr;
+	struct item *item;
+	struct route_graph_point *p;
+	struct route_graph_segment *s;
+	struct coord c;
+	GHashTable *seen=g_hash_table_new(NULL, NULL);
+	int found,count=0;
+
+	sel=map_selection_dup(this->sel);
+	for (curr = sel ; curr ; curr = curr->next) {
+		curr->range.min=type_traffic_distortion;
+		curr->range.max=type_traffic_distortion;
+	}
+	h=mapset_open(ms);
+	while ((m=mapset_next(h, 2))) {
+		mr=map_rect_new(m, sel);
+		if (!mr)
+			continue;
+		while ((item=map_rect_get_item(mr))) {
+			if (item->type != type_traffic_distortion || !item_coord_get(item, &c, 1))
+				continue;
+			found=0;
+			p=NULL;
+			while (!found && (p=route_graph_get_point_next(this, &c, p))) {
+				for (s = p->start ; s ; s = s->start_next) {
+					if (s->data.item.type == type_traffic_distortion && route_graph_traffic_distortion_match(s, item)) {
+						g_hash_table_insert(seen, s, s);
+						found=1;
+						break;
+					}
+				}
 			}
-		}
-		val=route_value_seg(profile, NULL, s, -2);
-		if (val != INT_MAX && s->start->value != INT_MAX) {
-			val=val*pos->percent/100;
-			dbg(lvl_debug,"val2 %d\n",val);
-			if (route_graph_segment_match(s,this->avoid_seg) && pos->street_direction > 0)
-				val+=profile->turn_around_penalty;
-			dbg(lvl_debug,"val2 %d\n",val);
-			val2_new=s->start->value+val;
-			dbg(lvl_debug,"val2 +%d=%d\n",s->start->value,val2_new);
-			if (val2_new < val2) {
-				val2=val2_new;
-				s2=s;
+			if (found)
+				continue;
+			item_coord_rewind(item);
+			s=this->route_segments;
+			route_process_traffic_distortion(this, item);
+			if (this->route_segments != s) {
+				s=this->route_segments;
+				dbg(lvl_debug,"new distortion 0x%x,0x%x\n", s->data.item.id_hi, s->data.item.id_lo);
+				g_hash_table_insert(seen, s, s);
+				*changed=g_list_prepend(*changed, s->end);
+				*changed=g_list_prepend(*changed, s->start);
+				count++;
 			}
 		}
+		map_rect_destroy(mr);
 	}
-	if (val1 == INT_MAX && val2 == INT_MAX) {
-		dbg(lvl_error,"no route found, pos blocked\n");
-		return NULL;
+	mapset_close(h);
+	map_selection_destroy(sel);
+	for (s = this->route_segments ; s ; s = s->next) {
+		if (s->data.item.type == type_traffic_distortion && s->data.item.map && !g_hash_table_lookup(seen, s)) {
+			dbg(lvl_debug,"removed distortion 0x%x,0x%x\n", s->data.item.id_hi, s->data.item.id_lo);
+			s->data.item.type=type_none;
+			*changed=g_list_prepend(*changed, s->end);
+			*changed=g_list_prepend(*changed, s->start);
+			count++;
+		}
 	}
-	if (val1 == val2) {
-		val1=s1->end->value;
+	g_hash_table_destroy(seen);
+	return count;
+}
+
+/**
+ * @brief Resets a point and all points whose path to the destination leads over it
+ *
+ * @param this The route graph
+ * @param p The point
+ * @param invalid All points which have been reset are prepended to this list
+ */
+static void
+route_graph_invalidate_subtree(struct route_graph *this, struct route_graph_point *p, GList **invalid)
+{
+	struct route_graph_segment *s;
+	struct route_graph_point *child;
+	GList *stack=NULL;
+	int i;
+
+	if (p->value == INT_MAX)
+		return;
+	p->value=INT_MAX;
+	stack=g_list_prepend(stack, p);
+	while (stack) {
+		p=stack->data;
+		stack=g_list_delete_link(stack, stack);
+		*invalid=g_list_prepend(*invalid, p);
+		for (i = 0 ; i < p->edge_starts+p->edge_ends ; i++) {
+			s=this->edges[p->edge_first+i];
+			child=(s->start == p) ? s->end : s->start;
+			if (child->seg == s && child != p && child->value != INT_MAX) {
+				child->value=INT_MAX;
+				stack=g_list_prepend(stack, child);
+			}
+		}
+		p->seg=NULL;
+	}
+}
+
+/**
+ * @brief Updates the values of a completely flooded graph after some segments have changed their costs
+ *
+ * Only the points whose path to the destination leads over one of the changed segments are reset.
+ * They, and all points which can now reach the destination at lower costs, are calculated again,
+ * starting from the points next to them whose values are still valid.
+ *
+ * @param this The route graph
+ * @param dst The destination the graph was flooded for
+ * @param changed Pairs of start and end points of all changed segments, the list is modified
+ * @param profile The vehicle profile
+ */
+static void
+route_graph_flood_partial(struct route_graph *this, struct route_info *dst, GList **changed, struct vehicleprofile *profile)
+{
+	struct route_graph_astar astar={0};
+	struct route_graph_segment *s;
+	struct route_graph_point *p,*a,*b;
+	struct route_heap *heap;
+	GList *l,*invalid=NULL;
+	int i,val,targets=0,settled,count=0;
+
+	profile(0,NULL);
+	if (!this->edges_valid)
+		route_graph_build_edges(this);
+	for (l = *changed ; l && l->next ; l = l->next->next) {
+		a=l->data;
+		b=l->next->data;
+		for (i = 0 ; i < a->edge_starts+a->edge_ends ; i++) {
+			s=this->edges[a->edge_first+i];
+			if ((s->start == a && s->end == b) || (s->start == b && s->end == a)) {
+				if (a->seg == s)
+					route_graph_invalidate_subtree(this, a, &invalid);
+				if (b->seg == s)
+					route_graph_invalidate_subtree(this, b, &invalid);
+			}
+		}
+	}
+	s=NULL;
+	while ((s=route_graph_get_segment(this, dst->street, s))) {
+		val=route_value_seg(this, profile, NULL, s, -1);
+		if (val != INT_MAX) {
+			val=val*(100-dst->percent)/100;
+			if (val < s->end->value) {
+				s->end->seg=s;
+				s->end->value=val;
+			}
+		}
+		val=route_value_seg(this, profile, NULL, s, 1);
+		if (val != INT_MAX) {
+			val=val*dst->percent/100;
+			if (val < s->start->value) {
+				s->start->seg=s;
+				s->start->value=val;
+			}
+		}
+	}
+	/* Points with valid values next to the reset ones are the new starting points */
+	for (l = invalid ; l ; l = l->next) {
+		p=l->data;
+		for (i = 0 ; i < p->edge_starts+p->edge_ends ; i++) {
+			s=this->edges[p->edge_first+i];
+			*changed=g_list_prepend(*changed, (s->start == p) ? s->end : s->start);
+		}
+		*changed=g_list_prepend(*changed, p);
+		count++;
+	}
+	heap=route_heap_new();
+	for (l = *changed ; l ; l = l->next) {
+		p=l->data;
+		if (p->value != INT_MAX && !p->el)
+			route_heap_insert(heap, p->value, p, &p->el);
+	}
+	settled=route_graph_flood_run(this, heap, profile, &astar, &targets);
+	route_heap_destroy(heap);
+	profile(0,"partial flood reset %d points, settled %d points\n", count, settled);
+	g_list_free(invalid);
+}
+
+/**
+ * @brief Starts an "offroad" path
+ *
+ * This starts a path that is not located on a street. It creates a new route path
+ * adding only one segment, that leads from pos to dest, and which is not associated with an item.
+ *
+ * @param this Not used
+ * @param pos The starting position for the new path
+ * @param dst The destination of the new path
+ * @param dir Not used
+ * @return The new path
+ */
+static struct route_path *
+route_path_new_offroad(struct route_graph *this, struct route_info *pos, struct route_info *dst)
+{
+	struct route_path *ret;
+
+	ret=g_new0(struct route_path, 1);
+	ret->in_use=1;
+	ret->path_hash=item_hash_new();
+	route_path_add_line(ret, &pos->c, &dst->c, pos->lenextra+dst->lenextra);
+	ret->updated=1;
+
+	return ret;
+}
+
+/**
+ * @brief Returns a coordinate at a given distance
+ *
+ * This function returns the coordinate, where the user will be if he
+ * follows the current route for a certain distance.
+ *
+ * @param this_ The route we're driving upon
+ * @param dist The distance in meters
+ * @return The coordinate where the user will be in that distance
+ */
+struct coord 
+route_get_coord_dist(struct route *this_, int dist)
+{
+	int d,l,i,len;
+	int dx,dy;
+	double frac;
+	struct route_path_segment *cur;
+	struct coord ret;
+	enum projection pro=route_projection(this_);
+	struct route_info *dst=route_get_dst(this_);
+
+	d = dist;
+
+	if (!this_->path2 || pro == projection_none) {
+		return this_->pos->c;
+	}
+	
+	ret = this_->pos->c;
+	cur = this_->path2->path;
+	while (cur) {
+		if (cur->data->len < d) {
+			d -= cur->data->len;
+		} else {
+			for (i=0; i < (cur->ncoords-1); i++) {
+				l = d;
+				len = (int)transform_polyline_length(pro, (cur->c + i), 2);
+				d -= len;
+				if (d <= 0) { 
+					// We interpolate a bit here...
+					frac = (double)l / len;
+					
+					dx = (cur->c + i + 1)->x - (cur->c + i)->x;
+					dy = (cur->c + i + 1)->y - (cur->c + i)->y;
+					
+					ret.x = (cur->c + i)->x + (frac * dx);
+					ret.y = (cur->c + i)->y + (frac * dy);
+					return ret;
+				}
+			}
+			return cur->c[(cur->ncoords-1)];
+		}
+		cur = cur->next;
+	}
+
+	return dst->c;
+}
+
+/**
+ * @brief Finds the cheapest segment a route path can start with in a flooded graph
+ *
+ * @param this The route graph, flooded for the destination
+ * @param pos The starting position of the route
+ * @param profile The vehicle profile
+ * @param start Set to the point at which the path continues after the returned segment
+ * @param dir Set to the direction in which the returned segment is used
+ * @return The segment, or NULL if no route was found
+ */
+static struct route_graph_segment *
+route_path_start_segment(struct route_graph *this, struct route_info *pos, struct vehicleprofile *profile, struct route_graph_point **start, int *dir)
+{
+	struct route_graph_segment *s,*s1,*s2; /* candidate segments for cheapest path */
+	int val1,val2; /* total cost for s1 and s2, respectively */
+	int val,val1_new,val2_new;
+
+	s=s1=s2=NULL;
+	val1=val2=INT_MAX;
+	while ((s=route_graph_get_segment(this, pos->street, s))) {
+		val=route_value_seg(this, profile, NULL, s, 2);
+		if (val != INT_MAX && s->end->value != INT_MAX) {
+			val=val*(100-pos->percent)/100;
+			dbg(lvl_debug,"val1 %d\n",val);
+			if (route_graph_segment_match(s,this->avoid_seg) && pos->street_direction < 0)
+				val+=profile->turn_around_penalty;
+			dbg(lvl_debug,"val1 %d\n",val);
+			val1_new=s->end->value+val;
+			dbg(lvl_debug,"val1 +%d=%d\n",s->end->value,val1_new);
+			if (val1_new < val1) {
+				val1=val1_new;
+				s1=s;
+			}
+		}
+		val=route_value_seg(this, profile, NULL, s, -2);
+		if (val != INT_MAX && s->start->value != INT_MAX) {
+			val=val*pos->percent/100;
+			dbg(lvl_debug,"val2 %d\n",val);
+			if (route_graph_segment_match(s,this->avoid_seg) && pos->street_direction > 0)
+				val+=profile->turn_around_penalty;
+			dbg(lvl_debug,"val2 %d\n",val);
+			val2_new=s->start->value+val;
+			dbg(lvl_debug,"val2 +%d=%d\n",s->start->value,val2_new);
+			if (val2_new < val2) {
+				val2=val2_new;
+				s2=s;
+			}
+		}
+	}
+	if (val1 == INT_MAX && val2 == INT_MAX)
+		return NULL;
+	if (val1 == val2) {
+		val1=s1->end->value;
 		val2=s2->start->value;
 	}
 	if (val1 < val2) {
-		start=s1->start;
-		s=s1;
-		dir=1;
-	} else {
-		start=s2->end;
-		s=s2;
-		dir=-1;
-	}
-	if (pos->street_direction && dir != pos->street_direction && profile->turn_around_penalty) {
-		if (!route_graph_segment_match(this->avoid_seg,s)) {
-			dbg(lvl_debug,"avoid current segment\n");
-			if (this->avoid_seg)
-				route_graph_set_traffic_distortion(this, this->avoid_seg, 0);
-			this->avoid_seg=s;
-			route_graph_set_traffic_distortion(this, this->avoid_seg, profile->turn_around_penalty);
-			route_graph_reset(this);
-			route_graph_flood(this, dst, profile, NULL);
-			return route_path_new(this, oldpath, pos, dst, profile);
+		*start=s1->start;
+		*dir=1;
+		return s1;
+	}
+	*start=s2->end;
+	*dir=-1;
+	return s2;
+}
+
+/**
+ * @brief Penalizes the segment of the position if the route starts with turning around on it
+ *
+ * If the vehicle is heading away from the cheapest way and the vehicle profile has a turn around
+ * penalty, a traffic distortion is added to the segment the vehicle is on and the graph is reset.
+ * It has to be flooded again afterwards.
+ *
+ * @param this The route graph
+ * @param pos The starting position of the route
+ * @param profile The vehicle profile
+ * @param s The segment found by route_path_start_segment()
+ * @param dir The direction found by route_path_start_segment()
+ * @return True if the graph has to be flooded again
+ */
+static int
+route_path_start_avoid(struct route_graph *this, struct route_info *pos, struct vehicleprofile *profile, struct route_graph_segment *s, int dir)
+{
+	if (!pos->street_direction || dir == pos->street_direction || !profile->turn_around_penalty || route_graph_segment_match(this->avoid_seg,s))
+		return 0;
+	dbg(lvl_debug,"avoid current segment\n");
+	if (this->avoid_seg)
+		route_graph_set_traffic_distortion(this, this->avoid_seg, 0);
+	this->avoid_seg=s;
+	route_graph_set_traffic_distortion(this, this->avoid_seg, profile->turn_around_penalty);
+	route_graph_reset(this);
+	return 1;
+}
+
+/**
+ * @brief Finds the segment a route path has to start with
+ *
+ * If the route starts with turning around, the graph is flooded again, see route_path_start_avoid(),
+ * so this may take as long as route_graph_flood(). Once the segment is penalized, calling this
+ * function again for the same position is cheap.
+ *
+ * @param this The route graph, flooded for {@code dst}
+ * @param pos The starting position of the route
+ * @param dst The destination of the route
+ * @param profile The vehicle profile
+ * @param start Set to the point at which the path continues after the returned segment
+ * @param dir Set to the direction in which the returned segment is used
+ * @return The segment, or NULL if no route was found
+ */
+static struct route_graph_segment *
+route_path_start(struct route_graph *this, struct route_info *pos, struct route_info *dst, struct vehicleprofile *profile, struct route_graph_point **start, int *dir)
+{
+	struct route_graph_segment *s;
+
+	for (;;) {
+		s=route_path_start_segment(this, pos, profile, start, dir);
+		if (!s) {
+			dbg(lvl_error,"no route found, pos blocked\n");
+			return NULL;
 		}
+		if (!route_path_start_avoid(this, pos, profile, s, *dir))
+			return s;
+		route_graph_flood(this, dst, profile->route_algorithm == route_algorithm_astar ? pos : NULL, profile, NULL);
+	}
+}
+
+/**
+ * @brief Checks if a route path is built without the route graph
+ */
+static int
+route_path_is_offroad(struct route_info *pos, struct route_info *dst, struct vehicleprofile *profile)
+{
+	return profile->mode == 2 || (profile->mode == 0 && pos->lenextra + dst->lenextra > transform_distance(map_projection(pos->street->item.map), &pos->c, &dst->c));
+}
+
+/**
+ * @brief Creates a new route path
+ * 
+ * This creates a new non-trivial route. It therefore needs the routing information created by route_graph_flood, so
+ * make sure to run route_graph_flood() after changing the destination before using this function.
+ *
+ * @param this The route graph to create the route from
+ * @param oldpath (Optional) old path which may contain parts of the new part - this speeds things up a bit. May be NULL.
+ * @param pos The starting position of the route
+ * @param dst The destination of the route
+ * @param preferences The routing preferences
+ * @return The new route path
+ */
+static struct route_path *
+route_path_new(struct route_graph *this, struct route_path *oldpath, struct route_info *pos, struct route_info *dst, struct vehicleprofile *profile)
+{
+	struct route_graph_segment *s; /* segment to add to the path next */
+	struct route_graph_point *start; /* point at which the next segment starts, i.e. up to which the path is complete */
+	struct route_info *posinfo, *dstinfo; /* same as pos and dst, but NULL if not part of current segment */
+	int segs=0,dir; /* number of segments added to graph, direction of first segment */
+	struct route_path *ret;
+
+	if (! pos->street || ! dst->street) {
+		dbg(lvl_error,"pos or dest not set\n");
+		return NULL;
 	}
+
+	if (route_path_is_offroad(pos, dst, profile))
+		return route_path_new_offroad(this, pos, dst);
+	s=route_path_start(this, pos, dst, profile, &start, &dir);
+	if (!s)
+		return NULL;
 	ret=g_new0(struct route_path, 1);
 	ret->in_use=1;
 	ret->updated=1;
@@ -2746,324 +3753,2534 @@ route_path_new(struct route_graph *this, struct route_path *oldpath, struct rout
 		if (s->start == start) {		
 			if (item_is_equal(s->data.item, dst->street->item) && (s->end->seg == s || !posinfo))
 				dstinfo=dst;
-			if (!route_path_add_item_from_graph(ret, oldpath, s, 1, posinfo, dstinfo))
-				ret->updated=0;
+			if (!route_path_add_item_from_graph(ret, oldpath, s, 1, posinfo, dstinfo))
+				ret->updated=0;
+			start=s->end;
+		} else {
+			if (item_is_equal(s->data.item, dst->street->item) && (s->start->seg == s || !posinfo))
+				dstinfo=dst;
+			if (!route_path_add_item_from_graph(ret, oldpath, s, -1, posinfo, dstinfo))
+				ret->updated=0;
+			start=s->start;
+		}
+		posinfo=NULL;
+		s=start->seg;
+	}
+	if (dst->lenextra) 
+		route_path_add_line(ret, &dst->lp, &dst->c, dst->lenextra);
+	dbg(lvl_debug, "%d segments\n", segs);
+	return ret;
+}
+
+#ifdef HAVE_PTHREAD
+/**
+ * @brief Copies a route info
+ *
+ * @param ri The route info, may be NULL
+ * @return The copy, NULL if {@code ri} is NULL
+ */
+static struct route_info *
+route_info_dup(struct route_info *ri)
+{
+	struct route_info *ret;
+	if (!ri)
+		return NULL;
+	ret=g_new(struct route_info, 1);
+	*ret=*ri;
+	if (ri->street)
+		ret->street=street_data_dup(ri->street);
+	return ret;
+}
+
+static void *
+route_graph_job_run(void *data)
+{
+	struct route_graph_job *job=data;
+
+	route_graph_flood(job->graph, job->dst, job->astar ? job->pos : NULL, job->profile, NULL);
+	if (write(job->fd[1], "", 1) != 1)
+		dbg(lvl_error,"failed to signal end of flood\n");
+	return NULL;
+}
+
+/**
+ * @brief Waits for the thread of a flood job and frees the job
+ *
+ * @param job The job
+ */
+static void
+route_graph_job_destroy(struct route_graph_job *job)
+{
+	if (job->started)
+		pthread_join(job->thread, NULL);
+	if (job->watch)
+		event_remove_watch(job->watch);
+	callback_destroy(job->watch_cb);
+	close(job->fd[0]);
+	close(job->fd[1]);
+	pthread_mutex_destroy(&job->mutex);
+	route_info_free(job->dst);
+	route_info_free(job->pos);
+	if (job->graph->job == job)
+		job->graph->job=NULL;
+	g_free(job);
+}
+
+/**
+ * @brief Cancels a flood job
+ *
+ * This returns as soon as the thread has stopped, the callback of the job is not called.
+ * The values of the graph are undefined afterwards, it has to be reset before it is flooded again.
+ *
+ * @param job The job
+ */
+static void
+route_graph_job_cancel(struct route_graph_job *job)
+{
+	dbg(lvl_debug,"enter\n");
+	pthread_mutex_lock(&job->mutex);
+	job->cancel=1;
+	pthread_mutex_unlock(&job->mutex);
+	route_graph_job_destroy(job);
+}
+
+/**
+ * @brief Called from the main loop when the thread of a flood job is done
+ *
+ * @param job The job
+ */
+static void
+route_graph_job_done(struct route_graph_job *job)
+{
+	struct callback *cb=job->cb;
+	dbg(lvl_debug,"enter\n");
+	route_graph_job_destroy(job);
+	callback_call_0(cb);
+}
+
+/**
+ * @brief Floods the graph again on a thread if the path of a route starts with turning around
+ *
+ * This is the part of route_path_start() which may flood the graph, for routes which are updated
+ * asynchronously. The traffic distortion is added here on the main thread, only the flood runs
+ * on the thread.
+ *
+ * @param this The route, its graph flooded for its current destination
+ * @param pos The start of the path
+ * @return True if the graph is flooded again, the path is updated when the flood is done
+ */
+static int
+route_path_start_async(struct route *this, struct route_info *pos)
+{
+	struct route_graph_segment *s;
+	struct route_graph_point *start;
+	int dir;
+
+	if (!(this->flags & route_path_flag_async) || !pos->street || !this->current_dst->street ||
+		route_path_is_offroad(pos, this->current_dst, this->vehicleprofile))
+		return 0;
+	s=route_path_start_segment(this->graph, pos, this->vehicleprofile, &start, &dir);
+	if (!s || !route_path_start_avoid(this->graph, pos, this->vehicleprofile, s, dir))
+		return 0;
+	route_graph_flood_start(this, this->route_graph_flood_done_cb);
+	return 1;
+}
+
+/**
+ * @brief Starts flooding the graph of a route on a new thread
+ *
+ * The graph is flooded for the current destination of the route. The thread only floods the graph,
+ * segments and traffic distortions are added by the main thread while there is no job, see route_path_start_async().
+ *
+ * @param this The route
+ * @param cb The callback to call from the main loop when the flood is done
+ * @return The job, or NULL if no thread could be started
+ */
+static struct route_graph_job *
+route_graph_job_new(struct route *this, struct callback *cb)
+{
+	struct route_graph_job *job=g_new0(struct route_graph_job, 1);
+	struct route_info *prev_dst=route_previous_destination(this);
+
+	if (pipe(job->fd)) {
+		g_free(job);
+		return NULL;
+	}
+	job->graph=this->graph;
+	job->profile=this->vehicleprofile;
+	job->dst=route_info_dup(this->current_dst);
+	job->pos=route_info_dup(prev_dst);
+	job->astar=route_flood_origin(this) != NULL;
+	job->at_position=job->astar && prev_dst == this->pos;
+	job->cb=cb;
+	pthread_mutex_init(&job->mutex, NULL);
+	this->graph->job=job;
+	job->watch_cb=callback_new_1(callback_cast(route_graph_job_done), job);
+	job->watch=event_add_watch(job->fd[0], event_watch_cond_read, job->watch_cb);
+	if (!job->watch || pthread_create(&job->thread, NULL, route_graph_job_run, job)) {
+		dbg(lvl_error,"failed to start flood thread\n");
+		route_graph_job_destroy(job);
+		return NULL;
+	}
+	job->started=1;
+	return job;
+}
+#endif
+
+/**
+ * @brief Floods the graph of a route for its current destination
+ *
+ * If the route is updated asynchronously, the graph is flooded on a thread of its own and
+ * {@code cb} is called from the main loop afterwards, otherwise this is route_graph_flood().
+ *
+ * @param this The route
+ * @param cb The callback to call when the flood is done
+ */
+static void
+route_graph_flood_start(struct route *this, struct callback *cb)
+{
+#ifdef HAVE_PTHREAD
+	if (this->graph->job)
+		route_graph_job_cancel(this->graph->job);
+	if ((this->flags & route_path_flag_async) && route_graph_job_new(this, cb))
+		return;
+#endif
+	route_graph_flood(this->graph, this->current_dst, route_flood_origin(this), this->vehicleprofile, cb);
+}
+
+/**
+ * @brief An edge of the contraction hierarchy
+ *
+ * This is the payload of the {@code attr_ch_edge} attributes of {@code type_ch_node} items,
+ * it has to match the layout written by maptool (see maptool/ch.c).
+ */
+struct route_ch_edge {
+	int flags;				/**< Combination of the CH_EDGE_* flags */
+	int weight;				/**< Cost of the edge in tenths of seconds */
+	struct item_id target;			/**< The node this edge leads to */
+	struct item_id middle;			/**< For shortcuts the contracted node, otherwise the street item */
+};
+
+#define CH_EDGE_FORWARD 1		/**< Edge can be used from the node holding it to the target */
+#define CH_EDGE_BACKWARD 2		/**< Edge can be used from the target to the node holding it */
+#define CH_EDGE_SHORTCUT 4		/**< Edge is a shortcut over {@code middle} */
+#define CH_EDGE_REVERSED 8		/**< Street runs from the target to the node holding the edge */
+
+/**
+ * @brief A node of the contraction hierarchy visited by a query
+ *
+ * Index 0 of the arrays belongs to the search from the position, index 1 to the
+ * search from the destination.
+ */
+struct route_ch_node {
+	struct item_id id;			/**< Item id of the {@code type_ch_node} item */
+	int value[2];				/**< Cost from the position / to the destination */
+	struct route_ch_node *pred[2];		/**< Node we came from, NULL for a start node */
+	struct route_ch_edge edge[2];		/**< Edge of {@code pred} used to reach this node */
+	int dir[2];				/**< For start nodes: direction on the street of the position / destination */
+	route_heap_el el[2];			/**< Heap element while the node is on the heap */
+};
+
+/**
+ * @brief State of a contraction hierarchy query
+ */
+struct route_ch {
+	struct map *m;				/**< The map holding both the streets and the hierarchy */
+	struct map_rect *mr;			/**< Map rect used to fetch items by id */
+	struct vehicleprofile *profile;		/**< The vehicle profile */
+	GHashTable *nodes;			/**< All visited nodes, by item id */
+	struct route_heap *heap[2];		/**< Heaps of the forward and backward search */
+	GList *streets;				/**< Result of unpacking the path, list of struct route_ch_street */
+};
+
+/**
+ * @brief A street of an unpacked contraction hierarchy path
+ */
+struct route_ch_street {
+	struct item_id id;			/**< Item id of the street */
+	int dir;				/**< Direction in which the street is used */
+};
+
+static guint
+route_ch_id_hash(gconstpointer key)
+{
+	const struct item_id *id=key;
+	return id->id_hi*2654435761UL+id->id_lo;
+}
+
+static gboolean
+route_ch_id_equal(gconstpointer a, gconstpointer b)
+{
+	const struct item_id *id_a=a;
+	const struct item_id *id_b=b;
+	return id_a->id_hi == id_b->id_hi && id_a->id_lo == id_b->id_lo;
+}
+
+static void
+route_ch_node_free(gpointer data)
+{
+	g_slice_free(struct route_ch_node, data);
+}
+
+/**
+ * @brief Returns the query state of a contraction hierarchy node, creating it if necessary
+ *
+ * @param ch The query
+ * @param id Item id of the node
+ * @return The node
+ */
+static struct route_ch_node *
+route_ch_get_node(struct route_ch *ch, struct item_id *id)
+{
+	struct route_ch_node *ret=g_hash_table_lookup(ch->nodes, id);
+	if (!ret) {
+		ret=g_slice_new0(struct route_ch_node);
+		ret->id=*id;
+		ret->value[0]=ret->value[1]=INT_MAX;
+		g_hash_table_insert(ch->nodes, &ret->id, ret);
+	}
+	return ret;
+}
+
+/**
+ * @brief Looks up the contraction hierarchy node at a given coordinate
+ *
+ * @param ch The query
+ * @param c The coordinate, usually the start or end of a street
+ * @param id Will receive the item id of the node
+ * @return True if a node was found
+ */
+static int
+route_ch_find_node(struct route_ch *ch, struct coord *c, struct item_id *id)
+{
+	struct map_selection *sel;
+	struct map_rect *mr;
+	struct item *item;
+	struct coord nc;
+	int ret=0;
+
+	sel=route_rect(18, c, c, 0, 1);
+	sel->range.min=type_ch_node;
+	sel->range.max=type_ch_node;
+	mr=map_rect_new(ch->m, sel);
+	while (mr && !ret && (item=map_rect_get_item(mr))) {
+		if (item->type == type_ch_node && item_coord_get(item, &nc, 1) == 1 && nc.x == c->x && nc.y == c->y) {
+			id->id_hi=item->id_hi;
+			id->id_lo=item->id_lo;
+			ret=1;
+		}
+	}
+	map_rect_destroy(mr);
+	map_selection_destroy(sel);
+	return ret;
+}
+
+/**
+ * @brief Fills route segment data for (a part of) a street
+ *
+ * Size, weight and dangerous goods restrictions are not part of the street data and
+ * therefore not copied.
+ *
+ * @param sd The street
+ * @param len The length of the part of the street which is used
+ * @param data Buffer which must be large enough for a {@code route_segment_data} plus maxspeed
+ */
+static void
+route_ch_segment_data(struct street_data *sd, int len, struct route_segment_data *data)
+{
+	data->item=sd->item;
+	data->flags=sd->flags & ~(AF_SEGMENTED|AF_SIZE_OR_WEIGHT_LIMIT|AF_DANGEROUS_GOODS);
+	data->len=len;
+	if (sd->maxspeed > 0 && (data->flags & AF_SPEED_LIMIT))
+		RSD_MAXSPEED(data)=sd->maxspeed;
+	else
+		data->flags&=~AF_SPEED_LIMIT;
+}
+
+/**
+ * @brief Returns the cost of driving along (a part of) a street in a given direction
+ *
+ * @return The cost in tenths of seconds, or {@code INT_MAX} if the street is impassable
+ */
+static int
+route_ch_street_value(struct vehicleprofile *profile, struct street_data *sd, int dir, int len)
+{
+	struct {
+		struct route_segment_data data;
+		int maxspeed;
+	} buffer;
+	struct route_segment_data *data=&buffer.data;
+	if ((sd->flags & (dir > 0 ? profile->flags_forward_mask : profile->flags_reverse_mask)) != profile->flags)
+		return INT_MAX;
+	route_ch_segment_data(sd, len, data);
+	return route_time_seg(profile, data, NULL);
+}
+
+/**
+ * @brief Puts a start node of the forward or backward search on its heap
+ *
+ * @param ch The query
+ * @param c Coordinate of the node
+ * @param idx 0 for the forward search, 1 for the backward search
+ * @param dir Direction on the street of the position or destination belonging to this node
+ * @param val Cost between the position or destination and the node
+ * @return True if the node was found
+ */
+static int
+route_ch_add_start(struct route_ch *ch, struct coord *c, int idx, int dir, int val)
+{
+	struct item_id id;
+	struct route_ch_node *node;
+	if (val == INT_MAX)
+		return 0;
+	if (!route_ch_find_node(ch, c, &id))
+		return 0;
+	node=route_ch_get_node(ch, &id);
+	if (val < node->value[idx]) {
+		node->value[idx]=val;
+		node->dir[idx]=dir;
+		if (node->el[idx])
+			route_heap_replace_key(ch->heap[idx], &node->el[idx], val);
+		else
+			route_heap_insert(ch->heap[idx], val, node, &node->el[idx]);
+	}
+	return 1;
+}
+
+/**
+ * @brief Settles a node and relaxes its upward edges
+ *
+ * @param ch The query
+ * @param node The node taken from the heap
+ * @param idx 0 for the forward search, 1 for the backward search
+ */
+static void
+route_ch_settle(struct route_ch *ch, struct route_ch_node *node, int idx)
+{
+	struct item *item;
+	struct attr attr;
+	struct route_ch_edge edge;
+	struct route_ch_node *target;
+	int mask=idx ? CH_EDGE_BACKWARD : CH_EDGE_FORWARD;
+	int val;
+
+	item=map_rect_get_item_byid(ch->mr, node->id.id_hi, node->id.id_lo);
+	if (!item)
+		return;
+	while (item_attr_get(item, attr_ch_edge, &attr)) {
+		memcpy(&edge, attr.u.data, sizeof(edge));
+		if (!(edge.flags & mask))
+			continue;
+		val=node->value[idx]+edge.weight;
+		target=route_ch_get_node(ch, &edge.target);
+		if (val < target->value[idx]) {
+			target->value[idx]=val;
+			target->pred[idx]=node;
+			target->edge[idx]=edge;
+			if (target->el[idx])
+				route_heap_replace_key(ch->heap[idx], &target->el[idx], val);
+			else
+				route_heap_insert(ch->heap[idx], val, target, &target->el[idx]);
+		}
+	}
+}
+
+/**
+ * @brief Looks up the cheapest edge leading from one node to another
+ *
+ * The edge may be stored with either of the two nodes.
+ *
+ * @param ch The query
+ * @param from The node to start at
+ * @param to The node to arrive at
+ * @param edge Will receive the edge
+ * @param owner Will receive the id of the node holding the edge
+ * @return True if an edge was found
+ */
+static int
+route_ch_find_edge(struct route_ch *ch, struct item_id *from, struct item_id *to, struct route_ch_edge *edge, struct item_id *owner)
+{
+	struct item *item;
+	struct attr attr;
+	struct route_ch_edge e;
+	int i,ret=0;
+
+	for (i = 0 ; i < 2 ; i++) {
+		struct item_id *id=i ? to : from;
+		struct item_id *other=i ? from : to;
+		int mask=i ? CH_EDGE_BACKWARD : CH_EDGE_FORWARD;
+		item=map_rect_get_item_byid(ch->mr, id->id_hi, id->id_lo);
+		if (!item)
+			continue;
+		while (item_attr_get(item, attr_ch_edge, &attr)) {
+			memcpy(&e, attr.u.data, sizeof(e));
+			if ((e.flags & mask) && route_ch_id_equal(&e.target, other) && (!ret || e.weight < edge->weight)) {
+				*edge=e;
+				*owner=*id;
+				ret=1;
+			}
+		}
+	}
+	return ret;
+}
+
+/**
+ * @brief Replaces an edge of the hierarchy by the streets it represents
+ *
+ * Shortcuts are unpacked recursively, the streets are prepended to {@code ch->streets}.
+ *
+ * @param ch The query
+ * @param from The node at which the edge is entered
+ * @param to The node at which the edge is left
+ * @param edge The edge
+ * @param owner The node holding the edge
+ * @param depth Recursion depth, to protect against broken data
+ * @return True on success
+ */
+static int
+route_ch_unpack(struct route_ch *ch, struct item_id *from, struct item_id *to, struct route_ch_edge *edge, struct item_id *owner, int depth)
+{
+	struct route_ch_edge e1,e2;
+	struct item_id o1,o2,middle;
+
+	if (depth > 64) {
+		dbg(lvl_error,"shortcut nesting too deep\n");
+		return 0;
+	}
+	if (!(edge->flags & CH_EDGE_SHORTCUT)) {
+		struct route_ch_street *street=g_new(struct route_ch_street, 1);
+		street->id=edge->middle;
+		street->dir=(route_ch_id_equal(from, owner) ^ !!(edge->flags & CH_EDGE_REVERSED)) ? 1 : -1;
+		ch->streets=g_list_prepend(ch->streets, street);
+		return 1;
+	}
+	middle=edge->middle;
+	if (!route_ch_find_edge(ch, from, &middle, &e1, &o1) || !route_ch_find_edge(ch, &middle, to, &e2, &o2)) {
+		dbg(lvl_error,"shortcut "ITEM_ID_FMT" without edges\n",ITEM_ID_ARGS(middle));
+		return 0;
+	}
+	return route_ch_unpack(ch, &middle, to, &e2, &o2, depth+1) && route_ch_unpack(ch, from, &middle, &e1, &o1, depth+1);
+}
+
+/**
+ * @brief Inserts (a part of) a street into a path built from a contraction hierarchy
+ *
+ * This works like route_path_add_item_from_graph(), but takes the street data directly.
+ *
+ * @param this The path to add the street to
+ * @param profile The vehicle profile
+ * @param sd The street
+ * @param dir Direction in which the street is used
+ * @param pos Information about start point if this is the first street
+ * @param dst Information about end point if this is the last street
+ * @return True on success, false if the street is impassable for the vehicle
+ */
+static int
+route_path_add_street(struct route_path *this, struct vehicleprofile *profile, struct street_data *sd, int dir, struct route_info *pos, struct route_info *dst)
+{
+	struct route_path_segment *segment;
+	struct coord *c,*cd;
+	int i,ccnt,len,extra=0;
+	int seg_size,seg_dat_size;
+
+	if ((sd->flags & (dir > 0 ? profile->flags_forward_mask : profile->flags_reverse_mask)) != profile->flags)
+		return 0;
+	if (pos) {
+		extra=1;
+		if (dir > 0) {
+			c=sd->c+pos->pos+1;
+			ccnt=sd->count-pos->pos-1;
+			len=pos->lenpos;
+		} else {
+			c=sd->c;
+			ccnt=pos->pos+1;
+			len=pos->lenneg;
+		}
+		pos->dir=dir;
+	} else if (dst) {
+		extra=1;
+		if (dir > 0) {
+			c=sd->c;
+			ccnt=dst->pos+1;
+			len=dst->lenneg;
+		} else {
+			c=sd->c+dst->pos+1;
+			ccnt=sd->count-dst->pos-1;
+			len=dst->lenpos;
+		}
+	} else {
+		c=sd->c;
+		ccnt=sd->count;
+		len=transform_polyline_length(map_projection(sd->item.map), sd->c, sd->count);
+	}
+	seg_size=sizeof(*segment) + sizeof(struct coord) * (ccnt + extra);
+	seg_dat_size=sizeof(struct route_segment_data)+sizeof(int);
+	segment=g_malloc0(seg_size + seg_dat_size);
+	segment->data=(struct route_segment_data *)((char *)segment+seg_size);
+	segment->direction=dir;
+	cd=segment->c;
+	if (pos && (ccnt <= 0 || c[dir < 0 ? ccnt-1 : 0].x != pos->lp.x || c[dir < 0 ? ccnt-1 : 0].y != pos->lp.y))
+		*cd++=pos->lp;
+	if (dir < 0)
+		c+=ccnt-1;
+	for (i = 0 ; i < ccnt ; i++) {
+		*cd++=*c;
+		c+=dir;
+	}
+	if (dst && (cd == segment->c || cd[-1].x != dst->lp.x || cd[-1].y != dst->lp.y))
+		*cd++=dst->lp;
+	segment->ncoords=cd-segment->c;
+	if (segment->ncoords <= 1) {
+		g_free(segment);
+		return 1;
+	}
+	route_ch_segment_data(sd, len, segment->data);
+	item_hash_insert(this->path_hash, &sd->item, segment);
+	route_path_add_segment(this, segment);
+	return 1;
+}
+
+/**
+ * @brief Creates a new route path using the contraction hierarchy stored in the map
+ *
+ * maptool stores a contraction hierarchy of the road network as {@code type_ch_node} items,
+ * one for each end of a street, whose {@code attr_ch_edge} attributes point to nodes of higher
+ * level. This function runs a bidirectional Dijkstra search upwards in the hierarchy, starting
+ * at the ends of the street of the position and of the destination, and unpacks the shortcuts
+ * of the cheapest path into the streets they represent.
+ *
+ * The weights of the hierarchy are calculated by maptool with fixed speeds per street type,
+ * so the result may differ from what route_graph_flood() finds for the given profile. Streets
+ * which are impassable for the profile make the query fail, so the caller can fall back to
+ * the route graph.
+ *
+ * @param pos The starting position of the route
+ * @param dst The destination of the route
+ * @param profile The vehicle profile
+ * @return The new route path, or NULL if there is no hierarchy or no path was found
+ */
+static struct route_path *
+route_path_new_ch(struct route_info *pos, struct route_info *dst, struct vehicleprofile *profile)
+{
+	struct route_ch ch;
+	struct route_ch_node *node,*meet=NULL,*n;
+	struct route_path *ret=NULL;
+	struct street_data *ps=pos->street, *ds=dst->street;
+	int i,idx,found,best=INT_MAX,failed=0;
+	GList *l,*chain=NULL;
+
+	if (!ps || !ds || ps->item.map != ds->item.map || item_is_equal(ps->item, ds->item))
+		return NULL;
+	if (profile->mode == 2 || (profile->mode == 0 && pos->lenextra + dst->lenextra > transform_distance(map_projection(ps->item.map), &pos->c, &dst->c)))
+		return NULL;
+	memset(&ch, 0, sizeof(ch));
+	ch.m=ps->item.map;
+	ch.profile=profile;
+	ch.mr=map_rect_new(ch.m, NULL);
+	if (!ch.mr)
+		return NULL;
+	ch.nodes=g_hash_table_new_full(route_ch_id_hash, route_ch_id_equal, NULL, route_ch_node_free);
+	ch.heap[0]=route_heap_new();
+	ch.heap[1]=route_heap_new();
+
+	found=route_ch_add_start(&ch, &ps->c[ps->count-1], 0, 1, route_ch_street_value(profile, ps, 1, pos->lenpos));
+	found|=route_ch_add_start(&ch, &ps->c[0], 0, -1, route_ch_street_value(profile, ps, -1, pos->lenneg));
+	if (found) {
+		found=route_ch_add_start(&ch, &ds->c[0], 1, 1, route_ch_street_value(profile, ds, 1, dst->lenneg));
+		found|=route_ch_add_start(&ch, &ds->c[ds->count-1], 1, -1, route_ch_street_value(profile, ds, -1, dst->lenpos));
+	}
+	if (!found)
+		dbg(lvl_debug,"no contraction hierarchy at position or destination\n");
+	while (found) {
+		struct route_ch_node *min0=route_heap_min(ch.heap[0]);
+		struct route_ch_node *min1=route_heap_min(ch.heap[1]);
+		if (min0 && min0->value[0] >= best)
+			min0=NULL;
+		if (min1 && min1->value[1] >= best)
+			min1=NULL;
+		if (!min0 && !min1)
+			break;
+		idx=(!min0 || (min1 && min1->value[1] < min0->value[0]));
+		node=route_heap_extract_min(ch.heap[idx]);
+		node->el[idx]=0;
+		if (node->value[!idx] != INT_MAX && node->value[0]+node->value[1] < best) {
+			best=node->value[0]+node->value[1];
+			meet=node;
+		}
+		route_ch_settle(&ch, node, idx);
+	}
+	if (meet) {
+		dbg(lvl_debug,"meeting at "ITEM_ID_FMT" cost %d, %d nodes visited\n",ITEM_ID_ARGS(meet->id), best, g_hash_table_size(ch.nodes));
+		/* streets are prepended, so unpack from the destination towards the position */
+		for (n = meet ; n->pred[1] ; n = n->pred[1])
+			chain=g_list_prepend(chain, n);
+		for (l = chain ; l && !failed ; l = g_list_next(l)) {
+			n=l->data;
+			failed=!route_ch_unpack(&ch, &n->id, &n->pred[1]->id, &n->edge[1], &n->pred[1]->id, 0);
+		}
+		g_list_free(chain);
+		for (n = meet ; n->pred[0] && !failed ; n = n->pred[0])
+			failed=!route_ch_unpack(&ch, &n->pred[0]->id, &n->id, &n->edge[0], &n->pred[0]->id, 0);
+	}
+	if (meet && !failed) {
+		struct route_ch_node *first=meet,*last=meet;
+		while (first->pred[0])
+			first=first->pred[0];
+		while (last->pred[1])
+			last=last->pred[1];
+		ret=g_new0(struct route_path, 1);
+		ret->in_use=1;
+		if (pos->lenextra)
+			route_path_add_line(ret, &pos->c, &pos->lp, pos->lenextra);
+		ret->path_hash=item_hash_new();
+		failed=!route_path_add_street(ret, profile, ps, first->dir[0], pos, NULL);
+		for (l = ch.streets, i = 0 ; l && !failed ; l = g_list_next(l), i++) {
+			struct route_ch_street *street=l->data;
+			struct item *item=map_rect_get_item_byid(ch.mr, street->id.id_hi, street->id.id_lo);
+			struct street_data *sd=item ? street_get_data(item) : NULL;
+			if (!sd || !route_path_add_street(ret, profile, sd, street->dir, NULL, NULL)) {
+				dbg(lvl_debug,"street "ITEM_ID_FMT" not usable\n",ITEM_ID_ARGS(street->id));
+				failed=1;
+			}
+			street_data_free(sd);
+		}
+		if (!failed)
+			failed=!route_path_add_street(ret, profile, ds, last->dir[1], NULL, dst);
+		if (dst->lenextra)
+			route_path_add_line(ret, &dst->lp, &dst->c, dst->lenextra);
+		dbg(lvl_debug,"%d streets\n", i);
+		if (failed) {
+			route_path_destroy(ret, 0);
+			ret=NULL;
+		}
+	}
+	g_list_foreach(ch.streets, (GFunc)g_free, NULL);
+	g_list_free(ch.streets);
+	route_heap_destroy(ch.heap[0]);
+	route_heap_destroy(ch.heap[1]);
+	g_hash_table_destroy(ch.nodes);
+	map_rect_destroy(ch.mr);
+	return ret;
+}
+
+/**
+ * @brief Updates the route path using the contraction hierarchy
+ *
+ * This is used instead of building and flooding a route graph if the vehicle profile
+ * asks for {@code route_algorithm_ch} and there is only one destination.
+ *
+ * @param this The route object
+ * @return True if the path was handled, false if the route graph has to be used
+ */
+static int
+route_path_update_ch(struct route *this)
+{
+	struct route_path *path;
+	struct attr route_status;
+
+	if (!this->vehicleprofile || this->vehicleprofile->route_algorithm != route_algorithm_ch)
+		return 0;
+	if (!this->pos || !this->destinations || this->destinations->next)
+		return 0;
+	if (this->path2 && this->path2->in_use > 1) {
+		this->path2->update_required=1;
+		return 1;
+	}
+	path=route_path_new_ch(this->pos, this->destinations->data, this->vehicleprofile);
+	if (!path)
+		return 0;
+	route_path_destroy(this->path2,1);
+	this->path2=path;
+	route_path_calc_time_len(this->path2, this->vehicleprofile);
+	route_status.type=attr_route_status;
+	route_status.u.num=route_status_path_done_new;
+	route_set_attr(this, &route_status);
+	return 1;
+}
+
+static int
+route_graph_build_next_map(struct route_graph *rg)
+{
+	do {
+		rg->m=mapset_next(rg->h, 2);
+		if (! rg->m)
+			return 0;
+		map_rect_destroy(rg->mr);
+		rg->mr=NULL;
+#ifdef HAVE_PTHREAD
+		if (route_graph_workers_has_map(rg->workers, rg->m))
+			continue;
+#endif
+		rg->mr=map_rect_new(rg->m, rg->sel);
+	} while (!rg->mr);
+		
+	return 1;
+}
+
+
+static int
+is_turn_allowed(struct route_graph_point *p, struct route_graph_segment *from, struct route_graph_segment *to)
+{
+	struct route_graph_point *prev,*next;
+	struct route_graph_segment *tmp1,*tmp2;
+	if (item_is_equal(from->data.item, to->data.item))
+		return 0;
+	if (from->start == p)
+		prev=from->end;
+	else
+		prev=from->start;
+	if (to->start == p)
+		next=to->end;
+	else
+		next=to->start;
+	tmp1=p->end;
+	while (tmp1) {
+		if (tmp1->start->c.x == prev->c.x && tmp1->start->c.y == prev->c.y &&
+			(tmp1->data.item.type == type_street_turn_restriction_no ||
+			tmp1->data.item.type == type_street_turn_restriction_only)) {
+			tmp2=p->start;
+			dbg(lvl_debug,"found %s (0x%x,0x%x) (0x%x,0x%x)-(0x%x,0x%x) %p-%p\n",item_to_name(tmp1->data.item.type),tmp1->data.item.id_hi,tmp1->data.item.id_lo,tmp1->start->c.x,tmp1->start->c.y,tmp1->end->c.x,tmp1->end->c.y,tmp1->start,tmp1->end);
+			while (tmp2) {
+				dbg(lvl_debug,"compare %s (0x%x,0x%x) (0x%x,0x%x)-(0x%x,0x%x) %p-%p\n",item_to_name(tmp2->data.item.type),tmp2->data.item.id_hi,tmp2->data.item.id_lo,tmp2->start->c.x,tmp2->start->c.y,tmp2->end->c.x,tmp2->end->c.y,tmp2->start,tmp2->end);
+				if (item_is_equal(tmp1->data.item, tmp2->data.item)) 
+					break;
+				tmp2=tmp2->start_next;
+			}
+			dbg(lvl_debug,"tmp2=%p\n",tmp2);
+			if (tmp2) {
+				dbg(lvl_debug,"%s tmp2->end=%p next=%p\n",item_to_name(tmp1->data.item.type),tmp2->end,next);
+			}
+			if (tmp1->data.item.type == type_street_turn_restriction_no && tmp2 && tmp2->end->c.x == next->c.x && tmp2->end->c.y == next->c.y) {
+				dbg(lvl_debug,"from 0x%x,0x%x over 0x%x,0x%x to 0x%x,0x%x not allowed (no)\n",prev->c.x,prev->c.y,p->c.x,p->c.y,next->c.x,next->c.y);
+				return 0;
+			}
+			if (tmp1->data.item.type == type_street_turn_restriction_only && tmp2 && (tmp2->end->c.x != next->c.x || tmp2->end->c.y != next->c.y)) {
+				dbg(lvl_debug,"from 0x%x,0x%x over 0x%x,0x%x to 0x%x,0x%x not allowed (only)\n",prev->c.x,prev->c.y,p->c.x,p->c.y,next->c.x,next->c.y);
+				return 0;
+			}
+		}
+		tmp1=tmp1->end_next;
+	}
+	dbg(lvl_debug,"from 0x%x,0x%x over 0x%x,0x%x to 0x%x,0x%x allowed\n",prev->c.x,prev->c.y,p->c.x,p->c.y,next->c.x,next->c.y);
+	return 1;
+}
+
+static void
+route_graph_clone_segment(struct route_graph *this, struct route_graph_segment *s, struct route_graph_point *start, struct route_graph_point *end, int flags)
+{
+	struct route_graph_segment_data data;
+	data.item=&s->data.item;
+	data.offset=1;
+	data.flags=s->data.flags|flags;
+	data.len=s->data.len+1;
+	data.maxspeed=-1;
+	data.dangerous_goods=0;
+	if (s->data.flags & AF_SPEED_LIMIT)
+		data.maxspeed=RSD_MAXSPEED(&s->data);
+	if (s->data.flags & AF_SEGMENTED) 
+		data.offset=RSD_OFFSET(&s->data);
+	dbg(lvl_debug,"cloning segment from %p (0x%x,0x%x) to %p (0x%x,0x%x)\n",start,start->c.x,start->c.y, end, end->c.x, end->c.y);
+	route_graph_add_segment(this, start, end, &data);
+}
+
+static void
+route_graph_process_restriction_segment(struct route_graph *this, struct route_graph_point *p, struct route_graph_segment *s, int dir)
+{
+	struct route_graph_segment *tmp;
+	struct route_graph_point *pn;
+	struct coord c=p->c;
+	int dx=0;
+	int dy=0;
+	c.x+=dx;
+	c.y+=dy;
+	dbg(lvl_debug,"From %s %d,%d\n",item_to_name(s->data.item.type),dx,dy);
+	pn=route_graph_point_new(this, &c);
+	if (dir > 0) { /* going away */
+		dbg(lvl_debug,"other 0x%x,0x%x\n",s->end->c.x,s->end->c.y);
+		if (s->data.flags & AF_ONEWAY) {
+			dbg(lvl_debug,"Not possible\n");
+			return;
+		}
+		route_graph_clone_segment(this, s, pn, s->end, AF_ONEWAYREV);
+	} else { /* coming in */
+		dbg(lvl_debug,"other 0x%x,0x%x\n",s->start->c.x,s->start->c.y);
+		if (s->data.flags & AF_ONEWAYREV) {
+			dbg(lvl_debug,"Not possible\n");
+			return;
+		}
+		route_graph_clone_segment(this, s, s->start, pn, AF_ONEWAY);
+	}
+	tmp=p->start;
+	while (tmp) {
+		if (tmp != s && tmp->data.item.type != type_street_turn_restriction_no &&
+			tmp->data.item.type != type_street_turn_restriction_only &&
+			!(tmp->data.flags & AF_ONEWAYREV) && is_turn_allowed(p, s, tmp)) {
+			route_graph_clone_segment(this, tmp, pn, tmp->end, AF_ONEWAY);
+			dbg(lvl_debug,"To start %s\n",item_to_name(tmp->data.item.type));
+		}
+		tmp=tmp->start_next;
+	}
+	tmp=p->end;
+	while (tmp) {
+		if (tmp != s && tmp->data.item.type != type_street_turn_restriction_no &&
+			tmp->data.item.type != type_street_turn_restriction_only &&
+			!(tmp->data.flags & AF_ONEWAY) && is_turn_allowed(p, s, tmp)) {
+			route_graph_clone_segment(this, tmp, tmp->start, pn, AF_ONEWAYREV);
+			dbg(lvl_debug,"To end %s\n",item_to_name(tmp->data.item.type));
+		}
+		tmp=tmp->end_next;
+	}
+}
+
+static void
+route_graph_process_restriction_point(struct route_graph *this, struct route_graph_point *p)
+{
+	struct route_graph_segment *tmp;
+	tmp=p->start;
+	dbg(lvl_debug,"node 0x%x,0x%x\n",p->c.x,p->c.y);
+	while (tmp) {
+		if (tmp->data.item.type != type_street_turn_restriction_no &&
+			tmp->data.item.type != type_street_turn_restriction_only)
+			route_graph_process_restriction_segment(this, p, tmp, 1);
+		tmp=tmp->start_next;
+	}
+	tmp=p->end;
+	while (tmp) {
+		if (tmp->data.item.type != type_street_turn_restriction_no &&
+			tmp->data.item.type != type_street_turn_restriction_only)
+			route_graph_process_restriction_segment(this, p, tmp, -1);
+		tmp=tmp->end_next;
+	}
+	p->flags |= RP_TURN_RESTRICTION_RESOLVED;
+}
+
+static void
+route_graph_process_restrictions(struct route_graph *this)
+{
+	struct route_graph_point *curr;
+	int i;
+	dbg(lvl_debug,"enter\n");
+	for (i = 0 ; i < this->hash_size ; i++) {
+		curr=this->hash[i];
+		while (curr) {
+			if (curr->flags & RP_TURN_RESTRICTION) 
+				route_graph_process_restriction_point(this, curr);
+			curr=curr->hash_next;
+		}
+	}
+}
+
+/**
+ * @brief Header of a route graph cache file
+ *
+ * A cache file holds a completely built route graph (including resolved turn restrictions, but without
+ * traffic distortions) in native byte order. The header is followed by the key, padded to a multiple of 4 bytes,
+ * {@code point_count} {@code struct route_graph_cache_point} and {@code segment_count} {@code struct route_graph_cache_segment}.
+ */
+struct route_graph_cache_header {
+	char magic[8];				/**< ROUTE_GRAPH_CACHE_MAGIC */
+	int version;				/**< ROUTE_GRAPH_CACHE_VERSION, also detects a different byte order */
+	int size;				/**< Size of the whole file */
+	int key_len;				/**< Length of the key, including the terminating 0 */
+	int point_count;			/**< Number of points */
+	int segment_count;			/**< Number of segments */
+};
+
+struct route_graph_cache_point {
+	struct coord c;
+	int flags;
+};
+
+struct route_graph_cache_segment {
+	int start,end;				/**< Indices of the points */
+	int map;				/**< Index of the map of the item in route_graph_cache->maps */
+	int type,id_hi,id_lo;			/**< The item */
+	int flags;
+	int len;
+	int offset;
+	int maxspeed;
+	struct size_weight_limit size_weight;
+	int dangerous_goods;
+};
+
+/**
+ * @brief Identifies a route graph in the cache
+ */
+struct route_graph_cache {
+	char *key;				/**< Describes everything the graph was built from */
+	char *filename;				/**< File the graph is stored in */
+	struct map **maps;			/**< The maps used to build the graph, in mapset order */
+	int map_count;				/**< Number of maps */
+	int loaded;				/**< The graph has been loaded from the cache */
+	struct callback *save_cb;		/**< Idle callback to write the graph to the cache */
+	struct event_idle *save_ev;		/**< The pointer to the idle event writing the graph */
+};
+
+#define ROUTE_GRAPH_CACHE_MAGIC "NAVITRGC"
+#define ROUTE_GRAPH_CACHE_VERSION 1
+#define ROUTE_GRAPH_CACHE_SLOTS 16
+#define ROUTE_GRAPH_CACHE_GRID 4096
+
+static void
+route_graph_cache_key_append(char **key, char *str)
+{
+	char *n=g_strconcat(*key, str, NULL);
+	g_free(*key);
+	g_free(str);
+	*key=n;
+}
+
+/**
+ * @brief Enlarges a rectangle of a selection to a coarse grid
+ *
+ * The grid is a power of two of at least ROUTE_GRAPH_CACHE_GRID and about an eighth of the size of the
+ * rectangle, so the rectangles of routes from or to nearby positions end up the same.
+ *
+ * @param r The rectangle
+ */
+static void
+route_graph_cache_align(struct coord_rect *r)
+{
+	int size=MAX(r->rl.x-r->lu.x, r->lu.y-r->rl.y)/8;
+	int grid=ROUTE_GRAPH_CACHE_GRID;
+
+	while (grid < size)
+		grid<<=1;
+	r->lu.x&=~(grid-1);
+	r->rl.y&=~(grid-1);
+	r->rl.x=(r->rl.x+grid-1) & ~(grid-1);
+	r->lu.y=(r->lu.y+grid-1) & ~(grid-1);
+}
+
+/**
+ * @brief Creates the cache key for a route graph
+ *
+ * The key consists of the item types the vehicle profile can use, the rectangles of the selection
+ * and name, release, size and modification time of each active map. The rectangles of the selection
+ * are enlarged to a coarse grid first, so the graph is built from the same area the key describes and
+ * can be used again for routes which do not start or end at exactly the same position.
+ *
+ * @param ms The mapset the graph is built from
+ * @param sel The selection of the graph, its rectangles are enlarged
+ * @param profile The vehicle profile
+ * @return The cache description, or {@code NULL} if there is no place to store the cache
+ */
+static struct route_graph_cache *
+route_graph_cache_new(struct mapset *ms, struct map_selection *sel, struct vehicleprofile *profile)
+{
+	struct route_graph_cache *this;
+	struct mapset_handle *h;
+	struct map *m;
+	struct attr data,release;
+	struct file *f;
+	char *key;
+	char *dir;
+	int type;
+
+	dir=navit_get_user_data_directory(FALSE);
+	if (!dir)
+		return NULL;
+	this=g_new0(struct route_graph_cache, 1);
+	key=g_strdup("profile");
+	for (type = route_item_first ; type <= route_item_last ; type++) {
+		if (vehicleprofile_get_roadprofile(profile, type))
+			route_graph_cache_key_append(&key, g_strdup_printf(",%x", type));
+	}
+	for ( ; sel ; sel = sel->next) {
+		route_graph_cache_align(&sel->u.c_rect);
+		route_graph_cache_key_append(&key, g_strdup_printf("\nsel %d,%d,%d,%d,%d", sel->order, sel->u.c_rect.lu.x, sel->u.c_rect.lu.y,
+			sel->u.c_rect.rl.x, sel->u.c_rect.rl.y));
+	}
+	h=mapset_open(ms);
+	while ((m=mapset_next(h, 2))) {
+		if (!map_get_attr(m, attr_data, &data, NULL))
+			data.u.str="";
+		if (!map_get_attr(m, attr_map_release, &release, NULL))
+			release.u.str="";
+		route_graph_cache_key_append(&key, g_strdup_printf("\nmap %s,%s", data.u.str, release.u.str));
+		f=file_create(data.u.str, NULL);
+		if (f) {
+#ifndef __CEGCC__
+			file_version(f, 0);
+			route_graph_cache_key_append(&key, g_strdup_printf(","LONGLONG_FMT",%ld", f->size, (long)f->mtime));
+#else
+			route_graph_cache_key_append(&key, g_strdup_printf(","LONGLONG_FMT, f->size));
+#endif
+			file_destroy(f);
+		}
+		this->maps=g_renew(struct map *, this->maps, this->map_count+1);
+		this->maps[this->map_count++]=m;
+	}
+	mapset_close(h);
+	this->key=key;
+	this->filename=g_strdup_printf("%s/routegraph%02d.bin", dir, g_str_hash(this->key) % ROUTE_GRAPH_CACHE_SLOTS);
+	return this;
+}
+
+static void
+route_graph_cache_destroy(struct route_graph_cache *this)
+{
+	if (!this)
+		return;
+	if (this->save_ev)
+		event_remove_idle(this->save_ev);
+	if (this->save_cb)
+		callback_destroy(this->save_cb);
+	g_free(this->key);
+	g_free(this->filename);
+	g_free(this->maps);
+	g_free(this);
+}
+
+/**
+ * @brief Opens the cache file of a route graph
+ *
+ * @param cache The cache description
+ * @return The mapped file if it holds the graph described by the key, {@code NULL} otherwise
+ */
+static struct file *
+route_graph_cache_open(struct route_graph_cache *cache)
+{
+	struct route_graph_cache_header *header;
+	struct file *f;
+	int key_size;
+
+	f=file_create(cache->filename, NULL);
+	if (!f)
+		return NULL;
+	if (f->size < sizeof(*header) || !file_mmap(f)) {
+		file_destroy(f);
+		return NULL;
+	}
+	header=(struct route_graph_cache_header *)f->begin;
+	key_size=(header->key_len+3) & ~3;
+	/* The counts are checked against the file size first, so the products below can not overflow */
+	if (memcmp(header->magic, ROUTE_GRAPH_CACHE_MAGIC, sizeof(header->magic)) || header->version != ROUTE_GRAPH_CACHE_VERSION ||
+		header->size != f->size || header->key_len != strlen(cache->key)+1 || key_size > f->size-sizeof(*header) ||
+		header->point_count < 0 || header->point_count > f->size/sizeof(struct route_graph_cache_point) ||
+		header->segment_count < 0 || header->segment_count > f->size/sizeof(struct route_graph_cache_segment) ||
+		f->size != sizeof(*header)+key_size+(long long)header->point_count*sizeof(struct route_graph_cache_point)+
+			(long long)header->segment_count*sizeof(struct route_graph_cache_segment) ||
+		strcmp((char *)(header+1), cache->key)) {
+		dbg(lvl_debug,"%s does not match\n", cache->filename);
+		file_destroy(f);
+		return NULL;
+	}
+	return f;
+}
+
+/**
+ * @brief Loads a route graph from the cache
+ *
+ * @param this The route graph, which must be empty
+ * @return True if the graph has been loaded
+ */
+static int
+route_graph_cache_load(struct route_graph *this)
+{
+	struct route_graph_cache *cache=this->cache;
+	struct route_graph_cache_header *header;
+	struct route_graph_cache_point *cp;
+	struct route_graph_cache_segment *cs;
+	struct route_graph_point **points;
+	struct route_graph_segment_data data;
+	struct item item;
+	struct file *f;
+	int i,ret=0;
+
+	f=route_graph_cache_open(cache);
+	if (!f)
+		return 0;
+	header=(struct route_graph_cache_header *)f->begin;
+	profile(0,NULL);
+	cp=(struct route_graph_cache_point *)((char *)(header+1)+((header->key_len+3) & ~3));
+	cs=(struct route_graph_cache_segment *)(cp+header->point_count);
+	points=g_new(struct route_graph_point *, header->point_count);
+	for (i = 0 ; i < header->point_count ; i++) {
+		points[i]=route_graph_point_new(this, &cp[i].c);
+		points[i]->flags=cp[i].flags;
+	}
+	memset(&item, 0, sizeof(item));
+	data.item=&item;
+	for (i = 0 ; i < header->segment_count ; i++, cs++) {
+		if (cs->start < 0 || cs->start >= header->point_count || cs->end < 0 || cs->end >= header->point_count ||
+			cs->map < 0 || cs->map >= cache->map_count)
+			break;
+		item.type=cs->type;
+		item.id_hi=cs->id_hi;
+		item.id_lo=cs->id_lo;
+		item.map=cache->maps[cs->map];
+		data.flags=cs->flags;
+		data.len=cs->len;
+		data.offset=cs->offset;
+		data.maxspeed=cs->maxspeed;
+		data.size_weight=cs->size_weight;
+		data.dangerous_goods=cs->dangerous_goods;
+		route_graph_add_segment(this, points[cs->start], points[cs->end], &data);
+	}
+	if (i == header->segment_count) {
+		ret=1;
+		profile(0,"loaded %d points and %d segments from %s\n", header->point_count, header->segment_count, cache->filename);
+	} else {
+		dbg(lvl_error,"%s is corrupt\n", cache->filename);
+		route_graph_free_points(this);
+		route_graph_free_segments(this);
+	}
+	g_free(points);
+	file_destroy(f);
+	return ret;
+}
+
+/**
+ * @brief Writes a completely built route graph to the cache
+ *
+ * @param this The route graph
+ */
+static void
+route_graph_cache_save(struct route_graph *this)
+{
+	struct route_graph_cache *cache=this->cache;
+	struct route_graph_cache_header header;
+	struct route_graph_cache_point cp;
+	struct route_graph_cache_segment cs;
+	struct route_graph_chunk *chunk;
+	struct route_graph_point *p,*end;
+	struct route_graph_segment *s;
+	GHashTable *index=g_hash_table_new(NULL, NULL);
+	GList *chunks=NULL,*segments=NULL,*l;
+	static const char pad[4];
+	char *tmpname;
+	FILE *out;
+	int i,ok=1;
+
+	navit_get_user_data_directory(TRUE);
+	tmpname=g_strdup_printf("%s.tmp", cache->filename);
+	out=fopen(tmpname, "wb");
+	if (!out) {
+		dbg(lvl_debug,"unable to create %s\n", tmpname);
+		g_free(tmpname);
+		g_hash_table_destroy(index);
+		return;
+	}
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, ROUTE_GRAPH_CACHE_MAGIC, sizeof(header.magic));
+	header.version=ROUTE_GRAPH_CACHE_VERSION;
+	header.key_len=strlen(cache->key)+1;
+	/* Points and segments are written in the order they were created, so loading them gives the same hash chains and segment lists */
+	for (chunk = this->points ; chunk ; chunk = chunk->next)
+		chunks=g_list_prepend(chunks, chunk);
+	for (s = this->route_segments ; s ; s = s->next) {
+		if (s->data.item.type != type_traffic_distortion)
+			segments=g_list_prepend(segments, s);
+	}
+	fwrite(&header, sizeof(header), 1, out);
+	fwrite(cache->key, header.key_len, 1, out);
+	fwrite(pad, ((header.key_len+3) & ~3)-header.key_len, 1, out);
+	for (l = chunks ; l ; l = l->next) {
+		chunk=l->data;
+		end=(struct route_graph_point *)((char *)(chunk+1)+chunk->used);
+		for (p = (struct route_graph_point *)(chunk+1) ; p < end ; p++) {
+			g_hash_table_insert(index, p, GINT_TO_POINTER(header.point_count++));
+			cp.c=p->c;
+			cp.flags=p->flags & ~(RP_TRAFFIC_DISTORTION|RP_FLOOD_TARGET);
+			fwrite(&cp, sizeof(cp), 1, out);
+		}
+	}
+	for (l = segments ; l && ok ; l = l->next) {
+		s=l->data;
+		memset(&cs, 0, sizeof(cs));
+		cs.start=GPOINTER_TO_INT(g_hash_table_lookup(index, s->start));
+		cs.end=GPOINTER_TO_INT(g_hash_table_lookup(index, s->end));
+		for (i = 0 ; i < cache->map_count && cache->maps[i] != s->data.item.map ; i++);
+		if (i == cache->map_count) {
+			dbg(lvl_debug,"item of unknown map, not caching graph\n");
+			ok=0;
+		}
+		cs.map=i;
+		cs.type=s->data.item.type;
+		cs.id_hi=s->data.item.id_hi;
+		cs.id_lo=s->data.item.id_lo;
+		cs.flags=s->data.flags;
+		cs.len=s->data.len;
+		cs.offset=1;
+		if (s->data.flags & AF_SEGMENTED)
+			cs.offset=RSD_OFFSET(&s->data);
+		if (s->data.flags & AF_SPEED_LIMIT)
+			cs.maxspeed=RSD_MAXSPEED(&s->data);
+		if (s->data.flags & AF_SIZE_OR_WEIGHT_LIMIT)
+			cs.size_weight=RSD_SIZE_WEIGHT(&s->data);
+		if (s->data.flags & AF_DANGEROUS_GOODS)
+			cs.dangerous_goods=RSD_DANGEROUS_GOODS(&s->data);
+		fwrite(&cs, sizeof(cs), 1, out);
+		header.segment_count++;
+	}
+	header.size=ftell(out);
+	fseek(out, 0, SEEK_SET);
+	fwrite(&header, sizeof(header), 1, out);
+	if (ferror(out))
+		ok=0;
+	if (fclose(out))
+		ok=0;
+	if (ok) {
+		remove(cache->filename);
+		if (!rename(tmpname, cache->filename))
+			dbg(lvl_debug,"saved %d points and %d segments to %s\n", header.point_count, header.segment_count, cache->filename);
+	} else
+		remove(tmpname);
+	g_free(tmpname);
+	g_list_free(chunks);
+	g_list_free(segments);
+	g_hash_table_destroy(index);
+}
+
+/**
+ * @brief Idle callback writing a newly built route graph to the cache
+ *
+ * This waits until the graph is no longer flooded by a thread. The graph is not written if the
+ * cache file already holds it, e.g. because another graph with the same key has been saved meanwhile.
+ *
+ * @param this The route graph
+ */
+static void
+route_graph_cache_save_idle(struct route_graph *this)
+{
+	struct route_graph_cache *cache=this->cache;
+	struct file *f;
+
+#ifdef HAVE_PTHREAD
+	if (this->job)
+		return;
+#endif
+	event_remove_idle(cache->save_ev);
+	cache->save_ev=NULL;
+	f=route_graph_cache_open(cache);
+	if (f) {
+		dbg(lvl_debug,"%s is up to date\n", cache->filename);
+		file_destroy(f);
+		return;
+	}
+	route_graph_cache_save(this);
+}
+
+/**
+ * @brief Adds an item read from a map to the route graph
+ *
+ * @param rg The route graph
+ * @param item The item
+ * @param profile The vehicle profile
+ */
+static void
+route_graph_process_item(struct route_graph *rg, struct item *item, struct vehicleprofile *profile)
+{
+	if (item->type == type_traffic_distortion)
+		route_process_traffic_distortion(rg, item);
+	else if (item->type == type_street_turn_restriction_no || item->type == type_street_turn_restriction_only)
+		route_process_turn_restriction(rg, item);
+	else
+		route_process_street_graph(rg, item, profile);
+}
+
+/**
+ * @brief A copy of a map of the mapset, kept by a route for reading the map on another thread
+ */
+struct route_graph_map_clone {
+	struct map *map;			/**< The map of the mapset */
+	struct map *clone;			/**< The copy, opened by map_clone() */
+};
+
+/**
+ * @brief Closes the unused map copies of a route
+ */
+static void
+route_graph_map_clones_destroy(GList **clones)
+{
+	struct route_graph_map_clone *c;
+	GList *l;
+
+	for (l = *clones ; l ; l = g_list_next(l)) {
+		c=l->data;
+		map_destroy(c->clone);
+		g_free(c);
+	}
+	g_list_free(*clones);
+	*clones=NULL;
+}
+
+#ifdef HAVE_PTHREAD
+#define ROUTE_GRAPH_MAX_WORKERS 8
+#define ROUTE_GRAPH_WORLD_MAX 20000000
+
+/**
+ * @brief A thread reading a part of the selection of a route graph into its own graph
+ */
+struct route_graph_worker {
+	pthread_t thread;
+	struct route_graph_workers *workers;	/**< The pool this worker belongs to */
+	struct route_graph *graph;		/**< Points and segments read by this worker */
+	struct map_selection *sel;		/**< The part of the selection read by this worker */
+	struct map **maps;			/**< Copies of the maps in route_graph_workers->maps, only read by this worker */
+	int started;				/**< The thread has been created */
+};
+
+/**
+ * @brief The threads building a route graph
+ *
+ * Only binfile maps are read by the workers, every worker reads its own copy of them. The copies are
+ * taken from the route and given back to it when the workers are destroyed, so they are only opened
+ * once per route. All other maps are read by the main thread into the route graph as before.
+ */
+struct route_graph_workers {
+	struct vehicleprofile *profile;
+	struct map **maps;			/**< The maps read by the workers */
+	int map_count;
+	GList **clones;				/**< Unused copies of the maps, see route->map_clones */
+	struct route_graph_worker *worker;
+	int count;				/**< Number of workers */
+	pthread_mutex_t mutex;			/**< Protects running and cancel */
+	int running;				/**< Number of workers which have not finished yet */
+	int cancel;				/**< The workers should stop */
+};
+
+static int
+route_graph_workers_cancelled(struct route_graph_workers *this)
+{
+	int ret;
+	pthread_mutex_lock(&this->mutex);
+	ret=this->cancel;
+	pthread_mutex_unlock(&this->mutex);
+	return ret;
+}
+
+static void *
+route_graph_worker_run(void *data)
+{
+	struct route_graph_worker *this=data;
+	struct route_graph_workers *workers=this->workers;
+	struct map_rect *mr;
+	struct item *item;
+	int i,count=0;
+
+	for (i = 0 ; i < workers->map_count ; i++) {
+		mr=map_rect_new(this->maps[i], this->sel);
+		if (!mr)
+			continue;
+		while ((item=map_rect_get_item(mr))) {
+			route_graph_process_item(this->graph, item, workers->profile);
+			if (!(++count % 1000) && route_graph_workers_cancelled(workers))
+				break;
+		}
+		map_rect_destroy(mr);
+	}
+	pthread_mutex_lock(&workers->mutex);
+	workers->running--;
+	pthread_mutex_unlock(&workers->mutex);
+	return NULL;
+}
+
+/**
+ * @brief Returns the part of a selection read by one worker
+ *
+ * The selection is split into vertical stripes whose borders are aligned to the binfile tile grid,
+ * so most tiles are only read by one worker.
+ *
+ * @param sel The selection
+ * @param part The number of the stripe
+ * @param parts The number of stripes
+ * @return The rectangles of the selection within the stripe, or NULL if there are none
+ */
+static struct map_selection *
+route_graph_worker_selection(struct map_selection *sel, int part, int parts)
+{
+	struct map_selection *curr,*ret=NULL,*tmp;
+	int minx=INT_MAX,maxx=INT_MIN,width,tile=2*ROUTE_GRAPH_WORLD_MAX,left,right;
+
+	for (curr = sel ; curr ; curr = curr->next) {
+		if (curr->u.c_rect.lu.x < minx)
+			minx=curr->u.c_rect.lu.x;
+		if (curr->u.c_rect.rl.x > maxx)
+			maxx=curr->u.c_rect.rl.x;
+	}
+	width=(maxx-minx)/parts;
+	while (tile > 1 && tile > width)
+		tile/=2;
+	left=minx+part*width;
+	right=minx+(part+1)*width;
+	left=left-(left+ROUTE_GRAPH_WORLD_MAX) % tile;
+	right=right-(right+ROUTE_GRAPH_WORLD_MAX) % tile;
+	if (part == 0)
+		left=minx;
+	if (part == parts-1)
+		right=maxx+1;
+	for (curr = sel ; curr ; curr = curr->next) {
+		if (curr->u.c_rect.rl.x < left || curr->u.c_rect.lu.x >= right)
+			continue;
+		tmp=g_new(struct map_selection, 1);
+		*tmp=*curr;
+		if (tmp->u.c_rect.lu.x < left)
+			tmp->u.c_rect.lu.x=left;
+		if (tmp->u.c_rect.rl.x > right-1)
+			tmp->u.c_rect.rl.x=right-1;
+		tmp->next=ret;
+		ret=tmp;
+	}
+	return ret;
+}
+
+/**
+ * @brief Returns the number of workers to use for building a route graph
+ */
+static int
+route_graph_workers_max(void)
+{
+	long count=sysconf(_SC_NPROCESSORS_ONLN);
+	if (count > ROUTE_GRAPH_MAX_WORKERS)
+		count=ROUTE_GRAPH_MAX_WORKERS;
+	return count < 1 ? 1 : count;
+}
+
+static void route_graph_workers_destroy(struct route_graph_workers *this);
+
+/**
+ * @brief Checks if a copy of a map still belongs to the map of the mapset
+ *
+ * @param this The workers, with their maps set
+ * @param c The copy
+ * @return True if the map is read by the workers and the copy reads the same data
+ */
+static int
+route_graph_workers_clone_valid(struct route_graph_workers *this, struct route_graph_map_clone *c)
+{
+	struct attr data,clone_data;
+
+	if (!route_graph_workers_has_map(this, c->map))
+		return 0;
+	return map_get_attr(c->map, attr_data, &data, NULL) && map_get_attr(c->clone, attr_data, &clone_data, NULL) &&
+		!strcmp(data.u.str, clone_data.u.str);
+}
+
+/**
+ * @brief Takes an unused copy of a map from the route, or opens a new one
+ *
+ * @param this The workers
+ * @param m The map
+ * @return The copy, or NULL if the map could not be opened again
+ */
+static struct map *
+route_graph_workers_clone(struct route_graph_workers *this, struct map *m)
+{
+	struct route_graph_map_clone *c;
+	struct map *ret;
+	GList *l;
+
+	for (l = this->clones ? *this->clones : NULL ; l ; l = g_list_next(l)) {
+		c=l->data;
+		if (c->map == m) {
+			ret=c->clone;
+			*this->clones=g_list_delete_link(*this->clones, l);
+			g_free(c);
+			return ret;
+		}
+	}
+	return map_clone(m);
+}
+
+/**
+ * @brief Starts threads reading the binfile maps of a mapset into private graphs
+ *
+ * @param sel The selection of the route graph
+ * @param ms The mapset
+ * @param clones The unused copies of the maps of the route, or NULL to open and close the copies for this graph only
+ * @param profile The vehicle profile
+ * @return The workers, or NULL if the graph should be built by the main thread only
+ */
+static struct route_graph_workers *
+route_graph_workers_new(struct map_selection *sel, struct mapset *ms, GList **clones, struct vehicleprofile *profile)
+{
+	struct route_graph_workers *this;
+	struct route_graph_worker *w;
+	struct route_graph_map_clone *c;
+	struct mapset_handle *h;
+	struct map *m;
+	struct attr type,url;
+	GList *l,*next;
+	int i,j,count=route_graph_workers_max();
+
+	if (count < 2 || !sel)
+		return NULL;
+	this=g_new0(struct route_graph_workers, 1);
+	this->profile=profile;
+	this->clones=clones;
+	h=mapset_open(ms);
+	while ((m=mapset_next(h, 2))) {
+		if (!map_get_attr(m, attr_type, &type, NULL) || strcmp(type.u.str, "binfile") || map_get_attr(m, attr_url, &url, NULL))
+			continue;
+		this->maps=g_renew(struct map *, this->maps, this->map_count+1);
+		this->maps[this->map_count++]=m;
+	}
+	mapset_close(h);
+	if (!this->map_count) {
+		g_free(this);
+		return NULL;
+	}
+	/* Copies of maps which have been removed from the mapset are closed */
+	for (l = clones ? *clones : NULL ; l ; l = next) {
+		next=g_list_next(l);
+		c=l->data;
+		if (!route_graph_workers_clone_valid(this, c)) {
+			map_destroy(c->clone);
+			g_free(c);
+			*clones=g_list_delete_link(*clones, l);
+		}
+	}
+	pthread_mutex_init(&this->mutex, NULL);
+	/* Initialize lazily created tables before any thread uses them */
+	item_get_default_flags(type_street_0);
+	this->worker=g_new0(struct route_graph_worker, count);
+	for (i = 0 ; i < count ; i++) {
+		w=&this->worker[this->count];
+		w->sel=route_graph_worker_selection(sel, i, count);
+		if (!w->sel)
+			continue;
+		w->workers=this;
+		w->graph=g_new0(struct route_graph, 1);
+		w->maps=g_new0(struct map *, this->map_count);
+		this->count++;
+		for (j = 0 ; j < this->map_count ; j++) {
+			w->maps[j]=route_graph_workers_clone(this, this->maps[j]);
+			if (!w->maps[j]) {
+				dbg(lvl_error,"failed to open map again, building route graph in one thread\n");
+				route_graph_workers_destroy(this);
+				return NULL;
+			}
+		}
+	}
+	this->running=this->count;
+	for (i = 0 ; i < this->count ; i++) {
+		w=&this->worker[i];
+		if (pthread_create(&w->thread, NULL, route_graph_worker_run, w)) {
+			dbg(lvl_error,"failed to create thread\n");
+			pthread_mutex_lock(&this->mutex);
+			this->running--;
+			pthread_mutex_unlock(&this->mutex);
+		} else
+			w->started=1;
+	}
+	dbg(lvl_debug,"%d workers reading %d maps\n", this->count, this->map_count);
+	return this;
+}
+
+/**
+ * @brief Checks if a map is read by the workers
+ */
+static int
+route_graph_workers_has_map(struct route_graph_workers *this, struct map *m)
+{
+	int i;
+	if (!this)
+		return 0;
+	for (i = 0 ; i < this->map_count ; i++) {
+		if (this->maps[i] == m)
+			return 1;
+	}
+	return 0;
+}
+
+/**
+ * @brief Adds the points and segments read by a worker to the route graph
+ *
+ * Points are merged by their coordinates. Items crossing the border between two workers have been
+ * read by both of them, their segments are only added once.
+ *
+ * @param this The route graph
+ * @param w The worker, which must have finished
+ */
+static void
+route_graph_worker_merge(struct route_graph *this, struct route_graph_worker *w)
+{
+	struct route_graph_workers *workers=w->workers;
+	struct route_graph_segment *s;
+	struct route_graph_point *start,*end;
+	struct route_graph_segment_data data;
+	struct item item;
+	GList *segments=NULL,*l;
+	int i;
+
+	for (s = w->graph->route_segments ; s ; s = s->next)
+		segments=g_list_prepend(segments, s);
+	data.item=&item;
+	for (l = segments ; l ; l = l->next) {
+		s=l->data;
+		item=s->data.item;
+		for (i = 0 ; i < workers->map_count ; i++) {
+			if (w->maps[i] == item.map) {
+				item.map=workers->maps[i];
+				break;
+			}
+		}
+		item.priv_data=NULL;
+		data.flags=s->data.flags;
+		data.len=s->data.len;
+		data.offset=1;
+		data.maxspeed=-1;
+		data.dangerous_goods=0;
+		if (s->data.flags & AF_SEGMENTED)
+			data.offset=RSD_OFFSET(&s->data);
+		if (s->data.flags & AF_SPEED_LIMIT)
+			data.maxspeed=RSD_MAXSPEED(&s->data);
+		if (s->data.flags & AF_SIZE_OR_WEIGHT_LIMIT)
+			data.size_weight=RSD_SIZE_WEIGHT(&s->data);
+		if (s->data.flags & AF_DANGEROUS_GOODS)
+			data.dangerous_goods=RSD_DANGEROUS_GOODS(&s->data);
+		start=route_graph_add_point(this, &s->start->c);
+		end=route_graph_add_point(this, &s->end->c);
+		start->flags |= s->start->flags;
+		end->flags |= s->end->flags;
+		if (!route_graph_segment_is_duplicate(start, &data))
+			route_graph_add_segment(this, start, end, &data);
+	}
+	g_list_free(segments);
+}
+
+/**
+ * @brief Waits for the workers and merges their results into the route graph
+ *
+ * @param rg The route graph
+ * @param wait If true, block until all workers have finished
+ * @return True if the workers are done (or there are none), false if they are still running
+ */
+static int
+route_graph_workers_finish(struct route_graph *rg, int wait)
+{
+	struct route_graph_workers *this=rg->workers;
+	int i,running;
+
+	if (!this)
+		return 1;
+	pthread_mutex_lock(&this->mutex);
+	running=this->running;
+	pthread_mutex_unlock(&this->mutex);
+	if (running && !wait)
+		return 0;
+	profile(0,NULL);
+	for (i = 0 ; i < this->count ; i++) {
+		if (this->worker[i].started) {
+			pthread_join(this->worker[i].thread, NULL);
+			this->worker[i].started=0;
+		}
+		route_graph_worker_merge(rg, &this->worker[i]);
+	}
+	profile(0,"merged graphs of %d workers\n", this->count);
+	route_graph_workers_destroy(this);
+	rg->workers=NULL;
+	return 1;
+}
+
+/**
+ * @brief Stops the workers and frees them
+ *
+ * The copies of the maps are given back to the route.
+ */
+static void
+route_graph_workers_destroy(struct route_graph_workers *this)
+{
+	struct route_graph_worker *w;
+	struct route_graph_map_clone *c;
+	int i,j;
+
+	if (!this)
+		return;
+	pthread_mutex_lock(&this->mutex);
+	this->cancel=1;
+	pthread_mutex_unlock(&this->mutex);
+	for (i = 0 ; i < this->count ; i++) {
+		w=&this->worker[i];
+		if (w->started)
+			pthread_join(w->thread, NULL);
+		for (j = 0 ; j < this->map_count ; j++) {
+			if (!w->maps[j])
+				continue;
+			if (this->clones) {
+				c=g_new(struct route_graph_map_clone, 1);
+				c->map=this->maps[j];
+				c->clone=w->maps[j];
+				*this->clones=g_list_prepend(*this->clones, c);
+			} else
+				map_destroy(w->maps[j]);
+		}
+		g_free(w->maps);
+		route_graph_free_points(w->graph);
+		route_graph_free_segments(w->graph);
+		g_free(w->graph);
+		map_selection_destroy(w->sel);
+	}
+	pthread_mutex_destroy(&this->mutex);
+	g_free(this->worker);
+	g_free(this->maps);
+	g_free(this);
+}
+#endif
+
+static void
+route_graph_build_done(struct route_graph *rg, int cancel)
+{
+	dbg(lvl_debug,"cancel=%d\n",cancel);
+#ifdef HAVE_PTHREAD
+	route_graph_workers_destroy(rg->workers);
+	rg->workers=NULL;
+#endif
+	if (rg->idle_ev)
+		event_remove_idle(rg->idle_ev);
+	if (rg->idle_cb)
+		callback_destroy(rg->idle_cb);
+	map_rect_destroy(rg->mr);
+        mapset_close(rg->h);
+	rg->idle_ev=NULL;
+	rg->idle_cb=NULL;
+	rg->mr=NULL;
+	rg->h=NULL;
+	if (cancel) {
+		route_free_selection(rg->sel);
+		rg->sel=NULL;
+	} else {
+		if (!rg->cache || !rg->cache->loaded) {
+			route_graph_process_restrictions(rg);
+			/* A new entry, written once routing is idle */
+			if (rg->cache && !rg->cache->save_ev && event_system()) {
+				if (!rg->cache->save_cb)
+					rg->cache->save_cb=callback_new_1(callback_cast(route_graph_cache_save_idle), rg);
+				rg->cache->save_ev=event_add_idle(1000, rg->cache->save_cb);
+			}
+		}
+		route_graph_build_edges(rg);
+		callback_call_0(rg->done_cb);
+	}
+	rg->busy=0;
+}
+
+static void
+route_graph_build_idle(struct route_graph *rg, struct vehicleprofile *profile)
+{
+	int count=1000;
+	struct item *item;
+
+	if (rg->cache && rg->cache->loaded) {
+		route_graph_build_done(rg, 0);
+		return;
+	}
+#ifdef HAVE_PTHREAD
+	if (!rg->m) {
+		/* The maps read by this thread are done, wait for the workers (without blocking when called from an idle event) */
+		if (route_graph_workers_finish(rg, !rg->idle_ev))
+			route_graph_build_done(rg, 0);
+		return;
+	}
+#endif
+	while (count > 0) {
+		for (;;) {	
+			item=map_rect_get_item(rg->mr);
+			if (item)
+				break;
+			if (!route_graph_build_next_map(rg)) {
+				if (!rg->workers)
+					route_graph_build_done(rg, 0);
+				return;
+			}
+		}
+		route_graph_process_item(rg, item, profile);
+		count--;
+	}
+}
+
+/**
+ * @brief Builds a new route graph from the items within a map selection
+ *
+ * @param ms The mapset to build the route graph from
+ * @param clones The unused copies of the maps of the route, see route_graph_workers_new()
+ * @param sel The map selection, it is owned by the graph afterwards
+ * @param done_cb The callback which will be called when graph is complete
+ * @param async If true, the graph is built by idle callbacks, otherwise route_graph_build_idle() has to be
+ * called until the graph is no longer busy
+ * @param profile The vehicle profile
+ * @return The new route graph.
+ */
+static struct route_graph *
+route_graph_build_selection(struct mapset *ms, GList **clones, struct map_selection *sel, struct callback *done_cb, int async, struct vehicleprofile *profile)
+{
+	struct route_graph *ret=g_new0(struct route_graph, 1);
+
+	dbg(lvl_debug,"enter\n");
+
+	ret->sel=sel;
+	ret->done_cb=done_cb;
+	ret->busy=1;
+	ret->cache=route_graph_cache_new(ms, ret->sel, profile);
+	if (ret->cache && route_graph_cache_load(ret)) {
+		GList *changed=NULL;
+		ret->cache->loaded=1;
+		route_graph_rescan_traffic_distortions(ret, ms, &changed);
+		g_list_free(changed);
+		if (async) {
+			ret->idle_cb=callback_new_2(callback_cast(route_graph_build_idle), ret, profile);
+			ret->idle_ev=event_add_idle(50, ret->idle_cb);
+		}
+		return ret;
+	}
+#ifdef HAVE_PTHREAD
+	ret->workers=route_graph_workers_new(ret->sel, ms, clones, profile);
+#endif
+	ret->h=mapset_open(ms);
+	if (route_graph_build_next_map(ret) || ret->workers) {
+		if (async) {
+			ret->idle_cb=callback_new_2(callback_cast(route_graph_build_idle), ret, profile);
+			ret->idle_ev=event_add_idle(50, ret->idle_cb);
+		}
+	} else
+		route_graph_build_done(ret, 0);
+
+	return ret;
+}
+
+/**
+ * @brief Builds a new route graph from a mapset
+ *
+ * This function builds a new route graph from a map. Please note that this function does not
+ * add any routing information to the route graph - this has to be done via the route_graph_flood()
+ * function.
+ *
+ * The function does not create a graph covering the whole map, but only covering the rectangle
+ * between c1 and c2.
+ *
+ * @param ms The mapset to build the route graph from
+ * @param clones The unused copies of the maps of the route, see route_graph_workers_new()
+ * @param c The coordinates of the destination or next waypoint
+ * @param c1 Corner 1 of the rectangle to use from the map
+ * @param c2 Corner 2 of the rectangle to use from the map
+ * @param done_cb The callback which will be called when graph is complete
+ * @return The new route graph.
+ */
+// FIXME documentation does not match argument list
+static struct route_graph *
+route_graph_build(struct mapset *ms, GList **clones, struct coord *c, int count, struct callback *done_cb, int async, struct vehicleprofile *profile)
+{
+	return route_graph_build_selection(ms, clones, route_calc_selection(c, count, profile), done_cb, async, profile);
+}
+
+static void
+route_graph_update_done(struct route *this, struct callback *cb)
+{
+	route_graph_flood_start(this, cb);
+}
+
+/**
+ * @brief Updates the route graph
+ *
+ * This updates the route graph after settings in the route have changed. It also
+ * adds routing information afterwards by calling route_graph_flood().
+ * 
+ * @param this The route to update the graph for
+ * @param cb The callback function to call when the route graph update is complete (used only in asynchronous mode)
+ * @param async Set to nonzero in order to update the route graph asynchronously
+ */
+static void
+route_graph_update(struct route *this, struct callback *cb, int async)
+{
+	struct attr route_status;
+	struct coord *c=g_alloca(sizeof(struct coord)*(1+g_list_length(this->destinations)));
+	int i=0;
+	GList *tmp;
+
+	route_status.type=attr_route_status;
+	route_graph_destroy(this->graph);
+	this->graph=NULL;
+	callback_destroy(this->route_graph_done_cb);
+	this->route_graph_done_cb=callback_new_2(callback_cast(route_graph_update_done), this, cb);
+	route_status.u.num=route_status_building_graph;
+	route_set_attr(this, &route_status);
+	c[i++]=this->pos->c;
+	tmp=this->destinations;
+	while (tmp) {
+		struct route_info *dst=tmp->data;
+		c[i++]=dst->c;
+		tmp=g_list_next(tmp);
+	}
+	this->graph=route_graph_build(this->ms, &this->map_clones, c, i, this->route_graph_done_cb, async, this->vehicleprofile);
+	if (! async) {
+		while (this->graph->busy) 
+			route_graph_build_idle(this->graph, this->vehicleprofile);
+	}
+}
+
+/**
+ * @brief Floods a route graph for one destination of a matrix
+ *
+ * The flood stops as soon as the points of the streets of all sources are settled.
+ *
+ * @param this The route graph, which has to be reset
+ * @param dst The destination
+ * @param src The sources, entries may be NULL
+ * @param src_count The number of sources
+ * @param profile The vehicle profile
+ * @return The number of settled points
+ */
+static int
+route_graph_flood_matrix(struct route_graph *this, struct route_info *dst, struct route_info **src, int src_count, struct vehicleprofile *profile)
+{
+	struct route_graph_astar astar={0};
+	struct route_heap *heap=route_heap_new();
+	int i,settled,targets=0;
+
+	if (!this->edges_valid)
+		route_graph_build_edges(this);
+	for (i = 0 ; i < src_count ; i++) {
+		if (src[i])
+			targets+=route_graph_flood_add_target(this, src[i]);
+	}
+	route_graph_flood_seed(this, heap, dst, profile, &astar, targets);
+	settled=route_graph_flood_run(this, heap, profile, &astar, &targets);
+	for (i = 0 ; i < src_count ; i++) {
+		if (src[i])
+			route_graph_flood_remove_target(this, src[i]);
+	}
+	if (route_heap_min(heap))
+		route_graph_flood_unsettle(this);
+	route_heap_destroy(heap);
+	return settled;
+}
+
+/**
+ * @brief Calculates the time and length of the path between two points of a flooded graph
+ *
+ * This follows the same segments as route_path_new() does, without building the path.
+ *
+ * @param this The route graph, flooded for {@code dst}
+ * @param pos The start
+ * @param dst The destination
+ * @param profile The vehicle profile
+ * @param time Set to the travel time in tenths of seconds
+ * @param len Set to the length in meters
+ * @return True if there is a path
+ */
+static int
+route_graph_matrix_entry(struct route_graph *this, struct route_info *pos, struct route_info *dst, struct vehicleprofile *profile, int *time, int *len)
+{
+	struct route_graph_segment *s;
+	struct route_graph_point *start;
+	struct route_info *posinfo=pos, *dstinfo=NULL;
+	int dir,seg_len,speed;
+
+	s=route_path_start(this, pos, dst, profile, &start, &dir);
+	if (!s)
+		return 0;
+	*time=0;
+	*len=pos->lenextra+dst->lenextra;
+	while (s && !dstinfo) {
+		if (s->start == start) {
+			if (item_is_equal(s->data.item, dst->street->item) && (s->end->seg == s || !posinfo))
+				dstinfo=dst;
+			dir=1;
 			start=s->end;
 		} else {
 			if (item_is_equal(s->data.item, dst->street->item) && (s->start->seg == s || !posinfo))
 				dstinfo=dst;
-			if (!route_path_add_item_from_graph(ret, oldpath, s, -1, posinfo, dstinfo))
-				ret->updated=0;
+			dir=-1;
 			start=s->start;
 		}
+		if (posinfo && dstinfo)
+			seg_len=abs(dstinfo->lenneg-posinfo->lenneg);
+		else if (posinfo)
+			seg_len=dir > 0 ? posinfo->lenpos : posinfo->lenneg;
+		else if (dstinfo)
+			seg_len=dir > 0 ? dstinfo->lenneg : dstinfo->lenpos;
+		else
+			seg_len=s->data.len;
+		speed=route_seg_speed(profile, &s->data, NULL);
+		if (speed)
+			*time+=seg_len*36/speed;
+		*len+=seg_len;
 		posinfo=NULL;
 		s=start->seg;
 	}
-	if (dst->lenextra) 
-		route_path_add_line(ret, &dst->lp, &dst->c, dst->lenextra);
-	dbg(lvl_debug, "%d segments\n", segs);
-	return ret;
-}
-
-static int
-route_graph_build_next_map(struct route_graph *rg)
-{
-	do {
-		rg->m=mapset_next(rg->h, 2);
-		if (! rg->m)
-			return 0;
-		map_rect_destroy(rg->mr);
-		rg->mr=map_rect_new(rg->m, rg->sel);
-	} while (!rg->mr);
-		
 	return 1;
 }
 
-
-static int
-is_turn_allowed(struct route_graph_point *p, struct route_graph_segment *from, struct route_graph_segment *to)
+/**
+ * @brief Calculates travel times and lengths between sources and destinations
+ *
+ * One route graph covering all points is built with the mapset and vehicle profile of the route.
+ * The route itself is not changed. For each destination the graph is flooded once, and the flood stops
+ * as soon as the streets of all sources are reached, so the cost grows with the number of destinations
+ * rather than with the number of pairs.
+ *
+ * @param this The route
+ * @param src The sources
+ * @param src_count The number of sources
+ * @param dst The destinations
+ * @param dst_count The number of destinations
+ * @param times If not NULL, receives the travel times in tenths of seconds, {@code src_count} rows of
+ * {@code dst_count} entries each. Pairs without a route are set to INT_MAX.
+ * @param lengths If not NULL, receives the lengths in meters, like {@code times}
+ * @return The number of pairs a route was found for
+ */
+int
+route_get_matrix(struct route *this, struct pcoord *src, int src_count, struct pcoord *dst, int dst_count, int *times, int *lengths)
 {
-	struct route_graph_point *prev,*next;
-	struct route_graph_segment *tmp1,*tmp2;
-	if (item_is_equal(from->data.item, to->data.item))
+	struct route_graph *graph;
+	struct route_info **ri;
+	struct pcoord *pc;
+	struct coord *c;
+	struct coord_geo g;
+	int i,j,time,len,count=src_count+dst_count,found=0;
+
+	for (i = 0 ; i < src_count*dst_count ; i++) {
+		if (times)
+			times[i]=INT_MAX;
+		if (lengths)
+			lengths[i]=INT_MAX;
+	}
+	if (!this->ms || !this->vehicleprofile || !src_count || !dst_count)
 		return 0;
-	if (from->start == p)
-		prev=from->end;
-	else
-		prev=from->start;
-	if (to->start == p)
-		next=to->end;
-	else
-		next=to->start;
-	tmp1=p->end;
-	while (tmp1) {
-		if (tmp1->start->c.x == prev->c.x && tmp1->start->c.y == prev->c.y &&
-			(tmp1->data.item.type == type_street_turn_restriction_no ||
-			tmp1->data.item.type == type_street_turn_restriction_only)) {
-			tmp2=p->start;
-			dbg(lvl_debug,"found %s (0x%x,0x%x) (0x%x,0x%x)-(0x%x,0x%x) %p-%p\n",item_to_name(tmp1->data.item.type),tmp1->data.item.id_hi,tmp1->data.item.id_lo,tmp1->start->c.x,tmp1->start->c.y,tmp1->end->c.x,tmp1->end->c.y,tmp1->start,tmp1->end);
-			while (tmp2) {
-				dbg(lvl_debug,"compare %s (0x%x,0x%x) (0x%x,0x%x)-(0x%x,0x%x) %p-%p\n",item_to_name(tmp2->data.item.type),tmp2->data.item.id_hi,tmp2->data.item.id_lo,tmp2->start->c.x,tmp2->start->c.y,tmp2->end->c.x,tmp2->end->c.y,tmp2->start,tmp2->end);
-				if (item_is_equal(tmp1->data.item, tmp2->data.item)) 
-					break;
-				tmp2=tmp2->start_next;
-			}
-			dbg(lvl_debug,"tmp2=%p\n",tmp2);
-			if (tmp2) {
-				dbg(lvl_debug,"%s tmp2->end=%p next=%p\n",item_to_name(tmp1->data.item.type),tmp2->end,next);
-			}
-			if (tmp1->data.item.type == type_street_turn_restriction_no && tmp2 && tmp2->end->c.x == next->c.x && tmp2->end->c.y == next->c.y) {
-				dbg(lvl_debug,"from 0x%x,0x%x over 0x%x,0x%x to 0x%x,0x%x not allowed (no)\n",prev->c.x,prev->c.y,p->c.x,p->c.y,next->c.x,next->c.y);
-				return 0;
-			}
-			if (tmp1->data.item.type == type_street_turn_restriction_only && tmp2 && (tmp2->end->c.x != next->c.x || tmp2->end->c.y != next->c.y)) {
-				dbg(lvl_debug,"from 0x%x,0x%x over 0x%x,0x%x to 0x%x,0x%x not allowed (only)\n",prev->c.x,prev->c.y,p->c.x,p->c.y,next->c.x,next->c.y);
-				return 0;
-			}
+	profile(0,NULL);
+	c=g_new(struct coord, count);
+	for (i = 0 ; i < count ; i++) {
+		pc=i < src_count ? &src[i] : &dst[i-src_count];
+		c[i].x=pc->x;
+		c[i].y=pc->y;
+		if (pc->pro != projection_mg) {
+			transform_to_geo(pc->pro, &c[i], &g);
+			transform_from_geo(projection_mg, &g, &c[i]);
 		}
-		tmp1=tmp1->end_next;
 	}
-	dbg(lvl_debug,"from 0x%x,0x%x over 0x%x,0x%x to 0x%x,0x%x allowed\n",prev->c.x,prev->c.y,p->c.x,p->c.y,next->c.x,next->c.y);
-	return 1;
+	graph=route_graph_build(this->ms, &this->map_clones, c, count, NULL, 0, this->vehicleprofile);
+	while (graph->busy)
+		route_graph_build_idle(graph, this->vehicleprofile);
+	g_free(c);
+	profile(0,"built graph for %d points\n", count);
+	ri=g_new0(struct route_info *, count);
+	for (i = 0 ; i < count ; i++) {
+		pc=i < src_count ? &src[i] : &dst[i-src_count];
+		ri[i]=route_find_nearest_street_graph(this->vehicleprofile, this->ms, pc, graph, 18);
+		if (ri[i])
+			route_info_distances(ri[i], pc->pro);
+		else
+			dbg(lvl_warning,"no street found for point %d\n", i);
+	}
+	profile(0,"matched %d points\n", count);
+	for (j = 0 ; j < dst_count ; j++) {
+		if (!ri[src_count+j])
+			continue;
+		route_graph_reset(graph);
+		route_graph_flood_matrix(graph, ri[src_count+j], ri, src_count, this->vehicleprofile);
+		for (i = 0 ; i < src_count ; i++) {
+			if (!ri[i] || !route_graph_matrix_entry(graph, ri[i], ri[src_count+j], this->vehicleprofile, &time, &len))
+				continue;
+			if (times)
+				times[i*dst_count+j]=time;
+			if (lengths)
+				lengths[i*dst_count+j]=len;
+			found++;
+		}
+	}
+	profile(0,"flooded %d times, found %d of %d routes\n", dst_count, found, src_count*dst_count);
+	for (i = 0 ; i < count ; i++)
+		route_info_free(ri[i]);
+	g_free(ri);
+	route_graph_destroy(graph);
+	return found;
 }
 
+/**
+ * @brief Updates the neighbors of a point settled by route_graph_flood_isochrone()
+ *
+ * This is the counterpart of route_graph_flood_relax() for a flood leaving the start instead of
+ * reaching the destination, so segments are travelled away from {@code p_min}.
+ *
+ * @param this The route graph
+ * @param heap The heap holding all points with temporary values
+ * @param p_min The settled point
+ * @param profile The vehicle profile
+ */
 static void
-route_graph_clone_segment(struct route_graph *this, struct route_graph_segment *s, struct route_graph_point *start, struct route_graph_point *end, int flags)
+route_graph_isochrone_relax(struct route_graph *this, struct route_heap *heap, struct route_graph_point *p_min, struct vehicleprofile *profile)
 {
-	struct route_graph_segment_data data;
-	data.item=&s->data.item;
-	data.offset=1;
-	data.flags=s->data.flags|flags;
-	data.len=s->data.len+1;
-	data.maxspeed=-1;
-	data.dangerous_goods=0;
-	if (s->data.flags & AF_SPEED_LIMIT)
-		data.maxspeed=RSD_MAXSPEED(&s->data);
-	if (s->data.flags & AF_SEGMENTED) 
-		data.offset=RSD_OFFSET(&s->data);
-	dbg(lvl_debug,"cloning segment from %p (0x%x,0x%x) to %p (0x%x,0x%x)\n",start,start->c.x,start->c.y, end, end->c.x, end->c.y);
-	route_graph_add_segment(this, start, end, &data);
+	struct route_graph_segment *s,**edge;
+	struct route_graph_point *to;
+	int i,new,val;
+
+	edge=this->edges+p_min->edge_first;
+	for (i = 0 ; i < p_min->edge_starts+p_min->edge_ends ; i++) {
+		s=edge[i];
+		if (i < p_min->edge_starts) {
+			val=route_value_seg(this, profile, p_min, s, 1);
+			to=s->end;
+		} else {
+			val=route_value_seg(this, profile, p_min, s, -1);
+			to=s->start;
+		}
+		if (val != INT_MAX && item_is_equal(s->data.item,p_min->seg->data.item)) {
+			if (profile->turn_around_penalty2)
+				val+=profile->turn_around_penalty2;
+			else
+				val=INT_MAX;
+		}
+		if (val == INT_MAX)
+			continue;
+		new=p_min->value+val;
+		if (new < to->value) {
+			to->value=new;
+			to->seg=s;
+			if (! to->el)
+				route_heap_insert(heap, new, to, &to->el);
+			else
+				route_heap_replace_key(heap, &to->el, new);
+		}
+	}
 }
 
-static void
-route_graph_process_restriction_segment(struct route_graph *this, struct route_graph_point *p, struct route_graph_segment *s, int dir)
+/**
+ * @brief Floods a route graph from a start until a cost limit is reached
+ *
+ * Afterwards each point which can be reached from {@code start} within {@code limit} holds the cost
+ * to get there in its value, and the segment leading there in its seg. All other points have a value of INT_MAX.
+ *
+ * @param this The route graph, which has to be reset
+ * @param start The start
+ * @param limit The cost limit in tenths of seconds
+ * @param profile The vehicle profile
+ * @return The number of reached points
+ */
+static int
+route_graph_flood_isochrone(struct route_graph *this, struct route_info *start, int limit, struct vehicleprofile *profile)
 {
-	struct route_graph_segment *tmp;
-	struct route_graph_point *pn;
-	struct coord c=p->c;
-	int dx=0;
-	int dy=0;
-	c.x+=dx;
-	c.y+=dy;
-	dbg(lvl_debug,"From %s %d,%d\n",item_to_name(s->data.item.type),dx,dy);
-	pn=route_graph_point_new(this, &c);
-	if (dir > 0) { /* going away */
-		dbg(lvl_debug,"other 0x%x,0x%x\n",s->end->c.x,s->end->c.y);
-		if (s->data.flags & AF_ONEWAY) {
-			dbg(lvl_debug,"Not possible\n");
-			return;
-		}
-		route_graph_clone_segment(this, s, pn, s->end, AF_ONEWAYREV);
-	} else { /* coming in */
-		dbg(lvl_debug,"other 0x%x,0x%x\n",s->start->c.x,s->start->c.y);
-		if (s->data.flags & AF_ONEWAYREV) {
-			dbg(lvl_debug,"Not possible\n");
-			return;
+	struct route_graph_segment *s=NULL;
+	struct route_graph_point *p_min;
+	struct route_heap *heap=route_heap_new();
+	int val,settled=0;
+
+	if (!this->edges_valid)
+		route_graph_build_edges(this);
+	while ((s=route_graph_get_segment(this, start->street, s))) {
+		val=route_value_seg(this, profile, NULL, s, 1);
+		if (val != INT_MAX && (val=val*(100-start->percent)/100) < s->end->value) {
+			s->end->seg=s;
+			s->end->value=val;
+			if (! s->end->el)
+				route_heap_insert(heap, val, s->end, &s->end->el);
+			else
+				route_heap_replace_key(heap, &s->end->el, val);
 		}
-		route_graph_clone_segment(this, s, s->start, pn, AF_ONEWAY);
-	}
-	tmp=p->start;
-	while (tmp) {
-		if (tmp != s && tmp->data.item.type != type_street_turn_restriction_no &&
-			tmp->data.item.type != type_street_turn_restriction_only &&
-			!(tmp->data.flags & AF_ONEWAYREV) && is_turn_allowed(p, s, tmp)) {
-			route_graph_clone_segment(this, tmp, pn, tmp->end, AF_ONEWAY);
-			dbg(lvl_debug,"To start %s\n",item_to_name(tmp->data.item.type));
+		val=route_value_seg(this, profile, NULL, s, -1);
+		if (val != INT_MAX && (val=val*start->percent/100) < s->start->value) {
+			s->start->seg=s;
+			s->start->value=val;
+			if (! s->start->el)
+				route_heap_insert(heap, val, s->start, &s->start->el);
+			else
+				route_heap_replace_key(heap, &s->start->el, val);
 		}
-		tmp=tmp->start_next;
 	}
-	tmp=p->end;
-	while (tmp) {
-		if (tmp != s && tmp->data.item.type != type_street_turn_restriction_no &&
-			tmp->data.item.type != type_street_turn_restriction_only &&
-			!(tmp->data.flags & AF_ONEWAY) && is_turn_allowed(p, s, tmp)) {
-			route_graph_clone_segment(this, tmp, tmp->start, pn, AF_ONEWAYREV);
-			dbg(lvl_debug,"To end %s\n",item_to_name(tmp->data.item.type));
-		}
-		tmp=tmp->end_next;
+	while ((p_min=route_heap_min(heap)) && p_min->value <= limit) {
+		route_heap_extract_min(heap);
+		p_min->el=0;
+		settled++;
+		route_graph_isochrone_relax(this, heap, p_min, profile);
 	}
+	if (route_heap_min(heap))
+		route_graph_flood_unsettle(this);
+	route_heap_destroy(heap);
+	return settled;
 }
 
+#define ROUTE_ISOCHRONE_GRID 64
+
 static void
-route_graph_process_restriction_point(struct route_graph *this, struct route_graph_point *p)
+route_isochrone_max_speed(gpointer key, gpointer value, gpointer user_data)
 {
-	struct route_graph_segment *tmp;
-	tmp=p->start;
-	dbg(lvl_debug,"node 0x%x,0x%x\n",p->c.x,p->c.y);
-	while (tmp) {
-		if (tmp->data.item.type != type_street_turn_restriction_no &&
-			tmp->data.item.type != type_street_turn_restriction_only)
-			route_graph_process_restriction_segment(this, p, tmp, 1);
-		tmp=tmp->start_next;
-	}
-	tmp=p->end;
-	while (tmp) {
-		if (tmp->data.item.type != type_street_turn_restriction_no &&
-			tmp->data.item.type != type_street_turn_restriction_only)
-			route_graph_process_restriction_segment(this, p, tmp, -1);
-		tmp=tmp->end_next;
-	}
-	p->flags |= RP_TURN_RESTRICTION_RESOLVED;
+	struct roadprofile *roadprofile=value;
+	int *speed=user_data;
+
+	if (roadprofile->route_weight > *speed)
+		*speed=roadprofile->route_weight;
 }
 
-static void
-route_graph_process_restrictions(struct route_graph *this)
+static int
+route_isochrone_coord_cmp(const void *a, const void *b)
 {
-	struct route_graph_point *curr;
-	int i;
-	dbg(lvl_debug,"enter\n");
-	for (i = 0 ; i < HASH_SIZE ; i++) {
-		curr=this->hash[i];
-		while (curr) {
-			if (curr->flags & RP_TURN_RESTRICTION) 
-				route_graph_process_restriction_point(this, curr);
-			curr=curr->hash_next;
-		}
-	}
+	const struct coord *c1=a,*c2=b;
+
+	if (c1->x != c2->x)
+		return c1->x < c2->x ? -1 : 1;
+	if (c1->y != c2->y)
+		return c1->y < c2->y ? -1 : 1;
+	return 0;
 }
 
-static void
-route_graph_build_done(struct route_graph *rg, int cancel)
+static double
+route_isochrone_cross(struct coord *o, struct coord *a, struct coord *b)
 {
-	dbg(lvl_debug,"cancel=%d\n",cancel);
-	if (rg->idle_ev)
-		event_remove_idle(rg->idle_ev);
-	if (rg->idle_cb)
-		callback_destroy(rg->idle_cb);
-	map_rect_destroy(rg->mr);
-        mapset_close(rg->h);
-	route_free_selection(rg->sel);
-	rg->idle_ev=NULL;
-	rg->idle_cb=NULL;
-	rg->mr=NULL;
-	rg->h=NULL;
-	rg->sel=NULL;
-	if (! cancel) {
-		route_graph_process_restrictions(rg);
-		callback_call_0(rg->done_cb);
+	return (double)(a->x-o->x)*(b->y-o->y)-(double)(a->y-o->y)*(b->x-o->x);
+}
+
+/**
+ * @brief Returns the distance between a point and a line segment
+ */
+static double
+route_isochrone_seg_dist(struct coord *p, struct coord *a, struct coord *b)
+{
+	double dx=b->x-a->x,dy=b->y-a->y,l=dx*dx+dy*dy,t=0,ex,ey;
+
+	if (l > 0) {
+		t=((double)(p->x-a->x)*dx+(double)(p->y-a->y)*dy)/l;
+		if (t < 0)
+			t=0;
+		if (t > 1)
+			t=1;
 	}
-	rg->busy=0;
+	ex=a->x+t*dx-p->x;
+	ey=a->y+t*dy-p->y;
+	return sqrt(ex*ex+ey*ey);
 }
 
-static void
-route_graph_build_idle(struct route_graph *rg, struct vehicleprofile *profile)
+/**
+ * @brief Checks if two line segments cross each other, touching at an end does not count
+ */
+static int
+route_isochrone_crosses(struct coord *a, struct coord *b, struct coord *c, struct coord *d)
 {
-	int count=1000;
-	struct item *item;
+	double d1=route_isochrone_cross(c, d, a),d2=route_isochrone_cross(c, d, b);
+	double d3=route_isochrone_cross(a, b, c),d4=route_isochrone_cross(a, b, d);
 
-	while (count > 0) {
-		for (;;) {	
-			item=map_rect_get_item(rg->mr);
-			if (item)
-				break;
-			if (!route_graph_build_next_map(rg)) {
-				route_graph_build_done(rg, 0);
-				return;
+	return ((d1 > 0 && d2 < 0) || (d1 < 0 && d2 > 0)) && ((d3 > 0 && d4 < 0) || (d3 < 0 && d4 > 0));
+}
+
+/**
+ * @brief Calculates the convex hull of a set of points
+ *
+ * @param c The points, sorted by route_isochrone_coord_cmp() and without duplicates
+ * @param count The number of points
+ * @param hull Receives the indices of the hull points in counterclockwise order, room for {@code count}+1 entries
+ * @return The number of hull points
+ */
+static int
+route_isochrone_convex_hull(struct coord *c, int count, int *hull)
+{
+	int i,n=0,lower;
+
+	if (count < 3) {
+		for (i = 0 ; i < count ; i++)
+			hull[i]=i;
+		return count;
+	}
+	for (i = 0 ; i < count ; i++) {
+		while (n >= 2 && route_isochrone_cross(&c[hull[n-2]], &c[hull[n-1]], &c[i]) <= 0)
+			n--;
+		hull[n++]=i;
+	}
+	lower=n+1;
+	for (i = count-2 ; i >= 0 ; i--) {
+		while (n >= lower && route_isochrone_cross(&c[hull[n-2]], &c[hull[n-1]], &c[i]) <= 0)
+			n--;
+		hull[n++]=i;
+	}
+	return n-1;
+}
+
+/**
+ * @brief Turns a convex hull into a concave one
+ *
+ * Each edge of the hull is replaced by two edges via the inner point nearest to it, as long as the edge
+ * is more than {@code concavity} times longer than that distance, the point is not nearer to one of the
+ * neighboring edges and the new edges do not cross the hull.
+ *
+ * @param c The points
+ * @param count The number of points
+ * @param hull The indices of the hull points, with room for {@code count} entries
+ * @param hull_count The number of hull points
+ * @param concavity The ratio of edge length to depth below which edges are kept
+ * @return The new number of hull points
+ */
+static int
+route_isochrone_concave_hull(struct coord *c, int count, int *hull, int hull_count, int concavity)
+{
+	char *used=g_new0(char, count);
+	struct coord *a,*b,*prev,*next;
+	double len,dist,best_dist;
+	int i,j,k,best;
+
+	for (i = 0 ; i < hull_count ; i++)
+		used[hull[i]]=1;
+	i=0;
+	while (i < hull_count && hull_count >= 3) {
+		prev=&c[hull[(i+hull_count-1)%hull_count]];
+		a=&c[hull[i]];
+		b=&c[hull[(i+1)%hull_count]];
+		next=&c[hull[(i+2)%hull_count]];
+		len=sqrt((double)(b->x-a->x)*(b->x-a->x)+(double)(b->y-a->y)*(b->y-a->y));
+		best=-1;
+		best_dist=len/concavity;
+		for (j = 0 ; j < count ; j++) {
+			if (used[j])
+				continue;
+			dist=route_isochrone_seg_dist(&c[j], a, b);
+			if (dist >= best_dist)
+				continue;
+			if (route_isochrone_seg_dist(&c[j], prev, a) < dist || route_isochrone_seg_dist(&c[j], b, next) < dist)
+				continue;
+			best=j;
+			best_dist=dist;
+		}
+		if (best != -1) {
+			for (k = 0 ; k < hull_count ; k++) {
+				struct coord *e1=&c[hull[k]],*e2=&c[hull[(k+1)%hull_count]];
+				if (k != i && (route_isochrone_crosses(a, &c[best], e1, e2) || route_isochrone_crosses(&c[best], b, e1, e2)))
+					break;
+			}
+			if (k == hull_count) {
+				memmove(hull+i+2, hull+i+1, (hull_count-i-1)*sizeof(*hull));
+				hull[i+1]=best;
+				used[best]=1;
+				hull_count++;
+				continue;
 			}
 		}
-		if (item->type == type_traffic_distortion)
-			route_process_traffic_distortion(rg, item);
-		else if (item->type == type_street_turn_restriction_no || item->type == type_street_turn_restriction_only)
-			route_process_turn_restriction(rg, item);
-		else
-			route_process_street_graph(rg, item, profile);
-		count--;
+		i++;
 	}
+	g_free(used);
+	return hull_count;
 }
 
 /**
- * @brief Builds a new route graph from a mapset
- *
- * This function builds a new route graph from a map. Please note that this function does not
- * add any routing information to the route graph - this has to be done via the route_graph_flood()
- * function.
+ * @brief Calculates the outline of the points reached by an isochrone
  *
- * The function does not create a graph covering the whole map, but only covering the rectangle
- * between c1 and c2.
+ * To keep the costs bounded, only one reached point per cell of a grid of ROUTE_ISOCHRONE_GRID
+ * by ROUTE_ISOCHRONE_GRID cells over the reached area is considered.
  *
- * @param ms The mapset to build the route graph from
- * @param c The coordinates of the destination or next waypoint
- * @param c1 Corner 1 of the rectangle to use from the map
- * @param c2 Corner 2 of the rectangle to use from the map
- * @param done_cb The callback which will be called when graph is complete
- * @return The new route graph.
+ * @param this The isochrone
+ * @param concavity 0 for the convex hull, otherwise see route_isochrone_concave_hull()
  */
-// FIXME documentation does not match argument list
-static struct route_graph *
-route_graph_build(struct mapset *ms, struct coord *c, int count, struct callback *done_cb, int async, struct vehicleprofile *profile)
+static void
+route_isochrone_hull(struct route_isochrone *this, int concavity)
 {
-	struct route_graph *ret=g_new0(struct route_graph, 1);
-
-	dbg(lvl_debug,"enter\n");
-
-	ret->sel=route_calc_selection(c, count, profile);
-	ret->h=mapset_open(ms);
-	ret->done_cb=done_cb;
-	ret->busy=1;
-	if (route_graph_build_next_map(ret)) {
-		if (async) {
-			ret->idle_cb=callback_new_2(callback_cast(route_graph_build_idle), ret, profile);
-			ret->idle_ev=event_add_idle(50, ret->idle_cb);
+	struct route_graph_chunk *chunk;
+	struct route_graph_point *p,*end;
+	struct coord_rect r;
+	struct coord *c;
+	int *cell,*hull,i,count=0,size,x,y;
+
+	for (chunk = this->graph->points ; chunk ; chunk = chunk->next) {
+		end=(struct route_graph_point *)((char *)(chunk+1)+chunk->used);
+		for (p = (struct route_graph_point *)(chunk+1) ; p < end ; p++) {
+			if (p->value == INT_MAX)
+				continue;
+			if (!count++)
+				r.lu=r.rl=p->c;
+			else
+				coord_rect_extend(&r, &p->c);
 		}
-	} else
-		route_graph_build_done(ret, 0);
-
-	return ret;
+	}
+	if (!count)
+		return;
+	size=MAX(r.rl.x-r.lu.x, r.lu.y-r.rl.y)/ROUTE_ISOCHRONE_GRID+1;
+	cell=g_new0(int, (ROUTE_ISOCHRONE_GRID+1)*(ROUTE_ISOCHRONE_GRID+1));
+	c=g_new(struct coord, (ROUTE_ISOCHRONE_GRID+1)*(ROUTE_ISOCHRONE_GRID+1));
+	count=0;
+	for (chunk = this->graph->points ; chunk ; chunk = chunk->next) {
+		end=(struct route_graph_point *)((char *)(chunk+1)+chunk->used);
+		for (p = (struct route_graph_point *)(chunk+1) ; p < end ; p++) {
+			if (p->value == INT_MAX)
+				continue;
+			x=(p->c.x-r.lu.x)/size;
+			y=(r.lu.y-p->c.y)/size;
+			if (cell[y*(ROUTE_ISOCHRONE_GRID+1)+x]++)
+				continue;
+			c[count++]=p->c;
+		}
+	}
+	g_free(cell);
+	qsort(c, count, sizeof(*c), route_isochrone_coord_cmp);
+	hull=g_new(int, count+1);
+	this->hull_count=route_isochrone_convex_hull(c, count, hull);
+	if (concavity > 0)
+		this->hull_count=route_isochrone_concave_hull(c, count, hull, this->hull_count, concavity);
+	this->hull=g_new(struct coord, this->hull_count);
+	for (i = 0 ; i < this->hull_count ; i++)
+		this->hull[i]=c[hull[i]];
+	g_free(hull);
+	g_free(c);
 }
 
 static void
-route_graph_update_done(struct route *this, struct callback *cb)
+route_isochrone_destroy(struct route_isochrone *this)
 {
-	route_graph_flood(this->graph, this->current_dst, this->vehicleprofile, cb);
+	if (!this)
+		return;
+	route_info_free(this->start);
+	route_graph_destroy(this->graph);
+	g_free(this->hull);
+	g_free(this);
 }
 
 /**
- * @brief Updates the route graph
- *
- * This updates the route graph after settings in the route have changed. It also
- * adds routing information afterwards by calling route_graph_flood().
- * 
- * @param this The route to update the graph for
- * @param cb The callback function to call when the route graph update is complete (used only in asynchronous mode)
- * @param async Set to nonzero in order to update the route graph asynchronously
+ * @brief Calculates the area which can be reached from a start within a cost limit
+ *
+ * A route graph around {@code start} is built with the mapset and vehicle profile of the route and flooded
+ * from the start until the limit is reached. The route itself is not changed. The reached points and the
+ * segments between them can be read from the map returned by route_get_isochrone_map(), which also holds
+ * their outline as an item of type poly_isochrone if {@code concavity} is not negative.
+ *
+ * @param this_ The route
+ * @param start The start, or NULL to remove the current isochrone
+ * @param limit The cost limit in tenths of seconds, 0 to remove the current isochrone
+ * @param concavity Negative to skip the outline, 0 for the convex hull of the reached points. Otherwise edges of
+ * the hull are bent inwards towards reached points nearer than their length divided by {@code concavity},
+ * so smaller values give a tighter outline.
+ * @return The number of reached points
  */
-static void
-route_graph_update(struct route *this, struct callback *cb, int async)
+int
+route_set_isochrone(struct route *this_, struct pcoord *start, int limit, int concavity)
 {
-	struct attr route_status;
-	struct coord *c=g_alloca(sizeof(struct coord)*(1+g_list_length(this->destinations)));
-	int i=0;
-	GList *tmp;
+	struct route_isochrone *iso;
+	struct coord c;
+	struct coord_geo g;
+	int speed=0,count;
 
-	route_status.type=attr_route_status;
-	route_graph_destroy(this->graph);
-	this->graph=NULL;
-	callback_destroy(this->route_graph_done_cb);
-	this->route_graph_done_cb=callback_new_2(callback_cast(route_graph_update_done), this, cb);
-	route_status.u.num=route_status_building_graph;
-	route_set_attr(this, &route_status);
-	c[i++]=this->pos->c;
-	tmp=this->destinations;
-	while (tmp) {
-		struct route_info *dst=tmp->data;
-		c[i++]=dst->c;
-		tmp=g_list_next(tmp);
+	route_isochrone_destroy(this_->isochrone);
+	this_->isochrone=NULL;
+	if (!start || limit <= 0 || !this_->ms || !this_->vehicleprofile)
+		return 0;
+	g_hash_table_foreach(this_->vehicleprofile->roadprofile_hash, route_isochrone_max_speed, &speed);
+	if (!speed)
+		return 0;
+	profile(0,NULL);
+	c.x=start->x;
+	c.y=start->y;
+	if (start->pro != projection_mg) {
+		transform_to_geo(start->pro, &c, &g);
+		transform_from_geo(projection_mg, &g, &c);
 	}
-	this->graph=route_graph_build(this->ms, c, i, this->route_graph_done_cb, async, this->vehicleprofile);
-	if (! async) {
-		while (this->graph->busy) 
-			route_graph_build_idle(this->graph, this->vehicleprofile);
+	iso=g_new0(struct route_isochrone, 1);
+	iso->limit=limit;
+	/* Allow for segments with a speed limit above the speed of their road profile */
+	iso->graph=route_graph_build_selection(this_->ms, &this_->map_clones, route_rect(18, &c, &c, 0, transform_scale(c.y)*limit*speed*5/4/36),
+		NULL, 0, this_->vehicleprofile);
+	while (iso->graph->busy)
+		route_graph_build_idle(iso->graph, this_->vehicleprofile);
+	profile(0,"built graph\n");
+	iso->start=route_find_nearest_street_graph(this_->vehicleprofile, this_->ms, start, iso->graph, 18);
+	if (!iso->start) {
+		dbg(lvl_warning,"no street found for start\n");
+		route_isochrone_destroy(iso);
+		return 0;
+	}
+	route_info_distances(iso->start, start->pro);
+	route_graph_reset(iso->graph);
+	count=route_graph_flood_isochrone(iso->graph, iso->start, limit, this_->vehicleprofile);
+	profile(0,"flooded %d points\n", count);
+	if (concavity >= 0) {
+		route_isochrone_hull(iso, concavity);
+		profile(0,"outline of %d points\n", iso->hull_count);
 	}
+	this_->isochrone=iso;
+	return count;
 }
 
 /**
@@ -3156,6 +6373,21 @@ street_data_free(struct street_data *sd)
  */
 static struct route_info *
 route_find_nearest_street(struct vehicleprofile *vehicleprofile, struct mapset *ms, struct pcoord *pc)
+{
+	return route_find_nearest_street_graph(vehicleprofile, ms, pc, NULL, 18);
+}
+
+/**
+ * @brief Finds the nearest street to a given coordinate
+ *
+ * @param ms The mapset to search in for the street
+ * @param pc The coordinate to find a street nearby
+ * @param graph If not {@code NULL}, only streets which are part of this route graph are considered
+ * @param order The map order to search at, lower orders only return more important streets
+ * @return The nearest street
+ */
+static struct route_info *
+route_find_nearest_street_graph(struct vehicleprofile *vehicleprofile, struct mapset *ms, struct pcoord *pc, struct route_graph *graph, int order)
 {
 	struct route_info *ret=NULL;
 	int max_dist=1000;
@@ -3184,7 +6416,7 @@ route_find_nearest_street(struct vehicleprofile *vehicleprofile, struct mapset *
 			transform_to_geo(pc->pro, &c, &g);
 			transform_from_geo(map_projection(m), &g, &c);
 		}
-		sel = route_rect(18, &c, &c, 0, max_dist);
+		sel = route_rect(order, &c, &c, 0, max_dist);
 		if (!sel)
 			continue;
 		mr=map_rect_new(m, sel);
@@ -3197,6 +6429,10 @@ route_find_nearest_street(struct vehicleprofile *vehicleprofile, struct mapset *
 				sd=street_get_data(item);
 				if (!sd)
 					continue;
+				if (graph && !route_graph_get_segment(graph, sd, NULL)) {
+					street_data_free(sd);
+					continue;
+				}
 				dist=transform_distance_polyline_sq(sd->c, sd->count, &c, &lp, &pos);
 				if (dist < mindist && (
 					(sd->flags & vehicleprofile->flags_forward_mask) == vehicleprofile->flags ||
@@ -3306,6 +6542,8 @@ struct map_rect_priv {
 	int hash_bucket;
 	struct coord *coord_sel;	/**< Set this to a coordinate if you want to filter for just a single route graph point */
 	struct route_graph_point_iterator it;
+	struct route_graph *graph;	/**< The graph the points and segments are taken from */
+	struct route_isochrone *isochrone;	/**< If set, only points and segments reached by this isochrone are returned, followed by its outline */
 	/* Pointer to current waypoint element of route->destinations */
 	GList *dest;
 };
@@ -3589,6 +6827,22 @@ rp_attr_get(void *priv_data, enum attr_type attr_type, struct attr *attr)
 	}
 }
 
+/**
+ * @brief Returns the projection of the map the items of a route graph map rect were taken from
+ */
+static enum projection
+rp_projection(struct map_rect_priv *mr)
+{
+	struct street_data *street;
+
+	if (!mr->isochrone)
+		return route_projection(mr->mpriv->route);
+	street=mr->isochrone->start->street;
+	if (!street || !street->item.map)
+		return projection_none;
+	return map_projection(street->item.map);
+}
+
 /**
  * @brief Returns the coordinates of a route graph item
  *
@@ -3604,8 +6858,7 @@ rp_coord_get(void *priv_data, struct coord *c, int count)
 	struct route_graph_point *p = mr->point;
 	struct route_graph_segment *seg = mr->rseg;
 	int rc = 0,i,dir;
-	struct route *r = mr->mpriv->route;
-	enum projection pro = route_projection(r);
+	enum projection pro = rp_projection(mr);
 
 	if (pro == projection_none)
 		return 0;
@@ -3653,6 +6906,69 @@ static struct item_methods methods_point_item = {
 	rp_attr_get,
 };
 
+static int
+ri_attr_get(void *priv_data, enum attr_type attr_type, struct attr *attr)
+{
+	struct map_rect_priv *mr = priv_data;
+
+	attr->type=attr_type;
+	switch (attr_type) {
+	case attr_any:
+		while (mr->attr_next != attr_none) {
+			if (ri_attr_get(priv_data, mr->attr_next, attr))
+				return 1;
+		}
+		return 0;
+	case attr_label:
+		mr->attr_next=attr_none;
+		if (mr->str)
+			g_free(mr->str);
+		mr->str=g_strdup_printf("%d:%02d", mr->isochrone->limit/600, mr->isochrone->limit/10%60);
+		attr->u.str = mr->str;
+		return 1;
+	default:
+		mr->attr_next=attr_none;
+		attr->type=attr_none;
+		return 0;
+	}
+}
+
+/**
+ * @brief Returns the coordinates of the outline of an isochrone
+ *
+ * @param priv_data The outline item's private data
+ * @param c Pointer where to store the coordinates
+ * @param count How many coordinates to get at a max?
+ * @return The number of coordinates retrieved
+ */
+static int
+ri_coord_get(void *priv_data, struct coord *c, int count)
+{
+	struct map_rect_priv *mr = priv_data;
+	struct route_isochrone *iso = mr->isochrone;
+	enum projection pro = rp_projection(mr);
+	int rc = 0;
+
+	if (pro == projection_none)
+		return 0;
+	while (rc < count && mr->last_coord < iso->hull_count) {
+		if (pro != projection_mg)
+			transform_from_to(&iso->hull[mr->last_coord], pro, &c[rc], projection_mg);
+		else
+			c[rc] = iso->hull[mr->last_coord];
+		mr->last_coord++;
+		rc++;
+	}
+	return rc;
+}
+
+static struct item_methods methods_isochrone_item = {
+	rm_coord_rewind,
+	ri_coord_get,
+	rp_attr_rewind,
+	ri_attr_get,
+};
+
 static void
 rp_destroy(struct map_priv *priv)
 {
@@ -3694,6 +7010,27 @@ rm_rect_new(struct map_priv *priv, struct map_selection *sel)
 	return mr;
 }
 
+static struct map_rect_priv * 
+rp_rect_new_graph(struct map_priv *priv, struct map_selection *sel, struct route_graph *graph, struct route_isochrone *isochrone)
+{
+	struct map_rect_priv * mr;
+
+	mr=g_new0(struct map_rect_priv, 1);
+	mr->mpriv = priv;
+	mr->graph = graph;
+	mr->isochrone = isochrone;
+	mr->item.priv_data = mr;
+	mr->item.type = type_rg_point;
+	mr->item.meth = &methods_point_item;
+	if (sel) {
+		if ((sel->u.c_rect.lu.x == sel->u.c_rect.rl.x) && (sel->u.c_rect.lu.y == sel->u.c_rect.rl.y)) {
+			mr->coord_sel = g_malloc(sizeof(struct coord));
+			*(mr->coord_sel) = sel->u.c_rect.lu;
+		}
+	}
+	return mr;
+}
+
 /**
  * @brief Opens a new map rectangle on the route graph's map
  *
@@ -3711,23 +7048,36 @@ rm_rect_new(struct map_priv *priv, struct map_selection *sel)
 static struct map_rect_priv * 
 rp_rect_new(struct map_priv *priv, struct map_selection *sel)
 {
-	struct map_rect_priv * mr;
-
 	dbg(lvl_debug,"enter\n");
 	if (! priv->route->graph)
 		return NULL;
-	mr=g_new0(struct map_rect_priv, 1);
-	mr->mpriv = priv;
-	mr->item.priv_data = mr;
-	mr->item.type = type_rg_point;
-	mr->item.meth = &methods_point_item;
-	if (sel) {
-		if ((sel->u.c_rect.lu.x == sel->u.c_rect.rl.x) && (sel->u.c_rect.lu.y == sel->u.c_rect.rl.y)) {
-			mr->coord_sel = g_malloc(sizeof(struct coord));
-			*(mr->coord_sel) = sel->u.c_rect.lu;
-		}
-	}
-	return mr;
+#ifdef HAVE_PTHREAD
+	/* The graph belongs to the thread flooding it */
+	if (priv->route->graph->job)
+		return NULL;
+#endif
+	return rp_rect_new_graph(priv, sel, priv->route->graph, NULL);
+}
+
+/**
+ * @brief Opens a new map rectangle on the isochrone's map
+ *
+ * This works like rp_rect_new(), but only returns the points and segments reached by the isochrone
+ * of the route, followed by its outline.
+ *
+ * @param priv The isochrone map's private data
+ * @param sel Here it's possible to specify a point for which to search, see rp_rect_new()
+ * @return A new map rect's private data
+ */
+static struct map_rect_priv * 
+ri_rect_new(struct map_priv *priv, struct map_selection *sel)
+{
+	struct route_isochrone *iso=priv->route->isochrone;
+
+	dbg(lvl_debug,"enter\n");
+	if (! iso)
+		return NULL;
+	return rp_rect_new_graph(priv, sel, iso->graph, iso);
 }
 
 static void
@@ -3752,7 +7102,6 @@ rm_rect_destroy(struct map_rect_priv *mr)
 static struct item *
 rp_get_item(struct map_rect_priv *mr)
 {
-	struct route *r = mr->mpriv->route;
 	struct route_graph_point *p = mr->point;
 	struct route_graph_segment *seg = mr->rseg;
 
@@ -3760,7 +7109,9 @@ rp_get_item(struct map_rect_priv *mr)
 		if (mr->coord_sel) {
 			// We are supposed to return only the point at one specified coordinate...
 			if (!p) {
-				p = route_graph_get_point_last(r->graph, mr->coord_sel);
+				p = route_graph_get_point_last(mr->graph, mr->coord_sel);
+				if (p && mr->isochrone && p->value == INT_MAX)
+					p = NULL;
 				if (!p) {
 					mr->point = NULL; // This indicates that no point has been found
 				} else {
@@ -3770,17 +7121,19 @@ rp_get_item(struct map_rect_priv *mr)
 				p = NULL;
 			}
 		} else {
-			if (!p) {
-				mr->hash_bucket=0;
-				p = r->graph->hash[0];
-			} else 
-				p=p->hash_next;
-			while (!p) {
-				mr->hash_bucket++;
-				if (mr->hash_bucket >= HASH_SIZE)
-					break;
-				p = r->graph->hash[mr->hash_bucket];
-			}
+			do {
+				if (!p) {
+					mr->hash_bucket=0;
+					p = mr->graph->hash ? mr->graph->hash[0] : NULL;
+				} else 
+					p=p->hash_next;
+				while (!p) {
+					mr->hash_bucket++;
+					if (mr->hash_bucket >= mr->graph->hash_size)
+						break;
+					p = mr->graph->hash[mr->hash_bucket];
+				}
+			} while (p && mr->isochrone && p->value == INT_MAX);
 		}
 		if (p) {
 			mr->point = p;
@@ -3798,12 +7151,15 @@ rp_get_item(struct map_rect_priv *mr)
 			return NULL;
 		}
 		seg = rp_iterator_next(&(mr->it));
-	} else {
-		if (!seg)
-			seg=r->graph->route_segments;
-		else
-			seg=seg->next;
-	}
+	} else if (mr->item.type == type_rg_segment) {
+		do {
+			if (!seg)
+				seg=mr->graph->route_segments;
+			else
+				seg=seg->next;
+		} while (seg && mr->isochrone && (seg->start->value == INT_MAX || seg->end->value == INT_MAX));
+	} else
+		seg=NULL;
 	
 	if (seg) {
 		mr->rseg = seg;
@@ -3812,6 +7168,15 @@ rp_get_item(struct map_rect_priv *mr)
 		rp_attr_rewind(mr);
 		return &mr->item;
 	}
+	if (mr->item.type == type_rg_segment && mr->isochrone && mr->isochrone->hull) {
+		mr->rseg = NULL;
+		mr->item.type = type_poly_isochrone;
+		mr->item.meth = &methods_isochrone_item;
+		mr->item.id_lo++;
+		rm_coord_rewind(mr);
+		rp_attr_rewind(mr);
+		return &mr->item;
+	}
 	return NULL;
 	
 }
@@ -3928,8 +7293,21 @@ static struct map_methods route_graph_meth = {
 	NULL,
 };
 
+static struct map_methods route_isochrone_meth = {
+	projection_mg,
+	"utf-8",
+	rp_destroy,
+	ri_rect_new,
+	rm_rect_destroy,
+	rp_get_item,
+	rp_get_item_byid,
+	NULL,
+	NULL,
+	NULL,
+};
+
 static struct map_priv *
-route_map_new_helper(struct map_methods *meth, struct attr **attrs, int graph)
+route_map_new_helper(struct map_methods *meth, struct attr **attrs, struct map_methods *type_meth)
 {
 	struct map_priv *ret;
 	struct attr *route_attr;
@@ -3938,10 +7316,7 @@ route_map_new_helper(struct map_methods *meth, struct attr **attrs, int graph)
 	if (! route_attr)
 		return NULL;
 	ret=g_new0(struct map_priv, 1);
-	if (graph)
-		*meth=route_graph_meth;
-	else
-		*meth=route_meth;
+	*meth=*type_meth;
 	ret->route=route_attr->u.route;
 
 	return ret;
@@ -3950,13 +7325,19 @@ route_map_new_helper(struct map_methods *meth, struct attr **attrs, int graph)
 static struct map_priv *
 route_map_new(struct map_methods *meth, struct attr **attrs, struct callback_list *cbl)
 {
-	return route_map_new_helper(meth, attrs, 0);
+	return route_map_new_helper(meth, attrs, &route_meth);
 }
 
 static struct map_priv *
 route_graph_map_new(struct map_methods *meth, struct attr **attrs, struct callback_list *cbl)
 {
-	return route_map_new_helper(meth, attrs, 1);
+	return route_map_new_helper(meth, attrs, &route_graph_meth);
+}
+
+static struct map_priv *
+route_isochrone_map_new(struct map_methods *meth, struct attr **attrs, struct callback_list *cbl)
+{
+	return route_map_new_helper(meth, attrs, &route_isochrone_meth);
 }
 
 static struct map *
@@ -4020,6 +7401,25 @@ route_get_graph_map(struct route *this_)
 	return route_get_map_helper(this_, &this_->graph_map, "route_graph","Route Graph");
 }
 
+/**
+ * @brief Returns a new map containing the isochrone of the route
+ *
+ * The map holds the points and segments reached by route_set_isochrone(), with the
+ * same items and attributes as the map returned by route_get_graph_map(), and the
+ * outline of the reached points as an item of type poly_isochrone. It is empty as
+ * long as no isochrone has been calculated.
+ *
+ * @important Do not map_destroy() this!
+ *
+ * @param this_ The route to get the map of
+ * @return A new map containing the isochrone
+ */
+struct map *
+route_get_isochrone_map(struct route *this_)
+{
+	return route_get_map_helper(this_, &this_->isochrone_map, "route_isochrone","Route Isochrone");
+}
+
 
 /**
  * @brief Returns the flags for the route.
@@ -4204,6 +7604,7 @@ route_init(void)
 {
 	plugin_register_category_map("route", route_map_new);
 	plugin_register_category_map("route_graph", route_graph_map_new);
+	plugin_register_category_map("route_isochrone", route_isochrone_map_new);
 }
 
 void
@@ -4212,10 +7613,13 @@ route_destroy(struct route *this_)
 	this_->refcount++; /* avoid recursion */
 	route_path_destroy(this_->path2,1);
 	route_graph_destroy(this_->graph);
+	route_isochrone_destroy(this_->isochrone);
 	route_clear_destinations(this_);
 	route_info_free(this_->pos);
 	map_destroy(this_->map);
 	map_destroy(this_->graph_map);
+	map_destroy(this_->isochrone_map);
+	route_graph_map_clones_destroy(&this_->map_clones);
 	g_free(this_);
 }
 
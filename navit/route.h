@@ -105,10 +105,13 @@ void route_set_destinations(struct route *this_, struct pcoord *dst, int count,
 int route_get_destinations(struct route *this_, struct pcoord *pc, int count);
 int route_get_destination_count(struct route *this_);
 void route_get_distances(struct route *this_, struct coord *c, int count, int *distances);
+int route_get_matrix(struct route *this_, struct pcoord *src, int src_count, struct pcoord *dst, int dst_count, int *times, int *lengths);
+int route_set_isochrone(struct route *this_, struct pcoord *start, int limit, int concavity);
 void route_set_destination(struct route *this_, struct pcoord *dst, int async);
 void route_append_destination(struct route *this_, struct pcoord *dst, int async);
 void route_remove_nth_waypoint(struct route *this_, int n);
 void route_remove_waypoint(struct route *this_);
+void route_update_traffic_distortions(struct route *this_);
 char* route_get_destination_description(struct route *this_, int n);
 struct coord route_get_coord_dist(struct route *this_, int dist);
 struct street_data *street_get_data(struct item *item);
@@ -118,6 +121,7 @@ void route_info_free(struct route_info *inf);
 struct street_data *route_info_street(struct route_info *rinf);
 struct map *route_get_map(struct route *this_);
 struct map *route_get_graph_map(struct route *this_);
+struct map *route_get_isochrone_map(struct route *this_);
 enum route_path_flags route_get_flags(struct route *this_);
 int route_has_graph(struct route *this_);
 void route_set_projection(struct route *this_, enum projection pro);
@@ -91,6 +91,9 @@ vehicleprofile_set_attr_do(struct vehicleprofile *this_, struct attr *attr)
 	case attr_turn_around_penalty2:
 		this_->turn_around_penalty2=attr->u.num;
 		break;
+	case attr_route_algorithm:
+		this_->route_algorithm=attr->u.num;
+		break;
 	default:
 		break;
 	}
@@ -120,6 +123,7 @@ vehicleprofile_clear(struct vehicleprofile *this_)
 	this_->flags_reverse_mask=0;
 	this_->flags=0;
 	this_->maxspeed_handling = maxspeed_enforce;
+	this_->route_algorithm = route_algorithm_dijkstra;
 	this_->static_speed=0;
 	this_->static_distance=0;
 	g_free(this_->name);
@@ -29,6 +29,12 @@ enum maxspeed_handling {
 	maxspeed_ignore = 2,		/*!< Ignore maxspeed of segment, always use {@code route_weight} of road profile */
 };
 
+enum route_algorithm {
+	route_algorithm_dijkstra = 0,	/*!< Flood the route graph from the destination (default) */
+	route_algorithm_ch = 1,		/*!< Query the contraction hierarchy stored in the map, fall back to dijkstra if there is none */
+	route_algorithm_astar = 2,	/*!< Flood the route graph from the destination only until the position is reached */
+};
+
 
 struct vehicleprofile {
 	NAVIT_OBJECT
@@ -52,6 +58,7 @@ struct vehicleprofile {
 	struct attr active_callback;
 	int turn_around_penalty;		/**< Penalty when turning around */
 	int turn_around_penalty2;		/**< Penalty when turning around, for planned turn arounds */
+	int route_algorithm;			/**< Algorithm used to calculate the route, see {@code enum route_algorithm} */
 };
 
 struct vehicleprofile * vehicleprofile_new(struct attr *parent, struct attr **attrs);